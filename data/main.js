@@ -1,16 +1,12 @@
-let wifiQuality = -30;
-
 const networkButton = document.querySelector("#network-save");
 const mqttButton = document.querySelector("#mqtt-save");
 const applyBytton = document.querySelector("#apply-changes");
 
 const dhcp = document.querySelector("#dhcp");
 
-let __IPADDRESS__ = "__IPADDRESS_VALUE__";
-
 networkButton.addEventListener("click", () => sendData("network", 7));
 
-mqttButton.addEventListener("click", () => sendData("mqtt", 7));
+mqttButton.addEventListener("click", () => sendData("mqtt", 12));
 
 applyBytton.addEventListener("click", () => {
     if (confirm("You confirm to apply changes?")) applyChanges();
@@ -18,7 +14,10 @@ applyBytton.addEventListener("click", () => {
 
 let ipv4s = document.querySelectorAll('.network[ipv4]');
 
-document.addEventListener("DOMContentLoaded", () => requestData());
+document.addEventListener("DOMContentLoaded", () => {
+    requestData();
+    listenStatus();
+});
 
 dhcp.addEventListener("change", function() {
     for (let input of ipv4s) {
@@ -47,7 +46,7 @@ function sendData(classData, objLength) {
     }
 
     if (Object.keys(bodyData).length == objLength || flag) {
-        fetch(`http://${__IPADDRESS__}/${classData}`, {
+        fetch(`/${classData}`, {
             method: "POST",
             headers: { "Content-Type": "application/json" },
             body: JSON.stringify(bodyData)
@@ -64,7 +63,7 @@ function sendData(classData, objLength) {
 
 // Request data when the page is loaded
 function requestData() {
-    fetch(`http://${__IPADDRESS__}/data`, {
+    fetch("/data", {
         method: "GET",
         headers: { "Content-Type": "application/json" }
     })
@@ -77,6 +76,14 @@ function requestData() {
     });
 }
 
+// Status changes pushed by the device, each event carries only the changed fields
+function listenStatus() {
+    if (!window.EventSource) return;
+
+    const events = new EventSource("events");
+    events.addEventListener("status", event => patchStatus(JSON.parse(event.data)));
+}
+
 // Validate data before send to device
 function validateData(elements) {
     let data = {};
@@ -115,7 +122,7 @@ function validateData(elements) {
 
 function applyChanges() {
     alert("Device will restart in 5 seconds.");
-    fetch(`http://${__IPADDRESS__}/restart`, { method: "GET" });
+    fetch("/restart", { method: "GET" });
 }
 
 // Load the data received from device (if there's somenthing)
@@ -123,77 +130,7 @@ function loadContent(configs) {
     const inputsNetwork = document.querySelectorAll(".network");
     const inputsMqtt = document.querySelectorAll(".mqtt");
 
-    if (configs.hasOwnProperty("status") && configs.status != null) {
-        let parent = document.querySelector(".container-items");
-
-        let index = 1;
-        for (let key in configs.status) {
-            if (key == "temperatures") {
-                let tempIndex = 1;
-                configs.status.temperatures.forEach(temp => {
-                    let div = document.createElement("div");
-                    div.id = `item${index}`;
-                    div.classList.add("item", "panel-grid-column");
-
-                    let h51 = document.createElement("h5");
-                    h51.innerHTML = `Temperatura ${tempIndex}`;
-                    div.appendChild(h51);
-
-                    let h52 = document.createElement("h5");
-                    h52.innerHTML = temp;
-                    div.appendChild(h52);
-
-                    parent.appendChild(div);
-
-                    tempIndex++;
-                    index++;
-                });
-                continue;
-            }
-            
-            if (key == "wifiQuality") {
-                let quality = configs.status["wifiQuality"];
-                
-                console.log(quality);
-
-                if (quality != 0) {
-                    let parentDiv = document.createElement("div");
-                    parentDiv.classList.add("item", "panel-grid-column");
-                    let h5 = document.createElement("h5");
-                    h5.innerText = "Wi-fi quality";
-                    let childDiv = document.createElement("div");
-                    let divSquare = document.createElement("div"); 
-                    
-                    divSquare.style.width = "16px";
-                    divSquare.style.height = "16px";
-    
-                    if (quality >= -50) divSquare.style.backgroundColor = "green";
-                    else if (quality >= -70) divSquare.style.backgroundColor = "yellow";
-                    else if (quality >= -90) divSquare.style.backgroundColor = "red";
-    
-                    childDiv.append(divSquare);
-                    parentDiv.append(h5, childDiv);
-                    parent.appendChild(parentDiv);
-                }
-                continue;
-            }
-
-            let div = document.createElement("div");
-            div.id = `item${index}`;
-            div.classList.add("item", "panel-grid-column");
-
-            let h51 = document.createElement("h5");
-            h51.innerHTML = key;
-            div.appendChild(h51);
-
-            let h52 = document.createElement("h5");
-            h52.innerHTML = configs.status[`${key}`];
-            div.appendChild(h52);
-
-            parent.appendChild(div);
-            index++;
-        }
-    }
+    if (configs.hasOwnProperty("status") && configs.status != null) patchStatus(configs.status);
 
     if (configs.hasOwnProperty("network") && configs.network != null) {
         inputsNetwork.forEach(input => {
@@ -210,11 +147,86 @@ function loadContent(configs) {
     
     if (configs.hasOwnProperty("mqtt") && configs.mqtt != null) {
         inputsMqtt.forEach(input => {
-            input.value = configs.mqtt[input.id];
+            if (configs.mqtt[input.id] !== undefined) input.value = configs.mqtt[input.id];
         });
     }
 }
 
+// Status item with a label and a value, created once and reused by later updates
+function statusItem(id, label) {
+    let div = document.getElementById(id);
+    if (div) return div.lastChild;
+
+    div = document.createElement("div");
+    div.id = id;
+    div.classList.add("item", "panel-grid-column");
+
+    let h51 = document.createElement("h5");
+    h51.innerText = label;
+    let value = document.createElement("h5");
+    div.append(h51, value);
+
+    document.querySelector(".container-items").appendChild(div);
+    return value;
+}
+
+// Remove the items whose id starts with prefix and is not in keep
+function removeStatusItems(prefix, keep) {
+    document.querySelectorAll(`[id^="${prefix}"]`).forEach((div) => {
+        if (!keep.has(div.id)) div.remove();
+    });
+}
+
+// Update the status panel in place, status can be complete or a delta
+function patchStatus(status) {
+    for (let key in status) {
+        if (key == "temperatures") {
+            // one item per sensor ROM, a sensor keeps its item whatever its position
+            let shown = new Set();
+            status.temperatures.forEach((sensor) => {
+                let id = `status-temp-${sensor.id}`;
+                let value = statusItem(id, sensor.id);
+                value.previousSibling.innerText = sensor.alias || sensor.id;
+                value.innerText = sensor.temp;
+                shown.add(id);
+            });
+            removeStatusItems("status-temp-", shown);
+            continue;
+        }
+
+        if (key == "channels") {
+            // channel 1 is already shown as counter
+            if (status.channels.length < 2) continue;
+            status.channels.forEach((channel, i) => {
+                statusItem(`status-channel${i + 1}`, `counter ${i + 1}`).innerText = channel.counter;
+            });
+            continue;
+        }
+
+        if (key == "wifiQuality") {
+            let quality = status.wifiQuality;
+            if (quality == 0) continue;
+
+            let value = statusItem("status-wifiQuality", "Wi-fi quality");
+            let square = value.firstChild;
+            if (!square) {
+                square = document.createElement("div");
+                square.style.width = "16px";
+                square.style.height = "16px";
+                value.appendChild(square);
+            }
+
+            if (quality >= -50) square.style.backgroundColor = "green";
+            else if (quality >= -70) square.style.backgroundColor = "yellow";
+            else if (quality >= -90) square.style.backgroundColor = "red";
+            else square.style.backgroundColor = "";
+            continue;
+        }
+
+        statusItem(`status-${key}`, key).innerText = status[key];
+    }
+}
+
 function showErrorMessage(message) {
     let err = document.createElement("p");
     err.style.color = "red";
@@ -0,0 +1,104 @@
+# Gzips the web interface under data/ and embeds it in the firmware as
+# include/WebAssets.h, so the server streams it from flash without touching
+# LittleFS. Stylesheet and script URLs get a content hash so they can be
+# cached forever, the page itself is revalidated through its ETag.
+#
+# Runs as a PlatformIO pre script and can also be run by hand:
+#   python scripts/embed_assets.py
+
+import gzip
+import hashlib
+import os
+
+ASSETS = [
+    # (request path, source file, content type, immutable)
+    ("/style.css", "style.css", "text/css", True),
+    ("/main.js", "main.js", "application/javascript", True),
+    ("/", "index.html", "text/html", False),
+]
+
+
+def content_hash(data):
+    return hashlib.sha1(data).hexdigest()[:16]
+
+
+def compress(data):
+    # mtime fixed so the output, and the hashes, are reproducible
+    return gzip.compress(data, compresslevel=9, mtime=0)
+
+
+def embed(project_dir):
+    data_dir = os.path.join(project_dir, "data")
+    output = os.path.join(project_dir, "include", "WebAssets.h")
+
+    hashes = {}
+    entries = []
+    for path, source, content_type, immutable in ASSETS:
+        with open(os.path.join(data_dir, source), "rb") as file:
+            content = file.read()
+
+        # point the page at the hashed asset URLs
+        for name, digest in hashes.items():
+            content = content.replace(
+                ('"%s"' % name).encode(), ('"%s?v=%s"' % (name, digest)).encode()
+            )
+
+        digest = content_hash(content)
+        hashes[source] = digest
+        entries.append((path, content_type, immutable, digest, compress(content)))
+
+    lines = [
+        "// Generated by scripts/embed_assets.py from data/, do not edit.",
+        "#ifndef EMBEDDED_WEB_ASSETS",
+        "#define EMBEDDED_WEB_ASSETS",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "struct WEB_ASSET {",
+        "    const char *path;",
+        "    const char *type;",
+        "    const char *etag;",
+        "    bool immutable;",
+        "    const uint8_t *data;",
+        "    size_t length;",
+        "};",
+        "",
+    ]
+
+    for index, (_, _, _, _, gz) in enumerate(entries):
+        lines.append("static const uint8_t WEB_ASSET_%d[] PROGMEM = {" % index)
+        for offset in range(0, len(gz), 16):
+            chunk = ", ".join("0x%02x" % byte for byte in gz[offset:offset + 16])
+            lines.append("    %s," % chunk)
+        lines.append("};")
+        lines.append("")
+
+    lines.append("static const WEB_ASSET WEB_ASSETS[] = {")
+    for index, (path, content_type, immutable, digest, gz) in enumerate(entries):
+        lines.append(
+            '    { "%s", "%s", "\\"%s\\"", %s, WEB_ASSET_%d, %d },'
+            % (path, content_type, digest, "true" if immutable else "false", index, len(gz))
+        )
+    lines.append("};")
+    lines.append("")
+    lines.append("#define WEB_ASSETS_COUNT (sizeof(WEB_ASSETS) / sizeof(WEB_ASSET))")
+    lines.append("")
+    lines.append("#endif")
+    lines.append("")
+
+    generated = "\n".join(lines)
+    if os.path.exists(output):
+        with open(output) as file:
+            if file.read() == generated:
+                return
+
+    with open(output, "w") as file:
+        file.write(generated)
+    print("embed_assets: wrote %s" % output)
+
+
+try:
+    Import("env")  # noqa: F821
+    embed(env.subst("$PROJECT_DIR"))  # noqa: F821
+except NameError:
+    embed(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
@@ -0,0 +1,91 @@
+#ifndef AGGREGATOR
+#define AGGREGATOR
+
+#include <Arduino.h>
+
+#include "Telemetry.hpp"
+
+// Folds samples taken at the internal sample rate into per-window
+// statistics, so short spikes show up in the min/max of the window that
+// is published once per interval.
+class Aggregator {
+    private:
+        TELEMETRY_WINDOW current;
+        bool open = false;
+
+        TELEMETRY_WINDOW completed[TELEMETRY_MAX_WINDOWS];
+        uint8_t count = 0;
+
+        TELEMETRY_SAMPLE previous;
+        bool hasPrevious = false;
+
+    public:
+        void add(const TELEMETRY_SAMPLE &sample) {
+            if (!this->open) {
+                // the window starts at the sample its counters are counted from,
+                // the last one of the previous window, so windows are contiguous
+                this->current = TELEMETRY_WINDOW();
+                const TELEMETRY_SAMPLE &start = this->hasPrevious ? this->previous : sample;
+                this->current.start = start.timestamp;
+                memcpy(this->current.counterStart, start.counters, sizeof(start.counters));
+                this->open = true;
+            }
+
+            this->current.end = sample.timestamp;
+            memcpy(this->current.counterEnd, sample.counters, sizeof(sample.counters));
+            // level and rate statistics follow channel 1
+            this->current.gpio.add(sample.levels & 1);
+            this->current.rssi.add(sample.rssi);
+            this->current.demand.add(sample.demands[0].instant);
+            this->current.demandEnd = sample.demands[0];
+
+            if (this->hasPrevious && sample.timestamp != this->previous.timestamp) {
+                float seconds = (sample.timestamp - this->previous.timestamp) / 1000.0f;
+                this->current.rate.add((sample.counters[0] - this->previous.counters[0]) / seconds);
+            }
+
+            // matched by address, a sensor dropping out does not shift the others
+            for (uint8_t i = 0; i < sample.tempCount; i++) {
+                TELEMETRY_STAT *stat = this->current.temp(sample.temps[i].rom);
+                if (stat != NULL) stat->add(sample.temps[i].value);
+            }
+
+            this->previous = sample;
+            this->hasPrevious = true;
+        }
+
+        // end the current window, the oldest window is dropped when nobody collected them
+        void close() {
+            if (!this->open) return;
+
+            if (this->count == TELEMETRY_MAX_WINDOWS) {
+                memmove(&this->completed[0], &this->completed[1], sizeof(TELEMETRY_WINDOW) * (TELEMETRY_MAX_WINDOWS - 1));
+                this->count--;
+            }
+            this->completed[this->count++] = this->current;
+            this->open = false;
+        }
+
+        bool isReady(uint8_t batch) const {
+            return this->count >= constrain(batch, 1, TELEMETRY_MAX_WINDOWS);
+        }
+
+        const TELEMETRY_WINDOW *getWindows() const {
+            return this->completed;
+        }
+
+        uint8_t getCount() const {
+            return this->count;
+        }
+
+        void clear() {
+            this->count = 0;
+        }
+
+        // most recent raw sample, stands in for the windows when they can not be sent
+        const TELEMETRY_SAMPLE &getLast() const {
+            return this->previous;
+        }
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef BENCHMARK_PROBES
+#define BENCHMARK_PROBES
+
+#include <Arduino.h>
+#include "esp_timer.h"
+
+// timed hot paths
+#define BENCH_PUBLISH 0
+#define BENCH_STATUS 1
+#define BENCH_PERSIST 2
+#define BENCH_CONFIG 3
+#define BENCH_ROUTE 4
+#define BENCH_SLOTS 5
+
+// how often the results are written to Serial (ms)
+#ifndef BENCH_REPORT_INTERVAL
+#define BENCH_REPORT_INTERVAL 10000
+#endif
+
+struct BENCH_STAT {
+    uint32_t count;
+    uint64_t totalUs;
+    uint32_t maxUs;
+    int32_t maxHeapDelta;
+
+    BENCH_STAT() :
+        count(0),
+        totalUs(0),
+        maxUs(0),
+        maxHeapDelta(0)
+    {}
+};
+
+// Timings of the hot paths on the device itself, built only into the bench
+// environment. Every report is one JSON object per line on Serial so a
+// capture of the monitor can be compared between releases:
+// {"bench":"publish","n":12,"avgUs":850,"maxUs":2100,"heapDelta":0}
+// {"bench":"boot","firstConnectMs":3120,"firstPublishMs":3135,"arenaHeapAllocations":0}
+class Benchmark {
+    private:
+        BENCH_STAT stats[BENCH_SLOTS];
+        portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+        uint32_t firstPublishMs = 0;
+        unsigned long lastReport = 0;
+
+    public:
+        // called from any task once the probed path returns
+        void record(uint8_t slot, uint32_t elapsedUs, int32_t heapDelta) {
+            portENTER_CRITICAL(&this->mux);
+            BENCH_STAT &stat = this->stats[slot];
+            stat.count++;
+            stat.totalUs += elapsedUs;
+            if (elapsedUs > stat.maxUs) stat.maxUs = elapsedUs;
+            if (heapDelta > stat.maxHeapDelta) stat.maxHeapDelta = heapDelta;
+            portEXIT_CRITICAL(&this->mux);
+        }
+
+        void markPublished() {
+            if (this->firstPublishMs == 0) this->firstPublishMs = millis();
+        }
+
+        // writes the lines when due, runs from loop()
+        void report(uint32_t firstConnectMs, uint32_t arenaHeapAllocations) {
+            if (millis() - this->lastReport < BENCH_REPORT_INTERVAL) return;
+            this->lastReport = millis();
+
+            static const char *names[BENCH_SLOTS] = { "publish", "status", "persist", "config", "route" };
+
+            BENCH_STAT copy[BENCH_SLOTS];
+            portENTER_CRITICAL(&this->mux);
+            memcpy(copy, this->stats, sizeof(copy));
+            portEXIT_CRITICAL(&this->mux);
+
+            for (uint8_t i = 0; i < BENCH_SLOTS; i++) {
+                Serial.printf(
+                    "{\"bench\":\"%s\",\"n\":%u,\"avgUs\":%u,\"maxUs\":%u,\"heapDelta\":%d}\n",
+                    names[i],
+                    (unsigned)copy[i].count,
+                    (unsigned)(copy[i].count > 0 ? copy[i].totalUs / copy[i].count : 0),
+                    (unsigned)copy[i].maxUs,
+                    (int)copy[i].maxHeapDelta
+                );
+            }
+            Serial.printf(
+                "{\"bench\":\"boot\",\"firstConnectMs\":%u,\"firstPublishMs\":%u,\"arenaHeapAllocations\":%u}\n",
+                (unsigned)firstConnectMs,
+                (unsigned)this->firstPublishMs,
+                (unsigned)arenaHeapAllocations
+            );
+        }
+};
+
+// times the enclosing scope, heapDelta is the free heap it did not give back
+class BenchProbe {
+    private:
+        Benchmark &benchmark;
+        uint8_t slot;
+        int64_t startedAt;
+        uint32_t freeHeap;
+
+    public:
+        BenchProbe(Benchmark &benchmark, uint8_t slot) :
+            benchmark(benchmark),
+            slot(slot),
+            startedAt(esp_timer_get_time()),
+            freeHeap(esp_get_free_heap_size())
+        {}
+
+        ~BenchProbe() {
+            this->benchmark.record(
+                this->slot,
+                esp_timer_get_time() - this->startedAt,
+                (int32_t)this->freeHeap - (int32_t)esp_get_free_heap_size()
+            );
+        }
+};
+
+#ifdef BENCHMARK
+#define BENCH_SCOPE(slot) BenchProbe benchProbe(this->benchmark, slot)
+#else
+#define BENCH_SCOPE(slot)
+#endif
+
+#endif
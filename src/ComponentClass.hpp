@@ -2,13 +2,28 @@
 #define COMPONENT_CLASS
 
 #include <ESPAsyncWebServer.h>
-#include <PubSubClient.h>
 #include <AsyncJson.h>
 #include <ArduinoJson.h>
 #include "esp_task_wdt.h"
 
-#include <DallasTemperature.h>
-#include <OneWire.h>
+#include "PulseCounter.hpp"
+#include "CounterJournal.hpp"
+#include "TemperatureSampler.hpp"
+#include "StatusCache.hpp"
+#include "Telemetry.hpp"
+#include "OutageQueue.hpp"
+#include "Aggregator.hpp"
+#include "HistoryStore.hpp"
+#include "ConnectionManager.hpp"
+#include "MqttQueue.hpp"
+#include "MqttClient.hpp"
+#include "TopicRouter.hpp"
+#include "ConfigStore.hpp"
+#include "DeviceSession.hpp"
+#include "Benchmark.hpp"
+#include "Metrics.hpp"
+#include "LiveStatus.hpp"
+#include "WebAssets.h"
 
 #define WEBSERVER_PORT 80
 #define LOCAL_IP IPAddress(192, 168, 1, 10)
@@ -19,100 +34,96 @@
 #define AP_SSID "DWEB08"
 #define AP_PASS "unilojasmille"
 
-OneWire wire(TEMP_PIN);
-DallasTemperature sensors(&wire);
-
 volatile bool restart = false;
-volatile bool saveCounter = false;
-
-struct NET_TEMPLATE {
-    IPAddress ip;
-    IPAddress gateway;
-    IPAddress dns;
-    IPAddress subnet;
-    int dhcp;
-    String ssid;
-    String wifiPass;
-    bool isConfigured;
-
-    NET_TEMPLATE() : 
-        ip(IPAddress{}),
-        gateway(IPAddress{}),
-        dns(IPAddress{}),
-        subnet(IPAddress{}),
-        ssid(""),
-        wifiPass(""),
-        dhcp(0),
-        isConfigured(false)
-    {}
-};
 
-struct MQTT_TEMPLATE {
-    String broker;
-    uint16_t port;
-    String clientId;
-    String client;
-    String clientPass;
-    String topic;
-    uint16_t interval;
-    bool isConfigured;
-
-    MQTT_TEMPLATE() : 
-        broker(""),
-        port(0),
-        client(""),
-        clientPass(""),
-        topic(""),
-        interval(0),
-        isConfigured(false)
-    {}
-};
+static_assert(INPUT_CHANNEL_COUNT > 0 && INPUT_CHANNEL_COUNT <= PULSE_MAX_CHANNELS, "1 to 8 input channels");
+static_assert(JOURNAL_MAX_SLOTS >= PULSE_MAX_CHANNELS, "a journal slot for every channel");
+static_assert(pulseSlotsValid(INPUT_CHANNELS, INPUT_CHANNEL_COUNT), "journal slots must be unique and below the channel count");
 
 class Component {
     private:
         AsyncWebServer server = AsyncWebServer(WEBSERVER_PORT);
 
         WiFiClient wifiClient;
-        PubSubClient mqtt = PubSubClient(this->wifiClient);
+        MqttClient mqtt = MqttClient(this->wifiClient);
+
+        // typed config, the session runs the applied copy and routes the broker's messages
+        ConfigStore store;
+
+        // one counter per entry of INPUT_CHANNELS, one journal slot each
+        PulseCounter pulses[INPUT_CHANNEL_COUNT];
+        CounterJournal journal = CounterJournal(INPUT_CHANNEL_COUNT, JOURNAL_SEGMENTS, JOURNAL_SEGMENT_RECORDS, JOURNAL_BATCH_PULSES, JOURNAL_BATCH_MS);
+        SemaphoreHandle_t journalLock = xSemaphoreCreateMutex();
+
+        TemperatureSampler temperatures;
+
+        StatusCache statusCache;
+        LiveStatus live;
 
-        NET_TEMPLATE netConfig;
-        MQTT_TEMPLATE mqttConfig;
+        TelemetryEncoder telemetry;
+        OutageQueue outbox;
+        // stamped on every sample, the outbox keeps samples across boots
+        uint32_t boot = esp_random();
 
-        uint16_t counter;
+        Aggregator aggregator;
+        unsigned long lastSample = 0;
+        unsigned long windowStart = 0;
+
+        HistoryStore history;
+
+        ConnectionManager connection;
+        DeviceSession session = DeviceSession(this->store, this->mqtt, this->connection, this->telemetry);
+
+        // the MQTT client is only touched by the owner task, others enqueue
+        MqttOutbound outbound;
+        TaskHandle_t mqttOwner = NULL;
+        TaskHandle_t counterTask = NULL;
+        TaskHandle_t restartTask = NULL;
+
+#ifdef BENCHMARK
+        Benchmark benchmark;
+#endif
+
+        Metrics metrics;
+        unsigned long lastHealth = 0;
 
     public:
         void begin() {
             // file system init
             LittleFS.begin();
 
-            this->getCounterBytes();
             this->configureCounterListener();
 
+            // temperature conversions run in background
+            this->temperatures.begin();
+
+            // samples left unsent by the previous boot
+            this->outbox.begin();
+
+            // history of the previous boots, recorded once SNTP has set the clock
+            this->history.begin();
+            configTime(0, 0, HISTORY_NTP_SERVER);
+
             // Listen the port
             this->configureRestartListener();
 
             // load wifi and mqtt configuration from file system
             this->loadConfiguration();
 
-            // begin connection to a wifi or init a acess point
-            if (this->netConfig.isConfigured) {
-                this->beginWifi();
-                if (WiFi.status() == WL_CONNECTED) {
-                    this->configureNetworkListener();
-                }
+            // connect to a wifi or init a acess point, the connections are
+            // made by the MQTT owner task without blocking the boot
+            if (this->session.getNetwork().isConfigured && !this->isSoftAPRequested()) {
+                this->connection.begin(
+                    [this]() { this->beginWifi(); },
+                    [this]() { return this->beginMqtt(); },
+                    [this]() { return this->mqtt.connected(); },
+                    this->session.getMqtt().isConfigured
+                );
             }
             else {
                 this->beginSoftAP();
             }
 
-            // begin connection to MQTT broker if is connected to wifi
-            if (this->mqttConfig.isConfigured && WiFi.status() == WL_CONNECTED) {
-                this->beginMqtt();
-                if (this->mqtt.connected()) {
-                    this->configureMqttListener();
-                }
-            }
-
             // load web interface
             this->configWebInterface();
 
@@ -121,327 +132,375 @@ class Component {
 
             // web server init
             this->server.begin();
-        }
-
-        void configureCounterListener() {
-            xTaskCreatePinnedToCore([](void* pvParameters) {
-                Component* comp = static_cast<Component*>(pvParameters);
-                uint16_t counter;
 
-                attachInterrupt(digitalPinToInterrupt(INPUT_PIN), []() {
-                    saveCounter = true;
-                }, RISING);
+            this->configureMqttOwner();
 
-                while (true) {
-                    if (saveCounter) {
-                        saveCounter = false;
-                        comp->incrementCounter();
-                        comp->writeCounterBytes();
-                        vTaskDelay(150 / portTICK_PERIOD_MS);
-                    }
-                }   
-            }, "counterListener", 4096, this, 1, NULL, tskNO_AFFINITY);
+            this->configurePowerSave();
         }
 
-        void configureRestartListener() {
-            xTaskCreatePinnedToCore([](void* pvParameters) {
+        // single task owning the MQTT client: connection upkeep, inbound
+        // messages, queued publishes, outage replay and sampling
+        void configureMqttOwner() {
+            xTaskCreatePinnedToCore([](void *pvParameters) {
+                Component* comp = static_cast<Component*>(pvParameters);
+                esp_task_wdt_add(NULL);
+
                 while (true) {
                     esp_task_wdt_reset();
-                    if (digitalRead(RESET_PIN) == LOW) {
-                        EEPROM.write(1, 1);
-                        EEPROM.commit();
-                        vTaskDelay(1500 / portTICK_PERIOD_MS);
-                        ESP.restart();
-                    }
-                    vTaskDelay(150 / portTICK_PERIOD_MS);
+                    comp->session.apply();
+                    comp->connection.tick();
+                    comp->session.acknowledge();
+                    comp->mqtt.loop();
+                    comp->drainCommands();
+                    comp->replayBacklog();
+                    comp->sampleInputs();
+                    comp->recordHistory();
+                    comp->publishHealth();
+
+                    // woken early when a producer enqueues
+                    ulTaskNotifyTake(pdTRUE, MQTT_TASK_PERIOD / portTICK_PERIOD_MS);
                 }
-            }, "restartListener", 4096, NULL, 1, NULL, tskNO_AFFINITY);
+            }, "mqttOwner", 8192, this, MQTT_TASK_PRIORITY, &this->mqttOwner, MQTT_TASK_CORE);
         }
 
-        void loadConfiguration() {
-            // open network file
-            File networkConfigurationFile = LittleFS.open("/network.json", "r");
+        bool enqueue(const MQTT_COMMAND &command, uint8_t priority) {
+            bool ok = this->outbound.push(command, priority);
+            if (ok && this->mqttOwner != NULL) xTaskNotifyGive(this->mqttOwner);
+            return ok;
+        }
 
-            // verify if file is present and if it's content are not 0
-            if (!networkConfigurationFile.available() || networkConfigurationFile.size() == 0) {
-                this->netConfig.isConfigured = false;
-                networkConfigurationFile.close();
-                return;
-            }
-            JsonDocument networkJson;
-            deserializeJson(networkJson, networkConfigurationFile.readString());
+        // publish a payload on <topic>/<subtopic> from any task
+        bool publishRaw(const char *subtopic, const uint8_t *payload, size_t length, uint8_t priority) {
+            if (length > MQTT_RAW_PAYLOAD_SIZE) return false;
 
-            this->netConfig.ip.fromString(networkJson["ip"].as<String>());
-            this->netConfig.gateway.fromString(networkJson["gateway"].as<String>());
-            this->netConfig.subnet.fromString(networkJson["subnet"].as<String>());
-            this->netConfig.dns.fromString(networkJson["dns"].as<String>());
-            this->netConfig.dhcp = networkJson["dhcp"].as<int>();
+            MQTT_COMMAND command;
+            command.type = MQTT_COMMAND_RAW;
+            snprintf(command.subtopic, MQTT_SUBTOPIC_SIZE, "%s", subtopic);
+            memcpy(command.payload, payload, length);
+            command.length = length;
+            return this->enqueue(command, priority);
+        }
 
-            this->netConfig.ssid = networkJson["ssid"].as<String>();
-            this->netConfig.wifiPass = networkJson["wifiPass"].as<String>();
+        // owner task only
+        void drainCommands() {
+            MQTT_COMMAND command;
 
-            if (!this->netConfig.ssid.isEmpty()) this->netConfig.isConfigured = true;
+            while (this->outbound.pop(command)) {
+                if (command.type == MQTT_COMMAND_SAMPLE) {
+                    if (!this->publishSample(command.sample, command.keyframe)) {
+                        this->outbox.push(command.sample);
+                    }
+                    continue;
+                }
 
-            networkConfigurationFile.close();
+                this->session.publish(command.subtopic, command.payload, command.length);
+            }
+        }
 
-            // open mqtt file
-            File mqttConfigurationFile = LittleFS.open("/mqtt.json", "r");
+        void configureCounterListener() {
+            // indexed by journal slot
+            uint64_t totals[INPUT_CHANNEL_COUNT] = {};
+            if (!this->journal.begin(totals)) {
+                // first boot with the journal, migrate the legacy EEPROM counter into slot 0
+                totals[0] = this->getCounterBytes();
+                this->journal.commit(totals, true);
+            }
 
-            // verify if file is present and if it's content are not 0
-            if (!mqttConfigurationFile.available() && mqttConfigurationFile.size() == 0) {
-                this->mqttConfig.isConfigured = false;
-                mqttConfigurationFile.close();
-                return;
+            // the ISRs count every edge, this task only drains and persists the totals
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                this->pulses[i].begin(INPUT_CHANNELS[i], totals[INPUT_CHANNELS[i].slot]);
             }
-            JsonDocument mqttJson;
-            deserializeJson(mqttJson, mqttConfigurationFile.readString());
 
-            // define mqtt struct data
-            this->mqttConfig.broker = mqttJson["broker"].as<String>();
-            this->mqttConfig.port = mqttJson["port"].as<uint16_t>();
-            this->mqttConfig.topic = mqttJson["topic"].as<String>();
-            this->mqttConfig.clientId = mqttJson["clientId"].as<String>();
-            this->mqttConfig.client = mqttJson["client"].as<String>();
-            this->mqttConfig.clientPass = mqttJson["clientPass"].as<String>();
-            this->mqttConfig.interval = mqttJson["interval"].as<uint16_t>();
+            xTaskCreatePinnedToCore([](void* pvParameters) {
+                Component* comp = static_cast<Component*>(pvParameters);
+                esp_task_wdt_add(NULL);
 
-            if (!this->mqttConfig.broker.isEmpty()) this->mqttConfig.isConfigured = true;
+                while (true) {
+                    // Sleeps until a pulse arrives. The timeout keeps feeding the
+                    // watchdog and lets an expired journal batch be committed.
+                    ulTaskNotifyTake(pdTRUE, (WATCHDOG_TIMEOUT * 1000 / 2) / portTICK_PERIOD_MS);
+                    esp_task_wdt_reset();
 
-            mqttConfigurationFile.close();
-        }
+                    comp->drainPulses();
+                    comp->persistCounter(false);
 
-        void beginWifi() {
-            // If the restart reason is caused by reed switch, start softAP.
-            if (EEPROM.read(1) == 1) {
-                EEPROM.write(1, 0);
-                EEPROM.commit();
-                delay(5000);
-                this->beginSoftAP();
-                return;
-            }
+                    // bounds the wake-ups on a fast input
+                    vTaskDelay(COUNTER_DRAIN_INTERVAL / portTICK_PERIOD_MS);
+                }
+            }, "counterListener", 4096, this, COUNTER_TASK_PRIORITY, &this->counterTask, APP_CORE);
 
-            // If the mode dhcp is activated, do not configure the network
-            if (this->netConfig.dhcp == 0) {
-                WiFi.config(
-                    this->netConfig.ip,
-                    this->netConfig.gateway,
-                    this->netConfig.subnet,
-                    DNS, // google DNS
-                    this->netConfig.dns
-                );
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                this->pulses[i].setListener(this->counterTask);
             }
+        }
 
-            WiFi.begin(this->netConfig.ssid, this->netConfig.wifiPass);
+        static void IRAM_ATTR onResetPin(void *arg) {
+            Component *self = static_cast<Component*>(arg);
+            if (self->restartTask == NULL) return;
 
-            unsigned int attempts = 0;
-            unsigned long startTime = millis();
-            while (WiFi.status() != WL_CONNECTED) {
-                delay(500);
-                if (millis() - startTime > 10000) {
-                    startTime = millis();
-                    attempts++;
-                    continue;
-                }
-                if (attempts == 10) {
-                    delay(1000);
+            BaseType_t woken = pdFALSE;
+            vTaskNotifyGiveFromISR(self->restartTask, &woken);
+            if (woken) portYIELD_FROM_ISR();
+        }
+
+        void configureRestartListener() {
+            xTaskCreatePinnedToCore([](void* pvParameters) {
+                Component* comp = static_cast<Component*>(pvParameters);
+
+                while (true) {
+                    // woken by the falling edge, the level is read again to ignore glitches
+                    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                    vTaskDelay(50 / portTICK_PERIOD_MS);
+                    if (digitalRead(RESET_PIN) != LOW) continue;
+
+                    comp->drainPulses();
+                    comp->persistCounter(true);
+                    EEPROM.write(1, 1);
+                    EEPROM.commit();
+                    vTaskDelay(1500 / portTICK_PERIOD_MS);
                     ESP.restart();
                 }
-            }
+            }, "restartListener", 4096, this, RESTART_TASK_PRIORITY, &this->restartTask, APP_CORE);
 
+            attachInterruptArg(digitalPinToInterrupt(RESET_PIN), Component::onResetPin, this, FALLING);
         }
 
-        void configureNetworkListener() {
-            xTaskCreatePinnedToCore([](void *pvParameters) {
-                while (true) {
-                    unsigned int attempts = 0;
-                    unsigned long startTime = millis();
-                    while (WiFi.getMode() == WIFI_MODE_STA && WiFi.status() == WL_CONNECTION_LOST) {
-                        vTaskDelay(500 / portTICK_PERIOD_MS);
-                        WiFi.reconnect();
-                        esp_task_wdt_reset();
-                        
-                        if (millis() - startTime > 10000) {
-                            vTaskDelay(50 / portTICK_PERIOD_MS);
-                            startTime = millis();
-                            attempts++;
-                            continue;
-                        }
-                        if (attempts == 10) {
-                            vTaskDelay(50 / portTICK_PERIOD_MS);
-                            vTaskDelay(1000 / portTICK_PERIOD_MS);
-                            ESP.restart();
-                        }
-                        esp_task_wdt_reset();
-                        vTaskDelay(500 / portTICK_PERIOD_MS);
-                    }
-                    vTaskDelay(1000 / portTICK_PERIOD_MS);
-                }
-            }, "configureNetworkListener", 4096, NULL, 1, NULL, tskNO_AFFINITY);
+        // Modem sleep only. Automatic light sleep stays off: edge interrupts do not
+        // fire in light sleep and no pulse loss across it has been measured yet.
+        void configurePowerSave() {
+#if POWER_SAVE
+            WiFi.setSleep(WIFI_PS_MAX_MODEM);
+#endif
         }
- 
-        void beginMqtt() {
-            this->mqtt.setServer(
-                this->mqttConfig.broker.c_str(),
-                this->mqttConfig.port
-            );
 
-            // attempt to connect to broker
-            this->mqtt.connect(
-                this->mqttConfig.clientId.c_str(),
-                this->mqttConfig.client.c_str(),
-                this->mqttConfig.clientPass.c_str()
+        void loadConfiguration() {
+            this->store.begin();
+
+            this->session.begin(
+                // queued so the owner task publishes it after the callback
+                [this]() { this->publishDweb08Data(true, MQTT_PRIORITY_HIGH); },
+                [this]() { this->statusCache.invalidateConfig(); },
+                [this](const TEMP_CONFIG &sensors) { this->temperatures.configure(sensors); }
             );
+            this->temperatures.configure(this->session.getSensors());
 
-            unsigned int attempts = 0;
-            unsigned long startTime = millis();
-            while (this->mqtt.state() != MQTT_CONNECTED) {
-                delay(500);
+            // /data shows the stored config, not the files
+            this->statusCache.setConfigSource([this](JsonDocument &doc) {
+                this->store.toJson(doc);
+            });
+        }
 
-                if (millis() - startTime > 10000) {
-                    startTime = millis();
-                    attempts++;
-                    continue;
-                }
-                if (attempts > 10) {
-                    ESP.restart();
-                }
-            }
+        // If the restart reason is caused by reed switch, start softAP.
+        bool isSoftAPRequested() {
+            if (EEPROM.read(1) != 1) return false;
 
-            // subscribing to topic
-            String topic = this->mqttConfig.topic;
-            this->mqtt.subscribe(topic.c_str());
+            EEPROM.write(1, 0);
+            EEPROM.commit();
+            delay(5000);
+            return true;
+        }
 
-            String networkTopic = this->mqttConfig.topic + "/network";
-            this->mqtt.subscribe(networkTopic.c_str());
+        // start one station attempt, the result arrives through WiFi.onEvent
+        void beginWifi() {
+            const NET_TEMPLATE &netConfig = this->session.getNetwork();
 
-            String mqttTopic = this->mqttConfig.topic + "/mqtt";
-            this->mqtt.subscribe(mqttTopic.c_str());
+            // If the mode dhcp is activated, do not configure the network
+            if (netConfig.dhcp == 0) {
+                WiFi.config(
+                    netConfig.ip,
+                    netConfig.gateway,
+                    netConfig.subnet,
+                    DNS, // google DNS
+                    netConfig.dns
+                );
+            }
+            else {
+                // back to DHCP when a static address was applied before
+                WiFi.config(IPAddress(), IPAddress(), IPAddress());
+            }
 
-            String dataTopic = this->mqttConfig.topic + "/data";
-            this->mqtt.subscribe(dataTopic.c_str());
+            WiFi.begin(netConfig.ssid, netConfig.wifiPass);
+        }
+
+        // one connection attempt, bounded by CONNECT_MQTT_TIMEOUT
+        bool beginMqtt() {
+            this->wifiClient.setTimeout(CONNECT_MQTT_TIMEOUT);
+            if (!this->session.connect()) return false;
 
-            this->publishDweb08Data();
+            // already on the owner task, publish right away
+            TELEMETRY_SAMPLE sample = this->captureSample();
+            if (!this->publishSample(sample, true)) {
+                this->outbox.push(sample);
+            }
+            this->outbox.onConnected();
 
             this->mqtt.setCallback(
-                [this, networkTopic, mqttTopic, dataTopic](char *msgTopic, byte *data, unsigned int length) {
-                    String topicMessage = String(msgTopic);
-                    // MQTT message receptors
-                    if (topicMessage.equals(networkTopic)) 
-                        Component::handleMqttMessageBody("/network.json", data, length);
-                    if (topicMessage.equals(mqttTopic))
-                        Component::handleMqttMessageBody("/mqtt.json", data, length);
-
-                    // MQTT message senders
-                    if (topicMessage.equals(dataTopic)) this->publishDweb08Data();
+                [this](char *msgTopic, byte *data, unsigned int length) {
+                    this->routeMessage(msgTopic, data, length);
                 });
-        }
 
-        void configureMqttListener() {
-            xTaskCreatePinnedToCore([](void *pvParameters) {
-                Component* comp = static_cast<Component*>(pvParameters);
+            return true;
+        }
 
-                while (true) {
-                    if (WiFi.status() == WL_CONNECTED && !comp->getMqtt()->connected()) {
-                        comp->beginMqtt();
-                    }
+        // topic and payload point into the client buffer, nothing is copied
+        void routeMessage(const char *topic, byte *data, unsigned int length) {
+            uint8_t action;
+            {
+                BENCH_SCOPE(BENCH_ROUTE);
+                action = this->session.match(topic);
+            }
 
-                    vTaskDelay(1000 / portTICK_PERIOD_MS);
-                } 
-            }, "configureMqttListener", 4096, this, 1, NULL, tskNO_AFFINITY);
+            // config patches are timed like the HTTP ones
+            if (action <= ROUTE_SENSORS) {
+                BENCH_SCOPE(BENCH_CONFIG);
+                this->session.dispatch(action, data, length);
+                return;
+            }
+            this->session.dispatch(action, data, length);
         }
 
         void configWebInterface() {
-            this->server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-                request->send(LittleFS, "/index.html", "text/html");
-            });
+            // gzipped assets embedded at build time by scripts/embed_assets.py
+            for (size_t i = 0; i < WEB_ASSETS_COUNT; i++) {
+                const WEB_ASSET *asset = &WEB_ASSETS[i];
 
-            this->server.on("/style.css", HTTP_GET, [](AsyncWebServerRequest *request) {
-                request->send(LittleFS, "/style.css", "text/css");
-            });
-
-            this->server.on("/main.js", HTTP_GET, [this](AsyncWebServerRequest *request) {
-                File file = LittleFS.open("/main.js", "r");
-                String scriptContent = file.readString();
+                this->server.on(asset->path, HTTP_GET, [asset](AsyncWebServerRequest *request) {
+                    AsyncWebServerResponse *response;
 
-                // If wifi is in station mode
-                if (WiFi.getMode() == WIFI_MODE_STA) {
-                    if (this->netConfig.dhcp) {
-                        // If DHCP mode is activated, get the IP provided by the DHCP server
-                        scriptContent.replace("__IPADDRESS_VALUE__", WiFi.localIP().toString());
+                    if (request->hasHeader("If-None-Match") &&
+                        request->getHeader("If-None-Match")->value() == asset->etag) {
+                        response = request->beginResponse(304);
                     }
                     else {
-                        // If DHCP mode is not activade, get the IP provided by the User
-                        scriptContent.replace("__IPADDRESS_VALUE__", this->netConfig.ip.toString());
+                        // streamed straight from flash
+                        response = request->beginResponse_P(200, asset->type, asset->data, asset->length);
+                        response->addHeader("Content-Encoding", "gzip");
                     }
+
+                    response->addHeader("ETag", asset->etag);
+                    // hashed asset URLs never change content, the page is revalidated
+                    response->addHeader("Cache-Control", asset->immutable ? "public, max-age=31536000, immutable" : "no-cache");
+                    request->send(response);
+                });
+            }
+
+            // status deltas pushed to the open panels
+            this->live.begin(this->server);
+
+            // Prometheus text format, streamed so no full body is buffered
+            this->server.on("/metrics", HTTP_GET, [this](AsyncWebServerRequest *request) {
+                AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+                this->writeMetrics(*response);
+                request->send(response);
+            });
+
+            // /history?from=&to=&step= in unix seconds, the last hour by default
+            this->server.on("/history", HTTP_GET, [this](AsyncWebServerRequest *request) {
+                const char *fromText = request->hasParam("from") ? request->getParam("from")->value().c_str() : NULL;
+                const char *toText = request->hasParam("to") ? request->getParam("to")->value().c_str() : NULL;
+                const char *stepText = request->hasParam("step") ? request->getParam("step")->value().c_str() : NULL;
+
+                uint32_t from, to, step;
+                const char *error = historyRange(fromText, toText, stepText, time(NULL), from, to, step);
+                if (error != NULL) {
+                    request->send(400, "text/plain", error);
+                    return;
                 }
-                else {
-                    // If the mode is Acess point
-                    scriptContent.replace("__IPADDRESS_VALUE__", LOCAL_IP.toString());
-                }
-                    
-                request->send(200, "application/javascript", scriptContent);
+
+                // rows are read from flash while the response is sent
+                std::shared_ptr<HistoryCursor> cursor = std::make_shared<HistoryCursor>(this->history, from, to, step);
+                request->send(request->beginChunkedResponse("application/json", [cursor](uint8_t *buffer, size_t maxLen, size_t index) {
+                    return cursor->fill(buffer, maxLen);
+                }));
             });
 
-            this->server.on("/restart", HTTP_GET, [](AsyncWebServerRequest *request) {
+            this->server.on("/restart", HTTP_GET, [this](AsyncWebServerRequest *request) {
                 request->send(200);
+                this->drainPulses();
+                this->persistCounter(true);
                 ESP.restart();
             });
 
             this->server.on("/data", HTTP_GET, [this](AsyncWebServerRequest *request) {
-                File networkFile = LittleFS.open("/network.json", "r");
-                String networkJson = networkFile.readString();
-                networkFile.close();
-
-                File mqttFile = LittleFS.open("/mqtt.json", "r");
-                String mqttJson = mqttFile.readString();
-                mqttFile.close();
-
-                JsonDocument doc;
-
-                if (!networkJson.isEmpty()) deserializeJson(doc["network"], networkJson);
-                if (!mqttJson.isEmpty()) deserializeJson(doc["mqtt"], mqttJson);
+                BENCH_SCOPE(BENCH_STATUS);
+                // served from the cached body unless config or status changed
+                this->statusCache.send(request, this->statusFingerprint(), [this](JsonDocument &doc) {
+                    // channel 1 at the top level, every channel in the list
+                    doc["status"]["counter"] = this->pulses[0].getSeen();
+                    doc["status"]["persisted"] = this->pulses[0].getPersisted();
+                    doc["status"]["GPIO"] = digitalRead(this->pulses[0].getPin()) ? true : false;
+                    doc["status"]["wifiQuality"] = this->statusRssi();
+
+                    // pulses per hour
+                    PULSE_DEMAND demand = this->pulses[0].getDemand();
+                    doc["status"]["demand"] = demand.instant;
+                    doc["status"]["windowDemand"] = demand.window;
+                    doc["status"]["peakDemand"] = demand.peak;
+
+                    for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                        JsonObject channel = doc["status"]["channels"].add<JsonObject>();
+                        channel["pin"] = this->pulses[i].getPin();
+                        channel["counter"] = this->pulses[i].getSeen();
+                        channel["persisted"] = this->pulses[i].getPersisted();
+                        channel["GPIO"] = digitalRead(this->pulses[i].getPin()) ? true : false;
+
+                        PULSE_DEMAND demand = this->pulses[i].getDemand();
+                        channel["demand"] = demand.instant;
+                        channel["windowDemand"] = demand.window;
+                        channel["peakDemand"] = demand.peak;
+                        channel["peakAge"] = demand.peakAge;
+                    }
 
-                doc["status"]["counter"] = this->counter;
-                doc["status"]["GPIO"] = digitalRead(INPUT_PIN) ? true : false;
-                doc["status"]["wifiQuality"] = WiFi.RSSI();
+                    TEMP_SNAPSHOT snapshot = this->temperatures.getSnapshot();
+                    unsigned long now = millis();
+                    for (uint8_t i = 0; i < snapshot.count; i++) {
+                        TEMP_READING &reading = snapshot.readings[i];
+                        char rom[17];
+                        formatRom(reading.rom, rom);
+
+                        if (reading.valid && reading.present) {
+                            JsonObject temp = doc["status"]["temperatures"].add<JsonObject>();
+                            temp["id"] = rom;
+                            if (reading.alias[0] != '\0') temp["alias"] = reading.alias;
+                            temp["temp"] = reading.value;
+                        }
 
-                sensors.requestTemperatures();
-                for (unsigned int i = 0; i < 4; i++) {
-                    float temp = sensors.getTempCByIndex(i);
-                    if (temp != DEVICE_DISCONNECTED_C) {
-                        doc["status"]["temperatures"].add(temp);
-                    }   
-                }
-                    
-                String response;
-                serializeJson(doc, response);
-                request->send(200, "application/json", response);
+                        JsonObject sensor = doc["sensors"].add<JsonObject>();
+                        sensor["id"] = rom;
+                        if (reading.alias[0] != '\0') sensor["alias"] = reading.alias;
+                        sensor["bus"] = reading.bus;
+                        sensor["resolution"] = reading.resolution;
+                        sensor["present"] = reading.present;
+                        sensor["age"] = statusAge(reading, now);
+                        sensor["errors"] = reading.errors;
+                    }
+                });
             });
         }
 
         void configEndpoints() {
-            this->server.addHandler(addRequestHandler("/network"));
-            this->server.addHandler(addRequestHandler("/mqtt"));
+            this->server.addHandler(addRequestHandler("/network", CONFIG_NETWORK));
+            this->server.addHandler(addRequestHandler("/mqtt", CONFIG_MQTT));
+            this->server.addHandler(addRequestHandler("/sensors", CONFIG_SENSORS));
         }
 
-        AsyncCallbackJsonWebHandler *addRequestHandler(String endpoint) {
+        AsyncCallbackJsonWebHandler *addRequestHandler(String endpoint, uint8_t kind) {
             return new AsyncCallbackJsonWebHandler(
                 endpoint,
-                [endpoint](AsyncWebServerRequest *request, JsonVariant &data) {
-                    JsonObject obj = data.as<JsonObject>();
-                    String path = endpoint + ".json";
-
-                    File file = LittleFS.open(path, "w");
-
-                    if (!file) {
-                        request->send(500, "application/json", "{ \"message\": \"Configuration has not been saved.\" }");
+                [this, kind](AsyncWebServerRequest *request, JsonVariant &data) {
+                    BENCH_SCOPE(BENCH_CONFIG);
+                    const char *error;
+                    uint8_t result = this->store.patch(kind, data.as<JsonObjectConst>(), error);
+
+                    if (result != CONFIG_SAVED) {
+                        char message[96];
+                        snprintf(message, sizeof(message), "{ \"message\": \"%s\" }", error);
+                        request->send(result == CONFIG_INVALID ? 400 : 500, "application/json", message);
                         return;
                     }
+                    this->statusCache.invalidateConfig();
 
-                    serializeJson(obj, file);
-                    file.close();
-
-                    request->send(200, "application", "{ \"message\": \"Configuration has been saved.\" }");
+                    request->send(200, "application/json", "{ \"message\": \"Configuration has been saved.\" }");
                 });
         }
 
@@ -450,126 +509,400 @@ class Component {
             WiFi.softAP(AP_SSID, AP_PASS);
         }
 
-        static void handleMqttMessageBody(String path, byte *data, unsigned int length) {
-            // read/write mode "r+".
-            File file = LittleFS.open(path, "r");
+        TELEMETRY_SAMPLE captureSample() {
+            TELEMETRY_SAMPLE sample;
 
-            // iterate above the data parsing to char
-            String body;
-            for (unsigned int i = 0; i < length; i++) {
-                body += (char)data[i];
+            sample.timestamp = millis();
+            sample.time = HistoryStore::isClockSet() ? time(NULL) : 0;
+            sample.boot = this->boot;
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                sample.counters[i] = this->pulses[i].getSeen();
+                sample.demands[i] = this->pulses[i].getDemand();
+                if (digitalRead(this->pulses[i].getPin())) sample.levels |= 1 << i;
             }
+            sample.rssi = WiFi.RSSI();
+            sample.ip = (uint32_t)WiFi.localIP();
 
-            // json object of file.
-            JsonDocument jsonFile;
-            deserializeJson(jsonFile, file);
-            file.close();
-
-            // body of message received.
-            JsonDocument jsonBody;
-            deserializeJson(jsonBody, body);
+            TEMP_SNAPSHOT snapshot = this->temperatures.getSnapshot();
+            for (uint8_t i = 0; i < snapshot.count; i++) {
+                const TEMP_READING &reading = snapshot.readings[i];
+                if (!reading.valid || !reading.present) continue;
 
-            // iterate over all keys of file and verify if the json of the message contains the key.
-            for (JsonPair kv : jsonFile.as<JsonObject>()) {
-                if (jsonBody.containsKey(kv.key())) {
-                    // replace with new value.
-                    jsonFile[kv.key()] = jsonBody[kv.key()];
-                }
+                TELEMETRY_TEMP &temp = sample.temps[sample.tempCount++];
+                memcpy(temp.rom, reading.rom, sizeof(DeviceAddress));
+                temp.value = reading.value;
             }
-            // serialize the json and put in the file.
-            file = LittleFS.open(path, "w");
-            serializeJson(jsonFile, file);
-            file.close();
+
+            return sample;
         }
 
-        void publishDweb08Data() {
-            if (!this->mqtt.connected()) return;
+        // keyframe sends every field even when the delta mode is enabled. The
+        // sample is taken now and published by the owner task, samples that
+        // can not be sent are kept in the outbox.
+        bool publishDweb08Data(bool keyframe = false, uint8_t priority = MQTT_PRIORITY_NORMAL) {
+            MQTT_COMMAND command;
+            command.type = MQTT_COMMAND_SAMPLE;
+            command.keyframe = keyframe;
+            command.sample = this->captureSample();
+            return this->enqueue(command, priority);
+        }
+
+        // owner task only. No heap allocation: payload and topic in preallocated buffers
+        bool publishSample(const TELEMETRY_SAMPLE &sample, bool keyframe) {
+            if (!this->mqtt.connected()) return false;
+            BENCH_SCOPE(BENCH_PUBLISH);
 
-            JsonDocument doc;
+            size_t length = this->telemetry.encode(this->session.getMqtt().clientId.c_str(), sample, keyframe);
 
-            doc["id"] = this->mqttConfig.clientId;
-            doc["slaves"].add(1);
+            int64_t startedAt = esp_timer_get_time();
+            bool sent = this->mqtt.publish(
+                this->session.getTopic(),
+                this->telemetry.getPayload(),
+                length,
+                MQTT_TELEMETRY_QOS
+            );
+            this->metrics.observePublish(esp_timer_get_time() - startedAt, sent);
+#ifdef BENCHMARK
+            if (sent) this->benchmark.markPublished();
+#endif
+            return sent;
+        }
 
-            doc["timestamp"] = millis();
-            doc["counter"] = this->getCounter();
-            doc["GPIO"] = digitalRead(INPUT_PIN) ? true : false;
-            doc["wifiQuality"] = WiFi.RSSI();
-            doc["ip"] = WiFi.localIP();
+        // send a rate-limited batch of the samples taken during an outage, owner task only
+        void replayBacklog() {
+            if (!this->mqtt.connected()) return;
 
-            sensors.requestTemperatures();
-            for (unsigned int i = 0; i < 4; i++) {
-                float temp = sensors.getTempCByIndex(i);
-                if (temp != DEVICE_DISCONNECTED_C)
-                    doc["temps"].add(temp);
+            // replayed samples are out of order for the delta mode, always send keyframes
+            this->outbox.replay([this](const TELEMETRY_SAMPLE &sample) {
+                return this->publishSample(sample, true);
+            });
+        }
+
+        void writeMetrics(Print &out) {
+            Metrics::writeSystem(out);
+            Metrics::writeTasks(out);
+            this->metrics.writePublish(out);
+
+            Metrics::counter(out, "wifi_connects_total", "Wi-Fi associations", this->connection.getWifiConnects());
+            Metrics::counter(out, "wifi_disconnects_total", "Wi-Fi losses", this->connection.getWifiDisconnects());
+            Metrics::counter(out, "mqtt_connects_total", "Broker connections", this->connection.getMqttConnects());
+            Metrics::counter(out, "mqtt_disconnects_total", "Broker losses", this->connection.getMqttDisconnects());
+            Metrics::counter(out, "mqtt_connect_failures_total", "Failed broker attempts", this->connection.getMqttFailures());
+            Metrics::gauge(out, "wifi_last_connect_seconds", "Duration of the last association",
+                this->connection.getLastWifiConnectMs() / 1000.0);
+            Metrics::gauge(out, "mqtt_last_connect_seconds", "Duration of the last broker connect",
+                this->connection.getLastMqttConnectMs() / 1000.0);
+            Metrics::gauge(out, "mqtt_last_outage_seconds", "Duration of the last broker outage",
+                this->connection.getLastMqttOutageMs() / 1000.0);
+
+            Metrics::header(out, "pulses_seen_total", "counter", "Pulses counted");
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                out.printf(METRICS_PREFIX "pulses_seen_total{channel=\"%u\"} %llu\n", i + 1,
+                    (unsigned long long)this->pulses[i].getSeen());
+            }
+            Metrics::header(out, "pulses_persisted_total", "counter", "Pulses committed to flash");
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                out.printf(METRICS_PREFIX "pulses_persisted_total{channel=\"%u\"} %llu\n", i + 1,
+                    (unsigned long long)this->pulses[i].getPersisted());
+            }
+            Metrics::header(out, "pulses_unstamped_total", "counter", "Pulses counted without a timestamp for the demand");
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                out.printf(METRICS_PREFIX "pulses_unstamped_total{channel=\"%u\"} %u\n", i + 1,
+                    (unsigned)this->pulses[i].getUnstamped());
+            }
+            Metrics::header(out, "demand_pulses_per_hour", "gauge", "Demand over the sliding window");
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                out.printf(METRICS_PREFIX "demand_pulses_per_hour{channel=\"%u\"} %.3f\n", i + 1,
+                    this->pulses[i].getDemand().window);
+            }
+            Metrics::header(out, "pulses_rejected_total", "counter", "Edges rejected by the debounce");
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                out.printf(METRICS_PREFIX "pulses_rejected_total{channel=\"%u\"} %u\n", i + 1,
+                    (unsigned)this->pulses[i].getRejected());
             }
+            Metrics::counter(out, "journal_commits_total", "Counter journal records written", this->journal.getCommits());
+            Metrics::counter(out, "journal_rotations_total", "Counter journal segment rotations", this->journal.getRotations());
+
+            Metrics::gauge(out, "outbox_pending", "Samples waiting for the broker", this->outbox.getPending());
+            Metrics::counter(out, "outbox_dropped_total", "Samples lost to the outbox caps", this->outbox.getDropped());
+            Metrics::counter(out, "outbox_replayed_total", "Samples replayed after an outage", this->outbox.getReplayed());
+            Metrics::counter(out, "history_appends_total", "History batches appended to flash", this->history.getAppends());
+            Metrics::counter(out, "history_rotations_total", "History segment rotations", this->history.getRotations());
+            Metrics::counter(out, "history_bytes_written_total", "Bytes appended to the history", this->history.getBytesWritten());
+            Metrics::counter(out, "history_dropped_total", "History records lost to failed appends", this->history.getDropped());
+            Metrics::counter(out, "queue_dropped_total", "Commands refused by the MQTT queue", this->outbound.getDropped());
+
+            Metrics::gauge(out, "mqtt_inflight", "QoS 1 publishes waiting for their PUBACK", this->mqtt.getInflight());
+            Metrics::counter(out, "mqtt_acked_total", "QoS 1 publishes acknowledged", this->mqtt.getAcked());
+            Metrics::counter(out, "mqtt_retransmits_total", "QoS 1 publishes sent again after a reconnect", this->mqtt.getRetransmits());
+            Metrics::counter(out, "mqtt_window_full_total", "QoS 1 publishes refused by a full window", this->mqtt.getRefused());
+            Metrics::counter(out, "mqtt_oversized_total", "Inbound messages larger than the receive buffer", this->mqtt.getOversized());
+            Metrics::counter(out, "mqtt_unrouted_total", "Inbound messages without a route", this->session.getUnrouted());
+
+            Metrics::gauge(out, "sensor_conversion_seconds", "Duration of the last temperature cycle",
+                this->temperatures.getConversionMs() / 1000.0);
+            TEMP_SNAPSHOT snapshot = this->temperatures.getSnapshot();
+            Metrics::header(out, "sensor_errors_total", "counter", "Failed reads per sensor");
+            for (uint8_t i = 0; i < snapshot.count; i++) {
+                char rom[17];
+                formatRom(snapshot.readings[i].rom, rom);
+                out.printf(METRICS_PREFIX "sensor_errors_total{sensor=\"%s\",bus=\"%u\"} %u\n",
+                    rom, snapshot.readings[i].bus, (unsigned)snapshot.readings[i].errors);
+            }
+        }
 
-            String payload;
-            serializeJson(doc, payload);
+        // summary on <topic>/health every mqtt health seconds, 0 disables it. Owner task only
+        void publishHealth() {
+            uint16_t period = this->session.getMqtt().health;
+            if (period == 0 || !this->mqtt.connected()) return;
+            if (millis() - this->lastHealth < period * 1000UL) return;
+            this->lastHealth = millis();
+
+            // summed over the channels
+            uint64_t seen = 0;
+            uint64_t persisted = 0;
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                seen += this->pulses[i].getSeen();
+                persisted += this->pulses[i].getPersisted();
+            }
 
-            this->mqtt.publish(
-                this->mqttConfig.topic.c_str(),
-                payload.c_str()
+            uint32_t sensorErrors = 0;
+            TEMP_SNAPSHOT snapshot = this->temperatures.getSnapshot();
+            for (uint8_t i = 0; i < snapshot.count; i++) sensorErrors += snapshot.readings[i].errors;
+
+            char payload[512];
+            int length = snprintf(payload, sizeof(payload),
+                "{\"uptime\":%u,\"reset\":\"%s\",\"heap\":%u,\"minHeap\":%u,\"largestBlock\":%u,\"minStack\":%u,"
+                "\"publishes\":%u,\"publishFailures\":%u,\"wifiDisconnects\":%u,\"mqttDisconnects\":%u,"
+                "\"seen\":%llu,\"persisted\":%llu,\"commits\":%u,\"conversionMs\":%u,\"sensorErrors\":%u,\"outbox\":%u,\"inflight\":%u}",
+                (unsigned)(esp_timer_get_time() / 1000000),
+                Metrics::resetReason(),
+                (unsigned)esp_get_free_heap_size(),
+                (unsigned)esp_get_minimum_free_heap_size(),
+                (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+                (unsigned)Metrics::getMinStackFree(),
+                (unsigned)this->metrics.getPublishes(),
+                (unsigned)this->metrics.getFailures(),
+                (unsigned)this->connection.getWifiDisconnects(),
+                (unsigned)this->connection.getMqttDisconnects(),
+                (unsigned long long)seen,
+                (unsigned long long)persisted,
+                (unsigned)this->journal.getCommits(),
+                (unsigned)this->temperatures.getConversionMs(),
+                (unsigned)sensorErrors,
+                (unsigned)this->outbox.getPending(),
+                (unsigned)this->mqtt.getInflight()
             );
+
+            this->session.publish("health", reinterpret_cast<const uint8_t*>(payload), length);
+        }
+
+        // aggregation replaces the plain interval publish when a sample rate is set
+        bool isAggregating() {
+            return this->session.getMqtt().sampleRate > 0;
         }
 
-        PubSubClient *getMqtt() {
+        // sample at the internal rate and publish the window statistics once per interval, owner task only
+        void sampleInputs() {
+            if (!this->isAggregating()) return;
+            const MQTT_TEMPLATE &mqttConfig = this->session.getMqtt();
+
+            unsigned long now = millis();
+            if (now - this->lastSample < mqttConfig.sampleRate) return;
+            this->lastSample = now;
+
+            if (this->windowStart == 0) this->windowStart = now;
+            this->aggregator.add(this->captureSample());
+
+            if (now - this->windowStart < mqttConfig.interval * 1000UL) return;
+            this->windowStart = now;
+            this->aggregator.close();
+
+            if (this->aggregator.isReady(mqttConfig.batch)) {
+                this->publishWindows();
+            }
+        }
+
+        // one history record every HISTORY_INTERVAL seconds, owner task only
+        void recordHistory() {
+            if (!this->history.isDue()) return;
+            this->history.add(this->captureSample());
+        }
+
+        void publishWindows() {
+            bool sent = false;
+
+            if (this->mqtt.connected()) {
+                BENCH_SCOPE(BENCH_PUBLISH);
+                size_t length = this->telemetry.encodeWindows(
+                    this->session.getMqtt().clientId.c_str(),
+                    this->aggregator.getWindows(),
+                    this->aggregator.getCount()
+                );
+
+                int64_t startedAt = esp_timer_get_time();
+                sent = this->mqtt.publish(this->session.getTopic(), this->telemetry.getPayload(), length, MQTT_TELEMETRY_QOS);
+                this->metrics.observePublish(esp_timer_get_time() - startedAt, sent);
+#ifdef BENCHMARK
+                if (sent) this->benchmark.markPublished();
+#endif
+            }
+
+            // the windows wait for the next attempt, close() drops the oldest past
+            // TELEMETRY_MAX_WINDOWS, and the last raw sample preserves the counter
+            if (!sent) {
+                this->outbox.push(this->aggregator.getLast());
+                return;
+            }
+            this->aggregator.clear();
+        }
+
+        MqttOutbound *getOutbound() {
+            return &this->outbound;
+        }
+
+        ConnectionManager *getConnection() {
+            return &this->connection;
+        }
+
+        OutageQueue *getOutbox() {
+            return &this->outbox;
+        }
+
+        // runs from loop(), LiveStatus bounds the rate and skips unchanged fields
+        void pushLiveStatus() {
+            if (!this->live.isDue()) return;
+
+            LIVE_STATE state;
+            state.counter = this->pulses[0].getSeen();
+            state.persisted = this->pulses[0].getPersisted();
+            state.gpio = digitalRead(this->pulses[0].getPin()) ? true : false;
+            // the same steps as /data, noise does not resend the field
+            state.rssi = this->statusRssi();
+
+            TEMP_SNAPSHOT snapshot = this->temperatures.getSnapshot();
+            for (uint8_t i = 0; i < snapshot.count; i++) {
+                const TEMP_READING &reading = snapshot.readings[i];
+                if (!reading.valid || !reading.present) continue;
+
+                LIVE_TEMP &temp = state.temps[state.tempCount++];
+                memcpy(temp.rom, reading.rom, sizeof(DeviceAddress));
+                snprintf(temp.alias, TEMP_ALIAS_SIZE, "%s", reading.alias);
+                temp.value = reading.value;
+            }
+
+            this->live.push(state);
+        }
+
+        TelemetryEncoder *getTelemetry() {
+            return &this->telemetry;
+        }
+
+        // RSSI rounded down to STATUS_RSSI_STEP, the /data body, its fingerprint and the live status read the same value
+        int8_t statusRssi() {
+            int rssi = WiFi.RSSI();
+            return rssi - ((rssi % STATUS_RSSI_STEP) + STATUS_RSSI_STEP) % STATUS_RSSI_STEP;
+        }
+
+        // ms since the last good read rounded down to STATUS_AGE_STEP, -1 without one
+        static long statusAge(const TEMP_READING &reading, unsigned long now) {
+            if (!reading.valid) return -1;
+            return (now - reading.updatedAt) / STATUS_AGE_STEP * STATUS_AGE_STEP;
+        }
+
+        // Changes whenever a value shown in the /data status block changes.
+        // Sensors are hashed by what they report, a read of the same value
+        // keeps the cached body, an age moving to the next step rebuilds it.
+        uint32_t statusFingerprint() {
+            uint32_t fields[2] = { (uint32_t)this->statusRssi(), 0 };
+            uint32_t crc = 0;
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                uint64_t counts[2] = { this->pulses[i].getSeen(), this->pulses[i].getPersisted() };
+                crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t*>(counts), sizeof(counts));
+                if (digitalRead(this->pulses[i].getPin())) fields[1] |= 1 << i;
+            }
+
+            TEMP_SNAPSHOT snapshot = this->temperatures.getSnapshot();
+            unsigned long now = millis();
+            for (uint8_t i = 0; i < snapshot.count; i++) {
+                const TEMP_READING &reading = snapshot.readings[i];
+                int32_t sensor[5] = {
+                    reading.valid ? (int32_t)lroundf(reading.value * 100) : INT32_MIN,
+                    (int32_t)statusAge(reading, now),
+                    (int32_t)reading.errors,
+                    reading.present,
+                    reading.resolution
+                };
+                crc = esp_rom_crc32_le(crc, reading.rom, sizeof(DeviceAddress));
+                crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t*>(reading.alias), strlen(reading.alias));
+                crc = esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t*>(sensor), sizeof(sensor));
+            }
+            return esp_rom_crc32_le(crc, reinterpret_cast<const uint8_t*>(fields), sizeof(fields));
+        }
+
+        MqttClient *getMqtt() {
             return &this->mqtt;
         }
 
         uint16_t getInterval() {
-            return this->mqttConfig.interval;
+            return this->session.getMqtt().interval;
         }
 
-        uint16_t getCounter() {
-            this->getCounterBytes();
-            return this->counter;
+        uint64_t getCounter(uint8_t channel = 0) {
+            return this->pulses[channel].getSeen();
         }
-        
-        void incrementCounter() {
-            this->counter += 1;
+
+        PulseCounter *getPulses(uint8_t channel = 0) {
+            return &this->pulses[channel];
         }
 
-        void writeCounterBytes() {
-            uint16_t counter = this->counter;
+        void drainPulses() {
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                this->pulses[i].drain();
+            }
+        }
 
-            bool bits[16] = {0};
+        // append the counters to the journal in one record, batched unless force is set
+        void persistCounter(bool force) {
+            uint64_t totals[INPUT_CHANNEL_COUNT];
 
-            uint index = 0;
-            while (counter != 0) {
-                bits[index++] = counter % 2;
-                counter /= 2;
+            xSemaphoreTake(this->journalLock, portMAX_DELAY);
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                totals[INPUT_CHANNELS[i].slot] = this->pulses[i].getTotal();
             }
-
-            byte bytes[2] = {0};
-            index = 0;
-            uint8_t decimal = 0;
-            int pot = 1;
-            for (uint i = 0; i < 16; i++) {
-                if (bits[i]) {
-                    decimal += pot;
-                }
-                pot *= 2;
-                if (i == 7 || i == 15) {
-                    bytes[index++] = decimal;
-                    decimal = 0;
-                    pot = 1;
-                }
+#ifdef BENCHMARK
+            // only the calls that write a record are timed
+            int64_t startedAt = esp_timer_get_time();
+            if (this->journal.commit(totals, force))
+                this->benchmark.record(BENCH_PERSIST, esp_timer_get_time() - startedAt, 0);
+#else
+            this->journal.commit(totals, force);
+#endif
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                this->pulses[i].markPersisted(this->journal.getCommitted(INPUT_CHANNELS[i].slot));
             }
+            xSemaphoreGive(this->journalLock);
+        }
 
-            // MSB
-            EEPROM.write(2, bytes[1]);
-            // LSB
-            EEPROM.write(3, bytes[0]);
-            EEPROM.commit();
+#ifdef BENCHMARK
+        void reportBenchmark() {
+            this->benchmark.report(this->connection.getFirstMqttConnectMs(), this->telemetry.getHeapAllocations());
+        }
+#endif
+
+        CounterJournal *getJournal() {
+            return &this->journal;
         }
 
-        void getCounterBytes() {
-            byte bytes[2] = {
-                EEPROM.read(2),
-                EEPROM.read(3)
-            };
-            uint16_t decimal = (bytes[0] << 8) | bytes[1];
-            this->counter = decimal;
+        // legacy counter kept in EEPROM before the journal, read once for migration
+        uint32_t getCounterBytes() {
+            uint16_t low = (EEPROM.read(2) << 8) | EEPROM.read(3);
+            uint16_t high = (EEPROM.read(4) << 8) | EEPROM.read(5);
+
+            // high word of a legacy 16-bit counter is still erased
+            if (high == 0xFFFF) high = 0;
+
+            return ((uint32_t)high << 16) | low;
         }
 };
 
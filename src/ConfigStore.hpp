@@ -0,0 +1,506 @@
+#ifndef CONFIG_STORE
+#define CONFIG_STORE
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include "esp_rom_crc.h"
+
+#include "Telemetry.hpp"
+#include "TopicRouter.hpp"
+
+#define CONFIG_NETWORK 0
+#define CONFIG_MQTT 1
+#define CONFIG_SENSORS 2
+
+#define CONFIG_FILE_SIZE 2048
+
+// result of a patch
+#define CONFIG_SAVED 0
+#define CONFIG_INVALID 1
+#define CONFIG_UNSAVED 2
+
+struct NET_TEMPLATE {
+    IPAddress ip;
+    IPAddress gateway;
+    IPAddress dns;
+    IPAddress subnet;
+    int dhcp;
+    String ssid;
+    String wifiPass;
+    bool isConfigured;
+
+    NET_TEMPLATE() :
+        ip(IPAddress{}),
+        gateway(IPAddress{}),
+        dns(IPAddress{}),
+        subnet(IPAddress{}),
+        ssid(""),
+        wifiPass(""),
+        dhcp(0),
+        isConfigured(false)
+    {}
+};
+
+struct MQTT_TEMPLATE {
+    String broker;
+    uint16_t port;
+    String clientId;
+    String client;
+    String clientPass;
+    String topic;
+    // optional prefix shared by a group of devices, may hold + wildcards
+    String group;
+    uint16_t interval;
+    uint8_t format;
+    uint16_t keyframe;
+    uint16_t sampleRate;
+    uint8_t batch;
+    uint16_t health;
+    bool isConfigured;
+
+    MQTT_TEMPLATE() :
+        broker(""),
+        port(0),
+        client(""),
+        clientPass(""),
+        topic(""),
+        group(""),
+        interval(0),
+        format(TELEMETRY_JSON),
+        keyframe(0),
+        sampleRate(0),
+        batch(1),
+        health(60),
+        isConfigured(false)
+    {}
+};
+
+#define CONFIG_IP 0
+#define CONFIG_STRING 1
+#define CONFIG_INTEGER 2
+#define CONFIG_FORMAT 3
+
+// accepted keys of a config file, strings are bounded by length and integers by value
+struct CONFIG_FIELD {
+    const char *key;
+    uint8_t type;
+    long min;
+    long max;
+};
+
+static const CONFIG_FIELD NETWORK_SCHEMA[] = {
+    { "ip", CONFIG_IP, 0, 0 },
+    { "gateway", CONFIG_IP, 0, 0 },
+    { "subnet", CONFIG_IP, 0, 0 },
+    { "dns", CONFIG_IP, 0, 0 },
+    { "dhcp", CONFIG_INTEGER, 0, 1 },
+    { "ssid", CONFIG_STRING, 1, 32 },
+    { "wifiPass", CONFIG_STRING, 0, 63 },
+};
+
+static const CONFIG_FIELD MQTT_SCHEMA[] = {
+    { "broker", CONFIG_STRING, 1, 127 },
+    { "port", CONFIG_INTEGER, 1, 65535 },
+    { "clientId", CONFIG_STRING, 1, 64 },
+    { "client", CONFIG_STRING, 0, 64 },
+    { "clientPass", CONFIG_STRING, 0, 64 },
+    { "topic", CONFIG_STRING, 1, 100 },
+    { "group", CONFIG_STRING, 0, 100 },
+    { "interval", CONFIG_INTEGER, 1, 65535 },
+    { "format", CONFIG_FORMAT, 0, 0 },
+    { "keyframe", CONFIG_INTEGER, 0, 65535 },
+    { "sampleRate", CONFIG_INTEGER, 0, 65535 },
+    { "batch", CONFIG_INTEGER, 1, TELEMETRY_MAX_WINDOWS },
+    { "health", CONFIG_INTEGER, 0, 65535 },
+};
+
+// Typed configuration kept in RAM. Patches are validated against the
+// schema and applied to the structs, the file is only written, never read
+// back, and every write goes to a temporary file that replaces the old one
+// by rename. The old file is kept as the last-known-good fallback and each
+// file ends with a CRC line so a torn or corrupted file is never loaded.
+class ConfigStore {
+    private:
+        SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+
+        NET_TEMPLATE network;
+        MQTT_TEMPLATE mqtt;
+        TEMP_CONFIG sensors;
+        uint32_t version = 0;
+
+        static const char *pathOf(uint8_t kind) {
+            if (kind == CONFIG_NETWORK) return "/network.json";
+            if (kind == CONFIG_MQTT) return "/mqtt.json";
+            return "/sensors.json";
+        }
+
+        static bool isInteger(JsonVariantConst value, long &out) {
+            if (value.is<long>()) {
+                out = value.as<long>();
+                return true;
+            }
+            // the web interface sends numbers as text
+            if (!value.is<const char*>()) return false;
+
+            const char *text = value.as<const char*>();
+            char *end;
+            out = strtol(text, &end, 10);
+            return *text != '\0' && *end == '\0';
+        }
+
+        static const char *validate(const CONFIG_FIELD *schema, size_t fields, JsonObjectConst patch) {
+            for (JsonPairConst kv : patch) {
+                const CONFIG_FIELD *field = NULL;
+                for (size_t i = 0; i < fields; i++) {
+                    if (strcmp(schema[i].key, kv.key().c_str()) == 0) field = &schema[i];
+                }
+                if (field == NULL) return "Unknown configuration key.";
+
+                JsonVariantConst value = kv.value();
+                long number;
+                IPAddress ip;
+
+                switch (field->type) {
+                    case CONFIG_IP:
+                        if (!value.is<const char*>()) return "Invalid IPv4 address.";
+                        if (strlen(value.as<const char*>()) > 0 && !ip.fromString(value.as<const char*>()))
+                            return "Invalid IPv4 address.";
+                        break;
+                    case CONFIG_STRING:
+                        if (!value.is<const char*>()) return "Invalid text value.";
+                        if ((long)strlen(value.as<const char*>()) < field->min || (long)strlen(value.as<const char*>()) > field->max)
+                            return "Text value out of bounds.";
+                        break;
+                    case CONFIG_INTEGER:
+                        if (!isInteger(value, number) || number < field->min || number > field->max)
+                            return "Number out of bounds.";
+                        break;
+                    case CONFIG_FORMAT:
+                        if (value != "json" && value != "msgpack") return "Unknown payload format.";
+                        break;
+                }
+            }
+            return NULL;
+        }
+
+        // { "<rom hex>": { "alias": "...", "resolution": 9-12 } or null to forget it }
+        static const char *validateSensors(JsonObjectConst patch) {
+            for (JsonPairConst kv : patch) {
+                uint8_t rom[8];
+                if (!parseRom(kv.key().c_str(), rom)) return "Invalid sensor address.";
+
+                JsonVariantConst value = kv.value();
+                if (value.isNull()) continue;
+                if (!value.is<JsonObjectConst>()) return "Invalid sensor settings.";
+
+                for (JsonPairConst field : value.as<JsonObjectConst>()) {
+                    long number;
+                    if (strcmp(field.key().c_str(), "alias") == 0) {
+                        if (!field.value().is<const char*>() || strlen(field.value().as<const char*>()) >= TEMP_ALIAS_SIZE)
+                            return "Text value out of bounds.";
+                    }
+                    else if (strcmp(field.key().c_str(), "resolution") == 0) {
+                        if (!isInteger(field.value(), number) || number < 9 || number > 12)
+                            return "Number out of bounds.";
+                    }
+                    else return "Unknown configuration key.";
+                }
+            }
+            return NULL;
+        }
+
+        // the group is a subscription prefix: + wildcards only, whole levels
+        static const char *validateGroup(JsonVariantConst group) {
+            const char *text = group.as<const char*>();
+            if (text == NULL || text[0] == '\0') return NULL;
+            if (strchr(text, '#') != NULL || !TopicRouter::isValidFilter(text)) return "Invalid group topic.";
+            return NULL;
+        }
+
+        // the topic is published to as it is: no wildcards and no empty level
+        static const char *validateTopic(JsonVariantConst topic) {
+            const char *text = topic.as<const char*>();
+            if (text == NULL) return NULL;
+
+            size_t length = strlen(text);
+            if (strpbrk(text, "+#") != NULL || strstr(text, "//") != NULL ||
+                text[0] == '/' || (length > 0 && text[length - 1] == '/')) return "Invalid topic.";
+            return NULL;
+        }
+
+        static long integer(JsonVariantConst value) {
+            long number = 0;
+            isInteger(value, number);
+            return number;
+        }
+
+        static void readNetwork(JsonObjectConst json, NET_TEMPLATE &config) {
+            if (json.containsKey("ip")) config.ip.fromString(json["ip"].as<const char*>());
+            if (json.containsKey("gateway")) config.gateway.fromString(json["gateway"].as<const char*>());
+            if (json.containsKey("subnet")) config.subnet.fromString(json["subnet"].as<const char*>());
+            if (json.containsKey("dns")) config.dns.fromString(json["dns"].as<const char*>());
+            if (json.containsKey("dhcp")) config.dhcp = integer(json["dhcp"]);
+            if (json.containsKey("ssid")) config.ssid = json["ssid"].as<String>();
+            if (json.containsKey("wifiPass")) config.wifiPass = json["wifiPass"].as<String>();
+
+            config.isConfigured = !config.ssid.isEmpty();
+        }
+
+        static void writeNetwork(const NET_TEMPLATE &config, JsonObject json) {
+            json["ip"] = config.ip.toString();
+            json["gateway"] = config.gateway.toString();
+            json["subnet"] = config.subnet.toString();
+            json["dns"] = config.dns.toString();
+            json["dhcp"] = config.dhcp;
+            json["ssid"] = config.ssid;
+            json["wifiPass"] = config.wifiPass;
+        }
+
+        static void readMqtt(JsonObjectConst json, MQTT_TEMPLATE &config) {
+            if (json.containsKey("broker")) config.broker = json["broker"].as<String>();
+            if (json.containsKey("port")) config.port = integer(json["port"]);
+            if (json.containsKey("clientId")) config.clientId = json["clientId"].as<String>();
+            if (json.containsKey("client")) config.client = json["client"].as<String>();
+            if (json.containsKey("clientPass")) config.clientPass = json["clientPass"].as<String>();
+            if (json.containsKey("topic")) config.topic = json["topic"].as<String>();
+            if (json.containsKey("group")) config.group = json["group"].as<String>();
+            if (json.containsKey("interval")) config.interval = integer(json["interval"]);
+            if (json.containsKey("format")) config.format = json["format"] == "msgpack" ? TELEMETRY_MSGPACK : TELEMETRY_JSON;
+            if (json.containsKey("keyframe")) config.keyframe = integer(json["keyframe"]);
+            if (json.containsKey("sampleRate")) config.sampleRate = integer(json["sampleRate"]);
+            if (json.containsKey("batch")) config.batch = constrain(integer(json["batch"]), 1, TELEMETRY_MAX_WINDOWS);
+            if (json.containsKey("health")) config.health = integer(json["health"]);
+
+            config.isConfigured = !config.broker.isEmpty();
+        }
+
+        static void writeMqtt(const MQTT_TEMPLATE &config, JsonObject json) {
+            json["broker"] = config.broker;
+            json["port"] = config.port;
+            json["clientId"] = config.clientId;
+            json["client"] = config.client;
+            json["clientPass"] = config.clientPass;
+            json["topic"] = config.topic;
+            json["group"] = config.group;
+            json["interval"] = config.interval;
+            json["format"] = config.format == TELEMETRY_MSGPACK ? "msgpack" : "json";
+            json["keyframe"] = config.keyframe;
+            json["sampleRate"] = config.sampleRate;
+            json["batch"] = config.batch;
+            json["health"] = config.health;
+        }
+
+        // false when the patch needs more sensors than TEMP_MAX_SENSORS
+        static bool readSensors(JsonObjectConst json, TEMP_CONFIG &config) {
+            for (JsonPairConst kv : json) {
+                uint8_t rom[8];
+                if (!parseRom(kv.key().c_str(), rom)) continue;
+
+                TEMP_SENSOR_CONFIG *sensor = const_cast<TEMP_SENSOR_CONFIG*>(config.find(rom));
+                if (kv.value().isNull()) {
+                    if (sensor == NULL) continue;
+                    *sensor = config.sensors[--config.count];
+                    continue;
+                }
+
+                if (sensor == NULL) {
+                    if (config.count == TEMP_MAX_SENSORS) return false;
+                    sensor = &config.sensors[config.count++];
+                    *sensor = TEMP_SENSOR_CONFIG();
+                    memcpy(sensor->rom, rom, sizeof(rom));
+                }
+
+                JsonObjectConst fields = kv.value().as<JsonObjectConst>();
+                if (fields.containsKey("alias")) snprintf(sensor->alias, TEMP_ALIAS_SIZE, "%s", fields["alias"].as<const char*>());
+                if (fields.containsKey("resolution")) sensor->resolution = integer(fields["resolution"]);
+            }
+            return true;
+        }
+
+        static void writeSensors(const TEMP_CONFIG &config, JsonObject json) {
+            for (uint8_t i = 0; i < config.count; i++) {
+                char rom[17];
+                formatRom(config.sensors[i].rom, rom);
+
+                JsonObject sensor = json[rom].to<JsonObject>();
+                sensor["alias"] = config.sensors[i].alias;
+                sensor["resolution"] = config.sensors[i].resolution;
+            }
+        }
+
+        // read one file, false when it is missing, torn or fails its CRC
+        static bool readFile(const String &path, JsonDocument &doc) {
+            File file = LittleFS.open(path, "r");
+            if (!file) return false;
+
+            char buffer[CONFIG_FILE_SIZE + 1];
+            size_t length = file.read(reinterpret_cast<uint8_t*>(buffer), CONFIG_FILE_SIZE);
+            file.close();
+            buffer[length] = '\0';
+            if (length == 0) return false;
+
+            // "<json>\n<crc32 hex>\n", files without the CRC line predate the store
+            size_t body = length;
+            char *trailer = strrchr(buffer, '\n');
+            if (trailer != NULL && trailer == buffer + length - 1) {
+                *trailer = '\0';
+                trailer = strrchr(buffer, '\n');
+            }
+            if (trailer != NULL && strlen(trailer + 1) == 8 && strspn(trailer + 1, "0123456789abcdef") == 8) {
+                body = trailer - buffer;
+                uint32_t crc = strtoul(trailer + 1, NULL, 16);
+                if (crc != esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(buffer), body)) return false;
+            }
+
+            return deserializeJson(doc, buffer, body) == DeserializationError::Ok && doc.is<JsonObject>();
+        }
+
+        static bool writeFile(uint8_t kind, JsonDocument &doc) {
+            String path = pathOf(kind);
+            String temporary = path + ".tmp";
+            String backup = path + ".bak";
+
+            // a body cut short would be saved with a valid CRC, refuse it instead
+            char buffer[CONFIG_FILE_SIZE];
+            if (measureJson(doc) >= sizeof(buffer) - 10) return false;
+            size_t length = serializeJson(doc, buffer, sizeof(buffer) - 10);
+            uint32_t crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(buffer), length);
+            length += snprintf(buffer + length, 11, "\n%08x\n", (unsigned)crc);
+
+            File file = LittleFS.open(temporary, "w");
+            if (!file) return false;
+            bool written = file.write(reinterpret_cast<const uint8_t*>(buffer), length) == length;
+            file.close();
+            if (!written) {
+                LittleFS.remove(temporary);
+                return false;
+            }
+
+            // current file becomes the last-known-good, then the new one takes its place
+            LittleFS.remove(backup);
+            if (LittleFS.exists(path)) LittleFS.rename(path, backup);
+            return LittleFS.rename(temporary, path);
+        }
+
+        static bool load(uint8_t kind, JsonDocument &doc) {
+            String path = pathOf(kind);
+            LittleFS.remove(path + ".tmp");
+            return readFile(path, doc) || readFile(path + ".bak", doc);
+        }
+
+    public:
+        void begin() {
+            JsonDocument doc;
+
+            if (load(CONFIG_NETWORK, doc)) readNetwork(doc.as<JsonObjectConst>(), this->network);
+
+            doc.clear();
+            if (load(CONFIG_MQTT, doc)) readMqtt(doc.as<JsonObjectConst>(), this->mqtt);
+
+            doc.clear();
+            if (load(CONFIG_SENSORS, doc)) readSensors(doc.as<JsonObjectConst>(), this->sensors);
+
+            this->version++;
+        }
+
+        // validate and apply a partial update, error describes anything but CONFIG_SAVED
+        uint8_t patch(uint8_t kind, JsonObjectConst values, const char *&error) {
+            if (kind == CONFIG_NETWORK)
+                error = validate(NETWORK_SCHEMA, sizeof(NETWORK_SCHEMA) / sizeof(CONFIG_FIELD), values);
+            else if (kind == CONFIG_MQTT)
+                error = validate(MQTT_SCHEMA, sizeof(MQTT_SCHEMA) / sizeof(CONFIG_FIELD), values);
+            else
+                error = validateSensors(values);
+            if (kind == CONFIG_MQTT && error == NULL)
+                error = validateTopic(values["topic"]);
+            if (kind == CONFIG_MQTT && error == NULL)
+                error = validateGroup(values["group"]);
+            if (error != NULL) return CONFIG_INVALID;
+
+            xSemaphoreTake(this->lock, portMAX_DELAY);
+
+            JsonDocument doc;
+            bool saved;
+            if (kind == CONFIG_NETWORK) {
+                NET_TEMPLATE next = this->network;
+                readNetwork(values, next);
+                writeNetwork(next, doc.to<JsonObject>());
+                saved = writeFile(kind, doc);
+                if (saved) this->network = next;
+            }
+            else if (kind == CONFIG_MQTT) {
+                MQTT_TEMPLATE next = this->mqtt;
+                readMqtt(values, next);
+                writeMqtt(next, doc.to<JsonObject>());
+                saved = writeFile(kind, doc);
+                if (saved) this->mqtt = next;
+            }
+            else {
+                TEMP_CONFIG next = this->sensors;
+                if (!readSensors(values, next)) {
+                    xSemaphoreGive(this->lock);
+                    error = "Too many sensors.";
+                    return CONFIG_INVALID;
+                }
+                writeSensors(next, doc.to<JsonObject>());
+                saved = writeFile(kind, doc);
+                if (saved) this->sensors = next;
+            }
+            if (saved) this->version++;
+
+            xSemaphoreGive(this->lock);
+
+            if (!saved) {
+                error = "Configuration has not been saved.";
+                return CONFIG_UNSAVED;
+            }
+            return CONFIG_SAVED;
+        }
+
+        // parse a raw MQTT payload straight from its buffer
+        uint8_t patch(uint8_t kind, const uint8_t *data, size_t length, const char *&error) {
+            JsonDocument doc;
+            if (deserializeJson(doc, data, length) != DeserializationError::Ok || !doc.is<JsonObject>()) {
+                error = "Invalid JSON.";
+                return CONFIG_INVALID;
+            }
+            return this->patch(kind, doc.as<JsonObjectConst>(), error);
+        }
+
+        NET_TEMPLATE getNetwork() {
+            xSemaphoreTake(this->lock, portMAX_DELAY);
+            NET_TEMPLATE copy = this->network;
+            xSemaphoreGive(this->lock);
+            return copy;
+        }
+
+        MQTT_TEMPLATE getMqtt() {
+            xSemaphoreTake(this->lock, portMAX_DELAY);
+            MQTT_TEMPLATE copy = this->mqtt;
+            xSemaphoreGive(this->lock);
+            return copy;
+        }
+
+        TEMP_CONFIG getSensors() {
+            xSemaphoreTake(this->lock, portMAX_DELAY);
+            TEMP_CONFIG copy = this->sensors;
+            xSemaphoreGive(this->lock);
+            return copy;
+        }
+
+        // network and mqtt configs as served by /data, only configured ones are present
+        void toJson(JsonDocument &doc) {
+            xSemaphoreTake(this->lock, portMAX_DELAY);
+            if (this->network.isConfigured) writeNetwork(this->network, doc["network"].to<JsonObject>());
+            if (this->mqtt.isConfigured) writeMqtt(this->mqtt, doc["mqtt"].to<JsonObject>());
+            xSemaphoreGive(this->lock);
+        }
+
+        // bumped on every successful patch
+        uint32_t getVersion() const {
+            return this->version;
+        }
+};
+
+#endif
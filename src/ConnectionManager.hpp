@@ -0,0 +1,231 @@
+#ifndef CONNECTION_MANAGER
+#define CONNECTION_MANAGER
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <functional>
+
+// Exponential backoff with jitter, the delay doubles after each failure up
+// to the cap and a random part of it is drawn so that a fleet that lost the
+// same broker does not come back in lockstep.
+class Backoff {
+    private:
+        uint32_t base;
+        uint32_t cap;
+        uint32_t current;
+        unsigned long next = 0;
+
+    public:
+        Backoff(uint32_t base, uint32_t cap) :
+            base(base),
+            cap(cap),
+            current(base)
+        {}
+
+        bool isDue() const {
+            return (long)(millis() - this->next) >= 0;
+        }
+
+        void fail() {
+            this->next = millis() + this->current / 2 + random(this->current / 2 + 1);
+            this->current = min(this->current * 2, this->cap);
+        }
+
+        void reset() {
+            this->current = this->base;
+            this->next = millis();
+        }
+};
+
+// Drives the Wi-Fi and MQTT connections without blocking. Wi-Fi state comes
+// from WiFi.onEvent, tick() runs on the task owning the MQTT client and only
+// starts an attempt when the backoff of that link is due, so the web server
+// and the counter keep running while the device reconnects.
+class ConnectionManager {
+    public:
+        typedef std::function<void()> WifiConnector;
+        typedef std::function<bool()> MqttConnector;
+        typedef std::function<bool()> MqttProbe;
+
+    private:
+        WifiConnector connectWifi;
+        MqttConnector connectMqtt;
+        MqttProbe isMqttConnected;
+
+        // a Wi-Fi attempt needs a few seconds to associate before it can be retried
+        Backoff wifiBackoff = Backoff(CONNECT_WIFI_BACKOFF_MIN, CONNECT_BACKOFF_MAX);
+        Backoff mqttBackoff = Backoff(CONNECT_MQTT_BACKOFF_MIN, CONNECT_BACKOFF_MAX);
+
+        // set by the Wi-Fi event task, seen by tick()
+        volatile bool wifiUp = false;
+        bool wifiSeenUp = false;
+        bool mqttUp = false;
+        bool mqttEnabled = false;
+        bool started = false;
+
+        unsigned long wifiAttemptAt = 0;
+        unsigned long mqttDownAt = 0;
+
+        // metrics
+        uint32_t wifiConnects = 0;
+        uint32_t wifiDisconnects = 0;
+        uint32_t mqttConnects = 0;
+        uint32_t mqttDisconnects = 0;
+        uint32_t mqttFailures = 0;
+        uint32_t lastWifiConnectMs = 0;
+        uint32_t lastMqttConnectMs = 0;
+        uint32_t lastMqttOutageMs = 0;
+        uint32_t firstMqttConnectMs = 0;
+
+    public:
+        void begin(WifiConnector connectWifi, MqttConnector connectMqtt, MqttProbe isMqttConnected, bool mqttEnabled) {
+            this->connectWifi = connectWifi;
+            this->connectMqtt = connectMqtt;
+            this->isMqttConnected = isMqttConnected;
+            this->mqttEnabled = mqttEnabled;
+
+            WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) {
+                switch (event) {
+                    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+                        this->wifiUp = true;
+                        break;
+                    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+                    case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+                        this->wifiUp = false;
+                        break;
+                    default:
+                        break;
+                }
+            });
+
+            this->wifiBackoff.reset();
+            this->mqttBackoff.reset();
+            this->started = true;
+        }
+
+        void tick() {
+            // soft-AP mode, nothing to connect
+            if (!this->started) return;
+
+            unsigned long now = millis();
+
+            bool wifiUp = this->wifiUp;
+
+            if (!wifiUp) {
+                if (this->wifiSeenUp) {
+                    this->wifiSeenUp = false;
+                    this->wifiDisconnects++;
+                    this->wifiBackoff.reset();
+                }
+                if (this->mqttUp) this->onMqttDown(now);
+
+                if (this->wifiBackoff.isDue()) {
+                    if (this->wifiAttemptAt == 0) this->wifiAttemptAt = now;
+                    this->connectWifi();
+                    // retried only if this attempt does not raise GOT_IP in time
+                    this->wifiBackoff.fail();
+                }
+                return;
+            }
+
+            if (!this->wifiSeenUp) {
+                this->wifiSeenUp = true;
+                this->wifiConnects++;
+                if (this->wifiAttemptAt != 0) this->lastWifiConnectMs = now - this->wifiAttemptAt;
+                this->wifiAttemptAt = 0;
+                this->wifiBackoff.reset();
+                this->mqttBackoff.reset();
+            }
+
+            if (!this->mqttEnabled) return;
+
+            if (this->mqttUp && !this->isMqttConnected()) this->onMqttDown(now);
+            if (this->mqttUp || !this->mqttBackoff.isDue()) return;
+
+            unsigned long startedAt = millis();
+            if (!this->connectMqtt()) {
+                this->mqttFailures++;
+                this->mqttBackoff.fail();
+                return;
+            }
+
+            this->mqttUp = true;
+            this->mqttConnects++;
+            this->lastMqttConnectMs = millis() - startedAt;
+            if (this->firstMqttConnectMs == 0) this->firstMqttConnectMs = millis();
+            if (this->mqttDownAt != 0) this->lastMqttOutageMs = millis() - this->mqttDownAt;
+            this->mqttDownAt = 0;
+            this->mqttBackoff.reset();
+        }
+
+        // drop the broker session after its settings changed, the next tick connects again
+        void reconnectMqtt(bool mqttEnabled) {
+            if (!this->started) return;
+
+            if (this->mqttUp) this->onMqttDown(millis());
+            this->mqttEnabled = mqttEnabled;
+            this->mqttBackoff.reset();
+        }
+
+        // drop the station after its settings changed, the next tick associates again
+        void reconnectWifi() {
+            if (!this->started) return;
+
+            WiFi.disconnect();
+            this->wifiUp = false;
+            this->wifiBackoff.reset();
+        }
+
+        void onMqttDown(unsigned long now) {
+            this->mqttUp = false;
+            this->mqttDisconnects++;
+            this->mqttDownAt = now;
+        }
+
+        bool isWifiUp() const {
+            return this->wifiUp;
+        }
+
+        bool isMqttUp() const {
+            return this->mqttUp;
+        }
+
+        uint32_t getWifiConnects() const {
+            return this->wifiConnects;
+        }
+
+        uint32_t getWifiDisconnects() const {
+            return this->wifiDisconnects;
+        }
+
+        uint32_t getMqttConnects() const {
+            return this->mqttConnects;
+        }
+
+        uint32_t getMqttDisconnects() const {
+            return this->mqttDisconnects;
+        }
+
+        uint32_t getMqttFailures() const {
+            return this->mqttFailures;
+        }
+
+        uint32_t getLastWifiConnectMs() const {
+            return this->lastWifiConnectMs;
+        }
+
+        uint32_t getLastMqttConnectMs() const {
+            return this->lastMqttConnectMs;
+        }
+
+        uint32_t getLastMqttOutageMs() const {
+            return this->lastMqttOutageMs;
+        }
+
+        // millis() at the first broker connection, time from boot to online
+        uint32_t getFirstMqttConnectMs() const {
+            return this->firstMqttConnectMs;
+        }
+};
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef COUNTER_JOURNAL
+#define COUNTER_JOURNAL
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "esp_rom_crc.h"
+
+#define JOURNAL_MAX_SLOTS 8
+#define JOURNAL_MAGIC 0x4C4E524A
+
+// first bytes of a segment, the segments of the older single slot journal have none
+struct __attribute__((packed)) JOURNAL_HEADER {
+    uint32_t magic;
+    uint8_t slots;
+    uint8_t reserved[3];
+};
+
+// Log-structured store for the pulse counters. Records are appended to a
+// ring of segment files, so consecutive commits never rewrite the same
+// data, and commits are batched by pulse count or elapsed time. One record
+// holds the total of every slot, whatever the number of channels a commit
+// is a single append. On disk a segment starts with a header giving its
+// slot count, then records of the totals, the sequence and a CRC. A build
+// with another channel count recovers the totals slot by slot and goes on
+// in a fresh segment.
+class CounterJournal {
+    private:
+        struct Record {
+            uint64_t totals[JOURNAL_MAX_SLOTS];
+            uint32_t sequence;
+        };
+
+        uint8_t slots;
+        uint8_t segments;
+        uint16_t segmentRecords;
+        uint32_t batchPulses;
+        uint32_t batchMs;
+
+        uint8_t segment = 0;
+        uint16_t records = 0;
+        uint32_t sequence = 0;
+
+        uint64_t committed[JOURNAL_MAX_SLOTS] = {};
+        unsigned long pendingSince = 0;
+
+        uint32_t commits = 0;
+        uint32_t rotations = 0;
+
+        static size_t recordSize(uint8_t slots) {
+            return slots * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+        }
+
+        static size_t encode(const Record &record, uint8_t slots, uint8_t *buffer) {
+            size_t offset = slots * sizeof(uint64_t);
+            memcpy(buffer, record.totals, offset);
+            memcpy(buffer + offset, &record.sequence, sizeof(uint32_t));
+            offset += sizeof(uint32_t);
+
+            uint32_t crc = esp_rom_crc32_le(0, buffer, offset);
+            memcpy(buffer + offset, &crc, sizeof(uint32_t));
+            return offset + sizeof(uint32_t);
+        }
+
+        static bool decode(const uint8_t *buffer, uint8_t slots, Record &record) {
+            size_t offset = slots * sizeof(uint64_t) + sizeof(uint32_t);
+            uint32_t crc;
+            memcpy(&crc, buffer + offset, sizeof(uint32_t));
+            if (crc != esp_rom_crc32_le(0, buffer, offset)) return false;
+
+            record = Record();
+            memcpy(record.totals, buffer, slots * sizeof(uint64_t));
+            memcpy(&record.sequence, buffer + slots * sizeof(uint64_t), sizeof(uint32_t));
+            return true;
+        }
+
+        static String segmentPath(uint8_t index) {
+            return "/counter" + String(index) + ".log";
+        }
+
+        // last valid record of the records from start on, scanning back over a torn tail
+        static bool readTail(File &file, size_t start, uint8_t slots, Record &tail, uint16_t &count, bool &torn) {
+            size_t size = file.size() - start;
+            size_t length = recordSize(slots);
+            count = size / length;
+            torn = (size % length) != 0;
+
+            uint8_t buffer[JOURNAL_MAX_SLOTS * sizeof(uint64_t) + 2 * sizeof(uint32_t)];
+            while (count > 0) {
+                file.seek(start + (count - 1) * length);
+                if (file.read(buffer, length) == length && decode(buffer, slots, tail)) return true;
+                torn = true;
+                count--;
+            }
+            return false;
+        }
+
+        // slots is the layout of the segment, headed tells it was written with a header
+        bool readSegment(uint8_t index, Record &tail, uint8_t &slots, bool &headed, uint16_t &count, bool &torn) {
+            File file = LittleFS.open(segmentPath(index), "r");
+            if (!file) return false;
+
+            JOURNAL_HEADER header;
+            headed = file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) == sizeof(header) &&
+                header.magic == JOURNAL_MAGIC && header.slots >= 1 && header.slots <= JOURNAL_MAX_SLOTS;
+            slots = headed ? header.slots : 1;
+
+            bool found = readTail(file, headed ? sizeof(header) : 0, slots, tail, count, torn);
+            // a single slot record that happens to start like a header
+            if (!found && headed) {
+                headed = false;
+                slots = 1;
+                found = readTail(file, 0, slots, tail, count, torn);
+            }
+            file.close();
+            return found;
+        }
+
+        bool recover(Record &newest, uint8_t &slots) {
+            bool found = false;
+            newest = Record();
+
+            for (uint8_t i = 0; i < this->segments; i++) {
+                Record tail;
+                uint8_t tailSlots;
+                bool headed;
+                uint16_t count;
+                bool torn;
+                if (!this->readSegment(i, tail, tailSlots, headed, count, torn)) continue;
+
+                if (!found || (int32_t)(tail.sequence - newest.sequence) > 0) {
+                    found = true;
+                    newest = tail;
+                    slots = tailSlots;
+                    this->segment = i;
+                    // never append behind a torn record or to a segment of another
+                    // layout, start the next segment instead
+                    bool appendable = !torn && headed && tailSlots == this->slots;
+                    this->records = appendable ? count : this->segmentRecords;
+                }
+            }
+            return found;
+        }
+
+    public:
+        CounterJournal(uint8_t slots, uint8_t segments, uint16_t segmentRecords, uint32_t batchPulses, uint32_t batchMs) :
+            slots(slots),
+            segments(segments),
+            segmentRecords(segmentRecords),
+            batchPulses(batchPulses),
+            batchMs(batchMs)
+        {}
+
+        // recover the newest committed totals, returns false if the journal is empty.
+        // Slots map by index, slots the journal did not have start at 0
+        bool begin(uint64_t *totals) {
+            Record newest;
+            uint8_t slots;
+            if (!this->recover(newest, slots)) return false;
+
+            this->sequence = newest.sequence;
+            for (uint8_t i = 0; i < this->slots; i++) {
+                this->committed[i] = i < slots ? newest.totals[i] : 0;
+                totals[i] = this->committed[i];
+            }
+            return true;
+        }
+
+        // persist the totals when a batch is full, the batch window elapsed or force is set
+        bool commit(const uint64_t *totals, bool force = false) {
+            bool changed = false;
+            bool full = false;
+            for (uint8_t i = 0; i < this->slots; i++) {
+                if (totals[i] == this->committed[i]) continue;
+                changed = true;
+                if (totals[i] - this->committed[i] >= this->batchPulses) full = true;
+            }
+
+            if (!changed) {
+                this->pendingSince = 0;
+                return false;
+            }
+
+            if (this->pendingSince == 0) this->pendingSince = millis();
+
+            bool expired = millis() - this->pendingSince >= this->batchMs;
+            if (!force && !full && !expired) return false;
+
+            if (this->records >= this->segmentRecords) {
+                this->segment = (this->segment + 1) % this->segments;
+                this->records = 0;
+                this->rotations++;
+            }
+            // a segment starts empty with its header, a first record torn by a
+            // power cut is not appended behind
+            bool fresh = this->records == 0;
+
+            Record record;
+            memcpy(record.totals, totals, this->slots * sizeof(uint64_t));
+            record.sequence = this->sequence + 1;
+
+            uint8_t buffer[sizeof(JOURNAL_HEADER) + JOURNAL_MAX_SLOTS * sizeof(uint64_t) + 2 * sizeof(uint32_t)];
+            size_t length = 0;
+            if (fresh) {
+                JOURNAL_HEADER header = { JOURNAL_MAGIC, this->slots, {} };
+                memcpy(buffer, &header, sizeof(header));
+                length = sizeof(header);
+            }
+            length += encode(record, this->slots, buffer + length);
+
+            File file = LittleFS.open(segmentPath(this->segment), fresh ? "w" : "a");
+            if (!file) return false;
+            size_t written = file.write(buffer, length);
+            file.close();
+            if (written != length) return false;
+
+            this->sequence = record.sequence;
+            this->records++;
+            memcpy(this->committed, totals, this->slots * sizeof(uint64_t));
+            this->pendingSince = 0;
+            this->commits++;
+            return true;
+        }
+
+        uint64_t getCommitted(uint8_t slot) const {
+            return this->committed[slot];
+        }
+
+        uint32_t getCommits() const {
+            return this->commits;
+        }
+
+        uint32_t getRotations() const {
+            return this->rotations;
+        }
+};
+
+#endif
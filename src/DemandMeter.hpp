@@ -0,0 +1,123 @@
+#ifndef DEMAND_METER
+#define DEMAND_METER
+
+#include <Arduino.h>
+
+#define DEMAND_US_PER_HOUR 3600000000.0
+
+// demand of one channel in pulses per hour, scaled by the meter constant downstream
+struct PULSE_DEMAND {
+    // from the last inter-pulse interval, decays while no pulse comes
+    float instant;
+    // pulses over the last DEMAND_WINDOW seconds
+    float window;
+    // highest full window since boot and how long ago it ended (s)
+    float peak;
+    uint32_t peakAge;
+
+    PULSE_DEMAND() :
+        instant(0),
+        window(0),
+        peak(0),
+        peakAge(0)
+    {}
+};
+
+// Sliding window demand over DEMAND_BUCKETS buckets of DEMAND_WINDOW /
+// DEMAND_BUCKETS seconds. A pulse adds to the current bucket and the
+// running sum, a bucket rollover removes the oldest one, so a pulse costs
+// the same whatever the window length. The peak is checked every time a
+// bucket closes over a full window. Timestamps are esp_timer microseconds.
+class DemandMeter {
+    private:
+        static constexpr int64_t BUCKET_US = DEMAND_WINDOW * 1000000LL / DEMAND_BUCKETS;
+
+        // pulses, a fast input without stamps can pass 16 bits in one bucket
+        uint32_t buckets[DEMAND_BUCKETS] = {};
+        uint8_t current = 0;
+        // closed buckets in the window, DEMAND_BUCKETS once it is full
+        uint8_t filled = 0;
+        uint32_t sum = 0;
+        int64_t bucketStart = 0;
+
+        int64_t lastPulseUs = 0;
+        int64_t lastIntervalUs = 0;
+
+        float peak = 0;
+        int64_t peakAtUs = 0;
+
+        float windowDemand(int64_t coveredUs) const {
+            return coveredUs > 0 ? this->sum * DEMAND_US_PER_HOUR / coveredUs : 0;
+        }
+
+        // closes the buckets that ended before now, at most one window of them
+        void advance(int64_t now) {
+            if (this->bucketStart == 0) this->bucketStart = now;
+
+            int64_t steps = (now - this->bucketStart) / BUCKET_US;
+            if (steps <= 0) return;
+            // bucket i ends at closedAt + (i + 1) * BUCKET_US, the ones past
+            // the window are empty and skipped
+            int64_t closedAt = this->bucketStart;
+            this->bucketStart += steps * BUCKET_US;
+            if (steps > DEMAND_BUCKETS) steps = DEMAND_BUCKETS + 1;
+
+            for (int64_t i = 0; i < steps; i++) {
+                if (this->filled < DEMAND_BUCKETS) this->filled++;
+                if (this->filled == DEMAND_BUCKETS) {
+                    float demand = this->windowDemand(DEMAND_BUCKETS * BUCKET_US);
+                    if (demand > this->peak) {
+                        this->peak = demand;
+                        this->peakAtUs = closedAt + (i + 1) * BUCKET_US;
+                    }
+                }
+
+                this->current = (this->current + 1) % DEMAND_BUCKETS;
+                this->sum -= this->buckets[this->current];
+                this->buckets[this->current] = 0;
+            }
+        }
+
+    public:
+        void add(int64_t stampUs) {
+            this->advance(stampUs);
+
+            if (this->lastPulseUs != 0) this->lastIntervalUs = stampUs - this->lastPulseUs;
+            this->lastPulseUs = stampUs;
+
+            this->buckets[this->current]++;
+            this->sum++;
+        }
+
+        // pulses counted without a timestamp go to the bucket of now, the
+        // instant demand keeps the last measured interval
+        void addUnstamped(uint32_t pulses, int64_t now) {
+            if (pulses == 0) return;
+            this->advance(now);
+
+            this->buckets[this->current] += pulses;
+            this->sum += pulses;
+        }
+
+        PULSE_DEMAND get(int64_t now) {
+            this->advance(now);
+
+            PULSE_DEMAND demand;
+            if (this->lastIntervalUs > 0) {
+                // a pulse overdue by more than the last interval lowers the demand
+                int64_t interval = max(this->lastIntervalUs, now - this->lastPulseUs);
+                if (interval < DEMAND_WINDOW * 1000000LL) demand.instant = DEMAND_US_PER_HOUR / interval;
+            }
+
+            // the closed buckets still in the sum plus the current one, less
+            // than a window until the window has filled once
+            uint8_t closed = min(this->filled, (uint8_t)(DEMAND_BUCKETS - 1));
+            demand.window = this->windowDemand(closed * BUCKET_US + (now - this->bucketStart));
+
+            demand.peak = this->peak;
+            demand.peakAge = this->peakAtUs ? (now - this->peakAtUs) / 1000000 : 0;
+            return demand;
+        }
+};
+
+#endif
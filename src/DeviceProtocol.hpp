@@ -0,0 +1,100 @@
+#ifndef DEVICE_PROTOCOL
+#define DEVICE_PROTOCOL
+
+#include <Arduino.h>
+
+#include "ConfigStore.hpp"
+#include "TopicRouter.hpp"
+
+// What the device says on the broker: its topics and their routes, how a
+// stored config differs from the running one and the acknowledgement of a
+// change. Shared by the component and the host fleet simulator so both
+// speak the same protocol, DeviceSession runs it.
+
+#define MQTT_TOPIC_SIZE 128
+// ack, health and the other topics published under the device topic
+#define MQTT_SUBTOPIC_SIZE 16
+
+// what a config change touched, reported in the acknowledgement
+#define CONFIG_CHANGED_TELEMETRY 1
+#define CONFIG_CHANGED_TOPIC 2
+#define CONFIG_CHANGED_BROKER 4
+#define CONFIG_CHANGED_WIFI 8
+#define CONFIG_CHANGED_SENSORS 16
+
+// what an inbound topic asks for, the suffix of the route under topic and group
+#define ROUTE_NETWORK 0
+#define ROUTE_MQTT 1
+#define ROUTE_SENSORS 2
+#define ROUTE_DATA 3
+#define ROUTE_TELEMETRY 4
+
+inline constexpr const char *ROUTE_SUFFIXES[] = { "network", "mqtt", "sensors", "data" };
+
+// topics derived from MQTT_TEMPLATE::topic, built once when the config is loaded
+struct MQTT_TOPICS {
+    char base[MQTT_TOPIC_SIZE];
+
+    MQTT_TOPICS() :
+        base("")
+    {}
+};
+
+inline void addRoutes(TopicRouter &routes, const char *prefix) {
+    char filter[MQTT_TOPIC_SIZE];
+    for (uint8_t action = ROUTE_NETWORK; action <= ROUTE_DATA; action++) {
+        snprintf(filter, MQTT_TOPIC_SIZE, "%s/%s", prefix, ROUTE_SUFFIXES[action]);
+        routes.add(filter, 1, action);
+    }
+}
+
+// routes under the device topic, then under the group topic when one is set
+inline void buildRoutes(const MQTT_TEMPLATE &config, MQTT_TOPICS &topics, TopicRouter &routes) {
+    snprintf(topics.base, MQTT_TOPIC_SIZE, "%s", config.topic.c_str());
+
+    routes.clear();
+    routes.add(topics.base, 0, ROUTE_TELEMETRY);
+    addRoutes(routes, config.topic.c_str());
+    if (!config.group.isEmpty()) addRoutes(routes, config.group.c_str());
+}
+
+// CONFIG_CHANGED_* bits of the stored config against the running one
+inline uint8_t configChanges(const NET_TEMPLATE &net, const MQTT_TEMPLATE &mqtt, const TEMP_CONFIG &sensors,
+                            const NET_TEMPLATE &runningNet, const MQTT_TEMPLATE &runningMqtt, const TEMP_CONFIG &runningSensors) {
+    uint8_t changes = 0;
+    if (mqtt.interval != runningMqtt.interval || mqtt.format != runningMqtt.format ||
+        mqtt.keyframe != runningMqtt.keyframe || mqtt.sampleRate != runningMqtt.sampleRate ||
+        mqtt.batch != runningMqtt.batch || mqtt.health != runningMqtt.health)
+        changes |= CONFIG_CHANGED_TELEMETRY;
+    if (mqtt.topic != runningMqtt.topic || mqtt.group != runningMqtt.group)
+        changes |= CONFIG_CHANGED_TOPIC;
+    if (mqtt.broker != runningMqtt.broker || mqtt.port != runningMqtt.port ||
+        mqtt.clientId != runningMqtt.clientId || mqtt.client != runningMqtt.client ||
+        mqtt.clientPass != runningMqtt.clientPass)
+        changes |= CONFIG_CHANGED_BROKER;
+    if (net.ssid != runningNet.ssid || net.wifiPass != runningNet.wifiPass ||
+        net.dhcp != runningNet.dhcp || net.ip != runningNet.ip ||
+        net.gateway != runningNet.gateway || net.subnet != runningNet.subnet ||
+        net.dns != runningNet.dns)
+        changes |= CONFIG_CHANGED_WIFI;
+    if (memcmp(&sensors, &runningSensors, sizeof(TEMP_CONFIG)) != 0)
+        changes |= CONFIG_CHANGED_SENSORS;
+    return changes;
+}
+
+// {"version","applied":[...],"ms"} published on <topic>/ack, returns the length
+inline size_t formatAck(char *payload, size_t size, uint32_t version, uint8_t changes, unsigned long ms) {
+    static const char *names[] = { "telemetry", "topic", "broker", "wifi", "sensors" };
+    int length = snprintf(payload, size, "{\"version\":%u,\"applied\":[", (unsigned)version);
+
+    bool first = true;
+    for (uint8_t i = 0; i < 5; i++) {
+        if (!(changes & (1 << i))) continue;
+        length += snprintf(payload + length, size - length, "%s\"%s\"", first ? "" : ",", names[i]);
+        first = false;
+    }
+    length += snprintf(payload + length, size - length, "],\"ms\":%lu}", ms);
+    return length;
+}
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef DEVICE_SESSION
+#define DEVICE_SESSION
+
+#include <Arduino.h>
+#include <functional>
+
+#include "ConfigStore.hpp"
+#include "TopicRouter.hpp"
+#include "MqttClient.hpp"
+#include "ConnectionManager.hpp"
+#include "Telemetry.hpp"
+#include "DeviceProtocol.hpp"
+
+// The device's side of DeviceProtocol: the running config and its routes,
+// inbound messages dispatched by route, a stored config applied without a
+// restart and its acknowledgement on <topic>/ack. The component's owner
+// task and every virtual device of the fleet simulator own one, what they
+// do differently comes in through the hooks. Owner task only.
+class DeviceSession {
+    public:
+        typedef std::function<void()> DataRequest;
+        typedef std::function<void()> ConfigSaved;
+        typedef std::function<void(const TEMP_CONFIG&)> SensorsChanged;
+
+    private:
+        ConfigStore &store;
+        MqttClient &mqtt;
+        ConnectionManager &connection;
+        TelemetryEncoder &telemetry;
+
+        DataRequest requestData;
+        ConfigSaved configSaved;
+        SensorsChanged sensorsChanged;
+
+        // the store is the source of truth and these are the applied copies
+        NET_TEMPLATE netConfig;
+        MQTT_TEMPLATE mqttConfig;
+        TEMP_CONFIG sensorsConfig;
+        MQTT_TOPICS topics;
+        // subscriptions and their actions, rebuilt with the topics
+        TopicRouter routes;
+        uint32_t unrouted = 0;
+        char rawTopic[MQTT_TOPIC_SIZE + MQTT_SUBTOPIC_SIZE];
+
+        // config version running and the acknowledgement of the last change
+        uint32_t appliedVersion = 0;
+        uint32_t ackVersion = 0;
+        uint8_t ackChanges = 0;
+        unsigned long ackStartedAt = 0;
+        bool ackPending = false;
+
+        void subscribeTopics() {
+            for (uint8_t i = 0; i < this->routes.getCount(); i++) {
+                this->mqtt.subscribe(this->routes.getRoute(i).filter, this->routes.getRoute(i).qos);
+            }
+        }
+
+        void unsubscribeTopics() {
+            for (uint8_t i = 0; i < this->routes.getCount(); i++) {
+                this->mqtt.unsubscribe(this->routes.getRoute(i).filter);
+            }
+        }
+
+        // partial config update received on <topic>/network, /mqtt or /sensors
+        void patch(uint8_t kind, const uint8_t *data, unsigned int length) {
+            const char *error;
+            if (this->store.patch(kind, data, length, error) == CONFIG_SAVED && this->configSaved) {
+                this->configSaved();
+            }
+        }
+
+    public:
+        DeviceSession(ConfigStore &store, MqttClient &mqtt, ConnectionManager &connection, TelemetryEncoder &telemetry) :
+            store(store),
+            mqtt(mqtt),
+            connection(connection),
+            telemetry(telemetry)
+        {}
+
+        // takes the stored config as the running one, the store is already loaded
+        void begin(DataRequest requestData, ConfigSaved configSaved, SensorsChanged sensorsChanged) {
+            this->requestData = requestData;
+            this->configSaved = configSaved;
+            this->sensorsChanged = sensorsChanged;
+
+            this->netConfig = this->store.getNetwork();
+            this->mqttConfig = this->store.getMqtt();
+            this->sensorsConfig = this->store.getSensors();
+
+            this->telemetry.setAliases(&this->sensorsConfig);
+            this->telemetry.setFormat(this->mqttConfig.format, this->mqttConfig.keyframe);
+            buildRoutes(this->mqttConfig, this->topics, this->routes);
+            this->appliedVersion = this->store.getVersion();
+        }
+
+        // one broker connection attempt and the subscriptions, the owner sets
+        // the socket timeout of its client and the message callback
+        bool connect() {
+            this->mqtt.setServer(this->mqttConfig.broker.c_str(), this->mqttConfig.port);
+            // room for the largest telemetry payload plus topic and header, and for inbound config
+            this->mqtt.setBufferSize(max(TELEMETRY_PAYLOAD_SIZE + MQTT_TOPIC_SIZE + 8, MQTT_RECEIVE_SIZE));
+            this->mqtt.setSocketTimeout(CONNECT_MQTT_TIMEOUT);
+
+            bool connected = this->mqtt.connect(
+                this->mqttConfig.clientId.c_str(),
+                this->mqttConfig.client.c_str(),
+                this->mqttConfig.clientPass.c_str()
+            );
+            if (!connected) return false;
+
+            // config and data requests at QoS 1, a persistent session keeps them while offline
+            this->subscribeTopics();
+            return true;
+        }
+
+        uint8_t match(const char *topic) {
+            return this->routes.match(topic);
+        }
+
+        // topic and payload point into the client buffer, nothing is copied
+        void dispatch(uint8_t action, const uint8_t *data, unsigned int length) {
+            switch (action) {
+                case ROUTE_NETWORK: this->patch(CONFIG_NETWORK, data, length); break;
+                case ROUTE_MQTT: this->patch(CONFIG_MQTT, data, length); break;
+                case ROUTE_SENSORS: this->patch(CONFIG_SENSORS, data, length); break;
+                // answered by the owner later, the callback never publishes re-entrantly
+                case ROUTE_DATA: if (this->requestData) this->requestData(); break;
+                case ROUTE_TELEMETRY: break;
+                default: this->unrouted++;
+            }
+        }
+
+        void route(const char *topic, const uint8_t *data, unsigned int length) {
+            this->dispatch(this->match(topic), data, length);
+        }
+
+        // Applies a stored config that differs from the one running:
+        // telemetry settings and topics at once, broker or credential
+        // changes by an MQTT reconnect and network changes by a station
+        // reconnect. Nothing here restarts the device.
+        void apply() {
+            uint32_t version = this->store.getVersion();
+            if (version == this->appliedVersion) return;
+            this->appliedVersion = version;
+
+            NET_TEMPLATE net = this->store.getNetwork();
+            MQTT_TEMPLATE mqtt = this->store.getMqtt();
+            TEMP_CONFIG sensors = this->store.getSensors();
+
+            uint8_t changes = configChanges(net, mqtt, sensors, this->netConfig, this->mqttConfig, this->sensorsConfig);
+
+            // the old subscriptions go before the topics change, a reconnect subscribes anyway
+            bool resubscribe = (changes & CONFIG_CHANGED_TOPIC) && !(changes & CONFIG_CHANGED_BROKER) && this->mqtt.connected();
+            if (resubscribe) this->unsubscribeTopics();
+
+            this->netConfig = net;
+            this->mqttConfig = mqtt;
+
+            if (changes & CONFIG_CHANGED_TELEMETRY) {
+                this->telemetry.setFormat(this->mqttConfig.format, this->mqttConfig.keyframe);
+            }
+            if (changes & CONFIG_CHANGED_TOPIC) {
+                buildRoutes(this->mqttConfig, this->topics, this->routes);
+                if (resubscribe) this->subscribeTopics();
+            }
+            if (changes & CONFIG_CHANGED_BROKER) {
+                this->mqtt.disconnect();
+                this->connection.reconnectMqtt(this->mqttConfig.isConfigured);
+            }
+            if (changes & CONFIG_CHANGED_WIFI) {
+                this->connection.reconnectWifi();
+            }
+            if (changes & CONFIG_CHANGED_SENSORS) {
+                // the encoder reads the aliases from this copy
+                this->sensorsConfig = sensors;
+                if (this->sensorsChanged) this->sensorsChanged(this->sensorsConfig);
+            }
+
+            // acknowledged once the broker is reachable with the new settings
+            this->ackVersion = version;
+            this->ackChanges |= changes;
+            if (!this->ackPending) this->ackStartedAt = millis();
+            this->ackPending = true;
+        }
+
+        // publishes {"version","applied":[...],"ms"} on <topic>/ack
+        void acknowledge() {
+            if (!this->ackPending || !this->mqtt.connected()) return;
+
+            char payload[128];
+            size_t length = formatAck(payload, sizeof(payload), this->ackVersion, this->ackChanges, millis() - this->ackStartedAt);
+            this->publish("ack", reinterpret_cast<const uint8_t*>(payload), length);
+
+            this->ackChanges = 0;
+            this->ackPending = false;
+        }
+
+        // a payload on <topic>/<subtopic>, dropped while offline
+        bool publish(const char *subtopic, const uint8_t *payload, size_t length) {
+            if (!this->mqtt.connected()) return false;
+
+            snprintf(this->rawTopic, sizeof(this->rawTopic), "%s/%s", this->topics.base, subtopic);
+            return this->mqtt.publish(this->rawTopic, payload, length);
+        }
+
+        const NET_TEMPLATE &getNetwork() const {
+            return this->netConfig;
+        }
+
+        const MQTT_TEMPLATE &getMqtt() const {
+            return this->mqttConfig;
+        }
+
+        const TEMP_CONFIG &getSensors() const {
+            return this->sensorsConfig;
+        }
+
+        const char *getTopic() const {
+            return this->topics.base;
+        }
+
+        uint32_t getUnrouted() const {
+            return this->unrouted;
+        }
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef DEVICE_SETTINGS
+#define DEVICE_SETTINGS
+
+// Compile-time settings of the firmware. The firmware and the host builds
+// include the same file, so the virtual devices run the values the hardware runs.
+
+#include <Arduino.h>
+
+// demand: sliding window integrated over (s), e.g. 15 minutes, and the buckets it
+// moves by, in pulses per hour. Defined before the pulse counter that uses them
+#define DEMAND_WINDOW 900
+#define DEMAND_BUCKETS 60
+
+#include "PulseCounter.hpp"
+
+#define RESET_PIN 5
+
+// OneWire buses, one pin each, and the sensors kept over all of them
+constexpr uint8_t TEMP_BUSES[] = { 4 };
+#define TEMP_BUS_COUNT (sizeof(TEMP_BUSES) / sizeof(TEMP_BUSES[0]))
+#define TEMP_MAX_SENSORS 16
+
+// pulse inputs, up to PULSE_MAX_CHANNELS: pin, edge (RISING, FALLING or CHANGE),
+// debounce window in microseconds and journal slot. Channel 1 is reported as
+// "counter" and "GPIO", with more channels all of them are in "counters" and "levels".
+// A build can pass its own entries in INPUT_CHANNEL_TABLE.
+#ifndef INPUT_CHANNEL_TABLE
+#define INPUT_CHANNEL_TABLE \
+    { 34, RISING, 100, 0 },
+#endif
+constexpr PULSE_CHANNEL INPUT_CHANNELS[] = {
+    INPUT_CHANNEL_TABLE
+};
+#define INPUT_CHANNEL_COUNT (sizeof(INPUT_CHANNELS) / sizeof(INPUT_CHANNELS[0]))
+
+// shortest time between two drains of the counted pulses (ms), the counter task
+// sleeps until the first pulse after a drain
+#define COUNTER_DRAIN_INTERVAL 150
+
+// counter journal: ring of segment files, commit after N pulses or N ms,
+// whichever comes first. This is the worst-case loss window on power cut.
+#define JOURNAL_SEGMENTS 4
+#define JOURNAL_SEGMENT_RECORDS 256
+#define JOURNAL_BATCH_PULSES 100
+#define JOURNAL_BATCH_MS 10000
+
+// temperature sampling period and slow re-enumeration of the OneWire buses (ms)
+#define TEMP_SAMPLE_INTERVAL 1000
+#define TEMP_ENUMERATE_INTERVAL 300000
+
+// LittleFS partition of the default esp32dev table (bytes)
+#define FS_PARTITION_SIZE 0x160000
+
+// outage queue: samples kept in RAM, spilled to flash at this many samples
+// or this age of the oldest one (ms), bytes of flash the spilled samples may
+// take, at most this share of the filesystem (%), and the replay pace after
+// a reconnect (samples per batch, ms between batches, random start delay)
+#define OUTBOX_RAM_SAMPLES 64
+#define OUTBOX_SPILL_SAMPLES 8
+#define OUTBOX_SPILL_INTERVAL 300000
+#define OUTBOX_FILE_BYTES 0x50000
+#define OUTBOX_FS_SHARE 25
+#define OUTBOX_REPLAY_BATCH 10
+#define OUTBOX_REPLAY_INTERVAL 500
+#define OUTBOX_REPLAY_JITTER 30000
+
+// reconnect backoff (ms): first retry delay of each link and the cap it doubles up to,
+// and the broker connect timeout (s)
+#define CONNECT_WIFI_BACKOFF_MIN 15000
+#define CONNECT_MQTT_BACKOFF_MIN 2000
+#define CONNECT_BACKOFF_MAX 300000
+#define CONNECT_MQTT_TIMEOUT 3
+
+// battery installs: modem sleep between DTIM beacons
+#define POWER_SAVE 0
+
+// core 0 is left to the Wi-Fi, lwIP and async_tcp tasks, the application runs on core 1.
+// The restart button and the counter task preempt the MQTT owner and loop().
+#define APP_CORE 1
+#define RESTART_TASK_PRIORITY 4
+#define COUNTER_TASK_PRIORITY 3
+#define TEMP_TASK_PRIORITY 1
+// tasks that run periodically are subscribed to the task watchdog (s)
+#define WATCHDOG_TIMEOUT 10
+// loop() wakes this often to schedule the interval publish and the live status (ms)
+#define LOOP_PERIOD 50
+
+// MQTT owner task: core, priority, idle period (ms) and outbound queue sizes (powers of two)
+#define MQTT_TASK_CORE APP_CORE
+#define MQTT_TASK_PRIORITY 2
+#if POWER_SAVE
+#define MQTT_TASK_PERIOD 100
+#else
+#define MQTT_TASK_PERIOD 10
+#endif
+#define MQTT_QUEUE_HIGH 8
+#define MQTT_QUEUE_NORMAL 16
+
+// MQTT client: QoS of the telemetry (0 or 1), QoS 1 publishes in flight before the
+// PUBACKs (messages and bytes), broker silence before the connection is dropped (ms),
+// keepalive (s) and a session kept by the broker across reconnects
+#define MQTT_TELEMETRY_QOS 1
+#define MQTT_INFLIGHT_MESSAGES 16
+#define MQTT_INFLIGHT_BYTES 16384
+#define MQTT_ACK_TIMEOUT 30000
+#define MQTT_KEEPALIVE 15
+#define MQTT_PERSISTENT_SESSION 1
+// largest inbound message (bytes), larger ones are acknowledged and dropped
+#define MQTT_RECEIVE_SIZE 4096
+
+// shortest time between two live status frames sent to the web UI (ms)
+#define LIVE_STATUS_INTERVAL 500
+
+// /data reports the RSSI in steps of N dBm and the sensor ages in steps of N ms,
+// the cached body is rebuilt when either moves to another step
+#define STATUS_RSSI_STEP 5
+#define STATUS_AGE_STEP 5000
+
+// history: one record every N seconds, appended N records at a time to a ring of
+// segment files, 7 segments of 1440 records keep a week at one record a minute.
+// Nothing is recorded until the clock has been set from the NTP server.
+#define HISTORY_INTERVAL 60
+#define HISTORY_BATCH 10
+#define HISTORY_SEGMENTS 7
+#define HISTORY_SEGMENT_RECORDS 1440
+#define HISTORY_NTP_SERVER "pool.ntp.org"
+
+#endif
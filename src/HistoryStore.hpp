@@ -0,0 +1,599 @@
+#ifndef HISTORY_STORE
+#define HISTORY_STORE
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <memory>
+#include <time.h>
+#include "esp_rom_crc.h"
+
+#include "DeviceSettings.hpp"
+#include "Telemetry.hpp"
+
+// value of a slot without a reading
+#define HISTORY_NO_TEMP INT16_MIN
+
+#define HISTORY_MAGIC 0x32545348
+// records read from flash at once while scanning
+#define HISTORY_READ_RECORDS 16
+// sensors in one row at most, a step across a swap holds the old and the new ones
+#define HISTORY_STEP_SENSORS (2 * TEMP_MAX_SENSORS)
+// one JSON row of the /history answer at most, every sensor and counter in it
+#define HISTORY_LINE_SIZE (96 + HISTORY_STEP_SENSORS * 40 + INPUT_CHANNEL_COUNT * 22)
+// clock considered set by SNTP past this time (2024-01-01)
+#define HISTORY_CLOCK_VALID 1704067200
+
+// one reading, fixed size on flash, temperatures in hundredths of a degree
+// in the slot their sensor has in the segment header
+struct __attribute__((packed)) HISTORY_RECORD {
+    uint32_t time;
+    uint64_t counters[INPUT_CHANNEL_COUNT];
+    uint8_t levels;
+    int8_t rssi;
+    int16_t temps[TEMP_MAX_SENSORS];
+    uint32_t crc;
+};
+
+// first bytes of every segment, a segment of another layout is started over.
+// roms is the sensor of each slot, all zero while the slot is free
+struct __attribute__((packed)) HISTORY_HEADER {
+    uint32_t magic;
+    uint16_t recordSize;
+    uint16_t reserved;
+    DeviceAddress roms[TEMP_MAX_SENSORS];
+};
+
+static_assert(HISTORY_SEGMENTS * (sizeof(HISTORY_HEADER) + HISTORY_SEGMENT_RECORDS * sizeof(HISTORY_RECORD)) <=
+    FS_PARTITION_SIZE * (100 - OUTBOX_FS_SHARE) / 100, "the history ring does not fit beside the outbox");
+
+// time range of a segment, kept in RAM for the seeks
+struct HISTORY_SEGMENT {
+    uint32_t first;
+    uint32_t last;
+    uint16_t count;
+
+    HISTORY_SEGMENT() :
+        first(0),
+        last(0),
+        count(0)
+    {}
+};
+
+inline String historyPath(uint8_t index) {
+    return "/history" + String(index) + ".bin";
+}
+
+inline bool historyValid(const HISTORY_RECORD &record) {
+    return record.crc == esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&record), offsetof(HISTORY_RECORD, crc));
+}
+
+inline bool historyFreeSlot(const uint8_t *rom) {
+    static const DeviceAddress NONE = {};
+    return memcmp(rom, NONE, sizeof(DeviceAddress)) == 0;
+}
+
+// the sensor table of a segment, false when it is missing or of another layout
+inline bool historyTable(File &file, DeviceAddress *roms) {
+    HISTORY_HEADER header;
+    if (!file.seek(0) || file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header) ||
+        header.magic != HISTORY_MAGIC || header.recordSize != sizeof(HISTORY_RECORD)) return false;
+
+    memcpy(roms, header.roms, sizeof(header.roms));
+    return true;
+}
+
+// unix seconds of a /history argument: digits only, within 32 bits
+inline bool historySeconds(const char *text, uint32_t &value) {
+    size_t length = strlen(text);
+    if (length == 0 || length > 10 || strspn(text, "0123456789") != length) return false;
+
+    unsigned long long number = strtoull(text, NULL, 10);
+    if (number > UINT32_MAX) return false;
+    value = (uint32_t)number;
+    return true;
+}
+
+// range of a /history query, a NULL argument takes its default: the hour
+// up to now at HISTORY_INTERVAL. The hour starts at 0 while the clock is
+// not set yet, which gives an empty answer. Returns the error, NULL if valid
+inline const char *historyRange(const char *fromText, const char *toText, const char *stepText, uint32_t now,
+                                uint32_t &from, uint32_t &to, uint32_t &step) {
+    to = now;
+    step = HISTORY_INTERVAL;
+    if (toText != NULL && !historySeconds(toText, to)) return "invalid to";
+    from = to > 3600 ? to - 3600 : 0;
+    if (fromText != NULL && !historySeconds(fromText, from)) return "invalid from";
+    if (stepText != NULL && (!historySeconds(stepText, step) || step == 0)) return "invalid step";
+    if (from > to) return "from after to";
+    return NULL;
+}
+
+// Time series of the readings on LittleFS, one record every HISTORY_INTERVAL
+// seconds once the clock is set. Records are batched in RAM and appended
+// HISTORY_BATCH at a time to a ring of HISTORY_SEGMENTS files, the oldest
+// segment is truncated when the ring wraps. The first and last time of
+// every segment stay in RAM, a query picks the segments by time and
+// binary searches the first one on flash, so a seek is O(log n) reads.
+// Temperatures are kept by ROM: a sensor keeps its slot for the whole
+// segment, a new one takes a free slot and the table in the header is
+// rewritten in place before its first record. When no slot is free, the next record starts a segment.
+class HistoryStore {
+    private:
+        HISTORY_SEGMENT index[HISTORY_SEGMENTS];
+        uint8_t segment = 0;
+        portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+        HISTORY_RECORD batch[HISTORY_BATCH];
+        uint8_t pending = 0;
+        uint32_t lastTime = 0;
+        // never append behind a torn record, the next flush starts a segment
+        bool torn = false;
+
+        // sensor table of the newest segment, the slots of the batch refer to it
+        DeviceAddress roms[TEMP_MAX_SENSORS];
+        // a slot was taken since the header was written
+        bool tableChanged = false;
+        // the table was renewed, the next flush starts a segment
+        bool renew = false;
+
+        uint32_t appends = 0;
+        uint32_t rotations = 0;
+        uint32_t bytesWritten = 0;
+        uint32_t dropped = 0;
+
+        // count and time range of a segment, a torn tail is cut off
+        HISTORY_SEGMENT scan(uint8_t index, bool &torn) {
+            HISTORY_SEGMENT range;
+            File file = LittleFS.open(historyPath(index), "r");
+            if (!file) return range;
+
+            DeviceAddress roms[TEMP_MAX_SENSORS];
+            if (!historyTable(file, roms)) {
+                file.close();
+                return range;
+            }
+
+            uint32_t count = (file.size() - sizeof(HISTORY_HEADER)) / sizeof(HISTORY_RECORD);
+            HISTORY_RECORD record;
+            while (count > 0) {
+                file.seek(sizeof(HISTORY_HEADER) + (count - 1) * sizeof(HISTORY_RECORD));
+                if (file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record) && historyValid(record)) break;
+                count--;
+            }
+            torn = file.size() != sizeof(HISTORY_HEADER) + count * sizeof(HISTORY_RECORD);
+            if (count > 0) {
+                range.count = count;
+                range.last = record.time;
+                file.seek(sizeof(HISTORY_HEADER));
+                file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record));
+                range.first = record.time;
+            }
+            file.close();
+            return range;
+        }
+
+        int8_t findSlot(const uint8_t *rom) const {
+            for (uint8_t i = 0; i < TEMP_MAX_SENSORS; i++) {
+                if (memcmp(this->roms[i], rom, sizeof(DeviceAddress)) == 0) return i;
+            }
+            return -1;
+        }
+
+        // slot of the sensor, a free one is taken for a new sensor, -1 when none is left
+        int8_t takeSlot(const uint8_t *rom) {
+            int8_t slot = this->findSlot(rom);
+            for (uint8_t i = 0; i < TEMP_MAX_SENSORS && slot < 0; i++) {
+                if (!historyFreeSlot(this->roms[i])) continue;
+                memcpy(this->roms[i], rom, sizeof(DeviceAddress));
+                this->tableChanged = true;
+                slot = i;
+            }
+            return slot;
+        }
+
+        // frees the slots no record of the batch uses, the others keep their index
+        void compact() {
+            for (uint8_t slot = 0; slot < TEMP_MAX_SENSORS; slot++) {
+                bool used = false;
+                for (uint8_t i = 0; i < this->pending && !used; i++) used = this->batch[i].temps[slot] != HISTORY_NO_TEMP;
+                if (!used) memset(this->roms[slot], 0, sizeof(DeviceAddress));
+            }
+        }
+
+        // the table of the current segment in place, before records that use a new slot
+        bool writeTable(uint8_t target) {
+            File file = LittleFS.open(historyPath(target), "r+");
+            if (!file) return false;
+
+            size_t written = 0;
+            if (file.seek(offsetof(HISTORY_HEADER, roms))) written = file.write(reinterpret_cast<const uint8_t*>(this->roms), sizeof(this->roms));
+            file.close();
+
+            this->bytesWritten += written;
+            return written == sizeof(this->roms);
+        }
+
+    public:
+        // picks up the segments of the previous boots, appends to the newest one
+        void begin() {
+            bool torn[HISTORY_SEGMENTS] = {};
+            for (uint8_t i = 0; i < HISTORY_SEGMENTS; i++) {
+                this->index[i] = this->scan(i, torn[i]);
+                if (this->index[i].count > 0 && this->index[i].last >= this->index[this->segment].last) this->segment = i;
+            }
+            this->torn = torn[this->segment];
+            this->lastTime = this->index[this->segment].last;
+
+            memset(this->roms, 0, sizeof(this->roms));
+            File file = LittleFS.open(historyPath(this->segment), "r");
+            if (file && this->index[this->segment].count > 0) historyTable(file, this->roms);
+            if (file) file.close();
+        }
+
+        static bool isClockSet() {
+            return time(NULL) >= HISTORY_CLOCK_VALID;
+        }
+
+        // true when a record is due, owner task only
+        bool isDue() const {
+            return isClockSet() && (uint32_t)time(NULL) - this->lastTime >= HISTORY_INTERVAL;
+        }
+
+        void add(const TELEMETRY_SAMPLE &sample) {
+            // a batch the flash refused is retried first, records are dropped while it fails
+            if (this->pending == HISTORY_BATCH) this->flush();
+            if (this->pending == HISTORY_BATCH) {
+                this->dropped++;
+                return;
+            }
+
+            // more new sensors than free slots: the batch closes this segment
+            // and the sensors of this sample keep their slots in the next one
+            uint8_t unknown = 0;
+            uint8_t free = 0;
+            for (uint8_t i = 0; i < sample.tempCount; i++) {
+                if (this->findSlot(sample.temps[i].rom) < 0) unknown++;
+            }
+            for (uint8_t i = 0; i < TEMP_MAX_SENSORS; i++) {
+                if (historyFreeSlot(this->roms[i])) free++;
+            }
+            if (unknown > free) {
+                this->flush();
+                if (this->pending > 0) {
+                    this->dropped++;
+                    return;
+                }
+                for (uint8_t slot = 0; slot < TEMP_MAX_SENSORS; slot++) {
+                    bool kept = false;
+                    for (uint8_t i = 0; i < sample.tempCount && !kept; i++) {
+                        kept = memcmp(this->roms[slot], sample.temps[i].rom, sizeof(DeviceAddress)) == 0;
+                    }
+                    if (!kept) memset(this->roms[slot], 0, sizeof(DeviceAddress));
+                }
+                this->renew = true;
+            }
+
+            HISTORY_RECORD &record = this->batch[this->pending++];
+            record.time = sample.time;
+            memcpy(record.counters, sample.counters, sizeof(record.counters));
+            record.levels = sample.levels;
+            record.rssi = sample.rssi;
+            for (uint8_t i = 0; i < TEMP_MAX_SENSORS; i++) record.temps[i] = HISTORY_NO_TEMP;
+            for (uint8_t i = 0; i < sample.tempCount; i++) {
+                int8_t slot = this->takeSlot(sample.temps[i].rom);
+                if (slot >= 0) record.temps[slot] = (int16_t)lroundf(sample.temps[i].value * 100);
+            }
+            record.crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&record), offsetof(HISTORY_RECORD, crc));
+            this->lastTime = record.time;
+
+            if (this->pending == HISTORY_BATCH) this->flush();
+        }
+
+        // one append for the whole batch, into a fresh segment when the current one is full
+        void flush() {
+            if (this->pending == 0) return;
+
+            bool rotate = this->torn || this->renew || this->index[this->segment].count + this->pending > HISTORY_SEGMENT_RECORDS;
+            uint8_t target = rotate ? (this->segment + 1) % HISTORY_SEGMENTS : this->segment;
+            bool fresh = rotate || this->index[target].count == 0;
+
+            // a new segment starts with the sensors of its first batch only
+            if (rotate && !this->renew) this->compact();
+            if (!fresh && this->tableChanged && !this->writeTable(target)) return;
+
+            File file = LittleFS.open(historyPath(target), fresh ? "w" : "a");
+            if (!file) return;
+
+            size_t written = 0;
+            if (fresh) {
+                HISTORY_HEADER header = { HISTORY_MAGIC, sizeof(HISTORY_RECORD), 0 };
+                memcpy(header.roms, this->roms, sizeof(header.roms));
+                written += file.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+            }
+            written += file.write(reinterpret_cast<const uint8_t*>(this->batch), this->pending * sizeof(HISTORY_RECORD));
+            file.close();
+
+            HISTORY_SEGMENT range = fresh ? HISTORY_SEGMENT() : this->index[target];
+            if (range.count == 0) range.first = this->batch[0].time;
+            range.count += this->pending;
+            range.last = this->batch[this->pending - 1].time;
+
+            portENTER_CRITICAL(&this->lock);
+            this->index[target] = range;
+            this->segment = target;
+            portEXIT_CRITICAL(&this->lock);
+
+            if (rotate) this->rotations++;
+            this->torn = false;
+            this->renew = false;
+            this->tableChanged = false;
+            this->appends++;
+            this->bytesWritten += written;
+            this->pending = 0;
+        }
+
+        // segment ranges in time order, empty ones left out, returns how many
+        uint8_t getSegments(HISTORY_SEGMENT *ranges, uint8_t *order) {
+            portENTER_CRITICAL(&this->lock);
+            uint8_t newest = this->segment;
+            memcpy(ranges, this->index, sizeof(this->index));
+            portEXIT_CRITICAL(&this->lock);
+
+            uint8_t count = 0;
+            for (uint8_t i = 1; i <= HISTORY_SEGMENTS; i++) {
+                uint8_t segment = (newest + i) % HISTORY_SEGMENTS;
+                if (ranges[segment].count > 0) order[count++] = segment;
+            }
+            return count;
+        }
+
+        uint32_t getAppends() const {
+            return this->appends;
+        }
+
+        uint32_t getRotations() const {
+            return this->rotations;
+        }
+
+        uint32_t getBytesWritten() const {
+            return this->bytesWritten;
+        }
+
+        uint32_t getDropped() const {
+            return this->dropped;
+        }
+};
+
+// Streams /history: the records between from and to, one row per step
+// seconds with the last counters and levels of the step, the mean RSSI and
+// the mean temperature of every sensor by ROM, whatever its slot in each
+// segment. Rows are produced as the response asks for bytes, the open
+// segment and one row are all that is held in RAM.
+class HistoryCursor {
+    private:
+        uint32_t from;
+        uint32_t to;
+        uint32_t step;
+
+        HISTORY_SEGMENT ranges[HISTORY_SEGMENTS];
+        uint8_t order[HISTORY_SEGMENTS];
+        uint8_t segments = 0;
+        uint8_t position = 0;
+
+        File file;
+        uint32_t next = 0;
+        uint32_t count = 0;
+        // sensor table of the open segment
+        DeviceAddress roms[TEMP_MAX_SENSORS];
+
+        HISTORY_RECORD records[HISTORY_READ_RECORDS];
+        uint8_t buffered = 0;
+        uint8_t consumed = 0;
+
+        // the step being folded
+        bool open = false;
+        uint32_t bucket = 0;
+        HISTORY_RECORD last;
+        int32_t rssiSum = 0;
+        // sensors seen in the step, in the order they came
+        DeviceAddress stepRoms[HISTORY_STEP_SENSORS];
+        uint8_t stepSensors = 0;
+        int32_t tempSums[HISTORY_STEP_SENSORS];
+        uint16_t tempCounts[HISTORY_STEP_SENSORS];
+        uint16_t samples = 0;
+
+        char line[HISTORY_LINE_SIZE];
+        size_t lineLength = 0;
+        size_t linePosition = 0;
+        uint8_t stage = 0;
+        bool firstRow = true;
+
+        // first record at or after time, binary search on flash
+        uint32_t seek(File &file, uint32_t count, uint32_t time) {
+            uint32_t low = 0;
+            uint32_t high = count;
+            while (low < high) {
+                uint32_t middle = (low + high) / 2;
+                uint32_t stamp = 0;
+                file.seek(sizeof(HISTORY_HEADER) + middle * sizeof(HISTORY_RECORD));
+                file.read(reinterpret_cast<uint8_t*>(&stamp), sizeof(stamp));
+                if (stamp < time) low = middle + 1;
+                else high = middle;
+            }
+            return low;
+        }
+
+        bool openSegment() {
+            while (this->position < this->segments) {
+                const HISTORY_SEGMENT &range = this->ranges[this->order[this->position++]];
+                if (range.last < this->from) continue;
+                if (range.first > this->to) return false;
+
+                this->file = LittleFS.open(historyPath(this->order[this->position - 1]), "r");
+                if (!this->file) continue;
+                if (!historyTable(this->file, this->roms)) {
+                    this->file.close();
+                    continue;
+                }
+
+                this->count = range.count;
+                this->next = range.first >= this->from ? 0 : this->seek(this->file, this->count, this->from);
+                this->buffered = 0;
+                this->consumed = 0;
+                return true;
+            }
+            return false;
+        }
+
+        // next record in range, false at the end
+        bool read(HISTORY_RECORD &record) {
+            while (true) {
+                if (this->consumed < this->buffered) {
+                    record = this->records[this->consumed++];
+                    if (!historyValid(record)) continue;
+                    if (record.time > this->to) return false;
+                    if (record.time < this->from) continue;
+                    return true;
+                }
+
+                if (this->file && this->next < this->count) {
+                    uint32_t batch = min((uint32_t)HISTORY_READ_RECORDS, this->count - this->next);
+                    this->file.seek(sizeof(HISTORY_HEADER) + this->next * sizeof(HISTORY_RECORD));
+                    size_t length = this->file.read(reinterpret_cast<uint8_t*>(this->records), batch * sizeof(HISTORY_RECORD));
+                    this->buffered = length / sizeof(HISTORY_RECORD);
+                    this->consumed = 0;
+                    this->next += batch;
+                    if (this->buffered > 0) continue;
+                }
+
+                if (this->file) this->file.close();
+                if (!this->openSegment()) return false;
+            }
+        }
+
+        void resetBucket(const HISTORY_RECORD &record) {
+            this->open = true;
+            this->bucket = record.time - (record.time - this->from) % this->step;
+            this->rssiSum = 0;
+            this->samples = 0;
+            this->stepSensors = 0;
+            memset(this->tempSums, 0, sizeof(this->tempSums));
+            memset(this->tempCounts, 0, sizeof(this->tempCounts));
+        }
+
+        void fold(const HISTORY_RECORD &record) {
+            this->last = record;
+            this->rssiSum += record.rssi;
+            this->samples++;
+            for (uint8_t slot = 0; slot < TEMP_MAX_SENSORS; slot++) {
+                if (record.temps[slot] == HISTORY_NO_TEMP || historyFreeSlot(this->roms[slot])) continue;
+
+                uint8_t sensor = 0;
+                while (sensor < this->stepSensors && memcmp(this->stepRoms[sensor], this->roms[slot], sizeof(DeviceAddress)) != 0) sensor++;
+                if (sensor == HISTORY_STEP_SENSORS) continue;
+                if (sensor == this->stepSensors) memcpy(this->stepRoms[this->stepSensors++], this->roms[slot], sizeof(DeviceAddress));
+
+                this->tempSums[sensor] += record.temps[slot];
+                this->tempCounts[sensor]++;
+            }
+        }
+
+        // [time,counter,GPIO,wifiQuality,[{id,temp}](,[counters])]
+        void formatRow() {
+            int length = snprintf(this->line, HISTORY_LINE_SIZE, "%s[%u,%llu,%u,%d,[", this->firstRow ? "" : ",",
+                (unsigned)this->bucket, (unsigned long long)this->last.counters[0], (unsigned)(this->last.levels & 1),
+                (int)(this->rssiSum / this->samples));
+            this->firstRow = false;
+
+            for (uint8_t i = 0; i < this->stepSensors; i++) {
+                char rom[17];
+                formatRom(this->stepRoms[i], rom);
+                length += snprintf(this->line + length, HISTORY_LINE_SIZE - length, "%s{\"id\":\"%s\",\"temp\":%.2f}", i ? "," : "",
+                    rom, this->tempSums[i] / (100.0f * this->tempCounts[i]));
+            }
+            length += snprintf(this->line + length, HISTORY_LINE_SIZE - length, "]");
+
+            if (INPUT_CHANNEL_COUNT > 1) {
+                length += snprintf(this->line + length, HISTORY_LINE_SIZE - length, ",[");
+                for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                    length += snprintf(this->line + length, HISTORY_LINE_SIZE - length, "%s%llu", i ? "," : "",
+                        (unsigned long long)this->last.counters[i]);
+                }
+                length += snprintf(this->line + length, HISTORY_LINE_SIZE - length, "]");
+            }
+            length += snprintf(this->line + length, HISTORY_LINE_SIZE - length, "]");
+            this->lineLength = min((size_t)length, (size_t)HISTORY_LINE_SIZE - 1);
+        }
+
+        // fills line with the next piece of the answer, false once everything was sent
+        bool nextLine() {
+            if (this->stage == 0) {
+                this->lineLength = snprintf(this->line, HISTORY_LINE_SIZE,
+                    "{\"from\":%u,\"to\":%u,\"step\":%u,\"columns\":[\"time\",\"counter\",\"GPIO\",\"wifiQuality\",\"temperatures\"%s],\"rows\":[",
+                    (unsigned)this->from, (unsigned)this->to, (unsigned)this->step, INPUT_CHANNEL_COUNT > 1 ? ",\"counters\"" : "");
+                this->stage = 1;
+                return true;
+            }
+
+            if (this->stage == 1) {
+                HISTORY_RECORD record;
+                while (this->read(record)) {
+                    if (this->open && record.time >= this->bucket + this->step) {
+                        this->formatRow();
+                        this->resetBucket(record);
+                        this->fold(record);
+                        return true;
+                    }
+                    if (!this->open) this->resetBucket(record);
+                    this->fold(record);
+                }
+
+                this->stage = 2;
+                if (this->open) {
+                    this->formatRow();
+                    this->open = false;
+                    return true;
+                }
+            }
+
+            if (this->stage == 2) {
+                this->lineLength = snprintf(this->line, HISTORY_LINE_SIZE, "]}");
+                this->stage = 3;
+                return true;
+            }
+            return false;
+        }
+
+    public:
+        HistoryCursor(HistoryStore &store, uint32_t from, uint32_t to, uint32_t step) :
+            from(from),
+            to(to),
+            step(max(step, (uint32_t)1))
+        {
+            this->segments = store.getSegments(this->ranges, this->order);
+            this->openSegment();
+        }
+
+        ~HistoryCursor() {
+            if (this->file) this->file.close();
+        }
+
+        // chunked response filler, 0 ends the response
+        size_t fill(uint8_t *buffer, size_t size) {
+            size_t written = 0;
+            while (written < size) {
+                if (this->linePosition == this->lineLength) {
+                    if (!this->nextLine()) break;
+                    this->linePosition = 0;
+                }
+
+                size_t length = min(size - written, this->lineLength - this->linePosition);
+                memcpy(buffer + written, this->line + this->linePosition, length);
+                this->linePosition += length;
+                written += length;
+            }
+            return written;
+        }
+};
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef LIVE_STATUS
+#define LIVE_STATUS
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "TemperatureSampler.hpp"
+
+// the other fields and every sensor with an alias of escaped control characters
+#define LIVE_STATUS_SIZE (160 + TEMP_MAX_SENSORS * (56 + TEMP_ALIAS_SIZE * 6))
+
+// one temperature of the panel, by ROM address
+struct LIVE_TEMP {
+    DeviceAddress rom;
+    char alias[TEMP_ALIAS_SIZE];
+    float value;
+
+    LIVE_TEMP() :
+        rom(),
+        alias(""),
+        value(0)
+    {}
+
+    bool operator!=(const LIVE_TEMP &other) const {
+        return memcmp(this->rom, other.rom, sizeof(DeviceAddress)) != 0 ||
+            strcmp(this->alias, other.alias) != 0 ||
+            this->value != other.value;
+    }
+};
+
+// values of the status panel, same keys as the /data status block
+struct LIVE_STATE {
+    uint64_t counter;
+    uint64_t persisted;
+    bool gpio;
+    int8_t rssi;
+    uint8_t tempCount;
+    LIVE_TEMP temps[TEMP_MAX_SENSORS];
+
+    LIVE_STATE() :
+        counter(0),
+        persisted(0),
+        gpio(false),
+        rssi(0),
+        tempCount(0)
+    {}
+};
+
+// Server-sent events on /events for the web UI. Only the fields that changed
+// since the previous frame are sent, at most once per LIVE_STATUS_INTERVAL,
+// and a frame is serialized once whatever the number of open panels. A
+// panel that connects gets a full frame with the next push.
+class LiveStatus {
+    private:
+        AsyncEventSource events = AsyncEventSource("/events");
+
+        LIVE_STATE last;
+        volatile bool full = true;
+        unsigned long lastPush = 0;
+        uint32_t id = 0;
+
+        char frame[LIVE_STATUS_SIZE];
+
+        // appends "key":value to the frame
+        int field(int length, const char *key, const char *format, ...) {
+            if (length >= LIVE_STATUS_SIZE) return length;
+            length += snprintf(this->frame + length, LIVE_STATUS_SIZE - length, "%s\"%s\":", length > 1 ? "," : "", key);
+            if (length >= LIVE_STATUS_SIZE) return length;
+
+            va_list args;
+            va_start(args, format);
+            length += vsnprintf(this->frame + length, LIVE_STATUS_SIZE - length, format, args);
+            va_end(args);
+            return length;
+        }
+
+        // appends text as a JSON string
+        int string(int length, const char *text) {
+            if (length < LIVE_STATUS_SIZE) this->frame[length++] = '"';
+            for (; *text != '\0' && length < LIVE_STATUS_SIZE; text++) {
+                uint8_t c = *text;
+                if (c == '"' || c == '\\') length += snprintf(this->frame + length, LIVE_STATUS_SIZE - length, "\\%c", c);
+                else if (c < 0x20) length += snprintf(this->frame + length, LIVE_STATUS_SIZE - length, "\\u%04x", c);
+                else this->frame[length++] = c;
+            }
+            if (length < LIVE_STATUS_SIZE) this->frame[length++] = '"';
+            return length;
+        }
+
+    public:
+        void begin(AsyncWebServer &server) {
+            this->events.onConnect([this](AsyncEventSourceClient *client) {
+                this->full = true;
+            });
+            server.addHandler(&this->events);
+        }
+
+        // false without a listener or before the interval elapsed, checked before the state is captured
+        bool isDue() {
+            return this->events.count() > 0 && millis() - this->lastPush >= LIVE_STATUS_INTERVAL;
+        }
+
+        void push(const LIVE_STATE &state) {
+            this->lastPush = millis();
+
+            bool full = this->full;
+            this->full = false;
+
+            int length = snprintf(this->frame, LIVE_STATUS_SIZE, "{");
+            if (full || state.counter != this->last.counter)
+                length = this->field(length, "counter", "%llu", (unsigned long long)state.counter);
+            if (full || state.persisted != this->last.persisted)
+                length = this->field(length, "persisted", "%llu", (unsigned long long)state.persisted);
+            if (full || state.gpio != this->last.gpio)
+                length = this->field(length, "GPIO", "%s", state.gpio ? "true" : "false");
+            if (full || state.rssi != this->last.rssi)
+                length = this->field(length, "wifiQuality", "%d", state.rssi);
+
+            bool tempsChanged = state.tempCount != this->last.tempCount;
+            for (uint8_t i = 0; i < state.tempCount && !tempsChanged; i++) {
+                tempsChanged = state.temps[i] != this->last.temps[i];
+            }
+            if (full || tempsChanged) {
+                length = this->field(length, "temperatures", "[");
+                for (uint8_t i = 0; i < state.tempCount && length < LIVE_STATUS_SIZE; i++) {
+                    const LIVE_TEMP &temp = state.temps[i];
+                    char rom[17];
+                    formatRom(temp.rom, rom);
+
+                    length += snprintf(this->frame + length, LIVE_STATUS_SIZE - length, "%s{\"id\":\"%s\"", i ? "," : "", rom);
+                    if (temp.alias[0] != '\0' && length < LIVE_STATUS_SIZE) {
+                        length += snprintf(this->frame + length, LIVE_STATUS_SIZE - length, ",\"alias\":");
+                        length = this->string(length, temp.alias);
+                    }
+                    if (length < LIVE_STATUS_SIZE)
+                        length += snprintf(this->frame + length, LIVE_STATUS_SIZE - length, ",\"temp\":%.2f}", temp.value);
+                }
+                if (length < LIVE_STATUS_SIZE) length += snprintf(this->frame + length, LIVE_STATUS_SIZE - length, "]");
+            }
+            this->last = state;
+
+            // nothing changed
+            if (length == 1) return;
+
+            // truncated, send everything again next time
+            if (length >= LIVE_STATUS_SIZE - 1) {
+                this->full = true;
+                return;
+            }
+            snprintf(this->frame + length, LIVE_STATUS_SIZE - length, "}");
+
+            this->events.send(this->frame, "status", ++this->id);
+        }
+
+        size_t getClients() {
+            return this->events.count();
+        }
+};
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef METRICS
+#define METRICS
+
+#include <Arduino.h>
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+
+#define METRICS_PREFIX "dweb08_"
+#define METRICS_MAX_TASKS 24
+
+// publish latency histogram bounds in microseconds, +Inf is implicit
+#define METRICS_LATENCY_BUCKETS 8
+static const uint32_t METRICS_LATENCY_BOUNDS[METRICS_LATENCY_BUCKETS] = {
+    250, 500, 1000, 2500, 5000, 10000, 50000, 250000
+};
+
+// Counters updated from the hot paths and the Prometheus text writers used
+// by /metrics. An update is a few increments in a critical section, the
+// formatting cost is paid only by whoever reads them.
+class Metrics {
+    private:
+        portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+        uint32_t buckets[METRICS_LATENCY_BUCKETS + 1] = {};
+        uint32_t publishes = 0;
+        uint32_t failures = 0;
+        uint64_t latencySumUs = 0;
+
+    public:
+        void observePublish(uint32_t elapsedUs, bool sent) {
+            uint8_t bucket = 0;
+            while (bucket < METRICS_LATENCY_BUCKETS && elapsedUs > METRICS_LATENCY_BOUNDS[bucket]) bucket++;
+
+            portENTER_CRITICAL(&this->mux);
+            this->buckets[bucket]++;
+            this->publishes++;
+            this->latencySumUs += elapsedUs;
+            if (!sent) this->failures++;
+            portEXIT_CRITICAL(&this->mux);
+        }
+
+        uint32_t getPublishes() {
+            portENTER_CRITICAL(&this->mux);
+            uint32_t publishes = this->publishes;
+            portEXIT_CRITICAL(&this->mux);
+            return publishes;
+        }
+
+        uint32_t getFailures() {
+            portENTER_CRITICAL(&this->mux);
+            uint32_t failures = this->failures;
+            portEXIT_CRITICAL(&this->mux);
+            return failures;
+        }
+
+        void writePublish(Print &out) {
+            uint32_t buckets[METRICS_LATENCY_BUCKETS + 1];
+            portENTER_CRITICAL(&this->mux);
+            memcpy(buckets, this->buckets, sizeof(buckets));
+            uint32_t publishes = this->publishes;
+            uint32_t failures = this->failures;
+            uint64_t latencySumUs = this->latencySumUs;
+            portEXIT_CRITICAL(&this->mux);
+
+            header(out, "publish_seconds", "histogram", "MQTT publish latency");
+            uint32_t cumulative = 0;
+            for (uint8_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+                cumulative += buckets[i];
+                out.printf(METRICS_PREFIX "publish_seconds_bucket{le=\"%g\"} %u\n",
+                    METRICS_LATENCY_BOUNDS[i] / 1000000.0, (unsigned)cumulative);
+            }
+            out.printf(METRICS_PREFIX "publish_seconds_bucket{le=\"+Inf\"} %u\n", (unsigned)publishes);
+            out.printf(METRICS_PREFIX "publish_seconds_sum %.6f\n", latencySumUs / 1000000.0);
+            out.printf(METRICS_PREFIX "publish_seconds_count %u\n", (unsigned)publishes);
+
+            counter(out, "publish_failures_total", "MQTT publishes refused by the client", failures);
+        }
+
+        // stack high-water mark of every task, and its CPU time when the run-time stats are built in
+        static void writeTasks(Print &out) {
+#if configUSE_TRACE_FACILITY
+            TaskStatus_t tasks[METRICS_MAX_TASKS];
+            uint32_t totalRunTime = 0;
+            UBaseType_t count = uxTaskGetSystemState(tasks, METRICS_MAX_TASKS, &totalRunTime);
+
+            header(out, "task_stack_free_bytes", "gauge", "Lowest free stack of the task");
+            for (UBaseType_t i = 0; i < count; i++) {
+                out.printf(METRICS_PREFIX "task_stack_free_bytes{task=\"%s\"} %u\n",
+                    tasks[i].pcTaskName, (unsigned)(tasks[i].usStackHighWaterMark * sizeof(StackType_t)));
+            }
+#if configGENERATE_RUN_TIME_STATS
+            header(out, "task_cpu_ticks_total", "counter", "Run-time counter of the task");
+            for (UBaseType_t i = 0; i < count; i++) {
+                out.printf(METRICS_PREFIX "task_cpu_ticks_total{task=\"%s\"} %u\n",
+                    tasks[i].pcTaskName, (unsigned)tasks[i].ulRunTimeCounter);
+            }
+#endif
+#endif
+        }
+
+        // lowest free stack across all tasks, 0 when the trace facility is not built in
+        static uint32_t getMinStackFree() {
+            uint32_t lowest = 0;
+#if configUSE_TRACE_FACILITY
+            TaskStatus_t tasks[METRICS_MAX_TASKS];
+            UBaseType_t count = uxTaskGetSystemState(tasks, METRICS_MAX_TASKS, NULL);
+            for (UBaseType_t i = 0; i < count; i++) {
+                uint32_t free = tasks[i].usStackHighWaterMark * sizeof(StackType_t);
+                if (i == 0 || free < lowest) lowest = free;
+            }
+#endif
+            return lowest;
+        }
+
+        static void writeSystem(Print &out) {
+            gauge(out, "heap_free_bytes", "Free heap", esp_get_free_heap_size());
+            gauge(out, "heap_min_free_bytes", "Lowest free heap since boot", esp_get_minimum_free_heap_size());
+            gauge(out, "heap_largest_block_bytes", "Largest allocatable block",
+                heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+            gauge(out, "uptime_seconds", "Time since boot", esp_timer_get_time() / 1000000.0);
+
+            header(out, "reset_reason", "gauge", "Cause of the last reset");
+            out.printf(METRICS_PREFIX "reset_reason{reason=\"%s\"} 1\n", resetReason());
+        }
+
+        static const char *resetReason() {
+            switch (esp_reset_reason()) {
+                case ESP_RST_POWERON: return "power_on";
+                case ESP_RST_EXT: return "external";
+                case ESP_RST_SW: return "software";
+                case ESP_RST_PANIC: return "panic";
+                case ESP_RST_INT_WDT: return "interrupt_watchdog";
+                case ESP_RST_TASK_WDT: return "task_watchdog";
+                case ESP_RST_WDT: return "watchdog";
+                case ESP_RST_DEEPSLEEP: return "deep_sleep";
+                case ESP_RST_BROWNOUT: return "brownout";
+                case ESP_RST_SDIO: return "sdio";
+                default: return "unknown";
+            }
+        }
+
+        static void header(Print &out, const char *name, const char *type, const char *help) {
+            out.printf("# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n", name, help, name, type);
+        }
+
+        static void gauge(Print &out, const char *name, const char *help, double value) {
+            header(out, name, "gauge", help);
+            out.printf(METRICS_PREFIX "%s %.15g\n", name, value);
+        }
+
+        static void counter(Print &out, const char *name, const char *help, double value) {
+            header(out, name, "counter", help);
+            out.printf(METRICS_PREFIX "%s %.15g\n", name, value);
+        }
+};
+
+#endif
@@ -0,0 +1,489 @@
+#ifndef MQTT_CLIENT
+#define MQTT_CLIENT
+
+#include <Arduino.h>
+#include <Client.h>
+#include <functional>
+
+// fixed header of the MQTT 3.1.1 packets used here, flags included
+#define MQTT_PACKET_CONNECT 0x10
+#define MQTT_PACKET_CONNACK 0x20
+#define MQTT_PACKET_PUBLISH 0x30
+#define MQTT_PACKET_PUBACK 0x40
+#define MQTT_PACKET_SUBSCRIBE 0x82
+#define MQTT_PACKET_UNSUBSCRIBE 0xA2
+#define MQTT_PACKET_PINGREQ 0xC0
+#define MQTT_PACKET_PINGRESP 0xD0
+#define MQTT_PACKET_DISCONNECT 0xE0
+
+#define MQTT_FLAG_DUP 0x08
+
+typedef std::function<void(char*, uint8_t*, unsigned int)> MQTT_CALLBACK;
+
+// a QoS 1 publish waiting for its PUBACK, the packet is kept in the store
+struct MQTT_INFLIGHT {
+    uint16_t id;
+    uint32_t offset;
+    uint32_t length;
+    unsigned long sentAt;
+    bool acked;
+
+    MQTT_INFLIGHT() :
+        id(0),
+        offset(0),
+        length(0),
+        sentAt(0),
+        acked(false)
+    {}
+};
+
+// MQTT 3.1.1 client with the PubSubClient surface used by the component,
+// plus QoS 1 publishing. A QoS 1 publish is written right away and kept in
+// a window of MQTT_INFLIGHT_MESSAGES packets, MQTT_INFLIGHT_BYTES at most,
+// until the broker acknowledges it, so publishes are pipelined and never
+// wait for the broker. The window survives a lost connection: unacknowledged
+// packets are sent again with DUP on the next connect, in the persistent
+// session when MQTT_PERSISTENT_SESSION is set. A full window refuses the
+// publish and the caller keeps the message. Owner task only.
+class MqttClient {
+    private:
+        Client &client;
+
+        String host;
+        uint16_t port = 1883;
+        uint32_t socketTimeout = 15000;
+        MQTT_CALLBACK callback;
+
+        // outgoing QoS 0 packets and every incoming packet
+        uint8_t *buffer = NULL;
+        size_t bufferSize = 0;
+        // the last packet read did not fit the buffer
+        bool truncated = false;
+
+        // ring of stored packets, acknowledged in order by the broker
+        uint8_t store[MQTT_INFLIGHT_BYTES];
+        MQTT_INFLIGHT window[MQTT_INFLIGHT_MESSAGES];
+        uint8_t head = 0;
+        uint8_t count = 0;
+        uint32_t tail = 0;
+        uint16_t nextId = 0;
+
+        bool online = false;
+        bool sessionPresent = false;
+        bool pingOutstanding = false;
+        unsigned long lastIn = 0;
+        unsigned long lastOut = 0;
+
+        uint32_t acked = 0;
+        uint32_t retransmits = 0;
+        uint32_t refused = 0;
+        uint32_t oversized = 0;
+
+        static uint8_t encodeLength(uint8_t *out, uint32_t length) {
+            uint8_t bytes = 0;
+            do {
+                uint8_t digit = length % 128;
+                length /= 128;
+                out[bytes++] = length > 0 ? digit | 0x80 : digit;
+            } while (length > 0);
+            return bytes;
+        }
+
+        static uint8_t lengthBytes(uint32_t length) {
+            return length < 128 ? 1 : length < 16384 ? 2 : length < 2097152 ? 3 : 4;
+        }
+
+        static uint32_t writeString(uint8_t *out, const char *text) {
+            uint16_t length = strlen(text);
+            out[0] = length >> 8;
+            out[1] = length & 0xFF;
+            memcpy(out + 2, text, length);
+            return length + 2;
+        }
+
+        // size of the whole packet for a remaining length
+        static uint32_t packetSize(uint32_t remaining) {
+            return 1 + lengthBytes(remaining) + remaining;
+        }
+
+        static uint32_t publishRemaining(const char *topic, size_t length, uint8_t qos) {
+            return 2 + strlen(topic) + (qos > 0 ? 2 : 0) + length;
+        }
+
+        static uint32_t packPublish(uint8_t *out, const char *topic, const uint8_t *payload, size_t length, uint8_t qos, uint16_t id) {
+            uint32_t size = 0;
+            out[size++] = MQTT_PACKET_PUBLISH | (qos << 1);
+            size += encodeLength(out + size, publishRemaining(topic, length, qos));
+            size += writeString(out + size, topic);
+            if (qos > 0) {
+                out[size++] = id >> 8;
+                out[size++] = id & 0xFF;
+            }
+            memcpy(out + size, payload, length);
+            return size + length;
+        }
+
+        bool write(const uint8_t *data, size_t length) {
+            size_t written = this->client.write(data, length);
+            this->lastOut = millis();
+            if (written == length) return true;
+
+            this->drop();
+            return false;
+        }
+
+        // waits up to the socket timeout for the next byte
+        bool readByte(uint8_t &value) {
+            unsigned long startedAt = millis();
+            while (!this->client.available()) {
+                if (millis() - startedAt >= this->socketTimeout || !this->client.connected()) return false;
+                delay(1);
+            }
+            value = this->client.read();
+            return true;
+        }
+
+        // reads one whole packet into the buffer, 0 on timeout. A packet larger
+        // than the buffer is read to the end and only its start is kept
+        uint32_t readPacket() {
+            uint8_t header;
+            if (!this->readByte(header)) return 0;
+            this->buffer[0] = header;
+
+            uint32_t remaining = 0;
+            uint32_t multiplier = 1;
+            uint32_t size = 1;
+            uint8_t digit;
+            do {
+                if (size == 5 || !this->readByte(digit)) return 0;
+                this->buffer[size++] = digit;
+                remaining += (digit & 0x7F) * multiplier;
+                multiplier *= 128;
+            } while (digit & 0x80);
+
+            this->truncated = size + remaining > this->bufferSize;
+            for (uint32_t i = 0; i < remaining; i++) {
+                if (!this->readByte(digit)) return 0;
+                if (size < this->bufferSize) this->buffer[size++] = digit;
+            }
+            this->lastIn = millis();
+            return size;
+        }
+
+        uint16_t allocateId() {
+            if (++this->nextId == 0) this->nextId = 1;
+            return this->nextId;
+        }
+
+        // start of a free run of length bytes in the store, -1 when the window is full
+        int32_t reserve(uint32_t length) {
+            if (this->count == MQTT_INFLIGHT_MESSAGES || length > MQTT_INFLIGHT_BYTES) return -1;
+            if (this->count == 0) return 0;
+
+            uint32_t oldest = this->window[this->head].offset;
+            if (this->tail > oldest) {
+                if (MQTT_INFLIGHT_BYTES - this->tail >= length) return this->tail;
+                return length < oldest ? 0 : -1;
+            }
+            return this->tail + length < oldest ? (int32_t)this->tail : -1;
+        }
+
+        // frees the acknowledged packets at the head of the window
+        void release() {
+            while (this->count > 0 && this->window[this->head].acked) {
+                this->head = (this->head + 1) % MQTT_INFLIGHT_MESSAGES;
+                this->count--;
+            }
+        }
+
+        void acknowledge(uint16_t id) {
+            for (uint8_t i = 0; i < this->count; i++) {
+                MQTT_INFLIGHT &entry = this->window[(this->head + i) % MQTT_INFLIGHT_MESSAGES];
+                if (entry.acked || entry.id != id) continue;
+
+                entry.acked = true;
+                this->acked++;
+                break;
+            }
+            this->release();
+        }
+
+        // unacknowledged packets are written again, with DUP, right after a connect
+        void retransmit() {
+            for (uint8_t i = 0; i < this->count && this->online; i++) {
+                MQTT_INFLIGHT &entry = this->window[(this->head + i) % MQTT_INFLIGHT_MESSAGES];
+                if (entry.acked) continue;
+
+                this->store[entry.offset] |= MQTT_FLAG_DUP;
+                entry.sentAt = millis();
+                this->retransmits++;
+                this->write(this->store + entry.offset, entry.length);
+            }
+        }
+
+        void handlePacket(uint32_t size) {
+            uint8_t type = this->buffer[0] & 0xF0;
+            uint32_t offset = 1;
+            while (this->buffer[offset] & 0x80) offset++;
+            offset++;
+
+            if (type == MQTT_PACKET_PUBACK && size >= offset + 2) {
+                this->acknowledge((this->buffer[offset] << 8) | this->buffer[offset + 1]);
+            }
+            else if (type == MQTT_PACKET_PINGRESP) {
+                this->pingOutstanding = false;
+            }
+            else if (type == MQTT_PACKET_PUBLISH && size >= offset + 2) {
+                uint8_t qos = (this->buffer[0] >> 1) & 0x03;
+                uint16_t topicLength = (this->buffer[offset] << 8) | this->buffer[offset + 1];
+                uint32_t payloadAt = offset + 2 + topicLength + (qos > 0 ? 2 : 0);
+                if (this->truncated) this->oversized++;
+                // not even the packet id fits, nothing to answer
+                if (payloadAt > size) return;
+
+                uint16_t id = qos > 0 ? (this->buffer[payloadAt - 2] << 8) | this->buffer[payloadAt - 1] : 0;
+
+                // the topic moves one byte down over its length to end with a NUL
+                char *topic = reinterpret_cast<char*>(this->buffer + offset + 1);
+                memmove(topic, this->buffer + offset + 2, topicLength);
+                topic[topicLength] = '\0';
+
+                // a partial payload is never handed over, an oversized message is acknowledged and counted
+                if (this->callback && !this->truncated) this->callback(topic, this->buffer + payloadAt, size - payloadAt);
+
+                if (qos == 1) {
+                    uint8_t ack[4] = { MQTT_PACKET_PUBACK, 2, (uint8_t)(id >> 8), (uint8_t)(id & 0xFF) };
+                    this->write(ack, sizeof(ack));
+                }
+            }
+        }
+
+        // the window is kept for the next connect
+        void drop() {
+            this->client.stop();
+            this->online = false;
+        }
+
+    public:
+        MqttClient(Client &client) :
+            client(client)
+        {}
+
+        void setServer(const char *host, uint16_t port) {
+            this->host = host;
+            this->port = port;
+        }
+
+        // largest packet sent at QoS 0 or received, allocated once
+        bool setBufferSize(size_t size) {
+            if (size <= this->bufferSize) return true;
+
+            uint8_t *buffer = static_cast<uint8_t*>(realloc(this->buffer, size));
+            if (buffer == NULL) return false;
+            this->buffer = buffer;
+            this->bufferSize = size;
+            return true;
+        }
+
+        void setSocketTimeout(uint16_t seconds) {
+            this->socketTimeout = seconds * 1000UL;
+        }
+
+        void setCallback(MQTT_CALLBACK callback) {
+            this->callback = callback;
+        }
+
+        // empty user or password are left out of the CONNECT
+        bool connect(const char *id, const char *user, const char *pass) {
+            if (this->buffer == NULL && !this->setBufferSize(256)) return false;
+            if (this->client.connected()) this->client.stop();
+            if (!this->client.connect(this->host.c_str(), this->port)) return false;
+
+            bool hasUser = user != NULL && user[0] != '\0';
+            bool hasPass = hasUser && pass != NULL && pass[0] != '\0';
+            uint32_t remaining = 10 + 2 + strlen(id) + (hasUser ? 2 + strlen(user) : 0) + (hasPass ? 2 + strlen(pass) : 0);
+            if (packetSize(remaining) > this->bufferSize) {
+                this->client.stop();
+                return false;
+            }
+
+            uint8_t flags = MQTT_PERSISTENT_SESSION ? 0x00 : 0x02;
+            if (hasUser) flags |= 0x80;
+            if (hasPass) flags |= 0x40;
+
+            uint32_t size = 0;
+            this->buffer[size++] = MQTT_PACKET_CONNECT;
+            size += encodeLength(this->buffer + size, remaining);
+            size += writeString(this->buffer + size, "MQTT");
+            this->buffer[size++] = 4;
+            this->buffer[size++] = flags;
+            this->buffer[size++] = MQTT_KEEPALIVE >> 8;
+            this->buffer[size++] = MQTT_KEEPALIVE & 0xFF;
+            size += writeString(this->buffer + size, id);
+            if (hasUser) size += writeString(this->buffer + size, user);
+            if (hasPass) size += writeString(this->buffer + size, pass);
+
+            this->online = true;
+            if (!this->write(this->buffer, size)) return false;
+
+            // CONNACK: session present flag, then the return code
+            uint32_t length = this->readPacket();
+            if (length < 4 || (this->buffer[0] & 0xF0) != MQTT_PACKET_CONNACK || this->buffer[3] != 0) {
+                this->drop();
+                return false;
+            }
+            this->sessionPresent = this->buffer[2] & 0x01;
+            this->pingOutstanding = false;
+            this->lastIn = millis();
+
+            this->retransmit();
+            return this->online;
+        }
+
+        void disconnect() {
+            if (this->online) {
+                uint8_t packet[2] = { MQTT_PACKET_DISCONNECT, 0 };
+                this->client.write(packet, sizeof(packet));
+            }
+            this->drop();
+        }
+
+        bool connected() {
+            if (this->online && !this->client.connected()) this->drop();
+            return this->online;
+        }
+
+        // reads every pending packet, keeps the connection alive and drops a
+        // connection whose broker stopped acknowledging
+        bool loop() {
+            if (!this->connected()) return false;
+
+            unsigned long now = millis();
+            if (now - this->lastIn > MQTT_KEEPALIVE * 1000UL || now - this->lastOut > MQTT_KEEPALIVE * 1000UL) {
+                if (this->pingOutstanding) {
+                    this->drop();
+                    return false;
+                }
+                uint8_t ping[2] = { MQTT_PACKET_PINGREQ, 0 };
+                if (!this->write(ping, sizeof(ping))) return false;
+                this->pingOutstanding = true;
+                this->lastIn = now;
+            }
+
+            if (this->count > 0 && !this->window[this->head].acked && now - this->window[this->head].sentAt > MQTT_ACK_TIMEOUT) {
+                this->drop();
+                return false;
+            }
+
+            while (this->online && this->client.available()) {
+                uint32_t size = this->readPacket();
+                if (size == 0) {
+                    this->drop();
+                    return false;
+                }
+                this->handlePacket(size);
+            }
+            return this->online;
+        }
+
+        bool publish(const char *topic, const uint8_t *payload, size_t length) {
+            return this->publish(topic, payload, length, 0);
+        }
+
+        // QoS 0 is written from the buffer, QoS 1 goes through the window.
+        // False when offline or the window is full, the message was not taken
+        bool publish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos) {
+            if (!this->connected()) return false;
+
+            uint32_t size = packetSize(publishRemaining(topic, length, qos));
+            if (qos == 0) {
+                if (size > this->bufferSize) return false;
+                return this->write(this->buffer, packPublish(this->buffer, topic, payload, length, 0, 0));
+            }
+
+            int32_t offset = this->reserve(size);
+            if (offset < 0) {
+                this->refused++;
+                return false;
+            }
+
+            MQTT_INFLIGHT &entry = this->window[(this->head + this->count) % MQTT_INFLIGHT_MESSAGES];
+            entry.id = this->allocateId();
+            entry.offset = offset;
+            entry.length = packPublish(this->store + offset, topic, payload, length, 1, entry.id);
+            entry.sentAt = millis();
+            entry.acked = false;
+            this->count++;
+            this->tail = offset + entry.length;
+
+            // a failed write is retried on the next connect, the message is taken either way
+            this->write(this->store + offset, entry.length);
+            return true;
+        }
+
+        bool subscribe(const char *topic, uint8_t qos = 0) {
+            if (!this->connected()) return false;
+
+            uint32_t remaining = 2 + 2 + strlen(topic) + 1;
+            if (packetSize(remaining) > this->bufferSize) return false;
+
+            uint16_t id = this->allocateId();
+            uint32_t size = 0;
+            this->buffer[size++] = MQTT_PACKET_SUBSCRIBE;
+            size += encodeLength(this->buffer + size, remaining);
+            this->buffer[size++] = id >> 8;
+            this->buffer[size++] = id & 0xFF;
+            size += writeString(this->buffer + size, topic);
+            this->buffer[size++] = qos;
+            return this->write(this->buffer, size);
+        }
+
+        bool unsubscribe(const char *topic) {
+            if (!this->connected()) return false;
+
+            uint32_t remaining = 2 + 2 + strlen(topic);
+            if (packetSize(remaining) > this->bufferSize) return false;
+
+            uint16_t id = this->allocateId();
+            uint32_t size = 0;
+            this->buffer[size++] = MQTT_PACKET_UNSUBSCRIBE;
+            size += encodeLength(this->buffer + size, remaining);
+            this->buffer[size++] = id >> 8;
+            this->buffer[size++] = id & 0xFF;
+            size += writeString(this->buffer + size, topic);
+            return this->write(this->buffer, size);
+        }
+
+        // QoS 1 packets not yet acknowledged
+        uint8_t getInflight() {
+            uint8_t pending = 0;
+            for (uint8_t i = 0; i < this->count; i++) {
+                if (!this->window[(this->head + i) % MQTT_INFLIGHT_MESSAGES].acked) pending++;
+            }
+            return pending;
+        }
+
+        uint32_t getAcked() {
+            return this->acked;
+        }
+
+        uint32_t getRetransmits() {
+            return this->retransmits;
+        }
+
+        // QoS 1 publishes refused by a full window
+        uint32_t getRefused() {
+            return this->refused;
+        }
+
+        // inbound messages larger than the buffer, dropped
+        uint32_t getOversized() {
+            return this->oversized;
+        }
+
+        bool isSessionPresent() {
+            return this->sessionPresent;
+        }
+};
+
+#endif
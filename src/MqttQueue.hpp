@@ -0,0 +1,145 @@
+#ifndef MQTT_QUEUE
+#define MQTT_QUEUE
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_timer.h"
+
+#include "Telemetry.hpp"
+#include "DeviceProtocol.hpp"
+
+// Bounded lock-free queue for many producers and one consumer. Every cell
+// carries a sequence number that tells producers whether it is free and the
+// consumer whether it is filled, so a push is a single compare-and-swap on
+// the enqueue position plus a copy, whatever task or core it runs on.
+template <typename T, size_t SIZE>
+class MpscQueue {
+    static_assert((SIZE & (SIZE - 1)) == 0, "queue size must be a power of two");
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        Cell cells[SIZE];
+        std::atomic<size_t> enqueuePos{0};
+        size_t dequeuePos = 0;
+
+    public:
+        MpscQueue() {
+            for (size_t i = 0; i < SIZE; i++) {
+                this->cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        // returns false when the queue is full
+        bool push(const T &data) {
+            Cell *cell;
+            size_t pos = this->enqueuePos.load(std::memory_order_relaxed);
+
+            while (true) {
+                cell = &this->cells[pos & (SIZE - 1)];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+                if (diff == 0) {
+                    if (this->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+                }
+                else if (diff < 0) {
+                    return false;
+                }
+                else {
+                    pos = this->enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->data = data;
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer side, only ever called from the owner task
+        bool pop(T &data) {
+            Cell *cell = &this->cells[this->dequeuePos & (SIZE - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+
+            if ((intptr_t)sequence - (intptr_t)(this->dequeuePos + 1) < 0) return false;
+
+            data = cell->data;
+            cell->sequence.store(this->dequeuePos + SIZE, std::memory_order_release);
+            this->dequeuePos++;
+            return true;
+        }
+};
+
+#define MQTT_COMMAND_SAMPLE 0
+#define MQTT_COMMAND_RAW 1
+
+#define MQTT_PRIORITY_HIGH 0
+#define MQTT_PRIORITY_NORMAL 1
+
+#define MQTT_RAW_PAYLOAD_SIZE 192
+
+// Work handed to the MQTT owner task. Samples are captured by the producer
+// and encoded by the owner, raw payloads are published to <topic>/<subtopic>.
+struct MQTT_COMMAND {
+    uint8_t type;
+    bool keyframe;
+    TELEMETRY_SAMPLE sample;
+    char subtopic[MQTT_SUBTOPIC_SIZE];
+    uint16_t length;
+    uint8_t payload[MQTT_RAW_PAYLOAD_SIZE];
+
+    MQTT_COMMAND() :
+        type(MQTT_COMMAND_SAMPLE),
+        keyframe(false),
+        subtopic(""),
+        length(0)
+    {}
+};
+
+// Outbound commands in two priorities, on-demand requests and replies are
+// drained before the periodic telemetry.
+class MqttOutbound {
+    private:
+        MpscQueue<MQTT_COMMAND, MQTT_QUEUE_HIGH> high;
+        MpscQueue<MQTT_COMMAND, MQTT_QUEUE_NORMAL> normal;
+
+        std::atomic<uint32_t> enqueued{0};
+        std::atomic<uint32_t> dropped{0};
+        std::atomic<uint32_t> maxPushUs{0};
+
+    public:
+        bool push(const MQTT_COMMAND &command, uint8_t priority) {
+            int64_t startedAt = esp_timer_get_time();
+            bool ok = priority == MQTT_PRIORITY_HIGH ? this->high.push(command) : this->normal.push(command);
+            uint32_t elapsed = esp_timer_get_time() - startedAt;
+
+            uint32_t max = this->maxPushUs.load(std::memory_order_relaxed);
+            while (elapsed > max && !this->maxPushUs.compare_exchange_weak(max, elapsed, std::memory_order_relaxed));
+
+            if (ok) this->enqueued.fetch_add(1, std::memory_order_relaxed);
+            else this->dropped.fetch_add(1, std::memory_order_relaxed);
+            return ok;
+        }
+
+        bool pop(MQTT_COMMAND &command) {
+            return this->high.pop(command) || this->normal.pop(command);
+        }
+
+        uint32_t getEnqueued() const {
+            return this->enqueued.load(std::memory_order_relaxed);
+        }
+
+        uint32_t getDropped() const {
+            return this->dropped.load(std::memory_order_relaxed);
+        }
+
+        // worst time a producer spent enqueueing, in microseconds
+        uint32_t getMaxPushUs() const {
+            return this->maxPushUs.load(std::memory_order_relaxed);
+        }
+};
+
+#endif
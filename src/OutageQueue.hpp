@@ -0,0 +1,241 @@
+#ifndef OUTAGE_QUEUE
+#define OUTAGE_QUEUE
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "esp_rom_crc.h"
+
+#include "Telemetry.hpp"
+
+#define OUTBOX_PATH "/outbox.bin"
+#define OUTBOX_MAGIC 0x3158424F
+// bumped when the meaning of the sample fields changes, their size is checked apart
+#define OUTBOX_VERSION 2
+
+// first bytes of the segment, a segment written by another firmware is discarded.
+// read is the number of records already replayed, rewritten after every batch
+struct __attribute__((packed)) OUTBOX_HEADER {
+    uint32_t magic;
+    uint16_t sampleSize;
+    uint16_t version;
+    uint32_t read;
+};
+
+// one sample on flash, the CRC covers the sample bytes
+struct OUTBOX_RECORD {
+    TELEMETRY_SAMPLE sample;
+    uint32_t crc;
+};
+
+// samples the segment holds within its byte budget
+#define OUTBOX_FILE_SAMPLES ((OUTBOX_FILE_BYTES - sizeof(OUTBOX_HEADER)) / sizeof(OUTBOX_RECORD))
+static_assert(sizeof(OUTBOX_HEADER) + OUTBOX_FILE_SAMPLES * sizeof(OUTBOX_RECORD) <= FS_PARTITION_SIZE * OUTBOX_FS_SHARE / 100,
+    "the outbox segment does not fit its share of the filesystem");
+
+// Keeps the samples taken while the broker is unreachable. New samples go
+// to a RAM ring, which is spilled in one append to a LittleFS segment once
+// it holds OUTBOX_SPILL_SAMPLES or its oldest sample is OUTBOX_SPILL_INTERVAL
+// old, so a power cut loses no more than that. Both are replayed oldest
+// first, a few samples at a time, once the connection is back, and the
+// position in the segment is kept in its header so a reboot resumes where
+// the replay stopped. Samples that do not fit either cap are counted, and
+// so are records that fail their CRC on the way back.
+class OutageQueue {
+    private:
+        TELEMETRY_SAMPLE ring[OUTBOX_RAM_SAMPLES];
+        uint16_t head = 0;
+        uint16_t count = 0;
+        // millis() of the oldest sample in the ring
+        unsigned long ringSince = 0;
+
+        // samples in the segment file and how many of them were replayed
+        uint32_t fileCount = 0;
+        uint32_t fileRead = 0;
+        // OUTBOX_FILE_SAMPLES, or less on a filesystem smaller than the partition
+        uint32_t fileCap = OUTBOX_FILE_SAMPLES;
+
+        uint32_t dropped = 0;
+        uint32_t replayed = 0;
+
+        unsigned long nextReplay = 0;
+
+        static size_t recordOffset(uint32_t index) {
+            return sizeof(OUTBOX_HEADER) + index * sizeof(OUTBOX_RECORD);
+        }
+
+        static uint32_t sampleCrc(const TELEMETRY_SAMPLE &sample) {
+            return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&sample), sizeof(TELEMETRY_SAMPLE));
+        }
+
+        // a new segment starts with its header, later spills write over a
+        // record torn by a power cut instead of appending behind it
+        bool spill() {
+            if (this->fileCount >= this->fileCap) return false;
+            uint32_t room = this->fileCap - this->fileCount;
+
+            File file = LittleFS.open(OUTBOX_PATH, this->fileCount == 0 ? "w" : "r+");
+            if (!file) return false;
+
+            if (this->fileCount == 0) {
+                OUTBOX_HEADER header = { OUTBOX_MAGIC, sizeof(TELEMETRY_SAMPLE), OUTBOX_VERSION, 0 };
+                if (file.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header)) != sizeof(header)) {
+                    file.close();
+                    return false;
+                }
+            }
+            else if (!file.seek(recordOffset(this->fileCount))) {
+                file.close();
+                return false;
+            }
+
+            uint32_t moved = 0;
+            while (this->count > 0 && moved < room) {
+                OUTBOX_RECORD record;
+                record.sample = this->ring[this->head];
+                record.crc = sampleCrc(record.sample);
+                if (file.write(reinterpret_cast<const uint8_t*>(&record), sizeof(record)) != sizeof(record)) break;
+
+                this->head = (this->head + 1) % OUTBOX_RAM_SAMPLES;
+                this->count--;
+                moved++;
+            }
+            file.close();
+
+            this->fileCount += moved;
+            this->ringSince = millis();
+            return moved > 0;
+        }
+
+        // the replay position in the header, a reboot resumes from it
+        void saveRead() {
+            File file = LittleFS.open(OUTBOX_PATH, "r+");
+            if (!file) return;
+
+            uint32_t read = this->fileRead;
+            if (file.seek(offsetof(OUTBOX_HEADER, read))) file.write(reinterpret_cast<const uint8_t*>(&read), sizeof(read));
+            file.close();
+        }
+
+        bool readFile(File &file, OUTBOX_RECORD &record) {
+            if (!file) file = LittleFS.open(OUTBOX_PATH, "r");
+            if (!file || !file.seek(recordOffset(this->fileRead))) return false;
+
+            return file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record);
+        }
+
+    public:
+        // pick up a backlog left in flash by a previous boot from where its
+        // replay stopped, a segment of another layout is removed and a torn
+        // last record left out
+        void begin() {
+            size_t share = LittleFS.totalBytes() * OUTBOX_FS_SHARE / 100;
+            this->fileCap = share > sizeof(OUTBOX_HEADER) ?
+                min((share - sizeof(OUTBOX_HEADER)) / sizeof(OUTBOX_RECORD), (size_t)OUTBOX_FILE_SAMPLES) : 0;
+
+            File file = LittleFS.open(OUTBOX_PATH, "r");
+            if (!file) return;
+
+            OUTBOX_HEADER header;
+            bool valid = file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) == sizeof(header) &&
+                header.magic == OUTBOX_MAGIC &&
+                header.sampleSize == sizeof(TELEMETRY_SAMPLE) &&
+                header.version == OUTBOX_VERSION;
+            size_t size = file.size();
+            file.close();
+
+            if (!valid) {
+                LittleFS.remove(OUTBOX_PATH);
+                return;
+            }
+            this->fileCount = min((size - sizeof(OUTBOX_HEADER)) / sizeof(OUTBOX_RECORD), (size_t)this->fileCap);
+            this->fileRead = min(header.read, this->fileCount);
+        }
+
+        void push(const TELEMETRY_SAMPLE &sample) {
+            if (this->count == OUTBOX_RAM_SAMPLES && !this->spill()) {
+                this->dropped++;
+                return;
+            }
+
+            if (this->count == 0) this->ringSince = millis();
+            this->ring[(this->head + this->count) % OUTBOX_RAM_SAMPLES] = sample;
+            this->count++;
+
+            if (this->count >= OUTBOX_SPILL_SAMPLES || millis() - this->ringSince >= OUTBOX_SPILL_INTERVAL) this->spill();
+        }
+
+        bool isEmpty() const {
+            return this->count == 0 && this->fileRead >= this->fileCount;
+        }
+
+        // spread the replay of a fleet-wide reconnect over the jitter window
+        void onConnected() {
+            this->nextReplay = millis() + random(OUTBOX_REPLAY_JITTER + 1);
+        }
+
+        // sends at most one batch per call when it is due, publish returns false to stop
+        template <typename Publish>
+        void replay(Publish publish) {
+            if (this->isEmpty() || (long)(millis() - this->nextReplay) < 0) return;
+
+            File file;
+            uint32_t fileRead = this->fileRead;
+            for (uint16_t sent = 0; sent < OUTBOX_REPLAY_BATCH && !this->isEmpty(); sent++) {
+                TELEMETRY_SAMPLE sample;
+                bool fromFile = this->fileRead < this->fileCount;
+
+                if (fromFile) {
+                    OUTBOX_RECORD record;
+                    if (!this->readFile(file, record)) {
+                        // unreadable backlog, give up on the file
+                        this->dropped += this->fileCount - this->fileRead;
+                        this->fileRead = this->fileCount;
+                        continue;
+                    }
+                    if (record.crc != sampleCrc(record.sample)) {
+                        // corrupted on flash, skip it
+                        this->dropped++;
+                        this->fileRead++;
+                        continue;
+                    }
+                    sample = record.sample;
+                }
+                else {
+                    sample = this->ring[this->head];
+                }
+
+                if (!publish(sample)) break;
+
+                if (fromFile) this->fileRead++;
+                else {
+                    this->head = (this->head + 1) % OUTBOX_RAM_SAMPLES;
+                    this->count--;
+                }
+                this->replayed++;
+            }
+            if (file) file.close();
+
+            if (this->fileCount > 0 && this->fileRead >= this->fileCount) {
+                LittleFS.remove(OUTBOX_PATH);
+                this->fileCount = 0;
+                this->fileRead = 0;
+            }
+            else if (this->fileRead != fileRead) this->saveRead();
+
+            this->nextReplay = millis() + OUTBOX_REPLAY_INTERVAL;
+        }
+
+        uint32_t getPending() const {
+            return this->count + (this->fileCount - this->fileRead);
+        }
+
+        uint32_t getDropped() const {
+            return this->dropped;
+        }
+
+        uint32_t getReplayed() const {
+            return this->replayed;
+        }
+};
+
+#endif
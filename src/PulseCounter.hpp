@@ -0,0 +1,193 @@
+#ifndef PULSE_COUNTER
+#define PULSE_COUNTER
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_timer.h"
+
+#include "DemandMeter.hpp"
+
+// channels of one device at most, their levels fit a byte
+#define PULSE_MAX_CHANNELS 8
+// edge timestamps buffered between two drains, a power of two
+#define PULSE_STAMP_RING 64
+
+// one metered input: pin, edge (RISING, FALLING or CHANGE), debounce window
+// in microseconds and the journal slot its total is persisted in
+struct PULSE_CHANNEL {
+    uint8_t pin;
+    int edge;
+    uint32_t debounceUs;
+    uint8_t slot;
+};
+
+// every slot is below the channel count and used once, checked at compile time
+constexpr bool pulseSlotUsed(const PULSE_CHANNEL *table, size_t count, uint8_t slot, size_t i) {
+    return i < count && (table[i].slot == slot || pulseSlotUsed(table, count, slot, i + 1));
+}
+
+constexpr bool pulseSlotsValid(const PULSE_CHANNEL *table, size_t count, size_t i = 0) {
+    return i == count || (table[i].slot < count && !pulseSlotUsed(table, count, table[i].slot, i + 1) &&
+        pulseSlotsValid(table, count, i + 1));
+}
+
+// Counts every edge of an input directly in the ISR. The ISR only bumps an
+// atomic pending counter, a task drains it into the 64-bit total, so no
+// pulse is lost while the total is being persisted. Each channel has its
+// own counter and ISR argument, an edge costs the same with 1 or 8 inputs.
+// The ISR also stores the esp_timer time of the edge in a single-producer
+// ring, the drain feeds the stamps to the demand meter, and the pulses of a
+// full ring without their stamps.
+class PulseCounter {
+    private:
+        uint8_t pin = 0;
+        int edge = RISING;
+        uint32_t debounceUs = 0;
+
+        std::atomic<uint32_t> pending{0};
+        std::atomic<uint32_t> rejected{0};
+        volatile int64_t lastEdgeUs = 0;
+
+        // written by the ISR at head, read by the drain at tail
+        int64_t stamps[PULSE_STAMP_RING];
+        std::atomic<uint32_t> stampHead{0};
+        std::atomic<uint32_t> stampTail{0};
+        // pulses counted without a stamp, the ring was full
+        std::atomic<uint32_t> unstamped{0};
+
+        // woken by the first pulse after a drain
+        TaskHandle_t listener = NULL;
+
+        // 64-bit values are not atomic on the ESP32, guard them between tasks
+        mutable portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+        uint64_t total = 0;
+        uint64_t persisted = 0;
+
+        // drains come from the counter, restart and web tasks, one at a time.
+        // The stamp tail and the demand are theirs, interrupts stay enabled
+        SemaphoreHandle_t drainLock = xSemaphoreCreateMutex();
+        DemandMeter demand;
+        // unstamped pulses already in the demand
+        uint32_t unstampedDrained = 0;
+
+        static void IRAM_ATTR onEdge(void *arg) {
+            PulseCounter *self = static_cast<PulseCounter*>(arg);
+            int64_t now = esp_timer_get_time();
+
+            // edges closer than the debounce window are contact bounce
+            if (self->debounceUs != 0 && now - self->lastEdgeUs < self->debounceUs) {
+                self->rejected.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            self->lastEdgeUs = now;
+
+            uint32_t head = self->stampHead.load(std::memory_order_relaxed);
+            if (head - self->stampTail.load(std::memory_order_acquire) < PULSE_STAMP_RING) {
+                self->stamps[head & (PULSE_STAMP_RING - 1)] = now;
+                self->stampHead.store(head + 1, std::memory_order_release);
+            }
+            else {
+                self->unstamped.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            if (self->pending.fetch_add(1, std::memory_order_relaxed) == 0 && self->listener != NULL) {
+                BaseType_t woken = pdFALSE;
+                vTaskNotifyGiveFromISR(self->listener, &woken);
+                if (woken) portYIELD_FROM_ISR();
+            }
+        }
+
+    public:
+        // total is the value recovered from persistent storage
+        void begin(const PULSE_CHANNEL &channel, uint64_t total) {
+            this->pin = channel.pin;
+            this->edge = channel.edge;
+            this->debounceUs = channel.debounceUs;
+
+            this->total = total;
+            this->persisted = total;
+
+            pinMode(this->pin, INPUT);
+            attachInterruptArg(digitalPinToInterrupt(this->pin), PulseCounter::onEdge, this, this->edge);
+        }
+
+        void setListener(TaskHandle_t listener) {
+            this->listener = listener;
+        }
+
+        // move the pulses counted by the ISR into the total and their stamps
+        // into the demand, returns how many were moved
+        uint32_t drain() {
+            xSemaphoreTake(this->drainLock, portMAX_DELAY);
+
+            uint32_t count = this->pending.exchange(0, std::memory_order_acquire);
+            uint32_t head = this->stampHead.load(std::memory_order_acquire);
+            uint32_t tail = this->stampTail.load(std::memory_order_relaxed);
+
+            // copied out so the ISR gets the ring back before the demand is updated
+            int64_t stamps[PULSE_STAMP_RING];
+            uint32_t stamped = head - tail;
+            for (uint32_t i = 0; i < stamped; i++) stamps[i] = this->stamps[(tail + i) & (PULSE_STAMP_RING - 1)];
+            this->stampTail.store(head, std::memory_order_release);
+
+            portENTER_CRITICAL(&this->lock);
+            this->total += count;
+            portEXIT_CRITICAL(&this->lock);
+
+            // the pulses of a full ring count in the current bucket
+            uint32_t unstamped = this->unstamped.load(std::memory_order_relaxed);
+            for (uint32_t i = 0; i < stamped; i++) this->demand.add(stamps[i]);
+            this->demand.addUnstamped(unstamped - this->unstampedDrained, esp_timer_get_time());
+            this->unstampedDrained = unstamped;
+
+            xSemaphoreGive(this->drainLock);
+            return count;
+        }
+
+        // demand up to the last drain, pulses per hour
+        PULSE_DEMAND getDemand() {
+            xSemaphoreTake(this->drainLock, portMAX_DELAY);
+            PULSE_DEMAND value = this->demand.get(esp_timer_get_time());
+            xSemaphoreGive(this->drainLock);
+            return value;
+        }
+
+        // pulses seen so far, including the ones not drained yet
+        uint64_t getSeen() const {
+            return this->getTotal() + this->pending.load(std::memory_order_relaxed);
+        }
+
+        uint64_t getTotal() const {
+            portENTER_CRITICAL(&this->lock);
+            uint64_t value = this->total;
+            portEXIT_CRITICAL(&this->lock);
+            return value;
+        }
+
+        uint64_t getPersisted() const {
+            portENTER_CRITICAL(&this->lock);
+            uint64_t value = this->persisted;
+            portEXIT_CRITICAL(&this->lock);
+            return value;
+        }
+
+        void markPersisted(uint64_t value) {
+            portENTER_CRITICAL(&this->lock);
+            this->persisted = value;
+            portEXIT_CRITICAL(&this->lock);
+        }
+
+        uint8_t getPin() const {
+            return this->pin;
+        }
+
+        uint32_t getRejected() const {
+            return this->rejected.load(std::memory_order_relaxed);
+        }
+
+        uint32_t getUnstamped() const {
+            return this->unstamped.load(std::memory_order_relaxed);
+        }
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef STATUS_CACHE
+#define STATUS_CACHE
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <functional>
+#include <memory>
+
+// Pre-serialized body of the /data endpoint. The config is copied in only
+// after it is written and the body is rebuilt only when the status
+// fingerprint moves, every other request is served from the buffer or
+// answered with 304 when the client already holds the current ETag. A
+// response shares the buffer instead of copying it, a rebuild makes a new
+// one and the responses still sending the old one keep it alive.
+class StatusCache {
+    private:
+        SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+
+        JsonDocument config;
+        volatile uint32_t configVersion = 1;
+        uint32_t builtConfigVersion = 0;
+        uint32_t builtFingerprint = 0;
+
+        // versions restart on every boot, the boot id keeps old ETags from matching
+        uint32_t boot = esp_random();
+        uint32_t version = 0;
+        std::shared_ptr<const String> body;
+        String etag;
+
+    public:
+        typedef std::function<void(JsonDocument&)> StatusBuilder;
+        typedef std::function<void(JsonDocument&)> ConfigSource;
+
+    private:
+        ConfigSource source;
+
+        void loadConfig() {
+            this->config.clear();
+            if (this->source) this->source(this->config);
+        }
+
+    public:
+        // fills the network and mqtt objects of the body
+        void setConfigSource(ConfigSource source) {
+            this->source = source;
+        }
+
+        // call after any config file is written
+        void invalidateConfig() {
+            this->configVersion++;
+        }
+
+        void send(AsyncWebServerRequest *request, uint32_t fingerprint, StatusBuilder build) {
+            xSemaphoreTake(this->lock, portMAX_DELAY);
+
+            uint32_t configVersion = this->configVersion;
+            bool configChanged = configVersion != this->builtConfigVersion;
+
+            if (configChanged || fingerprint != this->builtFingerprint || this->version == 0) {
+                if (configChanged) this->loadConfig();
+
+                JsonDocument doc;
+                if (!this->config["network"].isNull()) doc["network"] = this->config["network"];
+                if (!this->config["mqtt"].isNull()) doc["mqtt"] = this->config["mqtt"];
+                build(doc);
+
+                std::shared_ptr<String> body = std::make_shared<String>();
+                serializeJson(doc, *body);
+                this->body = body;
+
+                this->version++;
+                this->etag = "\"" + String(this->boot, HEX) + "-" + String(configVersion, HEX) + "-" + String(this->version, HEX) + "\"";
+                this->builtConfigVersion = configVersion;
+                this->builtFingerprint = fingerprint;
+            }
+
+            String etag = this->etag;
+            std::shared_ptr<const String> body = this->body;
+            bool notModified = request->hasHeader("If-None-Match") &&
+                request->getHeader("If-None-Match")->value() == etag;
+
+            AsyncWebServerResponse *response = notModified ?
+                request->beginResponse(304) :
+                request->beginResponse("application/json", body->length(), [body](uint8_t *buffer, size_t maxLen, size_t index) {
+                    size_t length = min(maxLen, body->length() - index);
+                    memcpy(buffer, body->c_str() + index, length);
+                    return length;
+                });
+
+            xSemaphoreGive(this->lock);
+
+            response->addHeader("ETag", etag);
+            response->addHeader("Cache-Control", "no-cache");
+            request->send(response);
+        }
+};
+
+#endif
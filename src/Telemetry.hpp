@@ -0,0 +1,456 @@
+#ifndef TELEMETRY
+#define TELEMETRY
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "TemperatureSampler.hpp"
+
+// sized for TELEMETRY_MAX_WINDOWS windows of TEMP_MAX_SENSORS sensors in JSON
+#define TELEMETRY_ARENA_SIZE 12288
+#define TELEMETRY_PAYLOAD_SIZE 4096
+// windows packed in one aggregated message at most
+#define TELEMETRY_MAX_WINDOWS 4
+
+// one temperature, always carried with the address of its sensor
+struct TELEMETRY_TEMP {
+    DeviceAddress rom;
+    float value;
+
+    TELEMETRY_TEMP() :
+        rom(),
+        value(0)
+    {}
+};
+
+struct TELEMETRY_SAMPLE {
+    unsigned long timestamp;
+    // UNIX time of the sample, 0 while the clock is not set, and the id of
+    // the boot that took it, which tells whose millis() timestamp is
+    uint32_t time;
+    uint32_t boot;
+    uint64_t counters[INPUT_CHANNEL_COUNT];
+    PULSE_DEMAND demands[INPUT_CHANNEL_COUNT];
+    // bit n is the level of channel n + 1
+    uint8_t levels;
+    int8_t rssi;
+    uint32_t ip;
+    uint8_t tempCount;
+    TELEMETRY_TEMP temps[TEMP_MAX_SENSORS];
+
+    TELEMETRY_SAMPLE() :
+        timestamp(0),
+        time(0),
+        boot(0),
+        counters(),
+        levels(0),
+        rssi(0),
+        ip(0),
+        tempCount(0)
+    {}
+};
+
+struct TELEMETRY_STAT {
+    float min;
+    float max;
+    float sum;
+    float last;
+    uint16_t count;
+
+    TELEMETRY_STAT() :
+        min(0),
+        max(0),
+        sum(0),
+        last(0),
+        count(0)
+    {}
+
+    void add(float value) {
+        if (this->count == 0 || value < this->min) this->min = value;
+        if (this->count == 0 || value > this->max) this->max = value;
+        this->sum += value;
+        this->last = value;
+        this->count++;
+    }
+
+    float mean() const {
+        return this->count ? this->sum / this->count : 0;
+    }
+};
+
+// statistics of the samples taken during one publish window
+struct TELEMETRY_WINDOW {
+    unsigned long start;
+    unsigned long end;
+    uint64_t counterStart[INPUT_CHANNEL_COUNT];
+    uint64_t counterEnd[INPUT_CHANNEL_COUNT];
+    TELEMETRY_STAT gpio;
+    TELEMETRY_STAT rssi;
+    TELEMETRY_STAT rate;
+    // instantaneous demand of channel 1, and its window and peak demand at the end
+    TELEMETRY_STAT demand;
+    PULSE_DEMAND demandEnd;
+    uint8_t tempCount;
+    DeviceAddress tempRoms[TEMP_MAX_SENSORS];
+    TELEMETRY_STAT temps[TEMP_MAX_SENSORS];
+
+    // statistics of the sensor, a slot is taken on its first sample
+    TELEMETRY_STAT *temp(const uint8_t *rom) {
+        for (uint8_t i = 0; i < this->tempCount; i++) {
+            if (memcmp(this->tempRoms[i], rom, sizeof(DeviceAddress)) == 0) return &this->temps[i];
+        }
+        if (this->tempCount == TEMP_MAX_SENSORS) return NULL;
+
+        memcpy(this->tempRoms[this->tempCount], rom, sizeof(DeviceAddress));
+        return &this->temps[this->tempCount++];
+    }
+
+    TELEMETRY_WINDOW() :
+        start(0),
+        end(0),
+        counterStart(),
+        counterEnd(),
+        tempCount(0)
+    {}
+};
+
+// Bump allocator over a fixed buffer for ArduinoJson. Everything is released
+// at once by reset(), only an exhausted arena falls back to the heap and that
+// is counted so the publish path can be checked for allocations.
+class TelemetryArena : public ArduinoJson::Allocator {
+    private:
+        struct Block {
+            size_t size;
+        };
+
+        alignas(8) uint8_t buffer[TELEMETRY_ARENA_SIZE];
+        size_t used = 0;
+        uint8_t *last = nullptr;
+
+        uint32_t heapAllocations = 0;
+
+        static size_t align(size_t size) {
+            return (size + 7) & ~(size_t)7;
+        }
+
+        bool owns(void *ptr) const {
+            return ptr >= this->buffer && ptr < this->buffer + TELEMETRY_ARENA_SIZE;
+        }
+
+        static size_t sizeOf(void *ptr) {
+            return reinterpret_cast<Block*>(static_cast<uint8_t*>(ptr) - align(sizeof(Block)))->size;
+        }
+
+    public:
+        void *allocate(size_t size) override {
+            size_t needed = align(sizeof(Block)) + align(size);
+            if (this->used + needed > TELEMETRY_ARENA_SIZE) {
+                this->heapAllocations++;
+                return malloc(size);
+            }
+
+            uint8_t *block = this->buffer + this->used;
+            reinterpret_cast<Block*>(block)->size = size;
+            this->used += needed;
+            this->last = block + align(sizeof(Block));
+            return this->last;
+        }
+
+        void deallocate(void *ptr) override {
+            if (!this->owns(ptr)) {
+                free(ptr);
+                return;
+            }
+            // only the newest block can be given back before reset()
+            if (ptr == this->last) {
+                this->used = static_cast<uint8_t*>(ptr) - align(sizeof(Block)) - this->buffer;
+                this->last = nullptr;
+            }
+        }
+
+        void *reallocate(void *ptr, size_t size) override {
+            if (ptr == nullptr) return this->allocate(size);
+
+            if (!this->owns(ptr)) {
+                this->heapAllocations++;
+                return realloc(ptr, size);
+            }
+
+            // the newest block grows or shrinks in place
+            if (ptr == this->last) {
+                size_t start = static_cast<uint8_t*>(ptr) - this->buffer;
+                if (start + align(size) <= TELEMETRY_ARENA_SIZE) {
+                    reinterpret_cast<Block*>(static_cast<uint8_t*>(ptr) - align(sizeof(Block)))->size = size;
+                    this->used = start + align(size);
+                    return ptr;
+                }
+            }
+
+            void *moved = this->allocate(size);
+            if (moved != nullptr) {
+                size_t old = sizeOf(ptr);
+                memcpy(moved, ptr, old < size ? old : size);
+            }
+            return moved;
+        }
+
+        void reset() {
+            this->used = 0;
+            this->last = nullptr;
+        }
+
+        uint32_t getHeapAllocations() const {
+            return this->heapAllocations;
+        }
+};
+
+#define TELEMETRY_JSON 0
+#define TELEMETRY_MSGPACK 1
+
+// Telemetry message, encoded as JSON or MessagePack with the same keys:
+//   id          string   clientId of the device
+//   slaves      [uint]   input channels reported
+//   timestamp   uint     millis() when the sample was taken
+//   time        uint     UNIX time of the sample, present once the clock is set
+//   boot        uint     id drawn at every boot, a timestamp is only comparable
+//                        with those of the same boot
+//   counter     uint64   pulses counted on channel 1 since installation
+//   GPIO        bool     current level of channel 1
+//   demand      float    channel 1 pulses per hour from the last pulse interval
+//   windowDemand float   channel 1 pulses per hour over the last DEMAND_WINDOW
+//   peakDemand  float    highest windowDemand since boot
+//   counters    [uint64] every channel, only with more than one channel
+//   levels      [bool]   every channel, only with more than one channel
+//   demands     [object] every channel, { demand, window, peak }, only with
+//                        more than one channel
+//   wifiQuality int      RSSI in dBm
+//   ip          string   station IP address
+//   sensors     [object] temperatures, each { id, alias, temp } where id is the
+//                        ROM address in hex, alias is present when configured
+//                        and temp is in Celsius
+//   delta       bool     present and true on delta frames
+// With a keyframe interval set, a keyframe carrying every field is sent every
+// N messages and the frames in between carry id, timestamp, delta and only
+// the fields that changed since the previous message.
+//
+// Aggregated message, sent instead when the sample rate is configured:
+//   id          string   clientId of the device
+//   slaves      [uint]   input channels reported
+//   windows     [object] oldest first, each one with
+//     start, end          millis() of the last sample of the previous window,
+//                         the one delta counts from, and of the last sample
+//     counter             pulses counted on channel 1 at the end of the window
+//     delta, rate         channel 1 pulses in the window and pulses per second
+//     counters, deltas    every channel, only with more than one channel
+//     windowDemand, peakDemand
+//                         channel 1 demand at the end of the window
+//     GPIO, wifiQuality, pulseRate, demand, sensors[].temp
+//                         { min, max, mean, last } over the window samples,
+//                         sensors[] also carry id and alias
+
+// Serializes telemetry samples into a preallocated payload buffer, the
+// document lives in the arena so a publish does not touch the heap.
+class TelemetryEncoder {
+    private:
+        TelemetryArena arena;
+        JsonDocument doc = JsonDocument(&this->arena);
+        char payload[TELEMETRY_PAYLOAD_SIZE];
+        size_t length = 0;
+
+        uint8_t format = TELEMETRY_JSON;
+        uint16_t keyframe = 0;
+        uint16_t sinceKeyframe = 0;
+        TELEMETRY_SAMPLE last;
+
+        uint32_t messages = 0;
+
+        // aliases by ROM address, owned by the caller
+        const TEMP_CONFIG *aliases = NULL;
+
+        static bool sameCounters(const TELEMETRY_SAMPLE &a, const TELEMETRY_SAMPLE &b) {
+            return memcmp(a.counters, b.counters, sizeof(a.counters)) == 0;
+        }
+
+        static bool sameDemands(const TELEMETRY_SAMPLE &a, const TELEMETRY_SAMPLE &b) {
+            return memcmp(a.demands, b.demands, sizeof(a.demands)) == 0;
+        }
+
+        static bool sameTemps(const TELEMETRY_SAMPLE &a, const TELEMETRY_SAMPLE &b) {
+            if (a.tempCount != b.tempCount) return false;
+            for (uint8_t i = 0; i < a.tempCount; i++) {
+                if (a.temps[i].value != b.temps[i].value) return false;
+                if (memcmp(a.temps[i].rom, b.temps[i].rom, sizeof(DeviceAddress)) != 0) return false;
+            }
+            return true;
+        }
+
+        JsonObject addSensor(JsonArray list, const uint8_t *rom) {
+            JsonObject sensor = list.add<JsonObject>();
+
+            char id[17];
+            formatRom(rom, id);
+            sensor["id"] = id;
+
+            const TEMP_SENSOR_CONFIG *config = this->aliases ? this->aliases->find(rom) : NULL;
+            if (config != NULL && config->alias[0] != '\0') sensor["alias"] = config->alias;
+            return sensor;
+        }
+
+        static void addStat(JsonObject object, const TELEMETRY_STAT &stat) {
+            object["min"] = stat.min;
+            object["max"] = stat.max;
+            object["mean"] = stat.mean();
+            object["last"] = stat.last;
+        }
+
+        void serialize() {
+            if (this->format == TELEMETRY_MSGPACK)
+                this->length = serializeMsgPack(this->doc, this->payload, sizeof(this->payload));
+            else
+                this->length = serializeJson(this->doc, this->payload, sizeof(this->payload));
+
+            this->messages++;
+        }
+
+    public:
+        // keyframe is the number of messages between full frames, 0 and 1 send full frames only
+        void setFormat(uint8_t format, uint16_t keyframe) {
+            this->format = format;
+            this->keyframe = keyframe;
+            this->sinceKeyframe = 0;
+        }
+
+        void setAliases(const TEMP_CONFIG *aliases) {
+            this->aliases = aliases;
+        }
+
+        // id is the configured clientId, forceKeyframe sends every field regardless of the delta mode
+        size_t encode(const char *id, const TELEMETRY_SAMPLE &sample, bool forceKeyframe = false) {
+            this->doc.clear();
+            this->arena.reset();
+
+            bool full = forceKeyframe || this->keyframe <= 1 || this->sinceKeyframe == 0;
+            this->sinceKeyframe = full ? 1 : (this->sinceKeyframe + 1) % this->keyframe;
+
+            this->doc["id"] = id;
+            this->doc["timestamp"] = sample.timestamp;
+            if (sample.time != 0) this->doc["time"] = sample.time;
+            if (!full) this->doc["delta"] = true;
+
+            if (full) {
+                this->doc["boot"] = sample.boot;
+                JsonArray slaves = this->doc["slaves"].to<JsonArray>();
+                for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) slaves.add(i + 1);
+            }
+            if (full || sample.counters[0] != this->last.counters[0]) this->doc["counter"] = sample.counters[0];
+            if (full || (sample.levels & 1) != (this->last.levels & 1)) this->doc["GPIO"] = (sample.levels & 1) != 0;
+            if (full || sample.demands[0].instant != this->last.demands[0].instant) this->doc["demand"] = sample.demands[0].instant;
+            if (full || sample.demands[0].window != this->last.demands[0].window) this->doc["windowDemand"] = sample.demands[0].window;
+            if (full || sample.demands[0].peak != this->last.demands[0].peak) this->doc["peakDemand"] = sample.demands[0].peak;
+
+            if (INPUT_CHANNEL_COUNT > 1 && (full || !sameCounters(sample, this->last))) {
+                JsonArray counters = this->doc["counters"].to<JsonArray>();
+                for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) counters.add(sample.counters[i]);
+            }
+            if (INPUT_CHANNEL_COUNT > 1 && (full || sample.levels != this->last.levels)) {
+                JsonArray levels = this->doc["levels"].to<JsonArray>();
+                for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) levels.add((sample.levels & (1 << i)) != 0);
+            }
+            if (INPUT_CHANNEL_COUNT > 1 && (full || !sameDemands(sample, this->last))) {
+                JsonArray demands = this->doc["demands"].to<JsonArray>();
+                for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+                    JsonObject demand = demands.add<JsonObject>();
+                    demand["demand"] = sample.demands[i].instant;
+                    demand["window"] = sample.demands[i].window;
+                    demand["peak"] = sample.demands[i].peak;
+                }
+            }
+            if (full || sample.rssi != this->last.rssi) this->doc["wifiQuality"] = sample.rssi;
+
+            if (full || sample.ip != this->last.ip) {
+                char ip[16];
+                snprintf(ip, sizeof(ip), "%u.%u.%u.%u",
+                    (unsigned)(sample.ip & 0xFF), (unsigned)((sample.ip >> 8) & 0xFF),
+                    (unsigned)((sample.ip >> 16) & 0xFF), (unsigned)(sample.ip >> 24));
+                this->doc["ip"] = ip;
+            }
+
+            if (full || !sameTemps(sample, this->last)) {
+                JsonArray sensors = this->doc["sensors"].to<JsonArray>();
+                for (uint8_t i = 0; i < sample.tempCount; i++) {
+                    this->addSensor(sensors, sample.temps[i].rom)["temp"] = sample.temps[i].value;
+                }
+            }
+
+            this->serialize();
+            this->last = sample;
+            return this->length;
+        }
+
+        size_t encodeWindows(const char *id, const TELEMETRY_WINDOW *windows, uint8_t count) {
+            this->doc.clear();
+            this->arena.reset();
+
+            this->doc["id"] = id;
+            JsonArray slaves = this->doc["slaves"].to<JsonArray>();
+            for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) slaves.add(i + 1);
+
+            JsonArray list = this->doc["windows"].to<JsonArray>();
+            for (uint8_t i = 0; i < count; i++) {
+                const TELEMETRY_WINDOW &window = windows[i];
+                JsonObject item = list.add<JsonObject>();
+
+                item["start"] = window.start;
+                item["end"] = window.end;
+                item["counter"] = window.counterEnd[0];
+
+                uint64_t delta = window.counterEnd[0] - window.counterStart[0];
+                unsigned long duration = window.end - window.start;
+                item["delta"] = delta;
+                item["rate"] = duration ? delta * 1000.0f / duration : 0.0f;
+                item["windowDemand"] = window.demandEnd.window;
+                item["peakDemand"] = window.demandEnd.peak;
+
+                if (INPUT_CHANNEL_COUNT > 1) {
+                    JsonArray counters = item["counters"].to<JsonArray>();
+                    JsonArray deltas = item["deltas"].to<JsonArray>();
+                    for (uint8_t c = 0; c < INPUT_CHANNEL_COUNT; c++) {
+                        counters.add(window.counterEnd[c]);
+                        deltas.add(window.counterEnd[c] - window.counterStart[c]);
+                    }
+                }
+
+                addStat(item["GPIO"].to<JsonObject>(), window.gpio);
+                addStat(item["wifiQuality"].to<JsonObject>(), window.rssi);
+                addStat(item["pulseRate"].to<JsonObject>(), window.rate);
+                addStat(item["demand"].to<JsonObject>(), window.demand);
+
+                JsonArray sensors = item["sensors"].to<JsonArray>();
+                for (uint8_t t = 0; t < window.tempCount; t++) {
+                    addStat(this->addSensor(sensors, window.tempRoms[t])["temp"].to<JsonObject>(), window.temps[t]);
+                }
+            }
+
+            this->serialize();
+            return this->length;
+        }
+
+        const uint8_t *getPayload() const {
+            return reinterpret_cast<const uint8_t*>(this->payload);
+        }
+
+        size_t getLength() const {
+            return this->length;
+        }
+
+        uint32_t getMessages() const {
+            return this->messages;
+        }
+
+        // heap allocations made by the encoder since boot, stays 0 when the arena is large enough
+        uint32_t getHeapAllocations() const {
+            return this->arena.getHeapAllocations();
+        }
+};
+
+#endif
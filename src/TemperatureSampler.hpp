@@ -0,0 +1,295 @@
+#ifndef TEMPERATURE_SAMPLER
+#define TEMPERATURE_SAMPLER
+
+#include <Arduino.h>
+#include <DallasTemperature.h>
+#include <OneWire.h>
+#include "esp_task_wdt.h"
+
+#include "DeviceSettings.hpp"
+
+#define TEMP_ALIAS_SIZE 24
+#define TEMP_DEFAULT_RESOLUTION 12
+
+// per-sensor settings, keyed by ROM address
+struct TEMP_SENSOR_CONFIG {
+    DeviceAddress rom;
+    char alias[TEMP_ALIAS_SIZE];
+    uint8_t resolution;
+
+    TEMP_SENSOR_CONFIG() :
+        rom(),
+        alias(""),
+        resolution(TEMP_DEFAULT_RESOLUTION)
+    {}
+};
+
+struct TEMP_CONFIG {
+    uint8_t count;
+    TEMP_SENSOR_CONFIG sensors[TEMP_MAX_SENSORS];
+
+    TEMP_CONFIG() :
+        count(0)
+    {}
+
+    const TEMP_SENSOR_CONFIG *find(const uint8_t *rom) const {
+        for (uint8_t i = 0; i < this->count; i++) {
+            if (memcmp(this->sensors[i].rom, rom, sizeof(DeviceAddress)) == 0) return &this->sensors[i];
+        }
+        return NULL;
+    }
+};
+
+// ROM address as 16 lowercase hex digits, the id used in payloads and config
+inline void formatRom(const uint8_t *rom, char *text) {
+    for (uint8_t i = 0; i < sizeof(DeviceAddress); i++) {
+        snprintf(text + i * 2, 3, "%02x", rom[i]);
+    }
+}
+
+inline bool parseRom(const char *text, uint8_t *rom) {
+    if (text == NULL || strlen(text) != sizeof(DeviceAddress) * 2) return false;
+    if (strspn(text, "0123456789abcdefABCDEF") != sizeof(DeviceAddress) * 2) return false;
+
+    for (uint8_t i = 0; i < sizeof(DeviceAddress); i++) {
+        char hex[3] = { text[i * 2], text[i * 2 + 1], '\0' };
+        rom[i] = strtoul(hex, NULL, 16);
+    }
+    return true;
+}
+
+struct TEMP_READING {
+    DeviceAddress rom;
+    char alias[TEMP_ALIAS_SIZE];
+    uint8_t bus;
+    uint8_t resolution;
+    // false while the sensor is missing from the last enumeration
+    bool present;
+    float value;
+    unsigned long updatedAt;
+    uint32_t errors;
+    bool valid;
+
+    TEMP_READING() :
+        rom(),
+        alias(""),
+        bus(0),
+        resolution(TEMP_DEFAULT_RESOLUTION),
+        present(false),
+        value(DEVICE_DISCONNECTED_C),
+        updatedAt(0),
+        errors(0),
+        valid(false)
+    {}
+};
+
+struct TEMP_SNAPSHOT {
+    uint8_t count;
+    unsigned long timestamp;
+    TEMP_READING readings[TEMP_MAX_SENSORS];
+
+    TEMP_SNAPSHOT() :
+        count(0),
+        timestamp(0)
+    {}
+};
+
+// Owns the OneWire buses listed in TEMP_BUSES. A background task starts the
+// conversions on every bus at once, sleeps for the slowest resolution in use
+// and reads each sensor by address, so buses convert in parallel and the
+// MQTT and HTTP paths never touch a bus. A sensor keeps its slot for the
+// whole boot, readings are identified by ROM address, never by position.
+class TemperatureSampler {
+    private:
+        OneWire wires[TEMP_BUS_COUNT];
+        DallasTemperature buses[TEMP_BUS_COUNT];
+
+        unsigned long enumeratedAt = 0;
+
+        portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+        TEMP_SNAPSHOT snapshot;
+
+        // written by configure(), applied by the sampler task
+        TEMP_CONFIG config;
+        bool reconfigure = false;
+
+        // duration of the last request, wait and read cycle
+        volatile uint32_t conversionMs = 0;
+
+        // applies alias and resolution of the config to every known sensor, sampler task only
+        void applyConfig(TEMP_SNAPSHOT &next) {
+            portENTER_CRITICAL(&this->lock);
+            TEMP_CONFIG config = this->config;
+            this->reconfigure = false;
+            portEXIT_CRITICAL(&this->lock);
+
+            for (uint8_t i = 0; i < next.count; i++) {
+                TEMP_READING &reading = next.readings[i];
+                const TEMP_SENSOR_CONFIG *sensor = config.find(reading.rom);
+
+                snprintf(reading.alias, TEMP_ALIAS_SIZE, "%s", sensor ? sensor->alias : "");
+                uint8_t resolution = sensor ? sensor->resolution : TEMP_DEFAULT_RESOLUTION;
+
+                if (reading.present && resolution != reading.resolution) {
+                    if (this->buses[reading.bus].setResolution(reading.rom, resolution, true))
+                        reading.resolution = resolution;
+                }
+            }
+        }
+
+        void enumerate(TEMP_SNAPSHOT &next) {
+            for (uint8_t i = 0; i < next.count; i++) next.readings[i].present = false;
+
+            // sensors not in the snapshot, given a slot once every bus was scanned
+            DeviceAddress found[TEMP_MAX_SENSORS];
+            uint8_t foundBus[TEMP_MAX_SENSORS];
+            uint8_t foundCount = 0;
+
+            for (uint8_t bus = 0; bus < TEMP_BUS_COUNT; bus++) {
+                DallasTemperature &sensors = this->buses[bus];
+                sensors.begin();
+                sensors.setWaitForConversion(false);
+
+                DeviceAddress rom;
+                uint8_t devices = sensors.getDeviceCount();
+                for (uint8_t d = 0; d < devices; d++) {
+                    if (!sensors.getAddress(rom, d)) continue;
+
+                    // known sensors keep their slot
+                    int8_t slot = -1;
+                    for (uint8_t i = 0; i < next.count && slot < 0; i++) {
+                        if (memcmp(next.readings[i].rom, rom, sizeof(DeviceAddress)) == 0) slot = i;
+                    }
+                    if (slot < 0) {
+                        if (foundCount < TEMP_MAX_SENSORS) {
+                            memcpy(found[foundCount], rom, sizeof(DeviceAddress));
+                            foundBus[foundCount++] = bus;
+                        }
+                        continue;
+                    }
+
+                    TEMP_READING &reading = next.readings[slot];
+                    reading.bus = bus;
+                    reading.present = true;
+                    reading.resolution = sensors.getResolution(rom);
+                }
+            }
+
+            // a slot is vacated only when its sensor is on no bus, new sensors
+            // take a free slot first, then a vacated one
+            uint8_t vacated = 0;
+            for (uint8_t f = 0; f < foundCount; f++) {
+                int8_t slot = -1;
+                if (next.count < TEMP_MAX_SENSORS) slot = next.count++;
+                for (; vacated < next.count && slot < 0; vacated++) {
+                    if (!next.readings[vacated].present) slot = vacated;
+                }
+                if (slot < 0) break;
+
+                TEMP_READING &reading = next.readings[slot];
+                reading = TEMP_READING();
+                memcpy(reading.rom, found[f], sizeof(DeviceAddress));
+                reading.bus = foundBus[f];
+                reading.present = true;
+                reading.resolution = this->buses[foundBus[f]].getResolution(found[f]);
+            }
+
+            this->enumeratedAt = millis();
+            this->applyConfig(next);
+        }
+
+        void sample() {
+            unsigned long startedAt = millis();
+
+            TEMP_SNAPSHOT next;
+            portENTER_CRITICAL(&this->lock);
+            next = this->snapshot;
+            bool reconfigure = this->reconfigure;
+            portEXIT_CRITICAL(&this->lock);
+
+            if (this->enumeratedAt == 0 || millis() - this->enumeratedAt > TEMP_ENUMERATE_INTERVAL) {
+                this->enumerate(next);
+            }
+            else if (reconfigure) {
+                this->applyConfig(next);
+            }
+
+            // start every bus, then wait once for the slowest sensor
+            uint8_t resolution = 9;
+            for (uint8_t i = 0; i < next.count; i++) {
+                if (next.readings[i].present && next.readings[i].resolution > resolution)
+                    resolution = next.readings[i].resolution;
+            }
+            for (uint8_t bus = 0; bus < TEMP_BUS_COUNT; bus++) {
+                this->buses[bus].requestTemperatures();
+            }
+
+            // the conversion runs on the sensors, let the other tasks work meanwhile
+            uint16_t wait = this->buses[0].millisToWaitForConversion(resolution);
+            vTaskDelay(wait / portTICK_PERIOD_MS);
+
+            unsigned long now = millis();
+            for (uint8_t i = 0; i < next.count; i++) {
+                TEMP_READING &reading = next.readings[i];
+                if (!reading.present) continue;
+
+                // addressed read, no bus search per sensor
+                float temp = this->buses[reading.bus].getTempC(reading.rom);
+
+                if (temp == DEVICE_DISCONNECTED_C) {
+                    reading.errors++;
+                    continue;
+                }
+                reading.value = temp;
+                reading.updatedAt = now;
+                reading.valid = true;
+            }
+            next.timestamp = now;
+
+            portENTER_CRITICAL(&this->lock);
+            this->snapshot = next;
+            portEXIT_CRITICAL(&this->lock);
+
+            this->conversionMs = millis() - startedAt;
+        }
+
+    public:
+        void begin() {
+            for (uint8_t bus = 0; bus < TEMP_BUS_COUNT; bus++) {
+                this->wires[bus].begin(TEMP_BUSES[bus]);
+                this->buses[bus].setOneWire(&this->wires[bus]);
+            }
+
+            xTaskCreatePinnedToCore([](void *pvParameters) {
+                TemperatureSampler *sampler = static_cast<TemperatureSampler*>(pvParameters);
+                esp_task_wdt_add(NULL);
+
+                while (true) {
+                    esp_task_wdt_reset();
+                    sampler->sample();
+                    vTaskDelay(TEMP_SAMPLE_INTERVAL / portTICK_PERIOD_MS);
+                }
+            }, "temperatureSampler", 6144, this, TEMP_TASK_PRIORITY, NULL, APP_CORE);
+        }
+
+        // new aliases and resolutions, applied before the next conversion
+        void configure(const TEMP_CONFIG &config) {
+            portENTER_CRITICAL(&this->lock);
+            this->config = config;
+            this->reconfigure = true;
+            portEXIT_CRITICAL(&this->lock);
+        }
+
+        TEMP_SNAPSHOT getSnapshot() {
+            portENTER_CRITICAL(&this->lock);
+            TEMP_SNAPSHOT copy = this->snapshot;
+            portEXIT_CRITICAL(&this->lock);
+            return copy;
+        }
+
+        uint32_t getConversionMs() const {
+            return this->conversionMs;
+        }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef TOPIC_ROUTER
+#define TOPIC_ROUTER
+
+#include <Arduino.h>
+
+#define ROUTER_MAX_ROUTES 16
+#define ROUTER_FILTER_SIZE 128
+
+// no route for the topic
+#define ROUTE_NONE 0xFF
+
+// a subscription filter and what to do with its messages
+struct TOPIC_ROUTE {
+    char filter[ROUTER_FILTER_SIZE];
+    uint32_t hash;
+    bool wildcard;
+    uint8_t qos;
+    uint8_t action;
+
+    TOPIC_ROUTE() :
+        filter(""),
+        hash(0),
+        wildcard(false),
+        qos(0),
+        action(ROUTE_NONE)
+    {}
+};
+
+// Maps inbound topics to actions. The filters are built once, when the
+// topics change, and a lookup works on the raw topic of the client buffer:
+// plain filters are compared by hash first, filters with + or # are
+// matched level by level, nothing is copied or allocated per message.
+class TopicRouter {
+    private:
+        TOPIC_ROUTE routes[ROUTER_MAX_ROUTES];
+        uint8_t count = 0;
+
+        // FNV-1a
+        static uint32_t hash(const char *text) {
+            uint32_t value = 2166136261u;
+            while (*text) {
+                value ^= (uint8_t)*text++;
+                value *= 16777619u;
+            }
+            return value;
+        }
+
+    public:
+        // MQTT matching: + is one level, a trailing # is any number of levels
+        // including none, and wildcards never match a leading $ topic
+        static bool matches(const char *filter, const char *topic) {
+            if (topic[0] == '$' && (filter[0] == '+' || filter[0] == '#')) return false;
+
+            while (*filter) {
+                if (*filter == '#') return true;
+
+                if (*filter == '+') {
+                    while (*topic && *topic != '/') topic++;
+                    filter++;
+                }
+                else {
+                    while (*filter && *filter != '/') {
+                        if (*filter++ != *topic++) return false;
+                    }
+                    if (*topic && *topic != '/') return false;
+                }
+
+                // both at the end of a level
+                if (*filter == '\0') return *topic == '\0';
+                if (*topic == '\0') return strcmp(filter, "/#") == 0;
+                filter++;
+                topic++;
+            }
+            return *topic == '\0';
+        }
+
+        // + alone in its level, # alone in the last level
+        static bool isValidFilter(const char *filter) {
+            size_t length = strlen(filter);
+            if (length == 0 || length >= ROUTER_FILTER_SIZE) return false;
+
+            for (size_t i = 0; i < length; i++) {
+                if (filter[i] != '+' && filter[i] != '#') continue;
+
+                bool alone = (i == 0 || filter[i - 1] == '/') && (i + 1 == length || filter[i + 1] == '/');
+                if (!alone) return false;
+                if (filter[i] == '#' && i + 1 != length) return false;
+            }
+            return true;
+        }
+
+        void clear() {
+            this->count = 0;
+        }
+
+        // false when the table is full or the filter is not valid
+        bool add(const char *filter, uint8_t qos, uint8_t action) {
+            if (this->count == ROUTER_MAX_ROUTES || !isValidFilter(filter)) return false;
+
+            TOPIC_ROUTE &route = this->routes[this->count++];
+            snprintf(route.filter, ROUTER_FILTER_SIZE, "%s", filter);
+            route.hash = hash(filter);
+            route.wildcard = strpbrk(filter, "+#") != NULL;
+            route.qos = qos;
+            route.action = action;
+            return true;
+        }
+
+        // action of the first plain route matching the topic, then of the
+        // first wildcard route, ROUTE_NONE without a match
+        uint8_t match(const char *topic) const {
+            uint32_t key = hash(topic);
+            for (uint8_t i = 0; i < this->count; i++) {
+                const TOPIC_ROUTE &route = this->routes[i];
+                if (!route.wildcard && route.hash == key && strcmp(route.filter, topic) == 0) return route.action;
+            }
+            for (uint8_t i = 0; i < this->count; i++) {
+                const TOPIC_ROUTE &route = this->routes[i];
+                if (route.wildcard && matches(route.filter, topic)) return route.action;
+            }
+            return ROUTE_NONE;
+        }
+
+        uint8_t getCount() const {
+            return this->count;
+        }
+
+        const TOPIC_ROUTE &getRoute(uint8_t index) const {
+            return this->routes[index];
+        }
+};
+
+#endif
@@ -2,17 +2,12 @@
 #include <LittleFS.h>
 #include <EEPROM.h>
 
-#define TEMP_PIN 4
-#define RESET_PIN 5
-#define INPUT_PIN 34
-
+#include "DeviceSettings.hpp"
 #include "ComponentClass.hpp"
 
 Component comp;
-PubSubClient* mqtt;
 
 unsigned long startTime;
-uint16_t interval;
 
 volatile unsigned int counter; 
 
@@ -23,22 +18,27 @@ void setup() {
     EEPROM.begin(8);
     Serial.begin(9600);
     
-    esp_task_wdt_init(1, true);
-
-    pinMode(INPUT_PIN, INPUT);
+    esp_task_wdt_init(WATCHDOG_TIMEOUT, true);
 
     comp.begin();
-    mqtt = comp.getMqtt();
 
-    interval = comp.getInterval();
     startTime = millis();
 }
 
 void loop() {
-    mqtt->loop();
-
-    if (millis() - startTime > (interval * 1000)) {
+    // MQTT runs in its own task, the loop only schedules the interval publish.
+    // The interval is read every pass so a new config applies at once.
+    if (!comp.isAggregating() && millis() - startTime > (comp.getInterval() * 1000UL)) {
         comp.publishDweb08Data();
         startTime = millis();
     }
+
+    comp.pushLiveStatus();
+
+#ifdef BENCHMARK
+    comp.reportBenchmark();
+#endif
+
+    // the other tasks are event driven, do not spin here
+    vTaskDelay(LOOP_PERIOD / portTICK_PERIOD_MS);
 }
\ No newline at end of file
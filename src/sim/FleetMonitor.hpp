@@ -0,0 +1,318 @@
+#ifndef FLEET_MONITOR
+#define FLEET_MONITOR
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <vector>
+
+#include "MqttClient.hpp"
+#include "SocketClient.hpp"
+#include "VirtualDevice.hpp"
+
+// latencies above this land in the last bucket (ms)
+#define SIM_LATENCY_MAX 60000
+// a command without an answer after this is counted lost (ms)
+#define SIM_COMMAND_TIMEOUT 60000
+
+#define SIM_COMMAND_DATA 0
+#define SIM_COMMAND_MQTT 1
+#define SIM_COMMAND_NETWORK 2
+#define SIM_COMMAND_KINDS 3
+
+static const char *SIM_COMMAND_NAMES[] = { "data", "mqtt", "network" };
+
+// one bucket per millisecond, percentiles without keeping the samples
+class LatencyHistogram {
+    private:
+        std::vector<uint32_t> buckets = std::vector<uint32_t>(SIM_LATENCY_MAX + 1);
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint32_t maximum = 0;
+
+    public:
+        void add(long ms) {
+            uint32_t bucket = constrain(ms, 0L, (long)SIM_LATENCY_MAX);
+            this->buckets[bucket]++;
+            this->count++;
+            this->sum += bucket;
+            this->maximum = max(this->maximum, bucket);
+        }
+
+        void clear() {
+            std::fill(this->buckets.begin(), this->buckets.end(), 0);
+            this->count = 0;
+            this->sum = 0;
+            this->maximum = 0;
+        }
+
+        uint32_t percentile(float p) const {
+            if (this->count == 0) return 0;
+
+            uint64_t rank = max((uint64_t)1, (uint64_t)ceil(this->count * p / 100));
+            uint64_t seen = 0;
+            for (uint32_t i = 0; i <= SIM_LATENCY_MAX; i++) {
+                seen += this->buckets[i];
+                if (seen >= rank) return i;
+            }
+            return SIM_LATENCY_MAX;
+        }
+
+        // "name":{"n":..,"p50":..,"p90":..,"p99":..,"max":..}
+        int format(char *out, size_t size, const char *name) const {
+            return snprintf(out, size, "\"%s\":{\"n\":%llu,\"mean\":%.1f,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}",
+                name, (unsigned long long)this->count, this->count ? (double)this->sum / this->count : 0.0,
+                this->percentile(50), this->percentile(90), this->percentile(99), this->maximum);
+        }
+
+        uint64_t getCount() const {
+            return this->count;
+        }
+};
+
+// a command sent to a device and not answered yet
+struct SIM_PENDING {
+    uint8_t kind;
+    unsigned long sentAt;
+    bool waiting;
+
+    SIM_PENDING() :
+        kind(0),
+        sentAt(0),
+        waiting(false)
+    {}
+};
+
+// The backend side of the test: one client subscribed to the telemetry and
+// acknowledgements of the whole fleet. It measures what the broker
+// delivers and how late, sampled telemetry timestamps against the shared
+// host clock, and sends <topic>/data, /mqtt and /network commands timed
+// until the device answers: a telemetry message for data, its ack for the
+// config changes. A device takes commands once its boot ack was seen.
+class FleetMonitor {
+    private:
+        const SIM_OPTIONS &options;
+        SocketClient socket;
+        MqttClient mqtt = MqttClient(this->socket);
+        char topic[MQTT_TOPIC_SIZE + 8];
+
+        std::vector<SIM_PENDING> pending;
+        std::vector<bool> ready;
+        std::vector<bool> dnsToggle;
+        uint32_t readyCount = 0;
+        uint32_t nextDevice = 0;
+        uint8_t nextKind = 0;
+        unsigned long commandAt = 0;
+
+        LatencyHistogram latency;
+        LatencyHistogram latencyTotal;
+        LatencyHistogram roundTrip[SIM_COMMAND_KINDS];
+
+        uint64_t received = 0;
+        uint64_t receivedTotal = 0;
+        uint64_t acks = 0;
+        uint32_t sent[SIM_COMMAND_KINDS] = {};
+        uint32_t lost[SIM_COMMAND_KINDS] = {};
+        uint32_t refused = 0;
+        uint32_t reconnects = 0;
+
+        JsonDocument filter;
+        JsonDocument doc;
+
+        // device number of <prefix>/<n>[/ack], false for anything else
+        bool parseTopic(const char *topic, uint32_t &number, bool &ack) const {
+            size_t length = this->options.prefix.length();
+            if (strncmp(topic, this->options.prefix.c_str(), length) != 0 || topic[length] != '/') return false;
+
+            char *end;
+            number = strtoul(topic + length + 1, &end, 10);
+            if (end == topic + length + 1 || number >= this->options.devices) return false;
+            ack = strcmp(end, "/ack") == 0;
+            return ack || *end == '\0';
+        }
+
+        void complete(uint32_t number, uint8_t kind) {
+            SIM_PENDING &command = this->pending[number];
+            if (!command.waiting || command.kind != kind) return;
+            command.waiting = false;
+            this->roundTrip[kind].add(millis() - command.sentAt);
+        }
+
+        void onMessage(const char *topic, const uint8_t *data, unsigned int length) {
+            uint32_t number;
+            bool ack;
+            if (!this->parseTopic(topic, number, ack)) return;
+
+            if (ack) {
+                this->acks++;
+                if (!this->ready[number]) {
+                    this->ready[number] = true;
+                    this->readyCount++;
+                }
+                if (this->pending[number].kind != SIM_COMMAND_DATA) this->complete(number, this->pending[number].kind);
+                return;
+            }
+
+            this->received++;
+            this->receivedTotal++;
+            DeserializationError result = length > 0 && data[0] == '{'
+                ? deserializeJson(this->doc, data, length, DeserializationOption::Filter(this->filter))
+                : deserializeMsgPack(this->doc, data, length, DeserializationOption::Filter(this->filter));
+            if (result == DeserializationError::Ok && this->doc["timestamp"].is<unsigned long>()) {
+                long late = millis() - this->doc["timestamp"].as<unsigned long>();
+                this->latency.add(late);
+                this->latencyTotal.add(late);
+            }
+            this->complete(number, SIM_COMMAND_DATA);
+        }
+
+        bool connect() {
+            this->mqtt.setServer(this->options.broker.c_str(), this->options.port);
+            this->mqtt.setBufferSize(TELEMETRY_PAYLOAD_SIZE + MQTT_TOPIC_SIZE + 8);
+            this->mqtt.setCallback([this](char *topic, uint8_t *data, unsigned int length) {
+                this->onMessage(topic, data, length);
+            });
+
+            snprintf(this->topic, sizeof(this->topic), "%s-monitor", this->options.prefix.c_str());
+            if (!this->mqtt.connect(this->topic, "", "")) return false;
+
+            snprintf(this->topic, sizeof(this->topic), "%s/+", this->options.prefix.c_str());
+            this->mqtt.subscribe(this->topic, 0);
+            snprintf(this->topic, sizeof(this->topic), "%s/+/ack", this->options.prefix.c_str());
+            this->mqtt.subscribe(this->topic, 0);
+            return true;
+        }
+
+        // the next ready device without a command in flight, round robin
+        bool pickDevice(uint32_t &number) {
+            if (this->readyCount == 0) return false;
+
+            for (uint32_t i = 0; i < this->options.devices; i++) {
+                number = this->nextDevice;
+                this->nextDevice = (this->nextDevice + 1) % this->options.devices;
+                if (this->ready[number] && !this->pending[number].waiting) return true;
+            }
+            return false;
+        }
+
+        void sendCommand() {
+            uint32_t number;
+            if (!this->pickDevice(number)) return;
+
+            uint8_t kind = this->nextKind;
+            this->nextKind = (this->nextKind + 1) % SIM_COMMAND_KINDS;
+
+            char payload[64];
+            int length = 0;
+            if (kind == SIM_COMMAND_MQTT) {
+                // stored and acknowledged, nothing to apply
+                length = snprintf(payload, sizeof(payload), "{\"interval\":%u}", this->options.interval);
+            }
+            else if (kind == SIM_COMMAND_NETWORK) {
+                // a changed DNS reassociates the station, the ack comes after the reconnect
+                this->dnsToggle[number] = !this->dnsToggle[number];
+                length = snprintf(payload, sizeof(payload), "{\"dns\":\"%s\"}", this->dnsToggle[number] ? "1.1.1.1" : "9.9.9.9");
+            }
+
+            snprintf(this->topic, sizeof(this->topic), "%s/%u/%s", this->options.prefix.c_str(), (unsigned)number, SIM_COMMAND_NAMES[kind]);
+            if (!this->mqtt.publish(this->topic, reinterpret_cast<const uint8_t*>(payload), length, 1)) {
+                this->refused++;
+                return;
+            }
+
+            SIM_PENDING &command = this->pending[number];
+            command.kind = kind;
+            command.sentAt = millis();
+            command.waiting = true;
+            this->sent[kind]++;
+        }
+
+        void expireCommands() {
+            unsigned long now = millis();
+            for (uint32_t i = 0; i < this->options.devices; i++) {
+                SIM_PENDING &command = this->pending[i];
+                if (!command.waiting || now - command.sentAt < SIM_COMMAND_TIMEOUT) continue;
+                command.waiting = false;
+                this->lost[command.kind]++;
+            }
+        }
+
+    public:
+        FleetMonitor(const SIM_OPTIONS &options) :
+            options(options),
+            pending(options.devices),
+            ready(options.devices),
+            dnsToggle(options.devices)
+        {
+            this->filter["timestamp"] = true;
+        }
+
+        // keeps the connection and sends SIM_OPTIONS::commands per second, monitor thread only
+        void tick() {
+            if (!this->mqtt.connected()) {
+                if (!this->connect()) {
+                    delay(1000);
+                    return;
+                }
+                this->reconnects++;
+            }
+            this->mqtt.loop();
+
+            unsigned long now = millis();
+            if (this->options.commands > 0 && (long)(now - this->commandAt) >= 0) {
+                this->sendCommand();
+                this->commandAt += max(1UL, (unsigned long)(1000 / this->options.commands));
+                // never catch up with a burst after a stall
+                if ((long)(now - this->commandAt) > 1000) this->commandAt = now;
+            }
+        }
+
+        // one JSON line of the period since the last report, then the period is reset
+        void report(FILE *out, unsigned long elapsed, unsigned long period, uint32_t online, const SIM_DEVICE_STATS &totals) {
+            this->expireCommands();
+
+            char latency[160];
+            this->latency.format(latency, sizeof(latency), "latencyMs");
+            fprintf(out, "{\"t\":%.1f,\"online\":%u,\"ready\":%u,\"receivedPerS\":%.1f,\"published\":%u,\"acked\":%u,"
+                "\"offline\":%u,\"refused\":%u,\"connects\":%u,\"failures\":%u,%s}\n",
+                elapsed / 1000.0, (unsigned)online, (unsigned)this->readyCount, this->received * 1000.0 / max(1UL, period),
+                (unsigned)totals.published, (unsigned)totals.acked, (unsigned)totals.offline, (unsigned)totals.refused,
+                (unsigned)totals.connects, (unsigned)totals.failures, latency);
+            fflush(out);
+
+            this->received = 0;
+            this->latency.clear();
+        }
+
+        // totals of the run, with the command round trips
+        void summary(FILE *out, unsigned long elapsed, const SIM_DEVICE_STATS &totals) {
+            this->expireCommands();
+
+            char line[256];
+            fprintf(out, "{\"summary\":true,\"devices\":%u,\"seconds\":%.1f,\"received\":%llu,\"receivedPerS\":%.1f,"
+                "\"published\":%u,\"acked\":%u,\"ackedPerS\":%.1f,\"retransmits\":%u,\"refused\":%u,\"offline\":%u,"
+                "\"connects\":%u,\"failures\":%u,\"acks\":%llu,\"monitorReconnects\":%u,\"commandsRefused\":%u,",
+                (unsigned)this->options.devices, elapsed / 1000.0, (unsigned long long)this->receivedTotal,
+                this->receivedTotal * 1000.0 / max(1UL, elapsed), (unsigned)totals.published, (unsigned)totals.acked,
+                totals.acked * 1000.0 / max(1UL, elapsed), (unsigned)totals.retransmits, (unsigned)totals.refused,
+                (unsigned)totals.offline, (unsigned)totals.connects, (unsigned)totals.failures,
+                (unsigned long long)this->acks, (unsigned)this->reconnects, (unsigned)this->refused);
+
+            this->latencyTotal.format(line, sizeof(line), "latencyMs");
+            fprintf(out, "%s", line);
+            for (uint8_t kind = 0; kind < SIM_COMMAND_KINDS; kind++) {
+                char name[32];
+                snprintf(name, sizeof(name), "%sRoundTripMs", SIM_COMMAND_NAMES[kind]);
+                this->roundTrip[kind].format(line, sizeof(line), name);
+                fprintf(out, ",%s,\"%sSent\":%u,\"%sLost\":%u", line, SIM_COMMAND_NAMES[kind], (unsigned)this->sent[kind],
+                    SIM_COMMAND_NAMES[kind], (unsigned)this->lost[kind]);
+            }
+            fprintf(out, "}\n");
+            fflush(out);
+        }
+
+        void disconnect() {
+            this->mqtt.disconnect();
+        }
+};
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef FLEET_SIMULATOR
+#define FLEET_SIMULATOR
+
+#include <Arduino.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "VirtualDevice.hpp"
+#include "FleetMonitor.hpp"
+
+// longest sleep of a worker between two passes over its devices (ms), the
+// owner task period of the firmware
+#define SIM_TICK_MS 10
+// how often a worker publishes the counters of its devices (ms)
+#define SIM_STATS_INTERVAL 250
+#define SIM_EPOLL_EVENTS 256
+
+// Runs a share of the fleet on one thread: device n belongs to worker
+// n % workers. One epoll set tells which sockets have something to read,
+// every device gets a pass of its owner task per wake-up.
+class FleetWorker {
+    private:
+        const SIM_OPTIONS &options;
+        uint16_t index;
+        std::atomic<bool> &running;
+        std::atomic<uint32_t> &storms;
+
+        std::vector<std::unique_ptr<VirtualDevice>> devices;
+        std::thread thread;
+
+        std::mutex lock;
+        SIM_DEVICE_STATS totals;
+        uint32_t online = 0;
+
+        void publishStats() {
+            SIM_DEVICE_STATS sum;
+            uint32_t up = 0;
+            for (const std::unique_ptr<VirtualDevice> &device : this->devices) {
+                SIM_DEVICE_STATS stats = device->getStats();
+                sum.published += stats.published;
+                sum.offline += stats.offline;
+                sum.refused += stats.refused;
+                sum.acked += stats.acked;
+                sum.retransmits += stats.retransmits;
+                sum.connects += stats.connects;
+                sum.failures += stats.failures;
+                sum.commands += stats.commands;
+                if (device->isOnline()) up++;
+            }
+
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->totals = sum;
+            this->online = up;
+        }
+
+        void run() {
+            int epoll = epoll_create1(EPOLL_CLOEXEC);
+            epoll_event events[SIM_EPOLL_EVENTS];
+
+            unsigned long startedAt = millis();
+            unsigned long statsAt = startedAt;
+            uint32_t stormSeen = this->storms.load();
+            uint32_t number = this->index;
+
+            while (this->running.load()) {
+                // devices come up at options.ramp per second over the whole fleet
+                unsigned long now = millis();
+                while (number < this->options.devices &&
+                       (this->options.ramp == 0 || (uint64_t)number * 1000 / this->options.ramp <= now - startedAt)) {
+                    this->devices.emplace_back(new VirtualDevice(this->options, number, epoll));
+                    this->devices.back()->begin();
+                    number += this->options.workers;
+                }
+
+                int ready = epoll_wait(epoll, events, SIM_EPOLL_EVENTS, SIM_TICK_MS);
+                for (int i = 0; i < ready; i++) {
+                    static_cast<SocketClient*>(events[i].data.ptr)->markReadable();
+                }
+
+                for (const std::unique_ptr<VirtualDevice> &device : this->devices) device->tick();
+
+                uint32_t storm = this->storms.load();
+                if (storm != stormSeen) {
+                    stormSeen = storm;
+                    for (const std::unique_ptr<VirtualDevice> &device : this->devices) {
+                        if (random(100) < this->options.stormFraction) device->dropConnection(this->options.stormStation);
+                    }
+                }
+
+                if (millis() - statsAt >= SIM_STATS_INTERVAL) {
+                    statsAt = millis();
+                    this->publishStats();
+                }
+            }
+
+            this->publishStats();
+            this->devices.clear();
+            close(epoll);
+        }
+
+    public:
+        FleetWorker(const SIM_OPTIONS &options, uint16_t index, std::atomic<bool> &running, std::atomic<uint32_t> &storms) :
+            options(options),
+            index(index),
+            running(running),
+            storms(storms)
+        {}
+
+        void start() {
+            this->thread = std::thread([this]() { this->run(); });
+        }
+
+        void join() {
+            if (this->thread.joinable()) this->thread.join();
+        }
+
+        // counters as of the last publishStats(), any thread
+        void getStats(SIM_DEVICE_STATS &sum, uint32_t &online) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            sum.published += this->totals.published;
+            sum.offline += this->totals.offline;
+            sum.refused += this->totals.refused;
+            sum.acked += this->totals.acked;
+            sum.retransmits += this->totals.retransmits;
+            sum.connects += this->totals.connects;
+            sum.failures += this->totals.failures;
+            sum.commands += this->totals.commands;
+            online += this->online;
+        }
+};
+
+// The whole run: the workers with the fleet, the monitor on the calling
+// thread, the reconnect storms and a JSON line per report period on stdout.
+class FleetSimulator {
+    private:
+        const SIM_OPTIONS &options;
+        std::atomic<bool> running;
+        std::atomic<uint32_t> storms;
+        std::vector<std::unique_ptr<FleetWorker>> workers;
+        FleetMonitor monitor;
+
+        void collect(SIM_DEVICE_STATS &totals, uint32_t &online) {
+            online = 0;
+            for (const std::unique_ptr<FleetWorker> &worker : this->workers) worker->getStats(totals, online);
+        }
+
+    public:
+        FleetSimulator(const SIM_OPTIONS &options) :
+            options(options),
+            running(true),
+            storms(0),
+            monitor(options)
+        {}
+
+        void run() {
+            // the backend listens before the first device connects
+            unsigned long startedAt = millis();
+            while (millis() - startedAt < 2000) this->monitor.tick();
+
+            for (uint16_t i = 0; i < this->options.workers; i++) {
+                this->workers.emplace_back(new FleetWorker(this->options, i, this->running, this->storms));
+                this->workers.back()->start();
+            }
+
+            startedAt = millis();
+            unsigned long reportAt = startedAt;
+            unsigned long stormAt = startedAt;
+            while (millis() - startedAt < this->options.duration * 1000UL) {
+                this->monitor.tick();
+                unsigned long now = millis();
+
+                if (this->options.stormEvery > 0 && now - stormAt >= this->options.stormEvery * 1000UL) {
+                    stormAt = now;
+                    this->storms++;
+                }
+
+                if (now - reportAt >= this->options.report * 1000UL) {
+                    SIM_DEVICE_STATS totals;
+                    uint32_t online;
+                    this->collect(totals, online);
+                    this->monitor.report(stdout, now - startedAt, now - reportAt, online, totals);
+                    reportAt = now;
+                }
+                delay(1);
+            }
+
+            this->running = false;
+            for (const std::unique_ptr<FleetWorker> &worker : this->workers) worker->join();
+
+            SIM_DEVICE_STATS totals;
+            uint32_t online;
+            this->collect(totals, online);
+            this->monitor.summary(stdout, millis() - startedAt, totals);
+            this->monitor.disconnect();
+        }
+};
+
+#endif
@@ -0,0 +1,378 @@
+#ifndef HOST_BROKER
+#define HOST_BROKER
+
+#include <Arduino.h>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "DeviceSettings.hpp"
+#include "MqttClient.hpp"
+#include "TopicRouter.hpp"
+
+// a PUBLISH the broker received, at is millis() on arrival
+struct HOST_MESSAGE {
+    std::string topic;
+    std::string payload;
+    uint8_t qos;
+    bool dup;
+    unsigned long at;
+};
+
+// MQTT 3.1.1 broker stand-in on 127.0.0.1 for the native tests: CONNECT,
+// PUBLISH at QoS 0 and 1 both ways, SUBSCRIBE, UNSUBSCRIBE and PINGREQ, one
+// thread per connection. What a test needs from a real broker is
+// scriptable: refused or slow CONNACKs, late or withheld PUBACKs,
+// connections dropped after a number of publishes and a stop and restart
+// on the same port, the way a Mosquitto kill and restart looks to the
+// device. Tests that want the real broker point the device at
+// DWEB08_BROKER instead.
+class HostBroker {
+    private:
+        // a PUBACK held back by ackDelayMs, the link latency
+        struct DELAYED_ACK {
+            int fd;
+            std::chrono::steady_clock::time_point due;
+            uint8_t packet[4];
+        };
+
+        struct SESSION {
+            int fd;
+            std::thread reader;
+            std::vector<std::string> filters;
+            uint32_t publishes = 0;
+        };
+
+        int listener = -1;
+        uint16_t port = 0;
+        std::thread acceptor;
+        std::vector<std::shared_ptr<SESSION>> sessions;
+        std::vector<HOST_MESSAGE> messages;
+        std::mutex lock;
+        std::mutex writing;
+        std::condition_variable arrived;
+        std::atomic<uint16_t> nextId = ATOMIC_VAR_INIT(0);
+
+        std::thread acker;
+        std::deque<DELAYED_ACK> delayed;
+        std::condition_variable queued;
+        bool stopping = false;
+
+        static bool readFully(int fd, uint8_t *buffer, size_t length) {
+            while (length > 0) {
+                ssize_t received = recv(fd, buffer, length, 0);
+                if (received <= 0) return false;
+                buffer += received;
+                length -= received;
+            }
+            return true;
+        }
+
+        void send(SESSION &session, const uint8_t *packet, size_t length) {
+            std::lock_guard<std::mutex> guard(this->writing);
+            ::send(session.fd, packet, length, MSG_NOSIGNAL);
+        }
+
+        static size_t encodeLength(uint8_t *out, uint32_t length) {
+            size_t bytes = 0;
+            do {
+                uint8_t digit = length % 128;
+                length /= 128;
+                out[bytes++] = length > 0 ? digit | 0x80 : digit;
+            } while (length > 0);
+            return bytes;
+        }
+
+        static std::string readString(const std::string &body, size_t &offset) {
+            if (offset + 2 > body.size()) return std::string();
+            size_t length = ((uint8_t)body[offset] << 8) | (uint8_t)body[offset + 1];
+            std::string text = body.substr(offset + 2, length);
+            offset += 2 + length;
+            return text;
+        }
+
+        // false once the session ends
+        bool handle(SESSION &session, uint8_t header, const std::string &body) {
+            uint8_t type = header & 0xF0;
+
+            if (type == MQTT_PACKET_CONNECT) {
+                this->connects++;
+                if (this->connackDelayMs > 0) delay(this->connackDelayMs);
+                // 0x03: server unavailable
+                uint8_t connack[4] = { MQTT_PACKET_CONNACK, 2, 0, (uint8_t)(this->refuse ? 0x03 : 0x00) };
+                this->send(session, connack, sizeof(connack));
+                return !this->refuse;
+            }
+            if (type == MQTT_PACKET_PUBLISH) {
+                HOST_MESSAGE message;
+                size_t offset = 0;
+                message.qos = (header >> 1) & 0x03;
+                message.dup = (header & MQTT_FLAG_DUP) != 0;
+                message.topic = readString(body, offset);
+                uint16_t id = 0;
+                if (message.qos > 0 && offset + 2 <= body.size()) {
+                    id = ((uint8_t)body[offset] << 8) | (uint8_t)body[offset + 1];
+                    offset += 2;
+                }
+                message.payload = body.substr(min(offset, body.size()));
+                message.at = millis();
+
+                if (message.qos == 1 && !this->withholdAcks) {
+                    uint8_t ack[4] = { MQTT_PACKET_PUBACK, 2, (uint8_t)(id >> 8), (uint8_t)(id & 0xFF) };
+                    if (this->ackDelayMs == 0) this->send(session, ack, sizeof(ack));
+                    else {
+                        // the reader goes on, publishes in flight overlap their latency
+                        std::lock_guard<std::mutex> guard(this->lock);
+                        DELAYED_ACK entry = { session.fd, std::chrono::steady_clock::now() + std::chrono::milliseconds(this->ackDelayMs) };
+                        memcpy(entry.packet, ack, sizeof(ack));
+                        this->delayed.push_back(entry);
+                        this->queued.notify_all();
+                    }
+                }
+                {
+                    std::lock_guard<std::mutex> guard(this->lock);
+                    this->messages.push_back(message);
+                }
+                this->arrived.notify_all();
+                return this->dropAfter == 0 || ++session.publishes < this->dropAfter;
+            }
+            if (type == (MQTT_PACKET_SUBSCRIBE & 0xF0) || type == (MQTT_PACKET_UNSUBSCRIBE & 0xF0)) {
+                bool subscribe = type == (MQTT_PACKET_SUBSCRIBE & 0xF0);
+                size_t offset = 2;
+                uint8_t ack[64] = { (uint8_t)(subscribe ? 0x90 : 0xB0), 2, (uint8_t)body[0], (uint8_t)body[1] };
+                size_t length = 4;
+
+                std::lock_guard<std::mutex> guard(this->lock);
+                while (offset < body.size()) {
+                    std::string filter = readString(body, offset);
+                    if (subscribe) {
+                        // granted QoS
+                        ack[length++] = min((uint8_t)body[offset++], (uint8_t)1);
+                        session.filters.push_back(filter);
+                    }
+                    else {
+                        session.filters.erase(std::remove(session.filters.begin(), session.filters.end(), filter), session.filters.end());
+                    }
+                }
+                ack[1] = length - 2;
+                this->send(session, ack, length);
+                return true;
+            }
+            if (type == MQTT_PACKET_PUBACK) {
+                this->pubacks++;
+                return true;
+            }
+            if (type == MQTT_PACKET_PINGREQ) {
+                uint8_t pong[2] = { MQTT_PACKET_PINGRESP, 0 };
+                this->send(session, pong, sizeof(pong));
+                return true;
+            }
+            return type != MQTT_PACKET_DISCONNECT;
+        }
+
+        void serve(std::shared_ptr<SESSION> session) {
+            while (true) {
+                uint8_t header;
+                if (!readFully(session->fd, &header, 1)) break;
+
+                uint32_t remaining = 0;
+                uint32_t multiplier = 1;
+                uint8_t digit;
+                do {
+                    if (!readFully(session->fd, &digit, 1)) return;
+                    remaining += (digit & 0x7F) * multiplier;
+                    multiplier *= 128;
+                } while (digit & 0x80);
+
+                std::string body(remaining, '\0');
+                if (remaining > 0 && !readFully(session->fd, reinterpret_cast<uint8_t*>(&body[0]), remaining)) break;
+                if (!this->handle(*session, header, body)) break;
+            }
+            // closed here, the descriptor itself is released by stop()
+            shutdown(session->fd, SHUT_RDWR);
+        }
+
+        // sends the delayed PUBACKs when they are due, in the order they were queued
+        void acknowledge() {
+            std::unique_lock<std::mutex> guard(this->lock);
+            while (!this->stopping) {
+                if (this->delayed.empty()) {
+                    this->queued.wait(guard);
+                    continue;
+                }
+                DELAYED_ACK entry = this->delayed.front();
+                if (this->queued.wait_until(guard, entry.due) != std::cv_status::timeout) continue;
+
+                this->delayed.pop_front();
+                std::lock_guard<std::mutex> writing(this->writing);
+                ::send(entry.fd, entry.packet, sizeof(entry.packet), MSG_NOSIGNAL);
+            }
+        }
+
+        void accept() {
+            while (true) {
+                int fd = ::accept(this->listener, NULL, NULL);
+                if (fd < 0) return;
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+                std::shared_ptr<SESSION> session = std::make_shared<SESSION>();
+                session->fd = fd;
+                std::lock_guard<std::mutex> guard(this->lock);
+                session->reader = std::thread(&HostBroker::serve, this, session);
+                this->sessions.push_back(session);
+            }
+        }
+
+    public:
+        // CONNACK with "server unavailable" and the connection closed
+        std::atomic<bool> refuse = ATOMIC_VAR_INIT(false);
+        // time before the CONNACK (ms)
+        std::atomic<uint32_t> connackDelayMs = ATOMIC_VAR_INIT(0);
+        // QoS 1 publishes are recorded but never acknowledged
+        std::atomic<bool> withholdAcks = ATOMIC_VAR_INIT(false);
+        // a connection is closed after this many publishes, 0 never
+        std::atomic<uint32_t> dropAfter = ATOMIC_VAR_INIT(0);
+        std::atomic<uint32_t> connects = ATOMIC_VAR_INIT(0);
+        // time before a PUBACK is sent (ms), the reader does not wait for it
+        std::atomic<uint32_t> ackDelayMs = ATOMIC_VAR_INIT(0);
+        // PUBACKs of the QoS 1 messages sent to the device
+        std::atomic<uint32_t> pubacks = ATOMIC_VAR_INIT(0);
+
+        ~HostBroker() {
+            this->stop();
+        }
+
+        // listens on port, 0 picks a free one. A restart passes getPort()
+        bool start(uint16_t port = 0) {
+            this->listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (this->listener < 0) return false;
+            int one = 1;
+            setsockopt(this->listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t length = sizeof(address);
+            if (bind(this->listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+                listen(this->listener, 64) != 0 ||
+                getsockname(this->listener, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+                ::close(this->listener);
+                this->listener = -1;
+                return false;
+            }
+
+            this->port = ntohs(address.sin_port);
+            this->stopping = false;
+            this->acceptor = std::thread(&HostBroker::accept, this);
+            this->acker = std::thread(&HostBroker::acknowledge, this);
+            return true;
+        }
+
+        // closes the listener and every connection, the process being killed
+        void stop() {
+            if (this->listener < 0) return;
+            shutdown(this->listener, SHUT_RDWR);
+            ::close(this->listener);
+            this->listener = -1;
+            this->acceptor.join();
+
+            // pending acks are lost with the connections, the descriptors close below
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                this->stopping = true;
+                this->delayed.clear();
+                this->queued.notify_all();
+            }
+            this->acker.join();
+
+            this->drop();
+            std::vector<std::shared_ptr<SESSION>> sessions;
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                sessions.swap(this->sessions);
+            }
+            for (auto &session : sessions) {
+                session->reader.join();
+                ::close(session->fd);
+            }
+        }
+
+        // closes the connections and keeps listening, a network cut
+        void drop() {
+            std::lock_guard<std::mutex> guard(this->lock);
+            for (auto &session : this->sessions) shutdown(session->fd, SHUT_RDWR);
+        }
+
+        uint16_t getPort() const {
+            return this->port;
+        }
+
+        // delivered to the connections subscribed to a matching filter, a
+        // QoS 1 message with the next packet id and never sent again
+        void publish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos = 0) {
+            size_t topicLength = strlen(topic);
+            std::string packet(1, (char)(MQTT_PACKET_PUBLISH | (qos > 0 ? 0x02 : 0x00)));
+            uint8_t digits[4];
+            packet.append(reinterpret_cast<char*>(digits), encodeLength(digits, 2 + topicLength + (qos > 0 ? 2 : 0) + length));
+            packet.push_back((char)(topicLength >> 8));
+            packet.push_back((char)(topicLength & 0xFF));
+            packet.append(topic, topicLength);
+            if (qos > 0) {
+                uint16_t id = ++this->nextId;
+                packet.push_back((char)(id >> 8));
+                packet.push_back((char)(id & 0xFF));
+            }
+            packet.append(reinterpret_cast<const char*>(payload), length);
+
+            std::lock_guard<std::mutex> guard(this->lock);
+            for (auto &session : this->sessions) {
+                for (const std::string &filter : session->filters) {
+                    if (!TopicRouter::matches(filter.c_str(), topic)) continue;
+                    this->send(*session, reinterpret_cast<const uint8_t*>(packet.data()), packet.size());
+                    break;
+                }
+            }
+        }
+
+        // subscriptions of the open connections
+        size_t getSubscriptions() {
+            std::lock_guard<std::mutex> guard(this->lock);
+            size_t count = 0;
+            for (auto &session : this->sessions) count += session->filters.size();
+            return count;
+        }
+
+        size_t count() {
+            std::lock_guard<std::mutex> guard(this->lock);
+            return this->messages.size();
+        }
+
+        std::vector<HOST_MESSAGE> getMessages() {
+            std::lock_guard<std::mutex> guard(this->lock);
+            return this->messages;
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->messages.clear();
+        }
+
+        // true once count messages were received
+        bool waitFor(size_t count, uint32_t timeoutMs) {
+            std::unique_lock<std::mutex> guard(this->lock);
+            return this->arrived.wait_for(guard, std::chrono::milliseconds(timeoutMs), [this, count]() {
+                return this->messages.size() >= count;
+            });
+        }
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef HOST_DEVICE
+#define HOST_DEVICE
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+#include "ConfigStore.hpp"
+#include "HostBroker.hpp"
+
+// Setup shared by the native tests under test/: the broker the firmware
+// talks to and the config a unit has after the web form was filled in.
+
+struct HOST_ENDPOINT {
+    String host;
+    uint16_t port;
+};
+
+// DWEB08_BROKER=host:port points the tests at a running broker such as
+// Mosquitto, without it the stand-in is started on a free local port
+inline HOST_ENDPOINT hostEndpoint(HostBroker &broker) {
+    const char *external = getenv("DWEB08_BROKER");
+    if (external != NULL && strchr(external, ':') != NULL) {
+        const char *colon = strchr(external, ':');
+        return { String(std::string(external, colon - external)), (uint16_t)atoi(colon + 1) };
+    }
+
+    if (broker.getPort() == 0) broker.start();
+    return { "127.0.0.1", broker.getPort() };
+}
+
+// writes the network and MQTT files of the bound file set through the store,
+// mqtt is a JSON object merged over the defaults of the tests
+inline bool hostProvision(const HOST_ENDPOINT &endpoint, const char *topic, const char *mqtt = "{}") {
+    ConfigStore store;
+    store.begin();
+
+    JsonDocument doc;
+    const char *error;
+    doc["ssid"] = "host";
+    doc["dhcp"] = 1;
+    if (store.patch(CONFIG_NETWORK, doc.as<JsonObjectConst>(), error) != CONFIG_SAVED) return false;
+
+    doc.clear();
+    doc["broker"] = endpoint.host;
+    doc["port"] = endpoint.port;
+    doc["clientId"] = topic;
+    doc["topic"] = topic;
+    doc["health"] = 0;
+
+    JsonDocument extra;
+    if (deserializeJson(extra, mqtt) != DeserializationError::Ok) return false;
+    for (JsonPair kv : extra.as<JsonObject>()) doc[kv.key()] = kv.value();
+
+    return store.patch(CONFIG_MQTT, doc.as<JsonObjectConst>(), error) == CONFIG_SAVED;
+}
+
+// a request through the routes the firmware registered on its web server
+inline std::unique_ptr<AsyncWebServerRequest> hostRequest(WebRequestMethodComposite method, const char *path, const char *body = "") {
+    std::unique_ptr<AsyncWebServerRequest> request(new AsyncWebServerRequest(method, path, body));
+    if (hostWebServer() != NULL) hostWebServer()->handle(request.get());
+    return request;
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef SOCKET_CLIENT
+#define SOCKET_CLIENT
+
+#include <Arduino.h>
+#include <Client.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define SOCKET_READ_SIZE 4096
+
+// Arduino Client over a non-blocking TCP socket. Reads go through a small
+// buffer so the byte-wise reads of the MQTT client cost one recv() per
+// burst. With an epoll set the socket is registered edge triggered and
+// isReadable() tells its owner when a loop() has something to read, so an
+// idle device costs no system call per tick.
+class SocketClient : public Client {
+    private:
+        int epoll;
+        int fd = -1;
+        bool closed = true;
+        bool readable = false;
+        uint32_t timeoutMs = 3000;
+
+        uint8_t buffer[SOCKET_READ_SIZE];
+        size_t buffered = 0;
+        size_t position = 0;
+
+        static bool resolve(const char *host, uint16_t port, sockaddr_in &address) {
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            if (inet_pton(AF_INET, host, &address.sin_addr) == 1) return true;
+
+            addrinfo hints = {};
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo *found = NULL;
+            if (getaddrinfo(host, NULL, &hints, &found) != 0 || found == NULL) return false;
+            address.sin_addr = reinterpret_cast<sockaddr_in*>(found->ai_addr)->sin_addr;
+            freeaddrinfo(found);
+            return true;
+        }
+
+        bool waitFor(short events) {
+            pollfd entry = { this->fd, events, 0 };
+            return poll(&entry, 1, this->timeoutMs) == 1 && !(entry.revents & (POLLERR | POLLHUP | POLLNVAL));
+        }
+
+    public:
+        // epoll is the set of the worker running the owner, -1 for none
+        SocketClient(int epoll = -1) :
+            epoll(epoll)
+        {}
+
+        ~SocketClient() {
+            this->stop();
+        }
+
+        void setTimeout(uint32_t timeoutMs) {
+            this->timeoutMs = timeoutMs;
+        }
+
+        int connect(const char *host, uint16_t port) override {
+            this->stop();
+
+            sockaddr_in address;
+            if (!resolve(host, port, address)) return 0;
+
+            this->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (this->fd < 0) return 0;
+            int one = 1;
+            setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            if (::connect(this->fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if (errno != EINPROGRESS || !this->waitFor(POLLOUT) ||
+                    getsockopt(this->fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+                    ::close(this->fd);
+                    this->fd = -1;
+                    return 0;
+                }
+            }
+
+            if (this->epoll >= 0) {
+                epoll_event event = {};
+                event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+                event.data.ptr = this;
+                epoll_ctl(this->epoll, EPOLL_CTL_ADD, this->fd, &event);
+            }
+            this->closed = false;
+            this->readable = true;
+            return 1;
+        }
+
+        size_t write(const uint8_t *data, size_t size) override {
+            if (this->closed) return 0;
+
+            size_t written = 0;
+            while (written < size) {
+                ssize_t sent = send(this->fd, data + written, size - written, MSG_NOSIGNAL);
+                if (sent > 0) {
+                    written += sent;
+                    continue;
+                }
+                if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && this->waitFor(POLLOUT)) continue;
+
+                this->closed = true;
+                break;
+            }
+            return written;
+        }
+
+        int available() override {
+            if (this->position < this->buffered) return this->buffered - this->position;
+            if (this->closed) return 0;
+
+            ssize_t length = recv(this->fd, this->buffer, sizeof(this->buffer), MSG_DONTWAIT);
+            if (length > 0) {
+                this->buffered = length;
+                this->position = 0;
+                return length;
+            }
+            if (length == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) this->closed = true;
+            this->readable = false;
+            return 0;
+        }
+
+        int read() override {
+            if (!this->available()) return -1;
+            return this->buffer[this->position++];
+        }
+
+        void stop() override {
+            if (this->fd >= 0) ::close(this->fd);
+            this->fd = -1;
+            this->closed = true;
+            this->readable = false;
+            this->buffered = 0;
+            this->position = 0;
+        }
+
+        uint8_t connected() override {
+            return !this->closed || this->position < this->buffered;
+        }
+
+        // set by the worker from its epoll events
+        void markReadable() {
+            this->readable = true;
+        }
+
+        // true when a read may find data, cleared once the socket is drained
+        bool isReadable() const {
+            return this->readable || this->position < this->buffered;
+        }
+};
+
+#endif
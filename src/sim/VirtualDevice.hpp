@@ -0,0 +1,328 @@
+#ifndef VIRTUAL_DEVICE
+#define VIRTUAL_DEVICE
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <WiFi.h>
+
+#include "DemandMeter.hpp"
+#include "Telemetry.hpp"
+#include "ConfigStore.hpp"
+#include "MqttClient.hpp"
+#include "ConnectionManager.hpp"
+#include "DeviceSession.hpp"
+#include "SocketClient.hpp"
+
+// pulse-rate profiles, each averages SIM_OPTIONS::rate pulses per hour
+#define SIM_PROFILE_STEADY 0
+#define SIM_PROFILE_RANDOM 1
+#define SIM_PROFILE_BURST 2
+
+// a burst profile runs at ten times the rate for a tenth of every period (s)
+#define SIM_BURST_PERIOD 600
+
+// loop() of an idle client at least this often, for keepalive and ack timeouts (ms)
+#define SIM_LOOP_INTERVAL 1000
+
+// most pulses counted in one tick, keeps a late tick from stalling the worker
+#define SIM_MAX_PULSES_PER_TICK 1000
+
+// one run of the fleet simulator, set from the command line
+struct SIM_OPTIONS {
+    String broker;
+    uint16_t port;
+    String prefix;
+    uint32_t devices;
+    uint16_t workers;
+    // run time and report period (s)
+    uint32_t duration;
+    uint16_t report;
+    // devices started per second, 0 starts them all at once
+    uint32_t ramp;
+    uint16_t interval;
+    // publish period drawn in interval +- jitter percent
+    uint8_t jitter;
+    uint8_t profile;
+    float rate;
+    String format;
+    uint16_t keyframe;
+    // association time of a station, drawn in associate +- 50 percent (ms)
+    uint32_t associate;
+    // commands sent by the monitor per second
+    float commands;
+    // every stormEvery seconds stormFraction percent of the devices lose the
+    // broker connection, or the station when stormStation is set
+    uint32_t stormEvery;
+    uint8_t stormFraction;
+    bool stormStation;
+
+    SIM_OPTIONS() :
+        broker("127.0.0.1"),
+        port(1883),
+        prefix("sim"),
+        devices(1000),
+        workers(4),
+        duration(60),
+        report(5),
+        ramp(0),
+        interval(10),
+        jitter(10),
+        profile(SIM_PROFILE_RANDOM),
+        rate(3600),
+        format("json"),
+        keyframe(0),
+        associate(2000),
+        commands(10),
+        stormEvery(0),
+        stormFraction(50),
+        stormStation(false)
+    {}
+};
+
+// counters of one device, summed per worker
+struct SIM_DEVICE_STATS {
+    uint32_t published;
+    uint32_t offline;
+    uint32_t refused;
+    uint32_t acked;
+    uint32_t retransmits;
+    uint32_t connects;
+    uint32_t failures;
+    uint32_t commands;
+
+    SIM_DEVICE_STATS() :
+        published(0),
+        offline(0),
+        refused(0),
+        acked(0),
+        retransmits(0),
+        connects(0),
+        failures(0),
+        commands(0)
+    {}
+};
+
+// One DWEB08 unit on the host. It runs the firmware's config store, device
+// session, telemetry encoder, MQTT client and connection manager the way the
+// component's owner task does, with a made-up pulse input and temperature
+// and a station that takes SIM_OPTIONS::associate to come up. Files and
+// radio are the device's own, bound to the thread before every tick.
+class VirtualDevice {
+    private:
+        const SIM_OPTIONS &options;
+        uint32_t number;
+
+        HostFiles files;
+        HostRadio radio;
+        SocketClient socket;
+        MqttClient mqtt = MqttClient(this->socket);
+
+        ConfigStore store;
+        TelemetryEncoder telemetry;
+        ConnectionManager connection;
+        DeviceSession session = DeviceSession(this->store, this->mqtt, this->connection, this->telemetry);
+
+        // the input
+        DemandMeter demand;
+        uint64_t counter = 0;
+        int64_t nextPulseUs = 0;
+        DeviceAddress rom;
+
+        unsigned long nextPublish = 0;
+        unsigned long lastLoop = 0;
+        bool dataRequested = false;
+
+        SIM_DEVICE_STATS stats;
+
+        void bind() {
+            hostFiles() = &this->files;
+            hostRadio() = &this->radio;
+        }
+
+        float currentRate(int64_t nowUs) const {
+            if (this->options.profile != SIM_PROFILE_BURST) return this->options.rate;
+
+            // devices start their bursts at different times
+            int64_t phase = (nowUs / 1000000 + this->number * 37) % SIM_BURST_PERIOD;
+            return phase < SIM_BURST_PERIOD / 10 ? this->options.rate * 10 : 0;
+        }
+
+        int64_t nextInterval(int64_t nowUs) const {
+            float rate = this->currentRate(nowUs);
+            // idle part of a burst period, look again in a second
+            if (rate <= 0) return 1000000;
+
+            double meanUs = DEMAND_US_PER_HOUR / rate;
+            if (this->options.profile == SIM_PROFILE_STEADY) return max((int64_t)1, (int64_t)meanUs);
+
+            double uniform = (random(1, 1000000) / 1000000.0);
+            return max((int64_t)1, (int64_t)(-log(uniform) * meanUs));
+        }
+
+        void countPulses() {
+            int64_t nowUs = (int64_t)millis() * 1000;
+            if (this->nextPulseUs == 0) this->nextPulseUs = nowUs + this->nextInterval(nowUs);
+
+            for (uint16_t i = 0; i < SIM_MAX_PULSES_PER_TICK && this->nextPulseUs <= nowUs; i++) {
+                if (this->currentRate(this->nextPulseUs) > 0) {
+                    this->counter++;
+                    this->demand.add(this->nextPulseUs);
+                }
+                this->nextPulseUs += this->nextInterval(this->nextPulseUs);
+            }
+        }
+
+        TELEMETRY_SAMPLE captureSample() {
+            TELEMETRY_SAMPLE sample;
+
+            sample.timestamp = millis();
+            sample.counters[0] = this->counter;
+            sample.demands[0] = this->demand.get((int64_t)sample.timestamp * 1000);
+            sample.levels = this->counter & 1;
+            sample.rssi = -50 - (int8_t)random(30);
+            sample.ip = 10 | (this->number & 0xFF) << 24 | ((this->number >> 8) & 0xFF) << 16;
+
+            TELEMETRY_TEMP &temp = sample.temps[sample.tempCount++];
+            memcpy(temp.rom, this->rom, sizeof(DeviceAddress));
+            temp.value = 20 + 5 * sin(sample.timestamp / 600000.0 + this->number);
+            return sample;
+        }
+
+        // the owner task publishing a sample, counted as the component does
+        bool publishSample(const TELEMETRY_SAMPLE &sample, bool keyframe) {
+            if (!this->mqtt.connected()) {
+                this->stats.offline++;
+                return false;
+            }
+
+            size_t length = this->telemetry.encode(this->session.getMqtt().clientId.c_str(), sample, keyframe);
+            bool sent = this->mqtt.publish(this->session.getTopic(), this->telemetry.getPayload(), length, MQTT_TELEMETRY_QOS);
+            if (sent) this->stats.published++;
+            else this->stats.refused++;
+            return sent;
+        }
+
+        unsigned long drawPeriod() const {
+            long period = this->session.getMqtt().interval * 1000L;
+            long spread = period * this->options.jitter / 100;
+            return period - spread + random(2 * spread + 1);
+        }
+
+        bool beginMqtt() {
+            this->socket.setTimeout(CONNECT_MQTT_TIMEOUT * 1000);
+            if (!this->session.connect()) return false;
+
+            this->publishSample(this->captureSample(), true);
+
+            this->mqtt.setCallback([this](char *topic, byte *data, unsigned int length) {
+                this->session.route(topic, data, length);
+            });
+            return true;
+        }
+
+    public:
+        VirtualDevice(const SIM_OPTIONS &options, uint32_t number, int epoll) :
+            options(options),
+            number(number),
+            socket(epoll)
+        {}
+
+        // provisions the device through its config store, as the web form would
+        void begin() {
+            this->bind();
+
+            for (uint8_t i = 0; i < sizeof(DeviceAddress); i++) this->rom[i] = (this->number >> ((i % 4) * 8)) ^ (0x28 + i);
+            this->rom[0] = 0x28;
+
+            JsonDocument doc;
+            const char *error;
+            doc["ssid"] = "sim";
+            doc["dhcp"] = 1;
+            this->store.patch(CONFIG_NETWORK, doc.as<JsonObjectConst>(), error);
+
+            char id[MQTT_TOPIC_SIZE];
+            doc.clear();
+            doc["broker"] = this->options.broker;
+            doc["port"] = this->options.port;
+            snprintf(id, sizeof(id), "%s-%u", this->options.prefix.c_str(), (unsigned)this->number);
+            doc["clientId"] = id;
+            snprintf(id, sizeof(id), "%s/%u", this->options.prefix.c_str(), (unsigned)this->number);
+            doc["topic"] = id;
+            doc["interval"] = this->options.interval;
+            doc["format"] = this->options.format;
+            doc["keyframe"] = this->options.keyframe;
+            doc["health"] = 0;
+            if (this->store.patch(CONFIG_MQTT, doc.as<JsonObjectConst>(), error) != CONFIG_SAVED) {
+                fprintf(stderr, "device %u: %s\n", (unsigned)this->number, error);
+            }
+
+            // answered by the next tick, as the component queues it for its owner task
+            this->session.begin(
+                [this]() {
+                    this->dataRequested = true;
+                    this->stats.commands++;
+                },
+                [this]() { this->stats.commands++; },
+                NULL
+            );
+
+            this->connection.begin(
+                [this]() { this->radio.associate(this->options.associate / 2 + random(this->options.associate + 1)); },
+                [this]() { return this->beginMqtt(); },
+                [this]() { return this->mqtt.connected(); },
+                true
+            );
+        }
+
+        // one pass of the owner task
+        void tick() {
+            this->bind();
+            unsigned long now = millis();
+
+            this->radio.tick();
+            // the station took the TCP connection down with it
+            if (!this->radio.isUp() && this->socket.connected()) this->socket.stop();
+
+            this->session.apply();
+            this->connection.tick();
+            this->session.acknowledge();
+
+            if (this->socket.isReadable() || now - this->lastLoop >= SIM_LOOP_INTERVAL) {
+                this->lastLoop = now;
+                this->mqtt.loop();
+            }
+
+            this->countPulses();
+
+            if (this->dataRequested) {
+                this->dataRequested = false;
+                this->publishSample(this->captureSample(), true);
+            }
+            if (this->nextPublish == 0) this->nextPublish = now + random(this->session.getMqtt().interval * 1000L);
+            if ((long)(now - this->nextPublish) >= 0) {
+                this->nextPublish = now + this->drawPeriod();
+                this->publishSample(this->captureSample(), false);
+            }
+        }
+
+        // a reconnect storm: the broker connection or the whole station goes
+        void dropConnection(bool station) {
+            this->bind();
+            if (station) this->radio.disconnect();
+            else this->socket.stop();
+        }
+
+        SIM_DEVICE_STATS getStats() {
+            this->stats.acked = this->mqtt.getAcked();
+            this->stats.retransmits = this->mqtt.getRetransmits();
+            this->stats.connects = this->connection.getMqttConnects();
+            this->stats.failures = this->connection.getMqttFailures();
+            return this->stats;
+        }
+
+        bool isOnline() const {
+            return this->connection.isMqttUp();
+        }
+};
+
+#endif
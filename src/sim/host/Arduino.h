@@ -0,0 +1,499 @@
+#ifndef HOST_ARDUINO
+#define HOST_ARDUINO
+
+// Host stand-in for the Arduino core used by the fleet simulator and the
+// native tests. Only the parts the shared headers touch are here: time,
+// random, String, IPAddress, Print and Serial, the GPIO interrupts of the
+// pulse inputs and the FreeRTOS primitives the ESP32 core pulls in with
+// Arduino.h.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define IRAM_ATTR
+#define PROGMEM
+
+#define DEC 10
+#define HEX 16
+
+// time added to the clock by hostAdvance(), tests skip batch windows and backoffs with it
+inline std::atomic<int64_t> &hostClockOffset() {
+    static std::atomic<int64_t> offset(0);
+    return offset;
+}
+
+// one clock for every thread, so timestamps of the devices and the monitor compare
+inline unsigned long micros() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() +
+        hostClockOffset().load();
+}
+
+inline unsigned long millis() {
+    return micros() / 1000;
+}
+
+inline void hostAdvance(unsigned long ms) {
+    hostClockOffset() += (int64_t)ms * 1000;
+}
+
+inline void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline std::mt19937 &hostRandom() {
+    static thread_local std::mt19937 engine(std::random_device{}());
+    return engine;
+}
+
+inline long random(long howBig) {
+    if (howBig <= 0) return 0;
+    return std::uniform_int_distribution<long>(0, howBig - 1)(hostRandom());
+}
+
+inline long random(long howSmall, long howBig) {
+    if (howSmall >= howBig) return howSmall;
+    return howSmall + random(howBig - howSmall);
+}
+
+inline void randomSeed(unsigned long seed) {
+    hostRandom().seed(seed);
+}
+
+// the subset of the Arduino String the shared headers and ArduinoJson use
+class String {
+    private:
+        std::string text;
+
+    public:
+        String() {}
+        String(const char *text) : text(text ? text : "") {}
+        String(const std::string &text) : text(text) {}
+        explicit String(char c) : text(1, c) {}
+        explicit String(int value) : text(std::to_string(value)) {}
+        explicit String(long value) : text(std::to_string(value)) {}
+
+        explicit String(unsigned long value, unsigned char base = DEC) {
+            char digits[24];
+            snprintf(digits, sizeof(digits), base == HEX ? "%lx" : "%lu", value);
+            this->text = digits;
+        }
+
+        explicit String(unsigned int value, unsigned char base = DEC) :
+            String((unsigned long)value, base)
+        {}
+
+        const char *c_str() const {
+            return this->text.c_str();
+        }
+
+        unsigned int length() const {
+            return this->text.length();
+        }
+
+        bool isEmpty() const {
+            return this->text.empty();
+        }
+
+        long toInt() const {
+            return strtol(this->text.c_str(), NULL, 10);
+        }
+
+        unsigned char concat(const char *text) {
+            this->text += text;
+            return 1;
+        }
+
+        unsigned char concat(const char *text, unsigned int length) {
+            this->text.append(text, length);
+            return 1;
+        }
+
+        unsigned char concat(char c) {
+            this->text += c;
+            return 1;
+        }
+
+        String &operator+=(const String &other) {
+            this->text += other.text;
+            return *this;
+        }
+
+        String &operator+=(const char *other) {
+            this->text += other;
+            return *this;
+        }
+
+        String &operator+=(char c) {
+            this->text += c;
+            return *this;
+        }
+
+        char operator[](unsigned int index) const {
+            return this->text[index];
+        }
+
+        bool operator==(const String &other) const {
+            return this->text == other.text;
+        }
+
+        bool operator!=(const String &other) const {
+            return this->text != other.text;
+        }
+
+        bool operator==(const char *other) const {
+            return this->text == other;
+        }
+
+        bool operator!=(const char *other) const {
+            return this->text != other;
+        }
+
+        bool operator<(const String &other) const {
+            return this->text < other.text;
+        }
+};
+
+class StringSumHelper : public String {
+    public:
+        StringSumHelper(const String &text) : String(text) {}
+};
+
+inline StringSumHelper operator+(const String &left, const String &right) {
+    String sum = left;
+    sum += right;
+    return sum;
+}
+
+inline StringSumHelper operator+(const String &left, const char *right) {
+    String sum = left;
+    sum += right;
+    return sum;
+}
+
+inline StringSumHelper operator+(const char *left, const String &right) {
+    String sum = left;
+    sum += right;
+    return sum;
+}
+
+class Print {
+    public:
+        virtual ~Print() {}
+
+        virtual size_t write(uint8_t c) = 0;
+
+        virtual size_t write(const uint8_t *buffer, size_t size) {
+            size_t written = 0;
+            while (size--) written += this->write(*buffer++);
+            return written;
+        }
+
+        size_t write(const char *text) {
+            return this->write(reinterpret_cast<const uint8_t*>(text), strlen(text));
+        }
+
+        size_t print(const char *text) {
+            return this->write(text);
+        }
+
+        size_t print(const String &text) {
+            return this->write(text.c_str());
+        }
+
+        size_t println(const char *text = "") {
+            return this->write(text) + this->write("\r\n");
+        }
+
+        size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+            char small[128];
+            va_list args;
+            va_start(args, format);
+            int length = vsnprintf(small, sizeof(small), format, args);
+            va_end(args);
+            if (length < 0) return 0;
+            if ((size_t)length < sizeof(small)) return this->write(reinterpret_cast<const uint8_t*>(small), length);
+
+            std::string large(length + 1, '\0');
+            va_start(args, format);
+            vsnprintf(&large[0], large.size(), format, args);
+            va_end(args);
+            return this->write(reinterpret_cast<const uint8_t*>(large.data()), length);
+        }
+};
+
+// Serial is the standard output, one report line per printf
+class HardwareSerial : public Print {
+    public:
+        void begin(unsigned long baud) {}
+
+        size_t write(uint8_t c) override {
+            return fwrite(&c, 1, 1, stdout);
+        }
+
+        size_t write(const uint8_t *buffer, size_t size) override {
+            size_t written = fwrite(buffer, 1, size, stdout);
+            fflush(stdout);
+            return written;
+        }
+
+        using Print::write;
+};
+
+static HardwareSerial Serial __attribute__((unused));
+
+class EspClass {
+    public:
+        // nothing reboots on the host, the process ends instead
+        void restart() {
+            fflush(stdout);
+            exit(0);
+        }
+};
+
+static EspClass ESP __attribute__((unused));
+
+// the host clock is already set
+inline void configTime(long gmtOffset, int daylightOffset, const char *server) {}
+
+class IPAddress {
+    private:
+        uint8_t octets[4] = {};
+
+    public:
+        IPAddress() {}
+
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) :
+            octets{ a, b, c, d }
+        {}
+
+        bool fromString(const char *text) {
+            unsigned int parts[4];
+            char tail;
+            if (sscanf(text, "%u.%u.%u.%u%c", &parts[0], &parts[1], &parts[2], &parts[3], &tail) != 4) return false;
+            for (uint8_t i = 0; i < 4; i++) {
+                if (parts[i] > 255) return false;
+                this->octets[i] = parts[i];
+            }
+            return true;
+        }
+
+        String toString() const {
+            char text[16];
+            snprintf(text, sizeof(text), "%u.%u.%u.%u", this->octets[0], this->octets[1], this->octets[2], this->octets[3]);
+            return String(text);
+        }
+
+        operator uint32_t() const {
+            return this->octets[0] | (this->octets[1] << 8) | (this->octets[2] << 16) | ((uint32_t)this->octets[3] << 24);
+        }
+
+        bool operator==(const IPAddress &other) const {
+            return memcmp(this->octets, other.octets, sizeof(this->octets)) == 0;
+        }
+
+        bool operator!=(const IPAddress &other) const {
+            return !(*this == other);
+        }
+};
+
+// pins as the ESP32 core numbers them, levels are driven from the host side
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define HOST_PIN_COUNT 40
+#define digitalPinToInterrupt(pin) (pin)
+
+struct HOST_PIN {
+    int level;
+    int edge;
+    void (*handler)(void*);
+    void *arg;
+
+    HOST_PIN() :
+        level(LOW),
+        edge(0),
+        handler(NULL),
+        arg(NULL)
+    {}
+};
+
+// A level written here runs the attached handler on the writing thread when
+// the edge matches, like the GPIO ISR preempting whatever task is running.
+class HostPins {
+    private:
+        HOST_PIN pins[HOST_PIN_COUNT];
+
+    public:
+        void attach(uint8_t pin, void (*handler)(void*), void *arg, int edge) {
+            if (pin >= HOST_PIN_COUNT) return;
+            this->pins[pin].handler = handler;
+            this->pins[pin].arg = arg;
+            this->pins[pin].edge = edge;
+        }
+
+        void detach(uint8_t pin) {
+            if (pin < HOST_PIN_COUNT) this->pins[pin].handler = NULL;
+        }
+
+        int read(uint8_t pin) const {
+            return pin < HOST_PIN_COUNT ? this->pins[pin].level : LOW;
+        }
+
+        void write(uint8_t pin, int level) {
+            if (pin >= HOST_PIN_COUNT) return;
+            HOST_PIN &target = this->pins[pin];
+            if (target.level == level) return;
+            target.level = level;
+
+            int edge = level == HIGH ? RISING : FALLING;
+            if (target.handler != NULL && (target.edge & edge)) target.handler(target.arg);
+        }
+
+        // one full pulse, a rising and a falling edge
+        void pulse(uint8_t pin) {
+            this->write(pin, HIGH);
+            this->write(pin, LOW);
+        }
+};
+
+inline HostPins &hostPins() {
+    static HostPins pins;
+    return pins;
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+
+inline int digitalRead(uint8_t pin) {
+    return hostPins().read(pin);
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t level) {
+    hostPins().write(pin, level);
+}
+
+inline void attachInterruptArg(uint8_t pin, void (*handler)(void*), void *arg, int edge) {
+    hostPins().attach(pin, handler, arg, edge);
+}
+
+inline void detachInterrupt(uint8_t pin) {
+    hostPins().detach(pin);
+}
+
+// FreeRTOS as seen through the ESP32 core, threads and mutexes underneath
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef std::mutex *SemaphoreHandle_t;
+typedef std::mutex portMUX_TYPE;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define portMUX_INITIALIZER_UNLOCKED portMUX_TYPE()
+#define portENTER_CRITICAL(mux) (mux)->lock()
+#define portEXIT_CRITICAL(mux) (mux)->unlock()
+#define portYIELD_FROM_ISR(...)
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new std::mutex();
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    semaphore->lock();
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    semaphore->unlock();
+    return pdTRUE;
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    delay(ticks * portTICK_PERIOD_MS);
+}
+
+// a task is a thread with its notification value
+struct HostTask {
+    std::mutex lock;
+    std::condition_variable wake;
+    uint32_t notified = 0;
+};
+
+typedef HostTask *TaskHandle_t;
+
+// the task of the calling thread, threads not made by xTaskCreate get one too
+inline HostTask *&hostCurrentTask() {
+    static thread_local HostTask own;
+    static thread_local HostTask *task = &own;
+    return task;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return hostCurrentTask();
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char *name, uint32_t stack, void *parameters,
+                                          unsigned priority, TaskHandle_t *handle, BaseType_t core) {
+    HostTask *created = new HostTask();
+    std::thread([task, parameters, created]() {
+        hostCurrentTask() = created;
+        task(parameters);
+    }).detach();
+    if (handle != NULL) *handle = created;
+    return pdTRUE;
+}
+
+inline void xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> guard(task->lock);
+    task->notified++;
+    task->wake.notify_one();
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+    xTaskNotifyGive(task);
+    if (woken != NULL) *woken = pdTRUE;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    HostTask *task = hostCurrentTask();
+    std::unique_lock<std::mutex> guard(task->lock);
+    if (ticks == portMAX_DELAY) task->wake.wait(guard, [task]() { return task->notified > 0; });
+    else task->wake.wait_for(guard, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS),
+                             [task]() { return task->notified > 0; });
+
+    uint32_t value = task->notified;
+    if (value > 0) task->notified = clear ? 0 : value - 1;
+    return value;
+}
+
+// the ESP32 core pulls the system calls in with Arduino.h
+#include "esp_system.h"
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef HOST_ASYNC_JSON
+#define HOST_ASYNC_JSON
+
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+
+typedef std::function<void(AsyncWebServerRequest*, JsonVariant&)> ArJsonRequestHandlerFunction;
+
+// parses the body of a POST, PUT or PATCH and hands the document over
+class AsyncCallbackJsonWebHandler : public AsyncWebHandler {
+    private:
+        String uri;
+        ArJsonRequestHandlerFunction handler;
+
+    public:
+        AsyncCallbackJsonWebHandler(const String &uri, ArJsonRequestHandlerFunction handler) :
+            uri(uri),
+            handler(handler)
+        {}
+
+        bool canHandle(AsyncWebServerRequest *request) override {
+            return (request->getMethod() & (HTTP_POST | HTTP_PUT | HTTP_PATCH)) && request->url() == this->uri;
+        }
+
+        void handleRequest(AsyncWebServerRequest *request) override {
+            JsonDocument doc;
+            if (deserializeJson(doc, request->body) != DeserializationError::Ok) {
+                request->send(400);
+                return;
+            }
+            JsonVariant data = doc.as<JsonVariant>();
+            this->handler(request, data);
+        }
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HOST_CLIENT
+#define HOST_CLIENT
+
+#include <Arduino.h>
+
+// the Arduino Client interface the MQTT client is written against
+class Client {
+    public:
+        virtual ~Client() {}
+        virtual int connect(const char *host, uint16_t port) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual void stop() = 0;
+        virtual uint8_t connected() = 0;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef HOST_DALLAS_TEMPERATURE
+#define HOST_DALLAS_TEMPERATURE
+
+#include <Arduino.h>
+#include <OneWire.h>
+
+#define DEVICE_DISCONNECTED_C -127
+
+typedef uint8_t DeviceAddress[8];
+
+// the sensors hostBuses() holds for the pin of the wire, conversions are instant
+class DallasTemperature {
+    private:
+        OneWire *wire = NULL;
+
+        uint8_t getPin() const {
+            return this->wire ? this->wire->getPin() : 0;
+        }
+
+    public:
+        void setOneWire(OneWire *wire) {
+            this->wire = wire;
+        }
+
+        void begin() {}
+        void setWaitForConversion(bool wait) {}
+        void requestTemperatures() {}
+
+        uint8_t getDeviceCount() {
+            HOST_SENSOR sensor;
+            uint8_t count = 0;
+            while (hostBuses().find(this->getPin(), count, sensor)) count++;
+            return count;
+        }
+
+        bool getAddress(uint8_t *rom, uint8_t index) {
+            HOST_SENSOR sensor;
+            if (!hostBuses().find(this->getPin(), index, sensor)) return false;
+            memcpy(rom, sensor.rom, sizeof(DeviceAddress));
+            return true;
+        }
+
+        uint8_t getResolution(const uint8_t *rom) {
+            HOST_SENSOR sensor;
+            return hostBuses().find(this->getPin(), rom, sensor) ? sensor.resolution : 0;
+        }
+
+        bool setResolution(const uint8_t *rom, uint8_t resolution, bool skipGlobal) {
+            return hostBuses().setResolution(this->getPin(), rom, resolution);
+        }
+
+        uint16_t millisToWaitForConversion(uint8_t resolution) {
+            return 0;
+        }
+
+        float getTempC(const uint8_t *rom) {
+            HOST_SENSOR sensor;
+            return hostBuses().find(this->getPin(), rom, sensor) ? sensor.celsius : DEVICE_DISCONNECTED_C;
+        }
+};
+
+#endif
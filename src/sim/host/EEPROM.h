@@ -0,0 +1,34 @@
+#ifndef HOST_EEPROM
+#define HOST_EEPROM
+
+#include <Arduino.h>
+#include <vector>
+
+// Host stand-in for the emulated EEPROM, erased bytes read 0xFF like a fresh
+// flash sector. It lives as long as the process, across Component instances.
+class HostEEPROM {
+    private:
+        std::vector<uint8_t> bytes;
+
+    public:
+        bool begin(size_t size) {
+            if (this->bytes.size() < size) this->bytes.resize(size, 0xFF);
+            return true;
+        }
+
+        uint8_t read(int address) {
+            return address >= 0 && (size_t)address < this->bytes.size() ? this->bytes[address] : 0xFF;
+        }
+
+        void write(int address, uint8_t value) {
+            if (address >= 0 && (size_t)address < this->bytes.size()) this->bytes[address] = value;
+        }
+
+        bool commit() {
+            return true;
+        }
+};
+
+static HostEEPROM EEPROM __attribute__((unused));
+
+#endif
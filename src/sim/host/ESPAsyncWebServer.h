@@ -0,0 +1,367 @@
+#ifndef HOST_ASYNC_WEB_SERVER
+#define HOST_ASYNC_WEB_SERVER
+
+#include <Arduino.h>
+#include <memory>
+#include <vector>
+
+// Host stand-in for ESPAsyncWebServer without a socket. A test builds an
+// AsyncWebServerRequest, hands it to the server the firmware registered
+// its routes on and reads the response back from the request. Chunked
+// bodies are drained within send(), event sources record their frames.
+
+typedef enum {
+    HTTP_GET = 0b00000001,
+    HTTP_POST = 0b00000010,
+    HTTP_PUT = 0b00001000,
+    HTTP_PATCH = 0b00010000,
+    HTTP_ANY = 0b01111111,
+} WebRequestMethod;
+
+typedef uint8_t WebRequestMethodComposite;
+
+class AsyncWebHeader {
+    private:
+        String name;
+        String text;
+
+    public:
+        AsyncWebHeader(const String &name, const String &text) : name(name), text(text) {}
+
+        const String &value() const {
+            return this->text;
+        }
+
+        const String &getName() const {
+            return this->name;
+        }
+};
+
+typedef AsyncWebHeader AsyncWebParameter;
+
+typedef std::function<size_t(uint8_t*, size_t, size_t)> AwsResponseFiller;
+
+class AsyncWebServerResponse {
+    public:
+        int code;
+        String contentType;
+        std::string body;
+        std::vector<AsyncWebHeader> headers;
+
+        AsyncWebServerResponse(int code, const String &contentType) : code(code), contentType(contentType) {}
+        virtual ~AsyncWebServerResponse() {}
+
+        void addHeader(const String &name, const String &value) {
+            this->headers.push_back(AsyncWebHeader(name, value));
+        }
+
+        const AsyncWebHeader *getHeader(const char *name) const {
+            for (const AsyncWebHeader &header : this->headers) {
+                if (header.getName() == name) return &header;
+            }
+            return NULL;
+        }
+
+        // fills the body of responses that produce it lazily
+        virtual void drain() {}
+};
+
+// holds its own copy of the content until it is sent, as the real one does
+class AsyncBasicResponse : public AsyncWebServerResponse {
+    private:
+        String content;
+
+    public:
+        AsyncBasicResponse(int code, const String &contentType, const String &content) :
+            AsyncWebServerResponse(code, contentType),
+            content(content)
+        {}
+
+        void drain() override {
+            this->body = this->content.c_str();
+        }
+};
+
+class AsyncResponseStream : public AsyncWebServerResponse, public Print {
+    public:
+        using Print::write;
+
+        AsyncResponseStream(const String &contentType) : AsyncWebServerResponse(200, contentType) {}
+
+        size_t write(uint8_t c) override {
+            this->body.push_back((char)c);
+            return 1;
+        }
+
+        size_t write(const uint8_t *buffer, size_t size) override {
+            this->body.append(reinterpret_cast<const char*>(buffer), size);
+            return size;
+        }
+};
+
+// asked for up to HOST_CHUNK_SIZE bytes at a time, the TCP window of the real server
+#define HOST_CHUNK_SIZE 1436
+
+class AsyncChunkedResponse : public AsyncWebServerResponse {
+    private:
+        AwsResponseFiller filler;
+
+    public:
+        size_t chunks = 0;
+
+        AsyncChunkedResponse(const String &contentType, AwsResponseFiller filler) :
+            AsyncWebServerResponse(200, contentType),
+            filler(filler)
+        {}
+
+        void drain() override {
+            uint8_t buffer[HOST_CHUNK_SIZE];
+            while (true) {
+                size_t length = this->filler(buffer, sizeof(buffer), this->body.size());
+                if (length == 0) break;
+                this->body.append(reinterpret_cast<const char*>(buffer), length);
+                this->chunks++;
+            }
+        }
+};
+
+// a body of known length produced by the filler, nothing is copied up front
+class AsyncCallbackResponse : public AsyncWebServerResponse {
+    private:
+        size_t length;
+        AwsResponseFiller filler;
+
+    public:
+        AsyncCallbackResponse(const String &contentType, size_t length, AwsResponseFiller filler) :
+            AsyncWebServerResponse(200, contentType),
+            length(length),
+            filler(filler)
+        {}
+
+        void drain() override {
+            uint8_t buffer[HOST_CHUNK_SIZE];
+            this->body.reserve(this->length);
+            while (this->body.size() < this->length) {
+                size_t length = this->filler(buffer, min(sizeof(buffer), this->length - this->body.size()), this->body.size());
+                if (length == 0) break;
+                this->body.append(reinterpret_cast<const char*>(buffer), length);
+            }
+        }
+};
+
+class AsyncWebServerRequest {
+    private:
+        WebRequestMethodComposite method;
+        String path;
+        std::vector<AsyncWebHeader> headers;
+        std::vector<AsyncWebParameter> params;
+        std::unique_ptr<AsyncWebServerResponse> response;
+
+        const AsyncWebHeader *find(const std::vector<AsyncWebHeader> &list, const char *name) const {
+            for (const AsyncWebHeader &entry : list) {
+                if (entry.getName() == name) return &entry;
+            }
+            return NULL;
+        }
+
+    public:
+        // the body of a POST, read by the JSON handler
+        std::string body;
+
+        AsyncWebServerRequest(WebRequestMethodComposite method, const String &path, const std::string &body = "") :
+            method(method),
+            path(path),
+            body(body)
+        {}
+
+        void addHeader(const String &name, const String &value) {
+            this->headers.push_back(AsyncWebHeader(name, value));
+        }
+
+        void addParam(const String &name, const String &value) {
+            this->params.push_back(AsyncWebParameter(name, value));
+        }
+
+        WebRequestMethodComposite getMethod() const {
+            return this->method;
+        }
+
+        const String &url() const {
+            return this->path;
+        }
+
+        bool hasHeader(const char *name) const {
+            return this->find(this->headers, name) != NULL;
+        }
+
+        const AsyncWebHeader *getHeader(const char *name) const {
+            return this->find(this->headers, name);
+        }
+
+        bool hasParam(const char *name) const {
+            return this->find(this->params, name) != NULL;
+        }
+
+        const AsyncWebParameter *getParam(const char *name) const {
+            return this->find(this->params, name);
+        }
+
+        AsyncWebServerResponse *beginResponse(int code, const String &contentType = String(), const String &content = String()) {
+            return new AsyncBasicResponse(code, contentType, content);
+        }
+
+        AsyncWebServerResponse *beginResponse(const String &contentType, size_t length, AwsResponseFiller filler) {
+            return new AsyncCallbackResponse(contentType, length, filler);
+        }
+
+        AsyncWebServerResponse *beginResponse_P(int code, const String &contentType, const uint8_t *content, size_t length) {
+            AsyncWebServerResponse *response = new AsyncWebServerResponse(code, contentType);
+            response->body.assign(reinterpret_cast<const char*>(content), length);
+            return response;
+        }
+
+        AsyncResponseStream *beginResponseStream(const String &contentType) {
+            return new AsyncResponseStream(contentType);
+        }
+
+        AsyncWebServerResponse *beginChunkedResponse(const String &contentType, AwsResponseFiller filler) {
+            return new AsyncChunkedResponse(contentType, filler);
+        }
+
+        void send(AsyncWebServerResponse *response) {
+            response->drain();
+            this->response.reset(response);
+        }
+
+        void send(int code, const String &contentType = String(), const String &content = String()) {
+            this->send(this->beginResponse(code, contentType, content));
+        }
+
+        // NULL until a handler answered
+        AsyncWebServerResponse *getResponse() const {
+            return this->response.get();
+        }
+};
+
+typedef std::function<void(AsyncWebServerRequest*)> ArRequestHandlerFunction;
+
+class AsyncWebHandler {
+    public:
+        virtual ~AsyncWebHandler() {}
+        virtual bool canHandle(AsyncWebServerRequest *request) = 0;
+        virtual void handleRequest(AsyncWebServerRequest *request) = 0;
+};
+
+class AsyncCallbackWebHandler : public AsyncWebHandler {
+    private:
+        String uri;
+        WebRequestMethodComposite method;
+        ArRequestHandlerFunction handler;
+
+    public:
+        AsyncCallbackWebHandler(const String &uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler) :
+            uri(uri),
+            method(method),
+            handler(handler)
+        {}
+
+        bool canHandle(AsyncWebServerRequest *request) override {
+            return (request->getMethod() & this->method) && request->url() == this->uri;
+        }
+
+        void handleRequest(AsyncWebServerRequest *request) override {
+            this->handler(request);
+        }
+};
+
+class AsyncEventSourceClient {};
+
+typedef std::function<void(AsyncEventSourceClient*)> ArEventHandlerFunction;
+
+// listeners are opened by the test, sent frames are kept for it to read
+class AsyncEventSource : public AsyncWebHandler {
+    private:
+        String uri;
+        ArEventHandlerFunction connectHandler;
+        std::vector<std::unique_ptr<AsyncEventSourceClient>> clients;
+
+    public:
+        std::vector<std::string> frames;
+
+        AsyncEventSource(const String &uri) : uri(uri) {}
+
+        void onConnect(ArEventHandlerFunction handler) {
+            this->connectHandler = handler;
+        }
+
+        size_t count() const {
+            return this->clients.size();
+        }
+
+        void send(const char *message, const char *event = NULL, uint32_t id = 0, uint32_t reconnect = 0) {
+            this->frames.push_back(message);
+        }
+
+        // a GET on the source opens a listener, like an EventSource in the page
+        bool canHandle(AsyncWebServerRequest *request) override {
+            return request->getMethod() == HTTP_GET && request->url() == this->uri;
+        }
+
+        void handleRequest(AsyncWebServerRequest *request) override {
+            this->clients.emplace_back(new AsyncEventSourceClient());
+            if (this->connectHandler) this->connectHandler(this->clients.back().get());
+            request->send(200, "text/event-stream");
+        }
+
+        void close() {
+            this->clients.clear();
+        }
+};
+
+class AsyncWebServer;
+
+// the server constructed last, the one the firmware under test runs
+inline AsyncWebServer *&hostWebServer() {
+    static AsyncWebServer *server = NULL;
+    return server;
+}
+
+class AsyncWebServer {
+    private:
+        uint16_t port;
+        std::vector<AsyncWebHandler*> handlers;
+        std::vector<std::unique_ptr<AsyncWebHandler>> owned;
+
+    public:
+        AsyncWebServer(uint16_t port) : port(port) {
+            hostWebServer() = this;
+        }
+
+        ~AsyncWebServer() {
+            if (hostWebServer() == this) hostWebServer() = NULL;
+        }
+
+        void begin() {}
+
+        void on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler) {
+            this->owned.emplace_back(new AsyncCallbackWebHandler(uri, method, handler));
+            this->handlers.push_back(this->owned.back().get());
+        }
+
+        AsyncWebHandler &addHandler(AsyncWebHandler *handler) {
+            this->handlers.push_back(handler);
+            return *handler;
+        }
+
+        // the first handler that takes the request answers it, 404 otherwise
+        void handle(AsyncWebServerRequest *request) {
+            for (AsyncWebHandler *handler : this->handlers) {
+                if (!handler->canHandle(request)) continue;
+                handler->handleRequest(request);
+                return;
+            }
+            request->send(404);
+        }
+};
+
+#endif
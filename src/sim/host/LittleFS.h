@@ -0,0 +1,192 @@
+#ifndef HOST_LITTLEFS
+#define HOST_LITTLEFS
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+
+// Host stand-in for LittleFS kept in RAM. Every simulated device owns a
+// HostFiles and binds it before it runs, so their config files never mix.
+// Threads that bind nothing, the firmware tasks of a native test, share one.
+
+// littlefs partition of the esp32dev layout and its block size
+#define HOST_FS_SIZE 0x160000
+#define HOST_FS_BLOCK 4096
+
+struct HostFiles {
+    std::map<std::string, std::shared_ptr<std::string>> files;
+    std::recursive_mutex lock;
+    size_t capacity = HOST_FS_SIZE;
+
+    // Bytes still written before the power is cut, -1 never. The write that
+    // crosses it is torn at that byte and no write lands after it.
+    long powerBudget = -1;
+    // copy-on-write like littlefs: a write programs a fresh copy of every
+    // block it touches, each one an erase
+    uint64_t erases = 0;
+    uint64_t bytesWritten = 0;
+
+    // whole blocks taken by the files, plus the two superblocks
+    size_t used() {
+        std::lock_guard<std::recursive_mutex> guard(this->lock);
+        size_t blocks = 2;
+        for (auto &file : this->files) blocks += (file.second->size() + HOST_FS_BLOCK - 1) / HOST_FS_BLOCK;
+        return blocks * HOST_FS_BLOCK;
+    }
+
+    void clear() {
+        std::lock_guard<std::recursive_mutex> guard(this->lock);
+        this->files.clear();
+        this->powerBudget = -1;
+        this->erases = 0;
+        this->bytesWritten = 0;
+    }
+};
+
+inline HostFiles *&hostFiles() {
+    static HostFiles shared;
+    static thread_local HostFiles *files = &shared;
+    return files;
+}
+
+class File {
+    private:
+        HostFiles *owner = NULL;
+        std::shared_ptr<std::string> data;
+        size_t offset = 0;
+        bool append = false;
+
+    public:
+        File() {}
+
+        File(HostFiles *owner, std::shared_ptr<std::string> data, size_t offset, bool append) :
+            owner(owner),
+            data(data),
+            offset(offset),
+            append(append)
+        {}
+
+        explicit operator bool() const {
+            return this->data != NULL;
+        }
+
+        size_t read(uint8_t *buffer, size_t length) {
+            if (this->data == NULL) return 0;
+            std::lock_guard<std::recursive_mutex> guard(this->owner->lock);
+            if (this->offset >= this->data->size()) return 0;
+            length = min(length, this->data->size() - this->offset);
+            memcpy(buffer, this->data->data() + this->offset, length);
+            this->offset += length;
+            return length;
+        }
+
+        // "a" writes at the end whatever the position, like O_APPEND. A full
+        // partition takes what fits in its last block and refuses the rest.
+        size_t write(const uint8_t *buffer, size_t length) {
+            if (this->data == NULL) return 0;
+            std::lock_guard<std::recursive_mutex> guard(this->owner->lock);
+            if (this->append) this->offset = this->data->size();
+            if (this->owner->powerBudget >= 0) {
+                length = min(length, (size_t)this->owner->powerBudget);
+                this->owner->powerBudget -= length;
+            }
+
+            size_t size = this->data->size();
+            size_t end = this->offset + length;
+            if (end > size) {
+                size_t slack = (size + HOST_FS_BLOCK - 1) / HOST_FS_BLOCK * HOST_FS_BLOCK - size;
+                size_t used = this->owner->used();
+                size_t fits = slack + (this->owner->capacity > used ? this->owner->capacity - used : 0);
+                if (end - size > fits) {
+                    end = size + fits;
+                    length = end > this->offset ? end - this->offset : 0;
+                }
+                this->data->resize(max(end, size));
+            }
+
+            if (length > 0) {
+                memcpy(&(*this->data)[this->offset], buffer, length);
+                this->owner->erases += (this->offset + length - 1) / HOST_FS_BLOCK - this->offset / HOST_FS_BLOCK + 1;
+                this->owner->bytesWritten += length;
+            }
+            this->offset += length;
+            return length;
+        }
+
+        bool seek(size_t offset) {
+            this->offset = offset;
+            return this->data != NULL && offset <= this->data->size();
+        }
+
+        size_t size() const {
+            return this->data ? this->data->size() : 0;
+        }
+
+        size_t position() const {
+            return this->offset;
+        }
+
+        void close() {
+            this->data = NULL;
+        }
+};
+
+class HostFS {
+    public:
+        bool begin() {
+            return true;
+        }
+
+        // "r", "r+", "w" and "a", the modes the firmware opens files with
+        File open(const String &path, const char *mode) {
+            HostFiles &files = *hostFiles();
+            std::lock_guard<std::recursive_mutex> guard(files.lock);
+
+            if (mode[0] == 'r') {
+                auto found = files.files.find(path.c_str());
+                if (found == files.files.end()) return File();
+                return File(&files, found->second, 0, false);
+            }
+
+            // without power nothing is created or truncated
+            if (files.powerBudget == 0) return File();
+            std::shared_ptr<std::string> &data = files.files[path.c_str()];
+            if (data == NULL || mode[0] == 'w') data = std::make_shared<std::string>();
+            return File(&files, data, mode[0] == 'a' ? data->size() : 0, mode[0] == 'a');
+        }
+
+        bool exists(const String &path) {
+            HostFiles &files = *hostFiles();
+            std::lock_guard<std::recursive_mutex> guard(files.lock);
+            return files.files.count(path.c_str()) > 0;
+        }
+
+        bool remove(const String &path) {
+            HostFiles &files = *hostFiles();
+            std::lock_guard<std::recursive_mutex> guard(files.lock);
+            if (files.powerBudget == 0) return false;
+            return files.files.erase(path.c_str()) > 0;
+        }
+
+        bool rename(const String &from, const String &to) {
+            HostFiles &files = *hostFiles();
+            std::lock_guard<std::recursive_mutex> guard(files.lock);
+            auto found = files.files.find(from.c_str());
+            if (found == files.files.end() || files.powerBudget == 0) return false;
+            files.files[to.c_str()] = found->second;
+            files.files.erase(found);
+            return true;
+        }
+
+        size_t totalBytes() {
+            return hostFiles()->capacity;
+        }
+
+        size_t usedBytes() {
+            return hostFiles()->used();
+        }
+};
+
+static HostFS LittleFS __attribute__((unused));
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef HOST_ONEWIRE
+#define HOST_ONEWIRE
+
+#include <Arduino.h>
+#include <vector>
+
+// one DS18B20 on a host bus, tests plug and unplug it and set its temperature
+struct HOST_SENSOR {
+    uint8_t rom[8];
+    float celsius;
+    uint8_t resolution;
+    bool present;
+};
+
+// the sensors of every bus by pin, empty unless a test adds some
+class HostBuses {
+    private:
+        std::mutex lock;
+        std::vector<std::pair<uint8_t, HOST_SENSOR>> sensors;
+
+    public:
+        void add(uint8_t pin, const uint8_t *rom, float celsius) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            HOST_SENSOR sensor = {};
+            memcpy(sensor.rom, rom, sizeof(sensor.rom));
+            sensor.celsius = celsius;
+            sensor.resolution = 12;
+            sensor.present = true;
+            this->sensors.push_back(std::make_pair(pin, sensor));
+        }
+
+        // a missing sensor stays known to the bus and can come back
+        void setPresent(const uint8_t *rom, bool present) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            for (auto &entry : this->sensors) {
+                if (memcmp(entry.second.rom, rom, 8) == 0) entry.second.present = present;
+            }
+        }
+
+        void setCelsius(const uint8_t *rom, float celsius) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            for (auto &entry : this->sensors) {
+                if (memcmp(entry.second.rom, rom, 8) == 0) entry.second.celsius = celsius;
+            }
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->sensors.clear();
+        }
+
+        // the index-th present sensor of the bus on pin
+        bool find(uint8_t pin, uint8_t index, HOST_SENSOR &found) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            for (auto &entry : this->sensors) {
+                if (entry.first != pin || !entry.second.present) continue;
+                if (index-- == 0) {
+                    found = entry.second;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool find(uint8_t pin, const uint8_t *rom, HOST_SENSOR &found) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            for (auto &entry : this->sensors) {
+                if (entry.first != pin || !entry.second.present || memcmp(entry.second.rom, rom, 8) != 0) continue;
+                found = entry.second;
+                return true;
+            }
+            return false;
+        }
+
+        bool setResolution(uint8_t pin, const uint8_t *rom, uint8_t resolution) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            for (auto &entry : this->sensors) {
+                if (entry.first != pin || !entry.second.present || memcmp(entry.second.rom, rom, 8) != 0) continue;
+                entry.second.resolution = resolution;
+                return true;
+            }
+            return false;
+        }
+};
+
+inline HostBuses &hostBuses() {
+    static HostBuses buses;
+    return buses;
+}
+
+class OneWire {
+    private:
+        uint8_t pin = 0;
+
+    public:
+        void begin(uint8_t pin) {
+            this->pin = pin;
+        }
+
+        uint8_t getPin() const {
+            return this->pin;
+        }
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef HOST_WIFI
+#define HOST_WIFI
+
+#include <Arduino.h>
+
+#include "../SocketClient.hpp"
+
+// Host stand-in for the ESP32 station. Every simulated device owns a
+// HostRadio and binds it before it runs, WiFi then acts on that radio, so
+// the connection manager of each device sees its own station events.
+// Threads that bind nothing, the firmware tasks of a native test, share one.
+
+typedef enum {
+    ARDUINO_EVENT_WIFI_STA_GOT_IP,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+    ARDUINO_EVENT_WIFI_STA_LOST_IP,
+} arduino_event_id_t;
+
+typedef struct {} arduino_event_info_t;
+
+typedef enum {
+    WIFI_PS_NONE,
+    WIFI_PS_MIN_MODEM,
+    WIFI_PS_MAX_MODEM,
+} wifi_ps_type_t;
+
+typedef std::function<void(arduino_event_id_t, arduino_event_info_t)> WiFiEventFunction;
+
+// a station that gets its address associateMs after an attempt
+class HostRadio {
+    private:
+        WiFiEventFunction handler;
+        unsigned long upAt = 0;
+        bool associating = false;
+        bool up = false;
+
+        void raise(arduino_event_id_t event) {
+            if (this->handler) this->handler(event, arduino_event_info_t());
+        }
+
+    public:
+        // association time of WiFi.begin() (ms), 0 comes up within the call
+        unsigned long associateMs = 0;
+        int8_t rssi = -60;
+        IPAddress address = IPAddress(127, 0, 0, 1);
+
+        void onEvent(WiFiEventFunction handler) {
+            this->handler = handler;
+        }
+
+        void associate(unsigned long associateMs) {
+            if (this->up || this->associating) return;
+            this->associating = true;
+            this->upAt = millis() + associateMs;
+            if (associateMs == 0) this->tick();
+        }
+
+        void disconnect() {
+            bool wasUp = this->up;
+            this->associating = false;
+            this->up = false;
+            if (wasUp) this->raise(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+        }
+
+        // raises GOT_IP once the association is done
+        void tick() {
+            if (!this->associating || (long)(millis() - this->upAt) < 0) return;
+            this->associating = false;
+            this->up = true;
+            this->raise(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+        }
+
+        bool isUp() const {
+            return this->up;
+        }
+};
+
+inline HostRadio *&hostRadio() {
+    static HostRadio shared;
+    static thread_local HostRadio *radio = &shared;
+    return radio;
+}
+
+class WiFiClass {
+    public:
+        void onEvent(WiFiEventFunction handler) {
+            hostRadio()->onEvent(handler);
+        }
+
+        bool config(IPAddress ip, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress()) {
+            if (ip != IPAddress()) hostRadio()->address = ip;
+            return true;
+        }
+
+        void begin(const String &ssid, const String &password) {
+            hostRadio()->associate(hostRadio()->associateMs);
+        }
+
+        bool disconnect() {
+            hostRadio()->disconnect();
+            return true;
+        }
+
+        bool setSleep(wifi_ps_type_t type) {
+            return true;
+        }
+
+        bool softAPConfig(IPAddress ip, IPAddress gateway, IPAddress subnet) {
+            return true;
+        }
+
+        bool softAP(const char *ssid, const char *password) {
+            return true;
+        }
+
+        int8_t RSSI() {
+            return hostRadio()->isUp() ? hostRadio()->rssi : 0;
+        }
+
+        IPAddress localIP() {
+            return hostRadio()->isUp() ? hostRadio()->address : IPAddress();
+        }
+};
+
+static WiFiClass WiFi __attribute__((unused));
+
+// the ESP32 client takes its timeout in seconds
+class WiFiClient : public SocketClient {
+    public:
+        void setTimeout(uint32_t seconds) {
+            SocketClient::setTimeout(seconds * 1000);
+        }
+};
+
+#endif
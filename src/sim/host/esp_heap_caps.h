@@ -0,0 +1,13 @@
+#ifndef HOST_ESP_HEAP_CAPS
+#define HOST_ESP_HEAP_CAPS
+
+#include "esp_system.h"
+
+#define MALLOC_CAP_8BIT (1 << 2)
+
+// the host heap does not fragment the way the ESP32's does, the free heap stands in
+inline size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return esp_get_free_heap_size();
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef HOST_ESP_ROM_CRC
+#define HOST_ESP_ROM_CRC
+
+#include <stdint.h>
+
+// CRC-32 (IEEE), same result as the ROM routine of the ESP32
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buffer, uint32_t length) {
+    crc = ~crc;
+    while (length--) {
+        crc ^= *buffer++;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+#endif
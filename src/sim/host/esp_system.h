@@ -0,0 +1,52 @@
+#ifndef HOST_ESP_SYSTEM
+#define HOST_ESP_SYSTEM
+
+#include <Arduino.h>
+#include <malloc.h>
+
+// Heap figures of the host process against a made-up heap of HOST_HEAP_SIZE.
+// Only the differences mean something, they are what the benchmark probes read.
+#define HOST_HEAP_SIZE (256 * 1024 * 1024)
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+    ESP_RST_DEEPSLEEP,
+    ESP_RST_BROWNOUT,
+    ESP_RST_SDIO,
+} esp_reset_reason_t;
+
+inline std::atomic<uint32_t> &hostMinimumFreeHeap() {
+    static std::atomic<uint32_t> minimum(HOST_HEAP_SIZE);
+    return minimum;
+}
+
+inline uint32_t esp_get_free_heap_size() {
+    size_t used = mallinfo2().uordblks;
+    uint32_t free = used < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - used : 0;
+
+    uint32_t minimum = hostMinimumFreeHeap().load();
+    while (free < minimum && !hostMinimumFreeHeap().compare_exchange_weak(minimum, free)) {}
+    return free;
+}
+
+inline uint32_t esp_get_minimum_free_heap_size() {
+    esp_get_free_heap_size();
+    return hostMinimumFreeHeap().load();
+}
+
+inline esp_reset_reason_t esp_reset_reason() {
+    return ESP_RST_POWERON;
+}
+
+inline uint32_t esp_random() {
+    return (uint32_t)hostRandom()();
+}
+
+#endif
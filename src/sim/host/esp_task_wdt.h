@@ -0,0 +1,13 @@
+#ifndef HOST_ESP_TASK_WDT
+#define HOST_ESP_TASK_WDT
+
+// no watchdog on the host
+static inline int esp_task_wdt_add(void *task) {
+    return 0;
+}
+
+static inline int esp_task_wdt_reset() {
+    return 0;
+}
+
+#endif
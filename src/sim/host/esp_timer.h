@@ -0,0 +1,11 @@
+#ifndef HOST_ESP_TIMER
+#define HOST_ESP_TIMER
+
+#include <Arduino.h>
+
+// microseconds on the host clock, like esp_timer since boot
+inline int64_t esp_timer_get_time() {
+    return micros();
+}
+
+#endif
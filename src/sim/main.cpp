@@ -0,0 +1,120 @@
+// Fleet simulator: thousands of virtual DWEB08 units on the host, against
+// one broker, for load tests of the broker and the backend without the
+// hardware. Built by the native-sim environment:
+//
+//   mosquitto -c mosquitto.conf          (max_connections -1, a listener on 1883)
+//   ulimit -n 65536
+//   pio run -e native-sim
+//   .pio/build/native-sim/program --devices 5000 --workers 8 --interval 10
+//       --storm-every 60 --storm-fraction 30 --duration 300   (one command line)
+//
+// Every report period prints one JSON line, the run ends with a summary
+// line holding the end-to-end latency and the command round trips.
+
+#include <Arduino.h>
+#include <getopt.h>
+
+#include "DeviceSettings.hpp"
+#include "FleetSimulator.hpp"
+
+static const option SIM_ARGUMENTS[] = {
+    { "broker", required_argument, NULL, 'b' },
+    { "port", required_argument, NULL, 'p' },
+    { "prefix", required_argument, NULL, 't' },
+    { "devices", required_argument, NULL, 'n' },
+    { "workers", required_argument, NULL, 'w' },
+    { "duration", required_argument, NULL, 'd' },
+    { "report", required_argument, NULL, 'r' },
+    { "ramp", required_argument, NULL, 'R' },
+    { "interval", required_argument, NULL, 'i' },
+    { "jitter", required_argument, NULL, 'j' },
+    { "profile", required_argument, NULL, 'P' },
+    { "rate", required_argument, NULL, 'q' },
+    { "format", required_argument, NULL, 'f' },
+    { "keyframe", required_argument, NULL, 'k' },
+    { "associate", required_argument, NULL, 'a' },
+    { "commands", required_argument, NULL, 'c' },
+    { "storm-every", required_argument, NULL, 's' },
+    { "storm-fraction", required_argument, NULL, 'F' },
+    { "storm-station", no_argument, NULL, 'S' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+};
+
+static void usage(const char *program) {
+    SIM_OPTIONS defaults;
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --broker HOST          broker address (%s)\n"
+        "  --port N               broker port (%u)\n"
+        "  --prefix TOPIC         device n publishes on TOPIC/n (%s)\n"
+        "  --devices N            virtual devices (%u)\n"
+        "  --workers N            threads running the devices (%u)\n"
+        "  --duration S           run time in seconds (%u)\n"
+        "  --report S             seconds between report lines (%u)\n"
+        "  --ramp N               devices started per second, 0 for all at once (%u)\n"
+        "  --interval S           telemetry interval of the devices (%u)\n"
+        "  --jitter PCT           interval drawn in +- PCT percent (%u)\n"
+        "  --profile NAME         steady, random or burst pulses (random)\n"
+        "  --rate N               mean pulses per hour (%.0f)\n"
+        "  --format NAME          json or msgpack telemetry (%s)\n"
+        "  --keyframe N           delta frames between full frames, 0 for full only (%u)\n"
+        "  --associate MS         Wi-Fi association time, +- 50 percent (%u)\n"
+        "  --commands N           data, mqtt and network commands per second (%.0f)\n"
+        "  --storm-every S        seconds between reconnect storms, 0 for none (%u)\n"
+        "  --storm-fraction PCT   devices dropped by a storm (%u)\n"
+        "  --storm-station        a storm drops the Wi-Fi station, not only the broker connection\n",
+        program, defaults.broker.c_str(), defaults.port, defaults.prefix.c_str(), (unsigned)defaults.devices,
+        defaults.workers, (unsigned)defaults.duration, defaults.report, (unsigned)defaults.ramp, defaults.interval,
+        defaults.jitter, defaults.rate, defaults.format.c_str(), defaults.keyframe, (unsigned)defaults.associate,
+        defaults.commands, (unsigned)defaults.stormEvery, defaults.stormFraction);
+}
+
+int main(int argc, char **argv) {
+    SIM_OPTIONS options;
+
+    int argument;
+    while ((argument = getopt_long(argc, argv, "", SIM_ARGUMENTS, NULL)) != -1) {
+        switch (argument) {
+            case 'b': options.broker = optarg; break;
+            case 'p': options.port = atoi(optarg); break;
+            case 't': options.prefix = optarg; break;
+            case 'n': options.devices = max(1, atoi(optarg)); break;
+            case 'w': options.workers = max(1, atoi(optarg)); break;
+            case 'd': options.duration = atoi(optarg); break;
+            case 'r': options.report = max(1, atoi(optarg)); break;
+            case 'R': options.ramp = atoi(optarg); break;
+            case 'i': options.interval = max(1, atoi(optarg)); break;
+            case 'j': options.jitter = constrain(atoi(optarg), 0, 100); break;
+            case 'P':
+                if (strcmp(optarg, "steady") == 0) options.profile = SIM_PROFILE_STEADY;
+                else if (strcmp(optarg, "random") == 0) options.profile = SIM_PROFILE_RANDOM;
+                else if (strcmp(optarg, "burst") == 0) options.profile = SIM_PROFILE_BURST;
+                else {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'q': options.rate = atof(optarg); break;
+            case 'f': options.format = optarg; break;
+            case 'k': options.keyframe = atoi(optarg); break;
+            case 'a': options.associate = atoi(optarg); break;
+            case 'c': options.commands = atof(optarg); break;
+            case 's': options.stormEvery = atoi(optarg); break;
+            case 'F': options.stormFraction = constrain(atoi(optarg), 0, 100); break;
+            case 'S': options.stormStation = true; break;
+            default:
+                usage(argv[0]);
+                return argument == 'h' ? 0 : 2;
+        }
+    }
+    if (options.format != "json" && options.format != "msgpack") {
+        usage(argv[0]);
+        return 2;
+    }
+    options.workers = min((uint32_t)options.workers, options.devices);
+
+    FleetSimulator simulator(options);
+    simulator.run();
+    return 0;
+}
@@ -0,0 +1,108 @@
+// Cost of the pulse path against the number of input channels, shared by the
+// bench_channels_N suites, each of which sets INPUT_CHANNEL_TABLE before it
+// includes this file. A 1 kHz train runs on every channel of the Component
+// at once, then the edge, drain, journal commit and encode costs are timed
+// and printed as a JSON line per channel count:
+// {"bench":"channels","channels":4,"pulses":4000,"edgeNs":450,"drainNs":900,"commitUs":9,"commitBytes":40,"encodeUs":12,"payloadBytes":402}
+// Run with: pio test -e native -f "bench_channels_*" -v
+
+#ifndef BENCH_CHANNELS
+#define BENCH_CHANNELS
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <EEPROM.h>
+#include <thread>
+#include <unity.h>
+
+#include "DeviceSettings.hpp"
+#include "ComponentClass.hpp"
+
+#define BENCH_PULSES 1000
+#define BENCH_RUNS 200
+
+static Component *comp = NULL;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// one edge on every channel, timed, returns the microseconds spent in the edges
+static int64_t pulseAll() {
+    int64_t startedAt = esp_timer_get_time();
+    for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) hostPins().pulse(INPUT_CHANNELS[i].pin);
+    return esp_timer_get_time() - startedAt;
+}
+
+void test_every_channel_counts(void) {
+    uint64_t before[INPUT_CHANNEL_COUNT];
+    for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) before[i] = comp->getCounter(i);
+
+    // a period after each round, never inside the debounce window of a channel
+    for (uint32_t n = 0; n < BENCH_PULSES; n++) {
+        std::chrono::steady_clock::time_point edge = std::chrono::steady_clock::now();
+        pulseAll();
+        std::this_thread::sleep_until(edge + std::chrono::microseconds(1000));
+    }
+    comp->drainPulses();
+
+    for (uint8_t i = 0; i < INPUT_CHANNEL_COUNT; i++) {
+        TEST_ASSERT_EQUAL_UINT64(before[i] + BENCH_PULSES, comp->getCounter(i));
+        TEST_ASSERT_EQUAL_UINT32(0, comp->getPulses(i)->getRejected());
+    }
+}
+
+void test_costs(void) {
+    int64_t edgeUs = 0;
+    int64_t drainUs = 0;
+    int64_t commitUs = 0;
+    uint64_t commitBytes = 0;
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        delay(1);
+        edgeUs += pulseAll();
+
+        int64_t startedAt = esp_timer_get_time();
+        comp->drainPulses();
+        drainUs += esp_timer_get_time() - startedAt;
+
+        // one record for every channel, whatever their number
+        uint64_t written = hostFiles()->bytesWritten;
+        startedAt = esp_timer_get_time();
+        comp->persistCounter(true);
+        commitUs += esp_timer_get_time() - startedAt;
+        commitBytes += hostFiles()->bytesWritten - written;
+        TEST_ASSERT_LESS_OR_EQUAL(sizeof(JOURNAL_HEADER) + INPUT_CHANNEL_COUNT * sizeof(uint64_t) + 2 * sizeof(uint32_t),
+            hostFiles()->bytesWritten - written);
+    }
+
+    TelemetryEncoder encoder;
+    size_t payloadBytes = 0;
+    int64_t startedAt = esp_timer_get_time();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) payloadBytes = encoder.encode("bench", comp->captureSample());
+    int64_t encodeUs = esp_timer_get_time() - startedAt;
+
+    printf("{\"bench\":\"channels\",\"channels\":%u,\"pulses\":%u,\"edgeNs\":%lld,\"drainNs\":%lld,\"commitUs\":%lld,"
+        "\"commitBytes\":%llu,\"encodeUs\":%lld,\"payloadBytes\":%u}\n",
+        (unsigned)INPUT_CHANNEL_COUNT, (unsigned)(INPUT_CHANNEL_COUNT * BENCH_PULSES),
+        (long long)(edgeUs * 1000 / BENCH_RUNS / INPUT_CHANNEL_COUNT), (long long)(drainUs * 1000 / BENCH_RUNS),
+        (long long)(commitUs / BENCH_RUNS), (unsigned long long)(commitBytes / BENCH_RUNS),
+        (long long)(encodeUs / BENCH_RUNS), (unsigned)payloadBytes);
+}
+
+int main(int argc, char **argv) {
+    // the first edge is not debounced against a clock at 0
+    hostAdvance(1);
+    EEPROM.begin(8);
+    comp = new Component();
+    comp->begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_every_channel_counts);
+    RUN_TEST(test_costs);
+
+    int failures = UNITY_END();
+    // the firmware tasks never return, leave without unwinding them
+    fflush(stdout);
+    _exit(failures);
+}
+
+#endif
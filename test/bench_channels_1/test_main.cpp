@@ -0,0 +1,6 @@
+// Pulse path with one input channel, the default table of the firmware
+
+#define INPUT_CHANNEL_TABLE \
+    { 34, RISING, 100, 0 },
+
+#include "../bench_channels.hpp"
@@ -0,0 +1,9 @@
+// Pulse path with four input channels
+
+#define INPUT_CHANNEL_TABLE \
+    { 34, RISING, 100, 0 }, \
+    { 35, RISING, 100, 1 }, \
+    { 36, RISING, 100, 2 }, \
+    { 39, RISING, 100, 3 },
+
+#include "../bench_channels.hpp"
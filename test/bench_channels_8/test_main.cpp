@@ -0,0 +1,13 @@
+// Pulse path with eight input channels, the most a build takes
+
+#define INPUT_CHANNEL_TABLE \
+    { 34, RISING, 100, 0 }, \
+    { 35, RISING, 100, 1 }, \
+    { 36, RISING, 100, 2 }, \
+    { 39, RISING, 100, 3 }, \
+    { 32, RISING, 100, 4 }, \
+    { 33, RISING, 100, 5 }, \
+    { 25, RISING, 100, 6 }, \
+    { 26, RISING, 100, 7 },
+
+#include "../bench_channels.hpp"
@@ -0,0 +1,203 @@
+// The history store on the host over a simulated month of one record a
+// minute with every sensor slot taken. The store keeps each sensor in its
+// slot by ROM, every one of them comes back from a query, a restart picks up
+// the same segments and a sensor swapped in mid-segment takes a free slot
+// while the readings of the old one stay queryable. Query arguments that
+// are not plain unix seconds are refused. The flash cost of the
+// month and the time of a one-day query at a one-hour step are printed as a
+// JSON line:
+// {"bench":"history","records":43200,"recordBytes":50,"appends":4320,"rotations":29,"bytesWritten":2164080,"erases":4860,"onDiskBytes":524288,"queryUs":2600,"rows":24}
+// Run with: pio test -e native -f bench_history -v
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <unity.h>
+#include <string>
+
+#include "DeviceSettings.hpp"
+#include "HistoryStore.hpp"
+
+#define BENCH_DAYS 30
+#define BENCH_START (HISTORY_CLOCK_VALID + 86400)
+
+// the store of the running firmware and of the next boot
+static HistoryStore *store = NULL;
+static HistoryStore *rebooted = NULL;
+
+void setUp(void) {
+    hostFiles()->clear();
+    store = new HistoryStore();
+    rebooted = new HistoryStore();
+}
+
+void tearDown(void) {
+    delete store;
+    delete rebooted;
+}
+
+static void romOf(uint8_t n, uint8_t *rom) {
+    const uint8_t base[8] = { 0x28, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x00 };
+    memcpy(rom, base, sizeof(base));
+    rom[7] = n;
+}
+
+static std::string idOf(uint8_t n) {
+    DeviceAddress rom;
+    char id[17];
+    romOf(n, rom);
+    formatRom(rom, id);
+    return id;
+}
+
+// a reading of every sensor listed, sensor n at 20 + n degrees
+static TELEMETRY_SAMPLE sampleAt(uint32_t i, const uint8_t *sensors, uint8_t count) {
+    TELEMETRY_SAMPLE sample;
+    sample.time = BENCH_START + i * HISTORY_INTERVAL;
+    sample.counters[0] = 1000 + i;
+    sample.rssi = -60;
+    for (uint8_t n = 0; n < count; n++) {
+        romOf(sensors[n], sample.temps[n].rom);
+        sample.temps[n].value = 20 + sensors[n];
+    }
+    sample.tempCount = count;
+    return sample;
+}
+
+// the whole /history answer
+static std::string query(HistoryStore &history, uint32_t from, uint32_t to, uint32_t step) {
+    HistoryCursor cursor(history, from, to, step);
+    std::string answer;
+    uint8_t buffer[512];
+    size_t length;
+    while ((length = cursor.fill(buffer, sizeof(buffer))) > 0) answer.append(reinterpret_cast<char*>(buffer), length);
+    return answer;
+}
+
+static uint32_t occurrences(const std::string &text, const std::string &part) {
+    uint32_t count = 0;
+    for (size_t at = text.find(part); at != std::string::npos; at = text.find(part, at + 1)) count++;
+    return count;
+}
+
+void test_month_of_wear(void) {
+    uint8_t sensors[TEMP_MAX_SENSORS];
+    for (uint8_t n = 0; n < TEMP_MAX_SENSORS; n++) sensors[n] = n;
+
+    uint32_t records = BENCH_DAYS * 86400 / HISTORY_INTERVAL;
+    for (uint32_t i = 0; i < records; i++) store->add(sampleAt(i, sensors, TEMP_MAX_SENSORS));
+    store->flush();
+    TEST_ASSERT_EQUAL_UINT32(0, store->getDropped());
+    TEST_ASSERT_EQUAL_UINT32(records / HISTORY_BATCH, store->getAppends());
+
+    // the table is written with each segment, never rewritten in place
+    uint32_t segments = store->getRotations() + 1;
+    TEST_ASSERT_EQUAL_UINT32(records * sizeof(HISTORY_RECORD) + segments * sizeof(HISTORY_HEADER), store->getBytesWritten());
+
+    // the last day, one row an hour, every sensor in every row
+    uint32_t last = BENCH_START + (records - 1) * HISTORY_INTERVAL;
+    int64_t startedAt = esp_timer_get_time();
+    std::string answer = query(*store, last - 86400 + 1, last, 3600);
+    int64_t queryUs = esp_timer_get_time() - startedAt;
+    uint32_t rows = occurrences(answer, "{\"id\":\"" + idOf(0) + "\"");
+    TEST_ASSERT_EQUAL_UINT32(24, rows);
+    for (uint8_t n = 0; n < TEMP_MAX_SENSORS; n++) {
+        char reading[64];
+        snprintf(reading, sizeof(reading), "{\"id\":\"%s\",\"temp\":%.2f}", idOf(n).c_str(), 20.0f + n);
+        TEST_ASSERT_EQUAL_UINT32(rows, occurrences(answer, reading));
+    }
+
+    // a restart finds the same segments and the same answer
+    rebooted->begin();
+    HISTORY_SEGMENT ranges[HISTORY_SEGMENTS];
+    HISTORY_SEGMENT reloaded[HISTORY_SEGMENTS];
+    uint8_t order[HISTORY_SEGMENTS];
+    uint8_t reorder[HISTORY_SEGMENTS];
+    uint8_t count = store->getSegments(ranges, order);
+    TEST_ASSERT_EQUAL_UINT8(count, rebooted->getSegments(reloaded, reorder));
+    TEST_ASSERT_EQUAL_UINT8(HISTORY_SEGMENTS, count);
+    for (uint8_t i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL_UINT8(order[i], reorder[i]);
+        TEST_ASSERT_EQUAL_UINT32(ranges[order[i]].first, reloaded[reorder[i]].first);
+        TEST_ASSERT_EQUAL_UINT32(ranges[order[i]].last, reloaded[reorder[i]].last);
+        TEST_ASSERT_EQUAL_UINT16(ranges[order[i]].count, reloaded[reorder[i]].count);
+    }
+    std::string again = query(*rebooted, last - 86400 + 1, last, 3600);
+    TEST_ASSERT_EQUAL_STRING(answer.c_str(), again.c_str());
+
+    printf("{\"bench\":\"history\",\"records\":%u,\"recordBytes\":%u,\"appends\":%u,\"rotations\":%u,\"bytesWritten\":%u,"
+        "\"erases\":%llu,\"onDiskBytes\":%u,\"queryUs\":%lld,\"rows\":%u}\n",
+        (unsigned)records, (unsigned)sizeof(HISTORY_RECORD), (unsigned)store->getAppends(), (unsigned)store->getRotations(),
+        (unsigned)store->getBytesWritten(), (unsigned long long)hostFiles()->erases, (unsigned)hostFiles()->used(),
+        (long long)queryUs, (unsigned)rows);
+}
+
+void test_swapped_sensor_takes_a_free_slot(void) {
+    uint8_t sensors[TEMP_MAX_SENSORS];
+    for (uint8_t n = 0; n < TEMP_MAX_SENSORS; n++) sensors[n] = n;
+
+    // one slot free, the new sensor takes it in place after a restart
+    for (uint32_t i = 0; i < 100; i++) store->add(sampleAt(i, sensors, TEMP_MAX_SENSORS - 1));
+    store->flush();
+    rebooted->begin();
+    sensors[TEMP_MAX_SENSORS - 2] = 100;
+    for (uint32_t i = 100; i < 200; i++) rebooted->add(sampleAt(i, sensors, TEMP_MAX_SENSORS - 1));
+    rebooted->flush();
+    TEST_ASSERT_EQUAL_UINT32(0, rebooted->getRotations());
+
+    std::string before = query(*rebooted, BENCH_START, BENCH_START + 99 * HISTORY_INTERVAL, 3600);
+    std::string after = query(*rebooted, BENCH_START + 100 * HISTORY_INTERVAL, BENCH_START + 199 * HISTORY_INTERVAL, 3600);
+    TEST_ASSERT_TRUE(before.find(idOf(TEMP_MAX_SENSORS - 2)) != std::string::npos);
+    TEST_ASSERT_TRUE(before.find(idOf(100)) == std::string::npos);
+    TEST_ASSERT_TRUE(after.find(idOf(TEMP_MAX_SENSORS - 2)) == std::string::npos);
+    TEST_ASSERT_TRUE(after.find("{\"id\":\"" + idOf(100) + "\",\"temp\":120.00}") != std::string::npos);
+
+    // no slot left: the next sensor starts a segment, the ones before stay queryable
+    sensors[TEMP_MAX_SENSORS - 1] = 101;
+    sensors[0] = 102;
+    for (uint32_t i = 200; i < 300; i++) rebooted->add(sampleAt(i, sensors, TEMP_MAX_SENSORS));
+    rebooted->flush();
+    TEST_ASSERT_EQUAL_UINT32(1, rebooted->getRotations());
+    TEST_ASSERT_EQUAL_UINT32(0, rebooted->getDropped());
+
+    std::string all = query(*rebooted, BENCH_START, BENCH_START + 299 * HISTORY_INTERVAL, 300 * HISTORY_INTERVAL);
+    for (uint8_t n : { (uint8_t)0, (uint8_t)(TEMP_MAX_SENSORS - 2), (uint8_t)100, (uint8_t)101, (uint8_t)102 }) {
+        TEST_ASSERT_TRUE(all.find(idOf(n)) != std::string::npos);
+    }
+    std::string last = query(*rebooted, BENCH_START + 200 * HISTORY_INTERVAL, BENCH_START + 299 * HISTORY_INTERVAL, 3600);
+    TEST_ASSERT_TRUE(last.find(idOf(0)) == std::string::npos);
+    TEST_ASSERT_EQUAL_UINT32(TEMP_MAX_SENSORS * occurrences(last, idOf(102)), occurrences(last, "{\"id\":"));
+}
+
+void test_query_arguments(void) {
+    uint32_t from, to, step;
+
+    // before SNTP the default hour starts at 0 instead of wrapping around
+    TEST_ASSERT_NULL(historyRange(NULL, NULL, NULL, 120, from, to, step));
+    TEST_ASSERT_EQUAL_UINT32(0, from);
+    TEST_ASSERT_EQUAL_UINT32(120, to);
+    TEST_ASSERT_EQUAL_UINT32(HISTORY_INTERVAL, step);
+    TEST_ASSERT_NULL(historyRange(NULL, NULL, NULL, BENCH_START, from, to, step));
+    TEST_ASSERT_EQUAL_UINT32(BENCH_START - 3600, from);
+
+    TEST_ASSERT_NULL(historyRange("100", "200", "10", BENCH_START, from, to, step));
+    TEST_ASSERT_EQUAL_UINT32(100, from);
+    TEST_ASSERT_EQUAL_UINT32(200, to);
+    TEST_ASSERT_EQUAL_UINT32(10, step);
+
+    static const char *INVALID[] = { "-1", "", "abc", "12x", "4294967296", " 5", "1e3" };
+    for (const char *text : INVALID) {
+        TEST_ASSERT_NOT_NULL(historyRange(text, NULL, NULL, BENCH_START, from, to, step));
+        TEST_ASSERT_NOT_NULL(historyRange(NULL, text, NULL, BENCH_START, from, to, step));
+        TEST_ASSERT_NOT_NULL(historyRange(NULL, NULL, text, BENCH_START, from, to, step));
+    }
+    TEST_ASSERT_NOT_NULL(historyRange(NULL, NULL, "0", BENCH_START, from, to, step));
+    TEST_ASSERT_NOT_NULL(historyRange("200", "100", NULL, BENCH_START, from, to, step));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_month_of_wear);
+    RUN_TEST(test_swapped_sensor_takes_a_free_slot);
+    RUN_TEST(test_query_arguments);
+    return UNITY_END();
+}
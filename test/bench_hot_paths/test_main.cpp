@@ -0,0 +1,137 @@
+// Hot path benchmark of the firmware on the host: the Component runs on the
+// native fakes against the broker stand-in, or Mosquitto with DWEB08_BROKER,
+// and every path the device benchmark times is driven here. The results are
+// the JSON lines of the bench environment on stdout, one per path:
+// {"bench":"publish","n":200,"avgUs":41,"maxUs":310,"heapDelta":0}
+// {"bench":"boot","firstConnectMs":3,"firstPublishMs":4,"arenaHeapAllocations":0}
+// The heap of the host is the whole process, so heapDelta also counts the
+// broker threads. The allocations of the publish path are the arena count.
+// Run with: pio test -e native -f bench_hot_paths -v
+
+#define BENCHMARK
+#define BENCH_REPORT_INTERVAL 0
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <EEPROM.h>
+#include <unity.h>
+
+#include "DeviceSettings.hpp"
+#include "ComponentClass.hpp"
+#include "HostDevice.hpp"
+
+#define BENCH_TOPIC "bench/hot"
+#define BENCH_RUNS 200
+
+static HostBroker broker;
+static Component *comp = NULL;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// telemetry published on the device topic itself
+static size_t telemetryCount() {
+    size_t count = 0;
+    for (const HOST_MESSAGE &message : broker.getMessages()) {
+        if (message.topic == BENCH_TOPIC) count++;
+    }
+    return count;
+}
+
+static bool waitTelemetry(size_t count) {
+    unsigned long startedAt = millis();
+    while (telemetryCount() < count) {
+        if (millis() - startedAt > 5000) return false;
+        broker.waitFor(broker.count() + 1, 50);
+    }
+    return true;
+}
+
+void test_boot_to_first_publish(void) {
+    // boot is the first clock read, millis() starts at 0 like the device
+    millis();
+    EEPROM.begin(8);
+    TEST_ASSERT_TRUE(hostProvision(hostEndpoint(broker), BENCH_TOPIC, "{\"interval\":3600}"));
+
+    comp = new Component();
+    comp->begin();
+    TEST_ASSERT_TRUE(waitTelemetry(1));
+    TEST_ASSERT_TRUE(comp->getMqtt()->connected());
+}
+
+void test_publish(void) {
+    for (size_t i = 0; i < BENCH_RUNS; i++) {
+        hostPins().pulse(INPUT_CHANNELS[0].pin);
+        size_t before = telemetryCount();
+        TEST_ASSERT_TRUE(comp->publishDweb08Data());
+        TEST_ASSERT_TRUE(waitTelemetry(before + 1));
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, comp->getTelemetry()->getHeapAllocations());
+}
+
+void test_data_handler(void) {
+    String etag;
+    for (size_t i = 0; i < BENCH_RUNS; i++) {
+        // every other request finds a new counter and rebuilds the body
+        if (i % 2 == 0) {
+            delay(1);
+            hostPins().pulse(INPUT_CHANNELS[0].pin);
+        }
+        comp->drainPulses();
+
+        AsyncWebServerRequest request(HTTP_GET, "/data");
+        if (!etag.isEmpty()) request.addHeader("If-None-Match", etag);
+        hostWebServer()->handle(&request);
+
+        AsyncWebServerResponse *response = request.getResponse();
+        TEST_ASSERT_NOT_NULL(response);
+        TEST_ASSERT_TRUE(response->code == 200 || response->code == 304);
+        if (response->code == 200) etag = response->getHeader("ETag")->value();
+    }
+}
+
+void test_counter_persist(void) {
+    for (size_t i = 0; i < BENCH_RUNS; i++) {
+        // one pulse per record, spaced past the debounce window
+        delay(1);
+        hostPins().pulse(INPUT_CHANNELS[0].pin);
+        comp->drainPulses();
+        comp->persistCounter(true);
+    }
+    TEST_ASSERT_EQUAL_UINT64(comp->getCounter(), comp->getPulses()->getPersisted());
+}
+
+void test_config_patch(void) {
+    char body[48];
+    for (size_t i = 0; i < BENCH_RUNS / 2; i++) {
+        // the web form, then the same patch on <topic>/mqtt
+        snprintf(body, sizeof(body), "{\"interval\":%u}", (unsigned)(3600 + i));
+        std::unique_ptr<AsyncWebServerRequest> request = hostRequest(HTTP_POST, "/mqtt", body);
+        TEST_ASSERT_EQUAL_INT(200, request->getResponse()->code);
+
+        snprintf(body, sizeof(body), "{\"interval\":%u}", (unsigned)(7200 + i));
+        broker.publish(BENCH_TOPIC "/mqtt", reinterpret_cast<const uint8_t*>(body), strlen(body));
+    }
+
+    // the broker's patches land on the owner task
+    unsigned long startedAt = millis();
+    while (comp->getInterval() != 7200 + BENCH_RUNS / 2 - 1 && millis() - startedAt < 5000) delay(5);
+    TEST_ASSERT_EQUAL_UINT16(7200 + BENCH_RUNS / 2 - 1, comp->getInterval());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_boot_to_first_publish);
+    RUN_TEST(test_publish);
+    RUN_TEST(test_data_handler);
+    RUN_TEST(test_counter_persist);
+    RUN_TEST(test_config_patch);
+
+    // the JSON lines of the bench environment
+    comp->reportBenchmark();
+
+    int failures = UNITY_END();
+    // the firmware tasks never return, leave without unwinding them
+    fflush(stdout);
+    _exit(failures);
+}
@@ -0,0 +1,113 @@
+// Inbound dispatch cost of the topic router on the host as its table grows.
+// A table of N routes is built like the device builds its own, one in four
+// of them a group filter with a + level, and three topics are looked up a
+// million times each: one matching the last plain route, one matching the
+// last wildcard route and one matching nothing. For reference the JSON
+// line per table size also carries a miss through a strcmp chain over the
+// same filters, which knows nothing of wildcards:
+// {"bench":"router","routes":16,"exactNs":76,"wildcardNs":222,"missNs":169,"strcmpNs":77}
+// Run with: pio test -e native -f bench_topic_router -v
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+
+#include "TopicRouter.hpp"
+
+#define BENCH_LOOKUPS 1000000
+
+static volatile uint32_t sink = 0;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// routes whose index is a multiple of 4 are wildcards
+static void buildTable(TopicRouter &router, uint8_t routes) {
+    char filter[ROUTER_FILTER_SIZE];
+    router.clear();
+    for (uint8_t i = 0; i < routes; i++) {
+        if (i % 4 == 0) snprintf(filter, sizeof(filter), "site/+/meters/group%u/config", (unsigned)i);
+        else snprintf(filter, sizeof(filter), "site/plant/meters/dweb08-%02u/config", (unsigned)i);
+        TEST_ASSERT_TRUE(router.add(filter, 1, i));
+    }
+}
+
+// nanoseconds per call of lookup
+template <typename Lookup>
+static uint32_t timeLookups(Lookup lookup) {
+    std::chrono::steady_clock::time_point startedAt = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < BENCH_LOOKUPS; n++) sink += lookup();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startedAt).count() / BENCH_LOOKUPS;
+}
+
+void test_matching_rules(void) {
+    TEST_ASSERT_TRUE(TopicRouter::matches("a/+/c", "a/b/c"));
+    TEST_ASSERT_FALSE(TopicRouter::matches("a/+/c", "a/b/d/c"));
+    TEST_ASSERT_TRUE(TopicRouter::matches("a/#", "a"));
+    TEST_ASSERT_TRUE(TopicRouter::matches("a/#", "a/b/c"));
+    TEST_ASSERT_TRUE(TopicRouter::matches("+/b", "/b"));
+    TEST_ASSERT_FALSE(TopicRouter::matches("#", "$SYS/uptime"));
+    TEST_ASSERT_FALSE(TopicRouter::matches("a/b", "a/bc"));
+    TEST_ASSERT_FALSE(TopicRouter::isValidFilter("a/b#"));
+    TEST_ASSERT_FALSE(TopicRouter::isValidFilter("a/#/b"));
+    TEST_ASSERT_FALSE(TopicRouter::isValidFilter("a+/b"));
+
+    // a plain route wins over a wildcard added before it
+    TopicRouter router;
+    TEST_ASSERT_TRUE(router.add("site/+/data", 0, 1));
+    TEST_ASSERT_TRUE(router.add("site/plant/data", 0, 2));
+    TEST_ASSERT_EQUAL_UINT8(2, router.match("site/plant/data"));
+    TEST_ASSERT_EQUAL_UINT8(1, router.match("site/other/data"));
+    TEST_ASSERT_EQUAL_UINT8(ROUTE_NONE, router.match("site/plant/data/x"));
+}
+
+void test_dispatch_cost(void) {
+    static const uint8_t SIZES[] = { 2, 4, 8, 16 };
+    static TopicRouter router;
+    char filters[ROUTER_MAX_ROUTES][ROUTER_FILTER_SIZE];
+
+    for (uint8_t size : SIZES) {
+        buildTable(router, size);
+
+        // the last plain and the last wildcard route, the worst case of each pass
+        uint8_t lastPlain = 0;
+        uint8_t lastWildcard = 0;
+        for (uint8_t i = 0; i < size; i++) {
+            snprintf(filters[i], ROUTER_FILTER_SIZE, "%s", router.getRoute(i).filter);
+            if (i % 4 == 0) lastWildcard = i;
+            else lastPlain = i;
+        }
+
+        char exact[ROUTER_FILTER_SIZE];
+        char wildcard[ROUTER_FILTER_SIZE];
+        snprintf(exact, sizeof(exact), "%s", filters[lastPlain]);
+        snprintf(wildcard, sizeof(wildcard), "site/hall/meters/group%u/config", (unsigned)lastWildcard);
+        const char *miss = "site/plant/meters/dweb08-99/config";
+
+        TEST_ASSERT_EQUAL_UINT8(lastPlain, router.match(exact));
+        TEST_ASSERT_EQUAL_UINT8(lastWildcard, router.match(wildcard));
+        TEST_ASSERT_EQUAL_UINT8(ROUTE_NONE, router.match(miss));
+
+        uint32_t exactNs = timeLookups([&exact]() { return router.match(exact); });
+        uint32_t wildcardNs = timeLookups([&wildcard]() { return router.match(wildcard); });
+        uint32_t missNs = timeLookups([&miss]() { return router.match(miss); });
+
+        // every filter compared in turn, a miss walks them all
+        uint32_t strcmpNs = timeLookups([&filters, size, &miss]() {
+            for (uint8_t i = 0; i < size; i++) {
+                if (strcmp(filters[i], miss) == 0) return (uint32_t)i;
+            }
+            return (uint32_t)ROUTE_NONE;
+        });
+
+        printf("{\"bench\":\"router\",\"routes\":%u,\"exactNs\":%u,\"wildcardNs\":%u,\"missNs\":%u,\"strcmpNs\":%u}\n",
+            (unsigned)size, (unsigned)exactNs, (unsigned)wildcardNs, (unsigned)missNs, (unsigned)strcmpNs);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_matching_rules);
+    RUN_TEST(test_dispatch_cost);
+    return UNITY_END();
+}
@@ -0,0 +1,82 @@
+// The aggregator on the host: windows follow each other without a gap, the
+// delta of a window is the pulses counted between its start and its end, so
+// delta over the duration is the pulse rate and the deltas add up to the
+// counter, and the published rate matches a constant pulse train.
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "DeviceSettings.hpp"
+#include "Aggregator.hpp"
+
+// samples every 100 ms of a 25 pulses per second train, 10 samples a window
+#define TEST_STEP_MS 100
+#define TEST_PULSES_PER_STEP 2.5
+#define TEST_WINDOW_SAMPLES 10
+
+static Aggregator aggregator;
+
+void setUp(void) {
+    aggregator = Aggregator();
+}
+
+void tearDown(void) {}
+
+static TELEMETRY_SAMPLE sampleAt(uint32_t i) {
+    TELEMETRY_SAMPLE sample;
+    sample.timestamp = 5000 + i * TEST_STEP_MS;
+    for (uint8_t c = 0; c < INPUT_CHANNEL_COUNT; c++) sample.counters[c] = 1000 + (uint64_t)(i * TEST_PULSES_PER_STEP);
+    return sample;
+}
+
+void test_windows_are_contiguous(void) {
+    for (uint32_t i = 0; i < 3 * TEST_WINDOW_SAMPLES; i++) {
+        aggregator.add(sampleAt(i));
+        if ((i + 1) % TEST_WINDOW_SAMPLES == 0) aggregator.close();
+    }
+    TEST_ASSERT_EQUAL_UINT8(3, aggregator.getCount());
+
+    const TELEMETRY_WINDOW *windows = aggregator.getWindows();
+    // the first window starts at the first sample ever taken
+    TEST_ASSERT_EQUAL_UINT32(sampleAt(0).timestamp, windows[0].start);
+    TEST_ASSERT_EQUAL_UINT64(sampleAt(0).counters[0], windows[0].counterStart[0]);
+
+    uint64_t total = 0;
+    for (uint8_t w = 0; w < 3; w++) {
+        if (w > 0) {
+            TEST_ASSERT_EQUAL_UINT32(windows[w - 1].end, windows[w].start);
+            TEST_ASSERT_EQUAL_UINT64(windows[w - 1].counterEnd[0], windows[w].counterStart[0]);
+        }
+        total += windows[w].counterEnd[0] - windows[w].counterStart[0];
+    }
+    TEST_ASSERT_EQUAL_UINT64(sampleAt(3 * TEST_WINDOW_SAMPLES - 1).counters[0] - sampleAt(0).counters[0], total);
+}
+
+void test_published_rate_matches_the_train(void) {
+    // past the first window, whose start is its own first sample
+    for (uint32_t i = 0; i < 21 * TEST_WINDOW_SAMPLES; i++) {
+        aggregator.add(sampleAt(i));
+        if ((i + 1) % TEST_WINDOW_SAMPLES == 0) aggregator.close();
+    }
+
+    TelemetryEncoder encoder;
+    encoder.encodeWindows("aggregator", aggregator.getWindows(), aggregator.getCount());
+    JsonDocument doc;
+    TEST_ASSERT_TRUE(deserializeJson(doc, encoder.getPayload(), encoder.getLength()) == DeserializationError::Ok);
+
+    JsonArray windows = doc["windows"].as<JsonArray>();
+    TEST_ASSERT_EQUAL_UINT32(TELEMETRY_MAX_WINDOWS, windows.size());
+    for (JsonObject window : windows) {
+        // 10 steps of 2.5 pulses over one second
+        TEST_ASSERT_EQUAL_UINT32(TEST_WINDOW_SAMPLES * TEST_STEP_MS, window["end"].as<uint32_t>() - window["start"].as<uint32_t>());
+        TEST_ASSERT_EQUAL_UINT64(25, window["delta"].as<uint64_t>());
+        TEST_ASSERT_FLOAT_WITHIN(0.001f, 25.0f, window["rate"].as<float>());
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_windows_are_contiguous);
+    RUN_TEST(test_published_rate_matches_the_train);
+    return UNITY_END();
+}
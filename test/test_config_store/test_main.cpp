@@ -0,0 +1,108 @@
+// The config store on the host: the power is cut at every byte of a save,
+// and the next boot loads either the old or the new config, never the
+// defaults. A save the store reports as done always survives the cut.
+// A config whose JSON does not fit the file buffer is refused instead of
+// being cut short and stored. A topic with a wildcard or an empty level is
+// refused, since the device publishes to it.
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <unity.h>
+
+#include "DeviceSettings.hpp"
+#include "ConfigStore.hpp"
+
+void setUp(void) {
+    hostFiles()->clear();
+}
+
+void tearDown(void) {}
+
+static uint8_t patchMqtt(ConfigStore &store, const char *json) {
+    JsonDocument doc;
+    deserializeJson(doc, json);
+    const char *error;
+    return store.patch(CONFIG_MQTT, doc.as<JsonObjectConst>(), error);
+}
+
+static String bootedBroker() {
+    ConfigStore store;
+    store.begin();
+    return store.getMqtt().broker;
+}
+
+void test_torn_saves_keep_a_config(void) {
+    static const char *OLD = "{\"broker\":\"old.example\",\"port\":1883,\"clientId\":\"a\",\"topic\":\"t\",\"interval\":60}";
+    static const char *NEW = "{\"broker\":\"new.example\"}";
+
+    // size of the whole save, the budget walks every byte of it
+    ConfigStore store;
+    store.begin();
+    TEST_ASSERT_EQUAL_UINT8(CONFIG_SAVED, patchMqtt(store, OLD));
+    uint64_t before = hostFiles()->bytesWritten;
+    TEST_ASSERT_EQUAL_UINT8(CONFIG_SAVED, patchMqtt(store, NEW));
+    long length = hostFiles()->bytesWritten - before;
+
+    uint32_t kept = 0;
+    uint32_t replaced = 0;
+    for (long budget = 0; budget <= length + 1; budget++) {
+        hostFiles()->clear();
+        ConfigStore running;
+        running.begin();
+        TEST_ASSERT_EQUAL_UINT8(CONFIG_SAVED, patchMqtt(running, OLD));
+
+        hostFiles()->powerBudget = budget;
+        uint8_t result = patchMqtt(running, NEW);
+        hostFiles()->powerBudget = -1;
+
+        String broker = bootedBroker();
+        if (result == CONFIG_SAVED) TEST_ASSERT_EQUAL_STRING("new.example", broker.c_str());
+        else TEST_ASSERT_EQUAL_STRING("old.example", broker.c_str());
+        if (broker == "new.example") replaced++;
+        else kept++;
+    }
+    printf("{\"bench\":\"config\",\"cuts\":%ld,\"kept\":%u,\"replaced\":%u}\n", length + 2, (unsigned)kept, (unsigned)replaced);
+    TEST_ASSERT_GREATER_THAN(0, replaced);
+}
+
+void test_oversized_config_is_refused(void) {
+    ConfigStore store;
+    store.begin();
+    TEST_ASSERT_EQUAL_UINT8(CONFIG_SAVED, patchMqtt(store, "{\"broker\":\"old.example\",\"port\":1883,\"clientId\":\"a\",\"topic\":\"t\"}"));
+
+    // control characters take six bytes each once escaped, the strings fit
+    // their bounds but the file would not fit its buffer
+    JsonDocument doc;
+    doc["broker"] = std::string(127, '\x01').c_str();
+    doc["clientId"] = std::string(64, '\x01').c_str();
+    doc["client"] = std::string(64, '\x01').c_str();
+    doc["clientPass"] = std::string(64, '\x01').c_str();
+    doc["topic"] = std::string(100, '\x01').c_str();
+    TEST_ASSERT_GREATER_OR_EQUAL(CONFIG_FILE_SIZE, measureJson(doc));
+
+    const char *error;
+    TEST_ASSERT_EQUAL_UINT8(CONFIG_UNSAVED, store.patch(CONFIG_MQTT, doc.as<JsonObjectConst>(), error));
+    TEST_ASSERT_EQUAL_STRING("old.example", store.getMqtt().broker.c_str());
+    TEST_ASSERT_EQUAL_STRING("old.example", bootedBroker().c_str());
+}
+
+void test_wildcard_topic_is_refused(void) {
+    ConfigStore store;
+    store.begin();
+    TEST_ASSERT_EQUAL_UINT8(CONFIG_SAVED, patchMqtt(store, "{\"topic\":\"site/meter\"}"));
+
+    static const char *INVALID[] = {
+        "{\"topic\":\"site/+\"}", "{\"topic\":\"site/#\"}", "{\"topic\":\"site/me+ter\"}",
+        "{\"topic\":\"site//meter\"}", "{\"topic\":\"/site\"}", "{\"topic\":\"site/\"}"
+    };
+    for (const char *json : INVALID) TEST_ASSERT_EQUAL_UINT8(CONFIG_INVALID, patchMqtt(store, json));
+    TEST_ASSERT_EQUAL_STRING("site/meter", store.getMqtt().topic.c_str());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_torn_saves_keep_a_config);
+    RUN_TEST(test_oversized_config_is_refused);
+    RUN_TEST(test_wildcard_topic_is_refused);
+    return UNITY_END();
+}
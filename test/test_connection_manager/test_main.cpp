@@ -0,0 +1,145 @@
+// The connection manager on the host against a broker stand-in that
+// misbehaves: refused connects are retried on the doubling backoff with
+// jitter, a CONNACK that never comes in time costs one bounded attempt, and
+// a connection the broker drops is noticed and made again with the QoS 1
+// messages of the window delivered. A tick never blocks past the connect
+// timeout, so the loop() running the web server keeps going.
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <unity.h>
+#include <chrono>
+#include <set>
+
+#include "DeviceSettings.hpp"
+#include "ConnectionManager.hpp"
+#include "MqttClient.hpp"
+#include "HostDevice.hpp"
+
+#define TEST_TOPIC "test/connection"
+
+static HostBroker broker;
+static WiFiClient client;
+static MqttClient mqtt(client);
+static ConnectionManager connection;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// real time spent in one tick (ms), the clock of the firmware jumps with hostAdvance
+static long tick() {
+    std::chrono::steady_clock::time_point startedAt = std::chrono::steady_clock::now();
+    connection.tick();
+    mqtt.loop();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startedAt).count();
+}
+
+void test_refused_connects_back_off(void) {
+    broker.refuse = true;
+
+    // ten minutes of loop() at 100 ms, attempts seen by the broker
+    std::vector<unsigned long> attempts;
+    long longest = 0;
+    for (uint32_t i = 0; i < 6000; i++) {
+        longest = max(longest, tick());
+        if (connection.getMqttFailures() > attempts.size()) attempts.push_back(millis());
+        hostAdvance(100);
+    }
+    TEST_ASSERT_FALSE(connection.isMqttUp());
+    TEST_ASSERT_GREATER_THAN(5, attempts.size());
+    TEST_ASSERT_LESS_THAN(CONNECT_MQTT_TIMEOUT * 1000, longest);
+
+    // each wait is drawn from the upper half of the doubled delay, capped
+    uint32_t current = CONNECT_MQTT_BACKOFF_MIN;
+    for (size_t i = 1; i < attempts.size(); i++) {
+        unsigned long gap = attempts[i] - attempts[i - 1];
+        TEST_ASSERT_GREATER_OR_EQUAL(current / 2, gap);
+        TEST_ASSERT_LESS_OR_EQUAL(current + 200, gap);
+        current = min(current * 2, (uint32_t)CONNECT_BACKOFF_MAX);
+    }
+
+    // the broker is back, the next due attempt connects
+    broker.refuse = false;
+    for (uint32_t i = 0; i < 4000 && !connection.isMqttUp(); i++) {
+        tick();
+        hostAdvance(100);
+    }
+    TEST_ASSERT_TRUE(connection.isMqttUp());
+    TEST_ASSERT_EQUAL_UINT32(1, connection.getMqttConnects());
+}
+
+void test_slow_connack_is_bounded(void) {
+    broker.connackDelayMs = (CONNECT_MQTT_TIMEOUT + 1) * 1000;
+    broker.drop();
+    for (uint32_t i = 0; i < 100 && mqtt.loop(); i++) delay(5);
+
+    // the drop is seen and the attempt made right away, it gives up at the timeout
+    uint32_t failures = connection.getMqttFailures();
+    long elapsed = tick();
+    TEST_ASSERT_EQUAL_UINT32(1, connection.getMqttDisconnects());
+    TEST_ASSERT_EQUAL_UINT32(failures + 1, connection.getMqttFailures());
+    TEST_ASSERT_GREATER_OR_EQUAL(CONNECT_MQTT_TIMEOUT * 1000 - 50, elapsed);
+    TEST_ASSERT_LESS_THAN(CONNECT_MQTT_TIMEOUT * 1000 + 500, elapsed);
+
+    // slow but within the timeout
+    broker.connackDelayMs = 200;
+    for (uint32_t i = 0; i < 100 && !connection.isMqttUp(); i++) {
+        hostAdvance(CONNECT_MQTT_BACKOFF_MIN);
+        tick();
+    }
+    TEST_ASSERT_TRUE(connection.isMqttUp());
+    TEST_ASSERT_GREATER_OR_EQUAL(200, connection.getLastMqttConnectMs());
+    broker.connackDelayMs = 0;
+}
+
+void test_dropped_connection_reconnects(void) {
+    broker.clear();
+    broker.dropAfter = 3;
+
+    // the broker hangs up after the third, the rest wait in the window
+    char payload[8];
+    for (uint8_t i = 0; i < 5; i++) {
+        snprintf(payload, sizeof(payload), "m%u", (unsigned)i);
+        mqtt.publish(TEST_TOPIC, reinterpret_cast<const uint8_t*>(payload), strlen(payload), 1);
+        delay(5);
+    }
+
+    // the hang up is seen, the next session keeps the connection
+    uint32_t disconnects = connection.getMqttDisconnects();
+    for (uint32_t i = 0; i < 100 && mqtt.loop(); i++) delay(5);
+    broker.dropAfter = 0;
+
+    std::set<std::string> received;
+    for (uint32_t i = 0; i < 200 && received.size() < 5; i++) {
+        tick();
+        hostAdvance(CONNECT_MQTT_BACKOFF_MIN);
+        delay(5);
+        received.clear();
+        for (const HOST_MESSAGE &message : broker.getMessages()) received.insert(message.payload);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(5, received.size());
+    TEST_ASSERT_EQUAL_UINT32(disconnects + 1, connection.getMqttDisconnects());
+    TEST_ASSERT_TRUE(connection.isMqttUp());
+    TEST_ASSERT_GREATER_THAN(0, connection.getLastMqttOutageMs());
+}
+
+int main(int argc, char **argv) {
+    hostAdvance(1);
+    HOST_ENDPOINT endpoint = hostEndpoint(broker);
+    mqtt.setServer(endpoint.host.c_str(), endpoint.port);
+    mqtt.setSocketTimeout(CONNECT_MQTT_TIMEOUT);
+
+    connection.begin(
+        []() { WiFi.begin("host", ""); },
+        []() { return mqtt.connect("connection", "", ""); },
+        []() { return mqtt.connected(); },
+        true
+    );
+
+    UNITY_BEGIN();
+    RUN_TEST(test_refused_connects_back_off);
+    RUN_TEST(test_slow_connack_is_bounded);
+    RUN_TEST(test_dropped_connection_reconnects);
+    return UNITY_END();
+}
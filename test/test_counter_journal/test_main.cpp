@@ -0,0 +1,229 @@
+// CounterJournal on the host file system with power cuts injected at random
+// bytes of its writes. After every cut the journal is recovered on a new
+// instance, as the next boot does. The worst loss and the flash erases per
+// million pulses are printed as a JSON line:
+// {"bench":"journal","slots":1,"cuts":2000,"worstLost":119,"erasesPerMillion":10000}
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <random>
+#include <unity.h>
+
+#include "DeviceSettings.hpp"
+#include "CounterJournal.hpp"
+
+#define TEST_CUTS 2000
+// pulses counted between two commit checks at most
+#define TEST_STEP 20
+
+static HostFiles files;
+
+void setUp(void) {
+    files.clear();
+    hostFiles() = &files;
+}
+
+void tearDown(void) {}
+
+static CounterJournal journal(uint8_t slots) {
+    return CounterJournal(slots, JOURNAL_SEGMENTS, JOURNAL_SEGMENT_RECORDS, JOURNAL_BATCH_PULSES, JOURNAL_BATCH_MS);
+}
+
+void test_recovers_committed_totals(void) {
+    uint64_t totals[3] = { 5, 1ULL << 40, 7 };
+    CounterJournal writer = journal(3);
+    uint64_t recovered[3] = {};
+    TEST_ASSERT_FALSE(writer.begin(recovered));
+    TEST_ASSERT_TRUE(writer.commit(totals, true));
+
+    CounterJournal reader = journal(3);
+    TEST_ASSERT_TRUE(reader.begin(recovered));
+    TEST_ASSERT_EQUAL_UINT64(5, recovered[0]);
+    TEST_ASSERT_EQUAL_UINT64(1ULL << 40, recovered[1]);
+    TEST_ASSERT_EQUAL_UINT64(7, recovered[2]);
+}
+
+void test_batches_by_pulses(void) {
+    CounterJournal writer = journal(1);
+    uint64_t total = 0;
+    writer.begin(&total);
+
+    total = JOURNAL_BATCH_PULSES - 1;
+    TEST_ASSERT_FALSE(writer.commit(&total));
+    total = JOURNAL_BATCH_PULSES;
+    TEST_ASSERT_TRUE(writer.commit(&total));
+    TEST_ASSERT_EQUAL_UINT32(1, writer.getCommits());
+}
+
+void test_rotates_over_segments(void) {
+    CounterJournal writer = journal(1);
+    uint64_t total = 0;
+    writer.begin(&total);
+
+    uint32_t records = JOURNAL_SEGMENTS * JOURNAL_SEGMENT_RECORDS + 10;
+    for (uint32_t i = 0; i < records; i++) {
+        total++;
+        TEST_ASSERT_TRUE(writer.commit(&total, true));
+    }
+    TEST_ASSERT_EQUAL_UINT32(JOURNAL_SEGMENTS, writer.getRotations());
+
+    // every segment file is rewritten, never grown past its records
+    for (uint8_t i = 0; i < JOURNAL_SEGMENTS; i++) {
+        File file = LittleFS.open("/counter" + String(i) + ".log", "r");
+        TEST_ASSERT_TRUE((bool)file);
+        TEST_ASSERT_LESS_OR_EQUAL(sizeof(JOURNAL_HEADER) + JOURNAL_SEGMENT_RECORDS * 16, file.size());
+    }
+
+    uint64_t recovered = 0;
+    CounterJournal reader = journal(1);
+    TEST_ASSERT_TRUE(reader.begin(&recovered));
+    TEST_ASSERT_EQUAL_UINT64(total, recovered);
+}
+
+// totals written by a build with from slots, read back by one with to slots
+static void changeSlots(uint8_t from, uint8_t to) {
+    files.clear();
+    uint64_t totals[JOURNAL_MAX_SLOTS];
+    for (uint8_t i = 0; i < JOURNAL_MAX_SLOTS; i++) totals[i] = 1000 * (i + 1);
+    CounterJournal writer = journal(from);
+    writer.begin(totals);
+    TEST_ASSERT_TRUE(writer.commit(totals, true));
+
+    uint64_t recovered[JOURNAL_MAX_SLOTS];
+    memset(recovered, 0xFF, sizeof(recovered));
+    CounterJournal reader = journal(to);
+    TEST_ASSERT_TRUE(reader.begin(recovered));
+    for (uint8_t i = 0; i < to; i++) TEST_ASSERT_EQUAL_UINT64(i < from ? totals[i] : 0, recovered[i]);
+
+    // the new layout goes on in its own segment and is the one recovered next
+    recovered[0]++;
+    TEST_ASSERT_TRUE(reader.commit(recovered, true));
+    uint64_t reread[JOURNAL_MAX_SLOTS] = {};
+    CounterJournal again = journal(to);
+    TEST_ASSERT_TRUE(again.begin(reread));
+    for (uint8_t i = 0; i < to; i++) TEST_ASSERT_EQUAL_UINT64(recovered[i], reread[i]);
+}
+
+void test_recovers_any_slot_count(void) {
+    static const uint8_t counts[] = { 1, 2, 3, 4, 8 };
+    for (uint8_t from : counts) {
+        for (uint8_t to : counts) changeSlots(from, to);
+    }
+}
+
+void test_recovers_headerless_segments(void) {
+    // the single slot journal of the older firmware: total, sequence, CRC
+    uint8_t record[16];
+    uint64_t total = 123456789;
+    uint32_t sequence = 42;
+    memcpy(record, &total, sizeof(total));
+    memcpy(record + 8, &sequence, sizeof(sequence));
+    uint32_t crc = esp_rom_crc32_le(0, record, 12);
+    memcpy(record + 12, &crc, sizeof(crc));
+    File file = LittleFS.open("/counter2.log", "w");
+    file.write(record, sizeof(record));
+    file.close();
+
+    uint64_t recovered[4] = {};
+    CounterJournal reader = journal(4);
+    TEST_ASSERT_TRUE(reader.begin(recovered));
+    TEST_ASSERT_EQUAL_UINT64(total, recovered[0]);
+    TEST_ASSERT_EQUAL_UINT64(0, recovered[3]);
+}
+
+// counts until the power goes at byte budget of the journal writes, then
+// recovers on a new instance. Returns the pulses lost by the cut.
+static uint64_t cutAndRecover(std::mt19937 &random, uint8_t slots, long budget) {
+    files.clear();
+    files.powerBudget = budget;
+
+    CounterJournal writer = journal(slots);
+    uint64_t totals[JOURNAL_MAX_SLOTS] = {};
+    if (!writer.begin(totals)) writer.commit(totals, true);
+
+    // every channel counts, the device stops counting when the power goes
+    for (uint32_t step = 0; step < 1000000 && files.powerBudget != 0; step++) {
+        totals[step % slots] += 1 + random() % TEST_STEP;
+        writer.commit(totals);
+    }
+
+    files.powerBudget = -1;
+    uint64_t recovered[JOURNAL_MAX_SLOTS] = {};
+    // empty only when the power went during the very first record
+    CounterJournal reader = journal(slots);
+    reader.begin(recovered);
+
+    uint64_t lost = 0;
+    for (uint8_t i = 0; i < slots; i++) {
+        // a recovered total is one that was counted, never more
+        TEST_ASSERT_LESS_OR_EQUAL(totals[i], recovered[i]);
+        lost += totals[i] - recovered[i];
+    }
+
+    // the journal keeps going after the torn record and recovers again
+    uint64_t next[JOURNAL_MAX_SLOTS];
+    memcpy(next, recovered, sizeof(next));
+    next[0] += 1;
+    TEST_ASSERT_TRUE(reader.commit(next, true));
+    CounterJournal again = journal(slots);
+    uint64_t reread[JOURNAL_MAX_SLOTS] = {};
+    TEST_ASSERT_TRUE(again.begin(reread));
+    TEST_ASSERT_EQUAL_UINT64(next[0], reread[0]);
+    return lost;
+}
+
+// pulses committed by a long run without cuts against the blocks it erased
+static uint64_t erasesPerMillion(uint8_t slots) {
+    files.clear();
+    CounterJournal writer = journal(slots);
+    uint64_t totals[JOURNAL_MAX_SLOTS] = {};
+    writer.begin(totals);
+
+    uint64_t pulses = 0;
+    for (uint32_t i = 0; i < 1000000; i++) {
+        totals[i % slots]++;
+        pulses++;
+        writer.commit(totals);
+    }
+    return files.erases * 1000000ULL / pulses;
+}
+
+static void powerCuts(uint8_t slots) {
+    std::mt19937 random(slots);
+    // cut points over the first journal segments and a full rotation
+    long span = (long)JOURNAL_SEGMENTS * JOURNAL_SEGMENT_RECORDS * (slots * 8 + 8) * 2;
+
+    uint64_t worst = 0;
+    for (uint32_t i = 0; i < TEST_CUTS; i++) {
+        worst = max(worst, cutAndRecover(random, slots, random() % span));
+    }
+    uint64_t erases = erasesPerMillion(slots);
+
+    printf("{\"bench\":\"journal\",\"slots\":%u,\"cuts\":%u,\"worstLost\":%llu,\"erasesPerMillion\":%llu}\n",
+        (unsigned)slots, (unsigned)TEST_CUTS, (unsigned long long)worst, (unsigned long long)erases);
+
+    // the batch not committed yet plus the pulses of the torn commit, per channel
+    TEST_ASSERT_LESS_OR_EQUAL((uint64_t)slots * (JOURNAL_BATCH_PULSES + TEST_STEP), worst);
+    // at most one erase per record of a full batch, plus the segment rewrites
+    TEST_ASSERT_LESS_OR_EQUAL(1000000 / JOURNAL_BATCH_PULSES * 11 / 10, erases);
+}
+
+void test_power_cuts_single_channel(void) {
+    powerCuts(1);
+}
+
+void test_power_cuts_eight_channels(void) {
+    powerCuts(8);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_recovers_committed_totals);
+    RUN_TEST(test_batches_by_pulses);
+    RUN_TEST(test_rotates_over_segments);
+    RUN_TEST(test_recovers_any_slot_count);
+    RUN_TEST(test_recovers_headerless_segments);
+    RUN_TEST(test_power_cuts_single_channel);
+    RUN_TEST(test_power_cuts_eight_channels);
+    return UNITY_END();
+}
@@ -0,0 +1,219 @@
+// The MQTT client on the host against the scripted broker stand-in: a full
+// window refuses the publish, unacknowledged packets go again with DUP
+// after a reconnect or an acknowledgement timeout, the store wraps around
+// under large packets, and a link dropping every few publishes still
+// delivers every message at least once. Inbound QoS 1 messages are
+// acknowledged. The pipelined window against stop-and-wait over a link
+// that takes BENCH_LATENCY_MS to acknowledge is printed as a JSON line:
+// {"bench":"qos1","messages":400,"payloadBytes":200,"latencyMs":5,"pipelinedPerS":3000,"stopAndWaitPerS":190}
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <unity.h>
+#include <algorithm>
+#include <map>
+
+#include "DeviceSettings.hpp"
+#include "MqttClient.hpp"
+#include "HostDevice.hpp"
+
+#define TEST_TOPIC "test/client"
+#define BENCH_MESSAGES 400
+#define BENCH_PAYLOAD 200
+#define BENCH_LATENCY_MS 5
+
+static HostBroker broker;
+static WiFiClient client;
+static MqttClient mqtt(client);
+
+static std::vector<std::string> inbound;
+
+// runs loop() until done() or the timeout, false on timeout
+template <typename Done>
+static bool pump(Done done, uint32_t timeoutMs = 2000) {
+    for (uint32_t waited = 0; waited < timeoutMs; waited++) {
+        mqtt.loop();
+        if (done()) return true;
+        delay(1);
+    }
+    return false;
+}
+
+static bool publishText(const std::string &text) {
+    return mqtt.publish(TEST_TOPIC, reinterpret_cast<const uint8_t*>(text.data()), text.size(), 1);
+}
+
+// the payloads the broker holds, with the number of times each came
+static std::map<std::string, uint32_t> received() {
+    std::map<std::string, uint32_t> payloads;
+    for (const HOST_MESSAGE &message : broker.getMessages()) {
+        if (message.topic == TEST_TOPIC) payloads[message.payload]++;
+    }
+    return payloads;
+}
+
+void setUp(void) {
+    broker.withholdAcks = false;
+    broker.dropAfter = 0;
+    if (!mqtt.connected()) mqtt.connect("client", "", "");
+    pump([]() { return mqtt.getInflight() == 0; });
+    broker.clear();
+}
+
+void tearDown(void) {}
+
+void test_full_window_refuses(void) {
+    broker.withholdAcks = true;
+    uint32_t refused = mqtt.getRefused();
+
+    for (uint8_t i = 0; i < MQTT_INFLIGHT_MESSAGES; i++) TEST_ASSERT_TRUE(publishText("w" + std::to_string(i)));
+    TEST_ASSERT_FALSE(publishText("over"));
+    TEST_ASSERT_EQUAL_UINT32(refused + 1, mqtt.getRefused());
+    TEST_ASSERT_EQUAL_UINT8(MQTT_INFLIGHT_MESSAGES, mqtt.getInflight());
+    TEST_ASSERT_TRUE(broker.waitFor(MQTT_INFLIGHT_MESSAGES, 2000));
+
+    // the broker is back to acknowledging after a reconnect
+    broker.drop();
+    TEST_ASSERT_TRUE(pump([]() { return !mqtt.connected(); }));
+    broker.withholdAcks = false;
+    uint32_t retransmits = mqtt.getRetransmits();
+    TEST_ASSERT_TRUE(mqtt.connect("client", "", ""));
+    TEST_ASSERT_TRUE(pump([]() { return mqtt.getInflight() == 0; }));
+    TEST_ASSERT_EQUAL_UINT32(retransmits + MQTT_INFLIGHT_MESSAGES, mqtt.getRetransmits());
+
+    // each one sent twice, the second time with DUP set
+    std::vector<HOST_MESSAGE> messages = broker.getMessages();
+    TEST_ASSERT_EQUAL_UINT32(2 * MQTT_INFLIGHT_MESSAGES, messages.size());
+    for (uint8_t i = 0; i < MQTT_INFLIGHT_MESSAGES; i++) {
+        TEST_ASSERT_FALSE(messages[i].dup);
+        TEST_ASSERT_TRUE(messages[MQTT_INFLIGHT_MESSAGES + i].dup);
+        TEST_ASSERT_EQUAL_STRING(messages[i].payload.c_str(), messages[MQTT_INFLIGHT_MESSAGES + i].payload.c_str());
+        TEST_ASSERT_EQUAL_UINT8(1, messages[i].qos);
+    }
+}
+
+void test_ack_timeout_drops_the_connection(void) {
+    broker.withholdAcks = true;
+    TEST_ASSERT_TRUE(publishText("late"));
+    TEST_ASSERT_TRUE(broker.waitFor(1, 2000));
+
+    // alive until the oldest packet is past its timeout
+    TEST_ASSERT_TRUE(mqtt.loop());
+    hostAdvance(MQTT_ACK_TIMEOUT + 1);
+    TEST_ASSERT_FALSE(mqtt.loop());
+
+    broker.withholdAcks = false;
+    TEST_ASSERT_TRUE(mqtt.connect("client", "", ""));
+    TEST_ASSERT_TRUE(pump([]() { return mqtt.getInflight() == 0; }));
+    std::vector<HOST_MESSAGE> messages = broker.getMessages();
+    TEST_ASSERT_EQUAL_UINT32(2, messages.size());
+    TEST_ASSERT_TRUE(messages[1].dup);
+}
+
+void test_store_wraps_around(void) {
+    // three packets fill most of the store, the fourth has to wrap to its start
+    std::string payload(MQTT_INFLIGHT_BYTES / 3 - 64, 'x');
+    uint32_t acked = mqtt.getAcked();
+    for (uint32_t i = 0; i < 30; i++) {
+        payload[0] = 'A' + i % 26;
+        payload[1] = '0' + i / 26;
+        TEST_ASSERT_TRUE(pump([&payload]() { return publishText(payload); }));
+    }
+    TEST_ASSERT_TRUE(pump([]() { return mqtt.getInflight() == 0; }));
+    TEST_ASSERT_EQUAL_UINT32(acked + 30, mqtt.getAcked());
+
+    // whole and in order, none sent twice
+    std::vector<HOST_MESSAGE> messages = broker.getMessages();
+    TEST_ASSERT_EQUAL_UINT32(30, messages.size());
+    for (uint32_t i = 0; i < 30; i++) {
+        TEST_ASSERT_EQUAL_UINT32(payload.size(), messages[i].payload.size());
+        TEST_ASSERT_EQUAL_INT('A' + i % 26, messages[i].payload[0]);
+        TEST_ASSERT_EQUAL_INT('0' + i / 26, messages[i].payload[1]);
+        TEST_ASSERT_EQUAL_UINT32(payload.size() - 2, std::count(messages[i].payload.begin(), messages[i].payload.end(), 'x'));
+        TEST_ASSERT_FALSE(messages[i].dup);
+    }
+}
+
+void test_lossy_link_delivers_everything(void) {
+    // the connection is lost after every seventh publish the broker reads
+    broker.dropAfter = 7;
+    uint32_t next = 0;
+    uint32_t reconnects = 0;
+    for (uint32_t i = 0; i < 20000 && (next < 100 || mqtt.getInflight() > 0); i++) {
+        if (!mqtt.loop()) {
+            TEST_ASSERT_TRUE(mqtt.connect("client", "", ""));
+            reconnects++;
+        }
+        if (next < 100 && publishText("m" + std::to_string(next))) next++;
+        delay(1);
+    }
+    broker.dropAfter = 0;
+
+    std::map<std::string, uint32_t> payloads = received();
+    for (uint32_t i = 0; i < 100; i++) TEST_ASSERT_TRUE(payloads.count("m" + std::to_string(i)) == 1);
+    TEST_ASSERT_EQUAL_UINT32(100, payloads.size());
+    TEST_ASSERT_GREATER_THAN(10, reconnects);
+    TEST_ASSERT_EQUAL_UINT8(0, mqtt.getInflight());
+}
+
+void test_inbound_qos1_is_acknowledged(void) {
+    TEST_ASSERT_TRUE(mqtt.subscribe(TEST_TOPIC "/in", 1));
+    TEST_ASSERT_TRUE(pump([]() { return broker.getSubscriptions() > 0; }));
+
+    uint32_t pubacks = broker.pubacks;
+    inbound.clear();
+    broker.publish(TEST_TOPIC "/in", reinterpret_cast<const uint8_t*>("set"), 3, 1);
+    TEST_ASSERT_TRUE(pump([pubacks]() { return broker.pubacks > pubacks; }));
+    TEST_ASSERT_EQUAL_UINT32(1, inbound.size());
+    TEST_ASSERT_EQUAL_STRING("set", inbound[0].c_str());
+}
+
+void test_benchmark(void) {
+    std::string payload(BENCH_PAYLOAD, 'p');
+    broker.ackDelayMs = BENCH_LATENCY_MS;
+
+    // pipelined, a publish waits only when the window is full
+    int64_t startedAt = esp_timer_get_time();
+    for (uint32_t i = 0; i < BENCH_MESSAGES; i++) {
+        while (!publishText(payload)) mqtt.loop();
+    }
+    while (mqtt.getInflight() > 0) mqtt.loop();
+    int64_t pipelined = esp_timer_get_time() - startedAt;
+
+    // stop-and-wait, every publish waits for its PUBACK
+    startedAt = esp_timer_get_time();
+    for (uint32_t i = 0; i < BENCH_MESSAGES; i++) {
+        publishText(payload);
+        while (mqtt.getInflight() > 0) mqtt.loop();
+    }
+    int64_t stopAndWait = esp_timer_get_time() - startedAt;
+
+    broker.ackDelayMs = 0;
+
+    TEST_ASSERT_TRUE(broker.waitFor(2 * BENCH_MESSAGES, 2000));
+    printf("{\"bench\":\"qos1\",\"messages\":%u,\"payloadBytes\":%u,\"latencyMs\":%u,\"pipelinedPerS\":%lld,\"stopAndWaitPerS\":%lld}\n",
+        (unsigned)BENCH_MESSAGES, (unsigned)BENCH_PAYLOAD, (unsigned)BENCH_LATENCY_MS,
+        (long long)(BENCH_MESSAGES * 1000000LL / max(pipelined, (int64_t)1)),
+        (long long)(BENCH_MESSAGES * 1000000LL / max(stopAndWait, (int64_t)1)));
+    TEST_ASSERT_LESS_THAN(stopAndWait, pipelined);
+}
+
+int main(int argc, char **argv) {
+    hostAdvance(1);
+    HOST_ENDPOINT endpoint = hostEndpoint(broker);
+    mqtt.setServer(endpoint.host.c_str(), endpoint.port);
+    mqtt.setSocketTimeout(CONNECT_MQTT_TIMEOUT);
+    mqtt.setBufferSize(512);
+    mqtt.setCallback([](char *topic, uint8_t *payload, unsigned int length) {
+        inbound.push_back(std::string(reinterpret_cast<char*>(payload), length));
+    });
+
+    UNITY_BEGIN();
+    RUN_TEST(test_full_window_refuses);
+    RUN_TEST(test_ack_timeout_drops_the_connection);
+    RUN_TEST(test_store_wraps_around);
+    RUN_TEST(test_lossy_link_delivers_everything);
+    RUN_TEST(test_inbound_qos1_is_acknowledged);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,130 @@
+// The outbound queue on the host under contention: producers on their own
+// threads push as fast as they can while one consumer pops, every item
+// arrives once, whole, and in the order its producer pushed it. The push
+// cost is printed as a JSON line:
+// {"bench":"mpsc","producers":4,"items":400000,"pushesPerMs":9000,"fullRetries":120}
+
+#include <Arduino.h>
+#include <unity.h>
+#include <thread>
+
+#include "DeviceSettings.hpp"
+#include "MqttQueue.hpp"
+
+#define TEST_PRODUCERS 4
+#define TEST_ITEMS 100000
+#define TEST_WORDS 15
+
+// a copy torn between two producers shows up as mixed words
+struct TEST_ITEM {
+    uint32_t producer;
+    uint32_t sequence;
+    uint32_t words[TEST_WORDS];
+};
+
+static MpscQueue<TEST_ITEM, 64> queue;
+static MqttOutbound outbound;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_producers_against_one_consumer(void) {
+    std::atomic<uint32_t> retries(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> producers;
+
+    for (uint32_t p = 0; p < TEST_PRODUCERS; p++) {
+        producers.emplace_back([p, &retries, &go]() {
+            while (!go) std::this_thread::yield();
+            TEST_ITEM item;
+            item.producer = p;
+            for (uint32_t i = 0; i < TEST_ITEMS; i++) {
+                item.sequence = i;
+                for (uint32_t w = 0; w < TEST_WORDS; w++) item.words[w] = p * 0x10000 + i + w;
+                while (!queue.push(item)) {
+                    retries++;
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    uint32_t next[TEST_PRODUCERS] = {};
+    uint32_t popped = 0;
+    uint32_t torn = 0;
+    uint32_t outOfOrder = 0;
+    TEST_ITEM item;
+
+    int64_t startedAt = esp_timer_get_time();
+    go = true;
+    while (popped < TEST_PRODUCERS * TEST_ITEMS) {
+        if (!queue.pop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        popped++;
+        if (item.producer >= TEST_PRODUCERS) {
+            torn++;
+            continue;
+        }
+        for (uint32_t w = 0; w < TEST_WORDS; w++) {
+            if (item.words[w] != item.producer * 0x10000 + item.sequence + w) {
+                torn++;
+                break;
+            }
+        }
+        if (item.sequence != next[item.producer]) outOfOrder++;
+        next[item.producer] = item.sequence + 1;
+    }
+    int64_t elapsed = esp_timer_get_time() - startedAt;
+    for (std::thread &producer : producers) producer.join();
+
+    printf("{\"bench\":\"mpsc\",\"producers\":%u,\"items\":%u,\"pushesPerMs\":%lld,\"fullRetries\":%u}\n",
+        (unsigned)TEST_PRODUCERS, (unsigned)popped, (long long)(popped * 1000LL / max(elapsed, (int64_t)1)), (unsigned)retries);
+
+    TEST_ASSERT_EQUAL_UINT32(0, torn);
+    TEST_ASSERT_EQUAL_UINT32(0, outOfOrder);
+    for (uint32_t p = 0; p < TEST_PRODUCERS; p++) TEST_ASSERT_EQUAL_UINT32(TEST_ITEMS, next[p]);
+    TEST_ASSERT_FALSE(queue.pop(item));
+}
+
+void test_outbound_counts_and_priorities(void) {
+    std::atomic<uint32_t> accepted(0);
+    std::vector<std::thread> producers;
+
+    // nobody pops, the queues fill and the rest is refused and counted
+    for (uint32_t p = 0; p < TEST_PRODUCERS; p++) {
+        producers.emplace_back([p, &accepted]() {
+            MQTT_COMMAND command;
+            command.type = MQTT_COMMAND_RAW;
+            for (uint32_t i = 0; i < 1000; i++) {
+                uint8_t priority = i % 2 == 0 ? MQTT_PRIORITY_HIGH : MQTT_PRIORITY_NORMAL;
+                command.keyframe = priority == MQTT_PRIORITY_HIGH;
+                if (outbound.push(command, priority)) accepted++;
+            }
+        });
+    }
+    for (std::thread &producer : producers) producer.join();
+
+    TEST_ASSERT_EQUAL_UINT32(MQTT_QUEUE_HIGH + MQTT_QUEUE_NORMAL, accepted.load());
+    TEST_ASSERT_EQUAL_UINT32(accepted.load(), outbound.getEnqueued());
+    TEST_ASSERT_EQUAL_UINT32(TEST_PRODUCERS * 1000 - accepted.load(), outbound.getDropped());
+
+    MQTT_COMMAND command;
+    // every high priority command comes out before the normal ones, marked by keyframe here
+    for (uint32_t i = 0; i < MQTT_QUEUE_HIGH + MQTT_QUEUE_NORMAL; i++) {
+        TEST_ASSERT_TRUE(outbound.pop(command));
+        TEST_ASSERT_EQUAL(i < MQTT_QUEUE_HIGH, command.keyframe);
+    }
+    TEST_ASSERT_FALSE(outbound.pop(command));
+
+    printf("{\"bench\":\"outbound\",\"producers\":%u,\"pushes\":%u,\"maxPushUs\":%u}\n",
+        (unsigned)TEST_PRODUCERS, (unsigned)(TEST_PRODUCERS * 1000), (unsigned)outbound.getMaxPushUs());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_producers_against_one_consumer);
+    RUN_TEST(test_outbound_counts_and_priorities);
+    return UNITY_END();
+}
@@ -0,0 +1,254 @@
+// The outbox on the host: samples spilled to flash survive a reboot, a
+// segment of another layout is discarded, a corrupted record is skipped, a
+// record torn by a power cut is written over and the segment stays within
+// its share of a filesystem smaller than the partition. The ring is spilled
+// by count and by age, and a reboot partway through a replay resumes after
+// the last batch sent. End to end, the broker
+// stand-in is killed and restarted on the same port, the way Mosquitto is,
+// and every sample taken while it was down reaches it after the replay.
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <EEPROM.h>
+#include <unity.h>
+#include <set>
+
+#include "DeviceSettings.hpp"
+#include "ComponentClass.hpp"
+#include "HostDevice.hpp"
+
+#define TEST_TOPIC "test/outage"
+#define TEST_SAMPLES (OUTBOX_RAM_SAMPLES * 2 + 10)
+// the samples of TEST_SAMPLES that reach flash, the rest waits in the ring
+#define TEST_SPILLED (TEST_SAMPLES - TEST_SAMPLES % OUTBOX_SPILL_SAMPLES)
+
+static HostBroker broker;
+static Component *comp = NULL;
+
+// a queue of the firmware is too large for the stack
+static OutageQueue queue;
+static OutageQueue rebooted;
+
+void setUp(void) {
+    hostFiles()->clear();
+    queue = OutageQueue();
+    rebooted = OutageQueue();
+}
+
+void tearDown(void) {}
+
+static TELEMETRY_SAMPLE sampleAt(uint32_t i) {
+    TELEMETRY_SAMPLE sample;
+    sample.timestamp = 1000 * i;
+    sample.counters[0] = 100 + i;
+    return sample;
+}
+
+// replays the whole backlog, returns the counters in the order they came
+static std::vector<uint64_t> replayAll(OutageQueue &outbox) {
+    std::vector<uint64_t> counters;
+    outbox.onConnected();
+    for (uint32_t i = 0; i < 1000 && !outbox.isEmpty(); i++) {
+        hostAdvance(OUTBOX_REPLAY_JITTER);
+        outbox.replay([&counters](const TELEMETRY_SAMPLE &sample) {
+            counters.push_back(sample.counters[0]);
+            return true;
+        });
+    }
+    return counters;
+}
+
+void test_backlog_survives_a_reboot(void) {
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) queue.push(sampleAt(i));
+    TEST_ASSERT_TRUE(LittleFS.exists(OUTBOX_PATH));
+
+    // the RAM ring is lost, the spilled samples are picked up
+    rebooted.begin();
+    uint32_t spilled = rebooted.getPending();
+    TEST_ASSERT_EQUAL_UINT32(TEST_SPILLED, spilled);
+
+    std::vector<uint64_t> counters = replayAll(rebooted);
+    TEST_ASSERT_EQUAL_UINT32(spilled, counters.size());
+    for (uint32_t i = 0; i < counters.size(); i++) TEST_ASSERT_EQUAL_UINT64(100 + i, counters[i]);
+    TEST_ASSERT_FALSE(LittleFS.exists(OUTBOX_PATH));
+}
+
+void test_other_layout_is_discarded(void) {
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) queue.push(sampleAt(i));
+
+    // the header of a firmware with a smaller sample
+    File file = LittleFS.open(OUTBOX_PATH, "r+");
+    OUTBOX_HEADER header = { OUTBOX_MAGIC, (uint16_t)(sizeof(TELEMETRY_SAMPLE) - 8), OUTBOX_VERSION, 0 };
+    file.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    file.close();
+
+    rebooted.begin();
+    TEST_ASSERT_EQUAL_UINT32(0, rebooted.getPending());
+    TEST_ASSERT_FALSE(LittleFS.exists(OUTBOX_PATH));
+}
+
+void test_corrupted_record_is_skipped(void) {
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) queue.push(sampleAt(i));
+
+    // one bit of the counter of the fourth record
+    File file = LittleFS.open(OUTBOX_PATH, "r+");
+    size_t offset = sizeof(OUTBOX_HEADER) + 3 * sizeof(OUTBOX_RECORD) + offsetof(TELEMETRY_SAMPLE, counters);
+    uint8_t byte;
+    file.seek(offset);
+    file.read(&byte, 1);
+    byte ^= 0x01;
+    file.seek(offset);
+    file.write(&byte, 1);
+    file.close();
+
+    rebooted.begin();
+    std::vector<uint64_t> counters = replayAll(rebooted);
+    TEST_ASSERT_EQUAL_UINT32(TEST_SPILLED - 1, counters.size());
+    TEST_ASSERT_EQUAL_UINT32(1, rebooted.getDropped());
+    for (uint64_t counter : counters) TEST_ASSERT_TRUE(counter != 103);
+}
+
+void test_torn_record_is_written_over(void) {
+    for (uint32_t i = 0; i < OUTBOX_SPILL_SAMPLES; i++) queue.push(sampleAt(i));
+
+    // the second spill loses the power halfway through its fifth record
+    hostFiles()->powerBudget = 4 * sizeof(OUTBOX_RECORD) + sizeof(OUTBOX_RECORD) / 2;
+    for (uint32_t i = OUTBOX_SPILL_SAMPLES; i < 2 * OUTBOX_SPILL_SAMPLES; i++) queue.push(sampleAt(i));
+    hostFiles()->powerBudget = -1;
+
+    rebooted.begin();
+    TEST_ASSERT_EQUAL_UINT32(OUTBOX_SPILL_SAMPLES + 4, rebooted.getPending());
+
+    // the next boot spills behind the intact records
+    for (uint32_t i = 0; i < OUTBOX_SPILL_SAMPLES + 1; i++) rebooted.push(sampleAt(1000 + i));
+    std::vector<uint64_t> counters = replayAll(rebooted);
+    TEST_ASSERT_EQUAL_UINT32(2 * OUTBOX_SPILL_SAMPLES + 5, counters.size());
+    TEST_ASSERT_EQUAL_UINT32(0, rebooted.getDropped());
+    TEST_ASSERT_EQUAL_UINT64(100 + OUTBOX_SPILL_SAMPLES + 3, counters[OUTBOX_SPILL_SAMPLES + 3]);
+    TEST_ASSERT_EQUAL_UINT64(1100, counters[OUTBOX_SPILL_SAMPLES + 4]);
+}
+
+void test_segment_keeps_to_its_share(void) {
+    // room for two spills in the share of this filesystem
+    hostFiles()->capacity = (sizeof(OUTBOX_HEADER) + 2 * OUTBOX_RAM_SAMPLES * sizeof(OUTBOX_RECORD)) * 100 / OUTBOX_FS_SHARE + 100;
+    queue.begin();
+    for (uint32_t i = 0; i < 4 * OUTBOX_RAM_SAMPLES; i++) queue.push(sampleAt(i));
+    hostFiles()->capacity = HOST_FS_SIZE;
+
+    // two rings spilled, one in the ring and the last one refused sample by sample
+    TEST_ASSERT_EQUAL_UINT32(3 * OUTBOX_RAM_SAMPLES, queue.getPending());
+    TEST_ASSERT_EQUAL_UINT32(OUTBOX_RAM_SAMPLES, queue.getDropped());
+    File file = LittleFS.open(OUTBOX_PATH, "r");
+    TEST_ASSERT_EQUAL_UINT32(sizeof(OUTBOX_HEADER) + 2 * OUTBOX_RAM_SAMPLES * sizeof(OUTBOX_RECORD), file.size());
+    file.close();
+}
+
+void test_ring_spills_on_age(void) {
+    // two samples, the second one after the oldest has waited its limit
+    queue.push(sampleAt(0));
+    TEST_ASSERT_FALSE(LittleFS.exists(OUTBOX_PATH));
+    hostAdvance(OUTBOX_SPILL_INTERVAL);
+    queue.push(sampleAt(1));
+
+    rebooted.begin();
+    std::vector<uint64_t> counters = replayAll(rebooted);
+    TEST_ASSERT_EQUAL_UINT32(2, counters.size());
+    TEST_ASSERT_EQUAL_UINT64(100, counters[0]);
+    TEST_ASSERT_EQUAL_UINT64(101, counters[1]);
+}
+
+void test_reboot_resumes_the_replay(void) {
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) queue.push(sampleAt(i));
+
+    // one batch sent, then the power goes
+    rebooted.begin();
+    rebooted.onConnected();
+    hostAdvance(OUTBOX_REPLAY_JITTER);
+    uint32_t sent = 0;
+    rebooted.replay([&sent](const TELEMETRY_SAMPLE &sample) {
+        sent++;
+        return true;
+    });
+    TEST_ASSERT_EQUAL_UINT32(OUTBOX_REPLAY_BATCH, sent);
+
+    // the next boot goes on with the first sample not sent
+    OutageQueue resumed;
+    resumed.begin();
+    TEST_ASSERT_EQUAL_UINT32(TEST_SPILLED - OUTBOX_REPLAY_BATCH, resumed.getPending());
+    std::vector<uint64_t> counters = replayAll(resumed);
+    TEST_ASSERT_EQUAL_UINT32(TEST_SPILLED - OUTBOX_REPLAY_BATCH, counters.size());
+    for (uint32_t i = 0; i < counters.size(); i++) TEST_ASSERT_EQUAL_UINT64(100 + OUTBOX_REPLAY_BATCH + i, counters[i]);
+    TEST_ASSERT_FALSE(LittleFS.exists(OUTBOX_PATH));
+}
+
+// counters of channel 1 in the telemetry the broker holds
+static std::set<uint64_t> receivedCounters() {
+    std::set<uint64_t> counters;
+    for (const HOST_MESSAGE &message : broker.getMessages()) {
+        if (message.topic != TEST_TOPIC) continue;
+        JsonDocument doc;
+        if (deserializeJson(doc, message.payload) != DeserializationError::Ok || !doc["counter"].is<uint64_t>()) continue;
+        counters.insert(doc["counter"].as<uint64_t>());
+    }
+    return counters;
+}
+
+void test_broker_restart_replays_the_outage(void) {
+    EEPROM.begin(8);
+    TEST_ASSERT_TRUE(hostProvision(hostEndpoint(broker), TEST_TOPIC, "{\"interval\":3600}"));
+    comp = new Component();
+    comp->begin();
+    for (uint32_t i = 0; i < 200 && !comp->getMqtt()->connected(); i++) delay(10);
+    TEST_ASSERT_TRUE(comp->getMqtt()->connected());
+
+    // killed, every sample taken meanwhile goes to the outbox
+    uint16_t port = broker.getPort();
+    broker.stop();
+    broker.clear();
+
+    std::set<uint64_t> expected;
+    for (uint32_t i = 0; i < TEST_SAMPLES; i++) {
+        delay(1);
+        hostPins().pulse(INPUT_CHANNELS[0].pin);
+        comp->drainPulses();
+        TEST_ASSERT_TRUE(comp->publishDweb08Data());
+        expected.insert(comp->getCounter());
+        delay(2);
+    }
+
+    TEST_ASSERT_TRUE(broker.start(port));
+
+    // past the reconnect backoff and the replay jitter
+    std::set<uint64_t> received;
+    for (uint32_t i = 0; i < 300; i++) {
+        hostAdvance(1000);
+        delay(20);
+        received = receivedCounters();
+        if (std::includes(received.begin(), received.end(), expected.begin(), expected.end())) break;
+    }
+    printf("{\"bench\":\"outage\",\"samples\":%u,\"received\":%u,\"dropped\":%u,\"replayed\":%u,\"connects\":%u}\n",
+        (unsigned)expected.size(), (unsigned)received.size(), (unsigned)comp->getOutbox()->getDropped(),
+        (unsigned)comp->getOutbox()->getReplayed(), (unsigned)broker.connects);
+
+    TEST_ASSERT_TRUE(std::includes(received.begin(), received.end(), expected.begin(), expected.end()));
+    TEST_ASSERT_EQUAL_UINT32(0, comp->getOutbox()->getDropped());
+}
+
+int main(int argc, char **argv) {
+    hostAdvance(1);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_backlog_survives_a_reboot);
+    RUN_TEST(test_other_layout_is_discarded);
+    RUN_TEST(test_corrupted_record_is_skipped);
+    RUN_TEST(test_torn_record_is_written_over);
+    RUN_TEST(test_segment_keeps_to_its_share);
+    RUN_TEST(test_ring_spills_on_age);
+    RUN_TEST(test_reboot_resumes_the_replay);
+    RUN_TEST(test_broker_restart_replays_the_outage);
+
+    int failures = UNITY_END();
+    // the firmware tasks never return, leave without unwinding them
+    fflush(stdout);
+    _exit(failures);
+}
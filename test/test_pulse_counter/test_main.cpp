@@ -0,0 +1,155 @@
+// PulseCounter on the host: the ISR runs on the thread driving the pin,
+// the drain on another one, as the edge interrupt and the counter task do.
+// Pulses whose stamps did not fit the ring still count in the demand, and
+// the demand peak is dated by the end of the bucket that closed it.
+
+#include <Arduino.h>
+#include <thread>
+#include <unity.h>
+
+#include "DeviceSettings.hpp"
+
+#define TEST_PIN 4
+
+static const PULSE_CHANNEL channel = { TEST_PIN, RISING, 100, 0 };
+
+void setUp(void) {}
+
+void tearDown(void) {
+    detachInterrupt(digitalPinToInterrupt(TEST_PIN));
+}
+
+// a 1 kHz square wave of count pulses. Each edge waits a full period after
+// the previous one, an oversleep of the host never bunches two edges into
+// the debounce window.
+static void pulseTrain(uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        std::chrono::steady_clock::time_point edge = std::chrono::steady_clock::now();
+        hostPins().pulse(TEST_PIN);
+        std::this_thread::sleep_until(edge + std::chrono::microseconds(1000));
+    }
+}
+
+void test_1khz_train_zero_loss(void) {
+    PulseCounter counter;
+    counter.begin(channel, 0);
+
+    std::atomic<bool> done(false);
+    std::thread drainer([&]() {
+        while (!done) {
+            counter.drain();
+            delay(COUNTER_DRAIN_INTERVAL);
+        }
+    });
+
+    pulseTrain(3000);
+    done = true;
+    drainer.join();
+    counter.drain();
+
+    TEST_ASSERT_EQUAL_UINT32(0, counter.getRejected());
+    // the stamp ring overflows at this rate, the count never does
+    TEST_ASSERT_EQUAL_UINT64(3000, counter.getTotal());
+}
+
+void test_seen_includes_pending(void) {
+    PulseCounter counter;
+    counter.begin(channel, 10);
+
+    pulseTrain(5);
+    TEST_ASSERT_EQUAL_UINT64(10, counter.getTotal());
+    TEST_ASSERT_EQUAL_UINT64(15, counter.getSeen());
+
+    TEST_ASSERT_EQUAL_UINT32(5, counter.drain());
+    TEST_ASSERT_EQUAL_UINT64(15, counter.getTotal());
+    TEST_ASSERT_EQUAL_UINT32(0, counter.drain());
+}
+
+void test_total_passes_32_bits(void) {
+    PulseCounter counter;
+    counter.begin(channel, 0xFFFFFFFFULL - 2);
+
+    pulseTrain(5);
+    counter.drain();
+    TEST_ASSERT_EQUAL_UINT64(0x100000002ULL, counter.getTotal());
+}
+
+void test_bounce_rejected(void) {
+    PulseCounter counter;
+    counter.begin(channel, 0);
+
+    // two rising edges well inside the 100 us window
+    hostPins().pulse(TEST_PIN);
+    hostPins().pulse(TEST_PIN);
+    counter.drain();
+
+    TEST_ASSERT_EQUAL_UINT64(1, counter.getTotal());
+    TEST_ASSERT_EQUAL_UINT32(1, counter.getRejected());
+}
+
+void test_falling_edge_only(void) {
+    PulseCounter counter;
+    counter.begin({ TEST_PIN, FALLING, 0, 0 }, 0);
+
+    hostPins().write(TEST_PIN, HIGH);
+    counter.drain();
+    TEST_ASSERT_EQUAL_UINT64(0, counter.getTotal());
+
+    hostPins().write(TEST_PIN, LOW);
+    counter.drain();
+    TEST_ASSERT_EQUAL_UINT64(1, counter.getTotal());
+}
+
+void test_window_demand_counts_unstamped(void) {
+    PulseCounter counter;
+    counter.begin(channel, 0);
+
+    std::atomic<bool> done(false);
+    std::thread drainer([&]() {
+        while (!done) {
+            counter.drain();
+            delay(COUNTER_DRAIN_INTERVAL);
+        }
+    });
+
+    // more pulses per drain than the stamp ring holds
+    int64_t startedAt = esp_timer_get_time();
+    pulseTrain(2000);
+    done = true;
+    drainer.join();
+    counter.drain();
+    PULSE_DEMAND demand = counter.getDemand();
+    int64_t elapsed = esp_timer_get_time() - startedAt;
+
+    // every pulse is in the window, stamped or not
+    TEST_ASSERT_GREATER_THAN(0, counter.getUnstamped());
+    float expected = 2000 * DEMAND_US_PER_HOUR / elapsed;
+    TEST_ASSERT_FLOAT_WITHIN(expected * 0.1f, expected, demand.window);
+}
+
+void test_peak_age_from_the_closing_bucket(void) {
+    DemandMeter meter;
+    int64_t startedAt = 1000000;
+    meter.add(startedAt);
+
+    // the window closed long before it is read, the peak is as old as that
+    int64_t now = startedAt + 10 * DEMAND_WINDOW * 1000000LL;
+    PULSE_DEMAND demand = meter.get(now);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 3600.0f / DEMAND_WINDOW, demand.peak);
+    TEST_ASSERT_EQUAL_INT(9 * DEMAND_WINDOW, demand.peakAge);
+}
+
+int main(int argc, char **argv) {
+    // the clock of a booted device is already past the first debounce window
+    hostAdvance(1);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_1khz_train_zero_loss);
+    RUN_TEST(test_seen_includes_pending);
+    RUN_TEST(test_total_passes_32_bits);
+    RUN_TEST(test_bounce_rejected);
+    RUN_TEST(test_falling_edge_only);
+    RUN_TEST(test_window_demand_counts_unstamped);
+    RUN_TEST(test_peak_age_from_the_closing_bucket);
+    return UNITY_END();
+}
@@ -0,0 +1,248 @@
+// /data on the host: the Component serves the status from its cache while
+// a fake DS18B20 keeps being read, and rebuilds it when a shown value moves.
+// The cost of a 304, of the cached body shared with the response, of the
+// same body copied into it the way it was sent before, and of a rebuild is
+// printed as a JSON line:
+// {"bench":"data","bodyBytes":429,"notModifiedUs":2,"hitUs":1,"copyUs":2,"missUs":47,"notModifiedBytes":545,"hitBytes":988,"copyBytes":1431,"missBytes":13644}
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <EEPROM.h>
+#include <dlfcn.h>
+#include <unity.h>
+
+#include "DeviceSettings.hpp"
+#include "ComponentClass.hpp"
+#include "HostDevice.hpp"
+
+#define TEST_RUNS 500
+
+static const uint8_t rom[8] = { 0x28, 0xAA, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 };
+static Component *comp = NULL;
+
+// bytes asked from the heap by this thread while counting is on, operator
+// new is counted by the malloc under it
+static thread_local bool counting = false;
+static thread_local uint64_t allocated = 0;
+
+void *operator new(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+
+// out of line, the compiler would otherwise pair an inlined new with free
+__attribute__((noinline)) void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept {
+    operator delete(ptr);
+}
+
+extern "C" void *malloc(size_t size) {
+    static void *(*real)(size_t) = reinterpret_cast<void *(*)(size_t)>(dlsym(RTLD_NEXT, "malloc"));
+    if (counting) allocated += size;
+    return real(size);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static std::unique_ptr<AsyncWebServerRequest> getData(const String &etag = String()) {
+    std::unique_ptr<AsyncWebServerRequest> request(new AsyncWebServerRequest(HTTP_GET, "/data"));
+    if (!etag.isEmpty()) request->addHeader("If-None-Match", etag);
+    hostWebServer()->handle(request.get());
+    return request;
+}
+
+static String etagOf(const std::unique_ptr<AsyncWebServerRequest> &request) {
+    return request->getResponse()->getHeader("ETag")->value();
+}
+
+// the first sensor of the body once it has a reading
+static bool readSensor(JsonDocument &doc) {
+    std::unique_ptr<AsyncWebServerRequest> request = getData();
+    deserializeJson(doc, request->getResponse()->body);
+    return doc["sensors"][0]["age"].as<long>() >= 0;
+}
+
+// waits for the sampler to read the value, a cycle is TEMP_SAMPLE_INTERVAL
+static bool waitTemperature(float value) {
+    JsonDocument doc;
+    for (uint32_t waited = 0; waited < 10 * TEMP_SAMPLE_INTERVAL; waited += 50) {
+        if (readSensor(doc) && fabsf(doc["status"]["temperatures"][0]["temp"].as<float>() - value) < 0.01f) return true;
+        delay(50);
+    }
+    return false;
+}
+
+void test_temperatures_by_rom(void) {
+    TEST_ASSERT_TRUE(waitTemperature(21.5f));
+    JsonDocument doc;
+    TEST_ASSERT_TRUE(readSensor(doc));
+    TEST_ASSERT_EQUAL_STRING("28aa010203040506", doc["status"]["temperatures"][0]["id"].as<const char*>());
+    TEST_ASSERT_FALSE(doc["status"]["temperatures"][0]["alias"].is<const char*>());
+}
+
+void test_same_reading_keeps_the_body(void) {
+    TEST_ASSERT_TRUE(waitTemperature(21.5f));
+    String etag = etagOf(getData());
+    TEST_ASSERT_EQUAL_INT(304, getData(etag)->getResponse()->code);
+
+    // new reads of the same value, the snapshot moves but the body does not
+    delay(3 * TEMP_SAMPLE_INTERVAL);
+    std::unique_ptr<AsyncWebServerRequest> request = getData(etag);
+    TEST_ASSERT_EQUAL_INT(304, request->getResponse()->code);
+}
+
+void test_new_value_rebuilds(void) {
+    String etag = etagOf(getData());
+    hostBuses().setCelsius(rom, 23.25f);
+    TEST_ASSERT_TRUE(waitTemperature(23.25f));
+    TEST_ASSERT_EQUAL_INT(200, getData(etag)->getResponse()->code);
+}
+
+void test_rssi_in_steps(void) {
+    hostRadio()->rssi = -61;
+    String etag = etagOf(getData());
+
+    // same 5 dBm step
+    hostRadio()->rssi = -64;
+    TEST_ASSERT_EQUAL_INT(304, getData(etag)->getResponse()->code);
+
+    hostRadio()->rssi = -66;
+    std::unique_ptr<AsyncWebServerRequest> request = getData(etag);
+    TEST_ASSERT_EQUAL_INT(200, request->getResponse()->code);
+
+    JsonDocument doc;
+    deserializeJson(doc, request->getResponse()->body);
+    TEST_ASSERT_EQUAL_INT(-70, doc["status"]["wifiQuality"].as<int>());
+}
+
+void test_age_moves_by_steps(void) {
+    String etag = etagOf(getData());
+
+    // the clock jumps past a step before the sampler reads again
+    hostAdvance(STATUS_AGE_STEP);
+    std::unique_ptr<AsyncWebServerRequest> request = getData(etag);
+    TEST_ASSERT_EQUAL_INT(200, request->getResponse()->code);
+
+    JsonDocument doc;
+    deserializeJson(doc, request->getResponse()->body);
+    TEST_ASSERT_EQUAL_INT(STATUS_AGE_STEP, doc["sensors"][0]["age"].as<long>());
+}
+
+void test_benchmark(void) {
+    String etag = etagOf(getData());
+    // time and bytes taken from the heap to answer, the copy is the way the
+    // body was sent before: the work of the handler as for a 304, then the
+    // body copied into the response instead of an empty one
+    int64_t notModifiedUs = 0;
+    int64_t hitUs = 0;
+    int64_t copyUs = 0;
+    int64_t missUs = 0;
+    uint64_t notModifiedBytes = 0;
+    uint64_t hitBytes = 0;
+    uint64_t copyBytes = 0;
+    uint64_t missBytes = 0;
+    size_t bodyBytes = 0;
+
+    for (uint32_t i = 0; i < TEST_RUNS; i++) {
+        allocated = 0;
+        counting = true;
+        int64_t startedAt = esp_timer_get_time();
+        std::unique_ptr<AsyncWebServerRequest> notModified = getData(etag);
+        int64_t took = esp_timer_get_time() - startedAt;
+        counting = false;
+        // the sampler moved a shown age in between, the run starts over
+        if (notModified->getResponse()->code == 200) {
+            etag = etagOf(notModified);
+            i--;
+            continue;
+        }
+        TEST_ASSERT_EQUAL_INT(304, notModified->getResponse()->code);
+        notModifiedUs += took;
+        copyUs += took;
+        notModifiedBytes += allocated;
+        copyBytes += allocated;
+        notModified.reset();
+
+        // the cached body in full, the response shares the buffer
+        allocated = 0;
+        counting = true;
+        startedAt = esp_timer_get_time();
+        std::unique_ptr<AsyncWebServerRequest> hit = getData();
+        hitUs += esp_timer_get_time() - startedAt;
+        counting = false;
+        hitBytes += allocated;
+        TEST_ASSERT_TRUE(etagOf(hit) == etag);
+        String body = hit->getResponse()->body.c_str();
+        bodyBytes = body.length();
+        hit.reset();
+
+        allocated = 0;
+        counting = true;
+        startedAt = esp_timer_get_time();
+        std::unique_ptr<AsyncWebServerRequest> copy(new AsyncWebServerRequest(HTTP_GET, "/data"));
+        copy->send(copy->beginResponse(200, "application/json", body));
+        copyUs += esp_timer_get_time() - startedAt;
+        counting = false;
+        copyBytes += allocated;
+        copy.reset();
+
+        allocated = 0;
+        counting = true;
+        startedAt = esp_timer_get_time();
+        std::unique_ptr<AsyncWebServerRequest> empty(new AsyncWebServerRequest(HTTP_GET, "/data"));
+        empty->send(empty->beginResponse(304));
+        copyUs -= esp_timer_get_time() - startedAt;
+        counting = false;
+        copyBytes -= allocated;
+        empty.reset();
+
+        // a pulse moves the fingerprint
+        delay(1);
+        hostPins().pulse(INPUT_CHANNELS[0].pin);
+
+        allocated = 0;
+        counting = true;
+        startedAt = esp_timer_get_time();
+        std::unique_ptr<AsyncWebServerRequest> miss = getData(etag);
+        missUs += esp_timer_get_time() - startedAt;
+        counting = false;
+        missBytes += allocated;
+        etag = etagOf(miss);
+        miss.reset();
+    }
+
+    printf("{\"bench\":\"data\",\"bodyBytes\":%u,\"notModifiedUs\":%lld,\"hitUs\":%lld,\"copyUs\":%lld,\"missUs\":%lld,"
+        "\"notModifiedBytes\":%llu,\"hitBytes\":%llu,\"copyBytes\":%llu,\"missBytes\":%llu}\n",
+        (unsigned)bodyBytes, (long long)(notModifiedUs / TEST_RUNS), (long long)(hitUs / TEST_RUNS), (long long)(copyUs / TEST_RUNS),
+        (long long)(missUs / TEST_RUNS), (unsigned long long)(notModifiedBytes / TEST_RUNS), (unsigned long long)(hitBytes / TEST_RUNS),
+        (unsigned long long)(copyBytes / TEST_RUNS), (unsigned long long)(missBytes / TEST_RUNS));
+    TEST_ASSERT_LESS_THAN(missUs, hitUs);
+    // a copied response takes the body once more than a shared one
+    TEST_ASSERT_GREATER_OR_EQUAL(hitBytes + bodyBytes * TEST_RUNS, copyBytes);
+}
+
+int main(int argc, char **argv) {
+    EEPROM.begin(8);
+    hostBuses().add(TEMP_BUSES[0], rom, 21.5f);
+    hostRadio()->associate(0);
+
+    comp = new Component();
+    comp->begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_temperatures_by_rom);
+    RUN_TEST(test_same_reading_keeps_the_body);
+    RUN_TEST(test_new_value_rebuilds);
+    RUN_TEST(test_rssi_in_steps);
+    RUN_TEST(test_age_moves_by_steps);
+    RUN_TEST(test_benchmark);
+    int failures = UNITY_END();
+    // the firmware tasks never return, leave without unwinding them
+    fflush(stdout);
+    _exit(failures);
+}
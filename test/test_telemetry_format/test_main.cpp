@@ -0,0 +1,157 @@
+// The telemetry formats on the host: a MessagePack frame decodes to the same
+// document as the JSON frame of the sample, delta frames applied over the
+// last keyframe rebuild the full message, and keyframes come every N
+// messages. Size and encode time per format and mode are printed:
+// {"bench":"format","format":"msgpack","keyframe":10,"n":1000,"avgBytes":105,"avgUs":5}
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "DeviceSettings.hpp"
+#include "Telemetry.hpp"
+
+#define TEST_RUNS 1000
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// the counters move every message, the rest on their own cadence the way
+// a meter with a few sensors does
+static TELEMETRY_SAMPLE sampleAt(uint32_t i) {
+    TELEMETRY_SAMPLE sample;
+    sample.timestamp = 1000 * i;
+    for (uint8_t c = 0; c < INPUT_CHANNEL_COUNT; c++) {
+        sample.counters[c] = 5000000000ULL + i * (c + 1);
+        sample.demands[c].instant = 3600 + (i / 5) % 7;
+        sample.demands[c].window = 3500;
+        sample.demands[c].peak = 4000;
+    }
+    sample.levels = (i / 2) & 1;
+    sample.rssi = -60 - (i / 3) % 3;
+    sample.ip = 0x0A01A8C0;
+    sample.tempCount = 4;
+    for (uint8_t t = 0; t < sample.tempCount; t++) {
+        sample.temps[t].rom[0] = 0x28;
+        sample.temps[t].rom[7] = t;
+        sample.temps[t].value = 20 + t + ((i / 4) % 4) * 0.25f;
+    }
+    return sample;
+}
+
+static void decode(const TelemetryEncoder &encoder, uint8_t format, JsonDocument &doc) {
+    DeserializationError error = format == TELEMETRY_MSGPACK ?
+        deserializeMsgPack(doc, encoder.getPayload(), encoder.getLength()) :
+        deserializeJson(doc, encoder.getPayload(), encoder.getLength());
+    TEST_ASSERT_TRUE(error == DeserializationError::Ok);
+}
+
+static std::string text(JsonVariantConst value) {
+    std::string out;
+    serializeJson(value, out);
+    return out;
+}
+
+void test_msgpack_decodes_like_json(void) {
+    TelemetryEncoder json;
+    TelemetryEncoder pack;
+    json.setFormat(TELEMETRY_JSON, 0);
+    pack.setFormat(TELEMETRY_MSGPACK, 0);
+
+    for (uint32_t i = 0; i < 50; i++) {
+        TELEMETRY_SAMPLE sample = sampleAt(i);
+        json.encode("format", sample);
+        pack.encode("format", sample);
+        TEST_ASSERT_LESS_THAN(json.getLength(), pack.getLength());
+
+        JsonDocument fromJson;
+        JsonDocument fromPack;
+        decode(json, TELEMETRY_JSON, fromJson);
+        decode(pack, TELEMETRY_MSGPACK, fromPack);
+        TEST_ASSERT_EQUAL_STRING(text(fromJson.as<JsonVariantConst>()).c_str(), text(fromPack.as<JsonVariantConst>()).c_str());
+        TEST_ASSERT_EQUAL_UINT64(sample.counters[0], fromPack["counter"].as<uint64_t>());
+    }
+}
+
+void test_deltas_rebuild_the_full_message(void) {
+    static const uint8_t formats[] = { TELEMETRY_JSON, TELEMETRY_MSGPACK };
+    for (uint8_t format : formats) {
+        TelemetryEncoder delta;
+        TelemetryEncoder full;
+        delta.setFormat(format, 10);
+        full.setFormat(format, 0);
+
+        // what a subscriber holds: the last keyframe with the deltas over it
+        JsonDocument state;
+        for (uint32_t i = 0; i < 100; i++) {
+            TELEMETRY_SAMPLE sample = sampleAt(i);
+            delta.encode("format", sample);
+            full.encode("format", sample);
+
+            JsonDocument frame;
+            JsonDocument expected;
+            decode(delta, format, frame);
+            decode(full, format, expected);
+
+            if (!frame["delta"].as<bool>()) state.clear();
+            for (JsonPair kv : frame.as<JsonObject>()) {
+                if (strcmp(kv.key().c_str(), "delta") != 0) state[kv.key()] = kv.value();
+            }
+
+            for (JsonPair kv : expected.as<JsonObject>()) {
+                TEST_ASSERT_EQUAL_STRING(text(kv.value()).c_str(), text(state[kv.key()]).c_str());
+            }
+            TEST_ASSERT_EQUAL_UINT32(expected.size(), state.size());
+        }
+    }
+}
+
+void test_keyframe_cadence(void) {
+    static const uint16_t intervals[] = { 0, 1, 2, 10 };
+    for (uint16_t keyframe : intervals) {
+        TelemetryEncoder encoder;
+        encoder.setFormat(TELEMETRY_JSON, keyframe);
+
+        for (uint32_t i = 0; i < 40; i++) {
+            // a forced keyframe restarts the count
+            bool force = i == 25;
+            encoder.encode("format", sampleAt(i), force);
+
+            JsonDocument frame;
+            decode(encoder, TELEMETRY_JSON, frame);
+            uint32_t since = i >= 25 ? i - 25 : i;
+            bool expectFull = keyframe <= 1 || since % keyframe == 0;
+            TEST_ASSERT_EQUAL(expectFull, !frame["delta"].as<bool>());
+            if (expectFull) TEST_ASSERT_TRUE(frame["slaves"].is<JsonArray>());
+        }
+    }
+}
+
+static void benchRun(uint8_t format, const char *name, uint16_t keyframe) {
+    TelemetryEncoder encoder;
+    encoder.setFormat(format, keyframe);
+
+    uint64_t bytes = 0;
+    int64_t startedAt = esp_timer_get_time();
+    for (uint32_t i = 0; i < TEST_RUNS; i++) bytes += encoder.encode("format", sampleAt(i));
+    int64_t elapsed = esp_timer_get_time() - startedAt;
+
+    printf("{\"bench\":\"format\",\"format\":\"%s\",\"keyframe\":%u,\"n\":%u,\"avgBytes\":%u,\"avgUs\":%lld}\n",
+        name, (unsigned)keyframe, (unsigned)TEST_RUNS, (unsigned)(bytes / TEST_RUNS), (long long)(elapsed / TEST_RUNS));
+    TEST_ASSERT_EQUAL_UINT32(0, encoder.getHeapAllocations());
+}
+
+void test_size_and_time(void) {
+    benchRun(TELEMETRY_JSON, "json", 0);
+    benchRun(TELEMETRY_MSGPACK, "msgpack", 0);
+    benchRun(TELEMETRY_JSON, "json", 10);
+    benchRun(TELEMETRY_MSGPACK, "msgpack", 10);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_msgpack_decodes_like_json);
+    RUN_TEST(test_deltas_rebuild_the_full_message);
+    RUN_TEST(test_keyframe_cadence);
+    RUN_TEST(test_size_and_time);
+    return UNITY_END();
+}
@@ -0,0 +1,154 @@
+// The publish path on the host: TelemetryEncoder into MqttClient over a TCP
+// socket to the broker stand-in, or Mosquitto with DWEB08_BROKER. Every
+// operator new and malloc of this thread is counted while a sample is
+// encoded and while it is published, the publish must make none and the
+// document must fit the arena, which leaves ArduinoJson nothing to take
+// from the heap. Printed per format:
+// {"bench":"publish","format":"json","n":1000,"avgUs":9,"maxUs":95,"bytes":1203,"encodeAllocations":0,"publishAllocations":0}
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <dlfcn.h>
+#include <unity.h>
+
+#include "DeviceSettings.hpp"
+#include "Telemetry.hpp"
+#include "MqttClient.hpp"
+#include "DeviceProtocol.hpp"
+#include "HostDevice.hpp"
+
+#define TEST_TOPIC "test/publish"
+#define TEST_RUNS 1000
+
+// heap calls made by this thread while counting is on, operator new is
+// counted by the malloc under it
+static thread_local bool counting = false;
+static thread_local uint32_t allocations = 0;
+
+void *operator new(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+
+// out of line, the compiler would otherwise pair an inlined new with free
+__attribute__((noinline)) void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept {
+    operator delete(ptr);
+}
+
+extern "C" void *malloc(size_t size) {
+    static void *(*real)(size_t) = reinterpret_cast<void *(*)(size_t)>(dlsym(RTLD_NEXT, "malloc"));
+    if (counting) allocations++;
+    return real(size);
+}
+
+static HostBroker broker;
+static WiFiClient client;
+static MqttClient mqtt(client);
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// a sample with every sensor slot filled
+static TELEMETRY_SAMPLE sampleAt(uint32_t i) {
+    TELEMETRY_SAMPLE sample;
+    sample.timestamp = 1000 * i;
+    for (uint8_t c = 0; c < INPUT_CHANNEL_COUNT; c++) {
+        sample.counters[c] = 1000000 + i * (c + 1);
+        sample.demands[c].instant = 3600 + i % 7;
+        sample.demands[c].window = 3500;
+        sample.demands[c].peak = 4000;
+    }
+    sample.levels = i & 1;
+    sample.rssi = -60 - i % 3;
+    sample.ip = 0x0A01A8C0;
+    sample.tempCount = TEMP_MAX_SENSORS;
+    for (uint8_t t = 0; t < TEMP_MAX_SENSORS; t++) {
+        sample.temps[t].rom[0] = 0x28;
+        sample.temps[t].rom[7] = t;
+        sample.temps[t].value = 20 + t + (i % 4) * 0.25f;
+    }
+    return sample;
+}
+
+static void publishRun(uint8_t format, const char *name) {
+    TelemetryEncoder encoder;
+    encoder.setFormat(format, 0);
+
+    int64_t totalUs = 0;
+    int64_t maxUs = 0;
+    uint32_t encodeMade = 0;
+    uint32_t publishMade = 0;
+    size_t start = broker.count();
+
+    for (uint32_t i = 0; i < TEST_RUNS; i++) {
+        TELEMETRY_SAMPLE sample = sampleAt(i);
+
+        allocations = 0;
+        counting = true;
+        int64_t startedAt = esp_timer_get_time();
+        size_t length = encoder.encode("publish", sample);
+        encodeMade += allocations;
+
+        allocations = 0;
+        bool sent = mqtt.publish(TEST_TOPIC, encoder.getPayload(), length, MQTT_TELEMETRY_QOS);
+        int64_t elapsed = esp_timer_get_time() - startedAt;
+        mqtt.loop();
+        counting = false;
+        publishMade += allocations;
+
+        TEST_ASSERT_TRUE(sent);
+        totalUs += elapsed;
+        maxUs = max(maxUs, elapsed);
+
+        // PUBACKs read before the window fills
+        while (mqtt.getInflight() >= MQTT_INFLIGHT_MESSAGES / 2) mqtt.loop();
+    }
+    TEST_ASSERT_TRUE(broker.getPort() == 0 || broker.waitFor(start + TEST_RUNS, 5000));
+
+    printf("{\"bench\":\"publish\",\"format\":\"%s\",\"n\":%u,\"avgUs\":%lld,\"maxUs\":%lld,\"bytes\":%u,\"encodeAllocations\":%u,\"publishAllocations\":%u}\n",
+        name, (unsigned)TEST_RUNS, (long long)(totalUs / TEST_RUNS), (long long)maxUs,
+        (unsigned)encoder.getLength(), (unsigned)encodeMade, (unsigned)publishMade);
+
+    // nothing from the heap, in or outside of the arena
+    TEST_ASSERT_EQUAL_UINT32(0, encodeMade);
+    TEST_ASSERT_EQUAL_UINT32(0, publishMade);
+    TEST_ASSERT_EQUAL_UINT32(0, encoder.getHeapAllocations());
+}
+
+void test_counting_sees_the_heap(void) {
+    allocations = 0;
+    counting = true;
+    std::string *text = new std::string(64, 'x');
+    counting = false;
+    delete text;
+    TEST_ASSERT_GREATER_OR_EQUAL(1, allocations);
+}
+
+void test_publish_json(void) {
+    publishRun(TELEMETRY_JSON, "json");
+}
+
+void test_publish_msgpack(void) {
+    publishRun(TELEMETRY_MSGPACK, "msgpack");
+}
+
+int main(int argc, char **argv) {
+    HOST_ENDPOINT endpoint = hostEndpoint(broker);
+    mqtt.setServer(endpoint.host.c_str(), endpoint.port);
+    mqtt.setBufferSize(max(TELEMETRY_PAYLOAD_SIZE + MQTT_TOPIC_SIZE + 8, MQTT_RECEIVE_SIZE));
+    if (!mqtt.connect("publish", "", "")) {
+        printf("no broker at %s:%u\n", endpoint.host.c_str(), (unsigned)endpoint.port);
+        return 1;
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_counting_sees_the_heap);
+    RUN_TEST(test_publish_json);
+    RUN_TEST(test_publish_msgpack);
+    return UNITY_END();
+}
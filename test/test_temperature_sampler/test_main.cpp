@@ -0,0 +1,82 @@
+// The temperature sampler on the host: every slot is taken, then a sensor
+// leaves and a new one shows up ahead of the others in the bus search. The
+// sensors still on the bus keep their slots and the new one takes the slot
+// that was vacated, not the slot of a sensor the search had not reached yet.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <unistd.h>
+
+#include "DeviceSettings.hpp"
+#include "TemperatureSampler.hpp"
+
+static TemperatureSampler sampler;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void romOf(uint8_t n, uint8_t *rom) {
+    const uint8_t base[8] = { 0x28, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x00 };
+    memcpy(rom, base, sizeof(base));
+    rom[7] = n;
+}
+
+// slot of the sensor in the snapshot, -1 when it has none or is missing
+static int slotOf(const TEMP_SNAPSHOT &snapshot, uint8_t n) {
+    DeviceAddress rom;
+    romOf(n, rom);
+    for (uint8_t i = 0; i < snapshot.count; i++) {
+        const TEMP_READING &reading = snapshot.readings[i];
+        if (reading.present && memcmp(reading.rom, rom, sizeof(DeviceAddress)) == 0) return i;
+    }
+    return -1;
+}
+
+// waits for the sampler to list the sensor, a cycle is TEMP_SAMPLE_INTERVAL
+static bool waitSensor(uint8_t n) {
+    for (uint32_t waited = 0; waited < 10 * TEMP_SAMPLE_INTERVAL; waited += 50) {
+        if (slotOf(sampler.getSnapshot(), n) >= 0) return true;
+        delay(50);
+    }
+    return false;
+}
+
+void test_new_sensor_takes_the_vacated_slot(void) {
+    TEST_ASSERT_TRUE(waitSensor(TEMP_MAX_SENSORS - 1));
+    TEMP_SNAPSHOT before = sampler.getSnapshot();
+    TEST_ASSERT_EQUAL_UINT8(TEMP_MAX_SENSORS, before.count);
+
+    // the last sensor leaves, the new one comes first in the search
+    DeviceAddress rom;
+    hostBuses().clear();
+    romOf(100, rom);
+    hostBuses().add(TEMP_BUSES[0], rom, 30);
+    for (uint8_t n = 0; n < TEMP_MAX_SENSORS - 1; n++) {
+        romOf(n, rom);
+        hostBuses().add(TEMP_BUSES[0], rom, 20 + n);
+    }
+    hostAdvance(TEMP_ENUMERATE_INTERVAL + 1);
+    TEST_ASSERT_TRUE(waitSensor(100));
+
+    TEMP_SNAPSHOT after = sampler.getSnapshot();
+    TEST_ASSERT_EQUAL_UINT8(TEMP_MAX_SENSORS, after.count);
+    for (uint8_t n = 0; n < TEMP_MAX_SENSORS - 1; n++) TEST_ASSERT_EQUAL_INT(slotOf(before, n), slotOf(after, n));
+    TEST_ASSERT_EQUAL_INT(slotOf(before, TEMP_MAX_SENSORS - 1), slotOf(after, 100));
+}
+
+int main(int argc, char **argv) {
+    hostAdvance(1);
+    DeviceAddress rom;
+    for (uint8_t n = 0; n < TEMP_MAX_SENSORS; n++) {
+        romOf(n, rom);
+        hostBuses().add(TEMP_BUSES[0], rom, 20 + n);
+    }
+    sampler.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_new_sensor_takes_the_vacated_slot);
+    int failures = UNITY_END();
+    // the sampler task never returns, leave without unwinding it
+    fflush(stdout);
+    _exit(failures);
+}